@@ -188,6 +188,7 @@ GLOBJS = &
 	r_sprite.obj &
 	r_alias.obj &
 	r_brush.obj &
+	r_lightmap.obj &
 	gl_model.obj
 
 OBJS = strlcat.obj &
@@ -230,6 +231,8 @@ OBJS = strlcat.obj &
 	sv_phys.obj &
 	sv_user.obj &
 	world.obj &
+	tasks.obj &
+	texcache.obj &
 	zone.obj &
 	$(SYSOBJ_SYS) $(SYSOBJ_MAIN)
 
@@ -74,6 +74,30 @@ static music_handler_t *music_handlers = NULL;
 
 static snd_stream_t *bgmstream = NULL;
 
+/*
+ The stream is decoded on a thread of its own, which keeps the mixer's raw
+ sample ring filled as far ahead as it goes, several hundred milliseconds,
+ rewinding for loops as it gets there.  The codecs allocate from the zone,
+ so streams are still opened and closed on the main thread, which holds
+ bgm_lock whenever it changes the stream.  A stream that ends or fails is
+ marked STREAM_NONE by the decoder and left for BGM_Update to close and
+ report, along with the underruns the mixer counted.  The decoder takes
+ bgm_lock for one chunk at a time, so the main thread never waits for more
+ than a chunk, and BGM_Update doesn't wait at all: if the decoder is busy,
+ the ended stream gets closed on a later frame.  With -nomusicthread,
+ BGM_Update decodes, as it used to.
+*/
+static SDL_Thread	*bgm_thread;
+static SDL_mutex	*bgm_lock;
+static SDL_sem		*bgm_wake;
+static SDL_atomic_t	bgm_quit;
+static char		bgm_error[64];	/* why the decoder stopped, under bgm_lock */
+static qboolean		bgm_rewound;	/* no data since the last rewind, under bgm_lock */
+static int		bgm_underruns;	/* as of the last report */
+
+static qboolean BGM_UpdateStream (void);
+static void BGM_EndStream (const char *fmt, ...) FUNC_PRINTF(1,2);
+
 static void BGM_Play_f (void)
 {
 	if (Cmd_Argc() == 2) {
@@ -106,7 +130,9 @@ static void BGM_Loop_f (void)
 		else if (q_strcasecmp(Cmd_Argv(1),"toggle") == 0)
 			bgmloop = !bgmloop;
 
+		SDL_LockMutex(bgm_lock);
 		if (bgmstream) bgmstream->loop = bgmloop;
+		SDL_UnlockMutex(bgm_lock);
 	}
 
 	if (bgmloop)
@@ -125,9 +151,83 @@ static void BGM_Jump_f (void)
 	if (Cmd_Argc() != 2) {
 		Con_Printf ("music_jump <ordernum>\n");
 	}
-	else if (bgmstream) {
-		S_CodecJumpToOrder(bgmstream, atoi(Cmd_Argv(1)));
+	else {
+		SDL_LockMutex(bgm_lock);
+		if (bgmstream) {
+			S_CodecJumpToOrder(bgmstream, atoi(Cmd_Argv(1)));
+			S_RawClear();
+		}
+		SDL_UnlockMutex(bgm_lock);
+		if (bgm_wake)
+			SDL_SemPost(bgm_wake);
+	}
+}
+
+static int SDLCALL BGM_DecoderThread (void *unused)
+{
+	qboolean more;
+
+	while (!SDL_AtomicGet(&bgm_quit))
+	{
+		SDL_SemWaitTimeout(bgm_wake, 20);
+		do
+		{
+			SDL_LockMutex(bgm_lock);
+			more = bgmstream && BGM_UpdateStream ();
+			SDL_UnlockMutex(bgm_lock);
+		} while (more && !SDL_AtomicGet(&bgm_quit));
+	}
+
+	return 0;
+}
+
+static void BGM_StartDecoder (void)
+{
+	bgm_lock = SDL_CreateMutex();
+	if (!bgm_lock)
+		Sys_Error("BGM_Init: %s", SDL_GetError());
+
+	if (COM_CheckParm("-nomusicthread"))
+		return;
+
+	SDL_AtomicSet(&bgm_quit, 0);
+	bgm_wake = SDL_CreateSemaphore(0);
+	if (bgm_wake)
+		bgm_thread = SDL_CreateThread(BGM_DecoderThread, "music", NULL);
+	if (!bgm_thread)
+		Con_Printf("BGM_StartDecoder: %s\n", SDL_GetError());
+}
+
+static void BGM_StopDecoder (void)
+{
+	if (bgm_thread)
+	{
+		SDL_AtomicSet(&bgm_quit, 1);
+		SDL_SemPost(bgm_wake);
+		SDL_WaitThread(bgm_thread, NULL);
+		bgm_thread = NULL;
+	}
+	if (bgm_wake)
+	{
+		SDL_DestroySemaphore(bgm_wake);
+		bgm_wake = NULL;
 	}
+	SDL_DestroyMutex(bgm_lock);
+	bgm_lock = NULL;
+}
+
+/* hands a newly opened stream over to the decoder */
+static void BGM_StartStream (snd_stream_t *stream)
+{
+	SDL_LockMutex(bgm_lock);
+	bgmstream = stream;
+	bgm_error[0] = '\0';
+	bgm_rewound = false;
+	S_RawSetState(RAW_PLAY);
+	SDL_UnlockMutex(bgm_lock);
+
+	if (bgm_wake)
+		SDL_SemPost(bgm_wake);
 }
 
 qboolean BGM_Init (void)
@@ -148,6 +248,8 @@ qboolean BGM_Init (void)
 
 	bgmloop = true;
 
+	BGM_StartDecoder ();
+
 	for (i = 0; wanted_handlers[i].type != CODECTYPE_NONE; i++)
 	{
 		switch (wanted_handlers[i].player)
@@ -184,6 +286,7 @@ qboolean BGM_Init (void)
 void BGM_Shutdown (void)
 {
 	BGM_Stop();
+	BGM_StopDecoder ();
 /* sever our connections to
  * midi_drv and snd_codec */
 	music_handlers = NULL;
@@ -193,6 +296,7 @@ static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 {
 	char tmp[MAX_QPATH];
 	music_handler_t *handler;
+	snd_stream_t *stream;
 
 	handler = music_handlers;
 	while (handler)
@@ -215,9 +319,12 @@ static void BGM_Play_noext (const char *filename, unsigned int allowed_types)
 		/* not supported in quake */
 			break;
 		case BGM_STREAMER:
-			bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
-			if (bgmstream)
+			stream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
+			if (stream)
+			{
+				BGM_StartStream(stream);
 				return;		/* success */
+			}
 			break;
 		case BGM_NONE:
 		default:
@@ -234,6 +341,7 @@ void BGM_Play (const char *filename)
 	char tmp[MAX_QPATH];
 	const char *ext;
 	music_handler_t *handler;
+	snd_stream_t *stream;
 
 	BGM_Stop();
 
@@ -273,9 +381,12 @@ void BGM_Play (const char *filename)
 	/* not supported in quake */
 		break;
 	case BGM_STREAMER:
-		bgmstream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
-		if (bgmstream)
+		stream = S_CodecOpenStreamType(tmp, handler->type, bgmloop);
+		if (stream)
+		{
+			BGM_StartStream(stream);
 			return;		/* success */
+		}
 		break;
 	case BGM_NONE:
 	default:
@@ -298,6 +409,7 @@ void BGM_PlayCDtrack (byte track, qboolean looping)
 	const char *ext;
 	unsigned int path_id, prev_id, type;
 	music_handler_t *handler;
+	snd_stream_t *stream;
 
 	BGM_Stop();
 	if (CDAudio_Play(track, looping) == 0)
@@ -338,44 +450,89 @@ void BGM_PlayCDtrack (byte track, qboolean looping)
 	{
 		q_snprintf(tmp, sizeof(tmp), "%s/track%02d.%s",
 				MUSIC_DIRNAME, (int)track, ext);
-		bgmstream = S_CodecOpenStreamType(tmp, type, bgmloop);
-		if (! bgmstream)
+		stream = S_CodecOpenStreamType(tmp, type, bgmloop);
+		if (stream)
+			BGM_StartStream(stream);
+		else
 			Con_Printf("Couldn't handle music file %s\n", tmp);
 	}
 }
 
+/* closes the stream, the caller holds bgm_lock */
+static void BGM_CloseStream (void)
+{
+	bgmstream->status = STREAM_NONE;
+	S_CodecCloseStream(bgmstream);
+	bgmstream = NULL;
+	S_RawSetState(RAW_IDLE);
+}
+
 void BGM_Stop (void)
 {
+	SDL_LockMutex(bgm_lock);
 	if (bgmstream)
 	{
-		bgmstream->status = STREAM_NONE;
-		S_CodecCloseStream(bgmstream);
-		bgmstream = NULL;
-		s_rawend = 0;
+		BGM_CloseStream();
+		S_RawClear();
 	}
+	bgm_error[0] = '\0';
+	SDL_UnlockMutex(bgm_lock);
 }
 
 void BGM_Pause (void)
 {
+	SDL_LockMutex(bgm_lock);
 	if (bgmstream)
 	{
 		if (bgmstream->status == STREAM_PLAY)
+		{
 			bgmstream->status = STREAM_PAUSE;
+			S_RawSetState(RAW_PAUSE);
+		}
 	}
+	else	/* what's left of an ended stream */
+		S_RawSetState(RAW_PAUSE);
+	SDL_UnlockMutex(bgm_lock);
 }
 
 void BGM_Resume (void)
 {
+	SDL_LockMutex(bgm_lock);
 	if (bgmstream)
 	{
 		if (bgmstream->status == STREAM_PAUSE)
+		{
 			bgmstream->status = STREAM_PLAY;
+			S_RawSetState(RAW_PLAY);
+		}
 	}
+	else
+		S_RawSetState(RAW_IDLE);
+	SDL_UnlockMutex(bgm_lock);
+	if (bgm_wake)
+		SDL_SemPost(bgm_wake);
 }
 
-static void BGM_UpdateStream (void)
+/* the decoder gives up on the stream, for BGM_Update to close and
+ * print why, if fmt isn't NULL. not va(), it isn't thread safe. */
+static void BGM_EndStream (const char *fmt, ...)
+{
+	va_list argptr;
+
+	bgmstream->status = STREAM_NONE;
+	bgm_error[0] = '\0';
+	if (fmt)
+	{
+		va_start(argptr, fmt);
+		q_vsnprintf(bgm_error, sizeof(bgm_error), fmt, argptr);
+		va_end(argptr);
+	}
+}
+
+/* decodes a chunk into the raw sample ring, the caller holds bgm_lock.
+ * returns true while there's room for more. */
+static qboolean BGM_UpdateStream (void)
 {
-	qboolean did_rewind = false;
 	int	res;	/* Number of bytes read. */
 	int	bufferSamples;
 	int	fileSamples;
@@ -383,87 +540,84 @@ static void BGM_UpdateStream (void)
 	byte	raw[16384];
 
 	if (bgmstream->status != STREAM_PLAY)
-		return;
+		return false;
 
 	/* don't bother playing anything if musicvolume is 0 */
 	if (bgmvolume.value <= 0)
-		return;
+		return false;
 
 	/* see how many samples should be copied into the raw buffer */
-	if (s_rawend < paintedtime)
-		s_rawend = paintedtime;
-
-	while (s_rawend < paintedtime + MAX_RAW_SAMPLES)
+	bufferSamples = S_RawSpace();
+	if (bufferSamples <= 0)
+		return false;
+
+	/* decide how much data needs to be read from the file */
+	fileSamples = bufferSamples * bgmstream->info.rate / shm->speed;
+	if (!fileSamples)
+		return false;
+
+	/* our max buffer size */
+	fileBytes = fileSamples * (bgmstream->info.width * bgmstream->info.channels);
+	if (fileBytes > (int) sizeof(raw))
 	{
-		bufferSamples = MAX_RAW_SAMPLES - (s_rawend - paintedtime);
-
-		/* decide how much data needs to be read from the file */
-		fileSamples = bufferSamples * bgmstream->info.rate / shm->speed;
-		if (!fileSamples)
-			return;
-
-		/* our max buffer size */
-		fileBytes = fileSamples * (bgmstream->info.width * bgmstream->info.channels);
-		if (fileBytes > (int) sizeof(raw))
-		{
-			fileBytes = (int) sizeof(raw);
-			fileSamples = fileBytes /
-					  (bgmstream->info.width * bgmstream->info.channels);
-		}
+		fileBytes = (int) sizeof(raw);
+		fileSamples = fileBytes /
+				  (bgmstream->info.width * bgmstream->info.channels);
+	}
 
-		/* Read */
-		res = S_CodecReadStream(bgmstream, fileBytes, raw);
-		if (res < fileBytes)
-		{
-			fileBytes = res;
-			fileSamples = res / (bgmstream->info.width * bgmstream->info.channels);
-		}
+	/* Read */
+	res = S_CodecReadStream(bgmstream, fileBytes, raw);
+	if (res < fileBytes)
+	{
+		fileBytes = res;
+		fileSamples = res / (bgmstream->info.width * bgmstream->info.channels);
+	}
 
-		if (res > 0)	/* data: add to raw buffer */
-		{
-			S_RawSamples(fileSamples, bgmstream->info.rate,
-							bgmstream->info.width,
-							bgmstream->info.channels,
-							raw, bgmvolume.value);
-			did_rewind = false;
-		}
-		else if (res == 0)	/* EOF */
+	if (res > 0)	/* data: add to raw buffer */
+	{
+		/* the mixer applies bgmvolume, so it changes right away */
+		S_RawSamples(fileSamples, bgmstream->info.rate,
+						bgmstream->info.width,
+						bgmstream->info.channels,
+						raw, 1.0f);
+		bgm_rewound = false;
+	}
+	else if (res == 0)	/* EOF */
+	{
+		if (bgmloop)
 		{
-			if (bgmloop)
+			if (bgm_rewound)
 			{
-				if (did_rewind)
-				{
-					Con_Printf("Stream keeps returning EOF.\n");
-					BGM_Stop();
-					return;
-				}
-
-				res = S_CodecRewindStream(bgmstream);
-				if (res != 0)
-				{
-					Con_Printf("Stream seek error (%i), stopping.\n", res);
-					BGM_Stop();
-					return;
-				}
-				did_rewind = true;
+				BGM_EndStream("Stream keeps returning EOF.");
+				return false;
 			}
-			else
+
+			res = S_CodecRewindStream(bgmstream);
+			if (res != 0)
 			{
-				BGM_Stop();
-				return;
+				BGM_EndStream("Stream seek error (%i), stopping.", res);
+				return false;
 			}
+			bgm_rewound = true;
 		}
-		else	/* res < 0: some read error */
+		else
 		{
-			Con_Printf("Stream read error (%i), stopping.\n", res);
-			BGM_Stop();
-			return;
+			BGM_EndStream(NULL);
+			return false;
 		}
 	}
+	else	/* res < 0: some read error */
+	{
+		BGM_EndStream("Stream read error (%i), stopping.", res);
+		return false;
+	}
+	return true;
 }
 
 void BGM_Update (void)
 {
+	int underruns;
+
 	if (old_volume != bgmvolume.value)
 	{
 		if (bgmvolume.value < 0)
@@ -472,7 +626,34 @@ void BGM_Update (void)
 			Cvar_SetQuick (&bgmvolume, "1");
 		old_volume = bgmvolume.value;
 	}
-	if (bgmstream)
-		BGM_UpdateStream ();
+
+	if (!bgm_thread)
+	{
+		SDL_LockMutex(bgm_lock);
+		while (bgmstream && BGM_UpdateStream ())
+			;
+		SDL_UnlockMutex(bgm_lock);
+	}
+
+	/* what was decoded of an ended stream still plays out */
+	if (SDL_TryLockMutex(bgm_lock) == 0)
+	{
+		if (bgmstream && bgmstream->status == STREAM_NONE)
+		{
+			if (bgm_error[0])
+				Con_Printf("%s\n", bgm_error);
+			BGM_CloseStream();
+		}
+		SDL_UnlockMutex(bgm_lock);
+	}
+
+	S_CodecFlushMessages();
+
+	underruns = S_RawUnderruns();
+	if (underruns != bgm_underruns)
+	{
+		Con_DPrintf("Music underrun, %d so far\n", underruns);
+		bgm_underruns = underruns;
+	}
 }
 
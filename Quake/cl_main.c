@@ -109,6 +109,7 @@ void CL_Disconnect (void)
 
 // stop sounds (especially looping!)
 	S_StopAllSounds (true);
+	S_EndPrecaching ();	// a Host_Error in CL_ParseServerInfo skips it
 	BGM_Stop();
 	CDAudio_Stop();
 
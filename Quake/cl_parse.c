@@ -398,6 +398,12 @@ void CL_ParseServerInfo (void)
 	// copy the naked name of the map file to the cl structure -- O.S
 	COM_StripExtension (COM_SkipPath(model_precache[1]), cl.mapname, sizeof(cl.mapname));
 
+	// get the disk reads going while the models are parsed one by one
+	for (i = 1; i < nummodels; i++)
+		Mod_Prefetch (model_precache[i]);
+	for (i = 1; i < numsounds; i++)
+		S_PrefetchSound (sound_precache[i]);
+
 	for (i = 1; i < nummodels; i++)
 	{
 		cl.model_precache[i] = Mod_ForName (model_precache[i], false);
@@ -415,6 +421,7 @@ void CL_ParseServerInfo (void)
 		CL_KeepaliveMessage ();
 	}
 	S_EndPrecaching ();
+	COM_FlushPrefetch ();
 
 // local state
 	cl_entities[0].model = cl.worldmodel = cl.model_precache[1];
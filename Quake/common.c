@@ -25,6 +25,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "q_ctype.h"
 #include <errno.h>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
 #include "vr.h"
 
 #include "miniz.h"
@@ -603,6 +606,7 @@ float Q_atof (const char *str)
 */
 
 qboolean	host_bigendian;
+int		com_cpufeatures;
 
 short	(*BigShort) (short l);
 short	(*LittleShort) (short l);
@@ -1449,6 +1453,99 @@ void COM_InitArgv (int argc, char **argv)
 	}
 }
 
+/*
+================
+COM_InitCPUFeatures
+
+-nosimd forces the plain C code paths everywhere.
+================
+*/
+static void COM_InitCPUFeatures (void)
+{
+	com_cpufeatures = 0;
+	if (COM_CheckParm ("-nosimd"))
+		return;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64) || defined(__i386__) || defined(_M_IX86)
+	if (SDL_HasSSE2 ())
+		com_cpufeatures |= CPU_SSE2;
+#if defined(USE_SDL2) && SDL_VERSION_ATLEAST(2,0,4)
+	if (SDL_HasAVX2 ())
+		com_cpufeatures |= CPU_AVX2;
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	com_cpufeatures |= CPU_NEON;	// baseline wherever the compiler emits it
+#endif
+}
+
+/*
+================
+COM_KernelsUsable
+================
+*/
+qboolean COM_KernelsUsable (const kernelinfo_t *kernels)
+{
+	return (com_cpufeatures & kernels->cpu) == kernels->cpu;
+}
+
+/*
+================
+COM_PickKernels
+
+Returns the fastest kernel set in list this cpu can run, or the C one
+(the last) when simd is false.
+================
+*/
+const kernelinfo_t *COM_PickKernels (const kernelinfo_t *const *list, int count, qboolean simd)
+{
+	int	i;
+
+	if (simd)
+	{
+		for (i = 0; i < count - 1; i++)
+		{
+			if (COM_KernelsUsable (list[i]))
+				return list[i];
+		}
+	}
+
+	return list[count - 1];
+}
+
+/*
+================
+COM_BenchKernels
+
+Runs func on every kernel set in list this cpu can run, starting with
+the C one, and prints a row for each: the name, the columns func filled
+in, the speedup over C and whether the output hash differed from C's.
+================
+*/
+void COM_BenchKernels (const kernelinfo_t *const *list, int count, kernelbench_func_t func, void *data)
+{
+	kernelbench_t	result, reference;
+	int		i;
+
+	memset (&reference, 0, sizeof(reference));
+	for (i = count - 1; i >= 0; i--)
+	{
+		if (!COM_KernelsUsable (list[i]))
+		{
+			Con_Printf ("%-5s  not supported by this cpu\n", list[i]->name);
+			continue;
+		}
+
+		memset (&result, 0, sizeof(result));
+		func (list[i], data, &result);
+		if (i == count - 1)
+			reference = result;
+
+		Con_Printf ("%-5s %s  %6.2fx%s\n", list[i]->name, result.columns,
+			    reference.time / q_max (result.time, 0.000001),
+			    (result.hash != reference.hash) ? "  MISMATCH" : "");
+	}
+}
+
 /*
 ================
 COM_Init
@@ -1497,6 +1594,8 @@ void COM_Init (void)
 
 	if (COM_CheckParm("-fitz"))
 		fitzmode = true;
+
+	COM_InitCPUFeatures ();
 }
 
 
@@ -1562,10 +1661,43 @@ typedef struct
 } dpackheader_t;
 
 #define MAX_FILES_IN_PACK	2048
+#define MAX_FILES_IN_PK3	65535	// no zip64 support
+
+//
+// on-disk pk3 (zip) structures, all little endian
+//
+#define ZIP_EOCD_SIG		0x06054b50	// end of central directory record
+#define ZIP_EOCD_SIZE		22
+#define ZIP_CDIR_SIG		0x02014b50	// central directory file header
+#define ZIP_CDIR_SIZE		46
+#define ZIP_LOCAL_SIG		0x04034b50	// local file header
+#define ZIP_LOCAL_SIZE		30
+
+#define ZIP_METHOD_STORED	0
+#define ZIP_METHOD_DEFLATED	8
 
 char	com_gamedir[MAX_OSPATH];
 char	com_basedir[MAX_OSPATH];
 int	file_from_pak;		// ZOID: global indicating that file came from a pak
+static int	com_fileofs;	// offset of the last found file inside its pak
+static int	com_filedeflated;	// compressed size if the last found file is deflated, else 0
+static qboolean	com_nommap;	// -nommap: always read files into memory
+static char	com_filepath[MAX_OSPATH];	// os file holding the last found file
+
+static cvar_t	fs_prefetch = {"fs_prefetch","1",CVAR_NONE};
+
+// filesystem statistics for fs_stats
+static struct
+{
+	int	mapped, mappedbytes;	// COM_MapFile served from a mapping
+	int	copied, copiedbytes;	// COM_MapFile fell back to reading
+	int	inflated;		// deflated pk3 entries
+	double	inflatedbytes, deflatedbytes;
+	double	inflatetime;
+	int	prefetched, prefetchedbytes;	// served by the background loader
+	int	prefetchwasted;		// read but never asked for
+	double	prefetchwait;		// time spent waiting for the loader
+} fs_stats;
 
 searchpath_t	*com_searchpaths;
 searchpath_t	*com_base_searchpaths;
@@ -1591,6 +1723,212 @@ static void COM_Path_f (void)
 	}
 }
 
+/*
+============
+FS_Stats_f
+============
+*/
+static void FS_Stats_f (void)
+{
+	Con_Printf ("mapped reads : %6i files %8.2f MB\n", fs_stats.mapped, fs_stats.mappedbytes / (1024.0 * 1024.0));
+	Con_Printf ("copied reads : %6i files %8.2f MB\n", fs_stats.copied, fs_stats.copiedbytes / (1024.0 * 1024.0));
+	Con_Printf ("pk3 inflated : %6i files %8.2f MB (from %.2f MB)\n", fs_stats.inflated,
+			fs_stats.inflatedbytes / (1024.0 * 1024.0), fs_stats.deflatedbytes / (1024.0 * 1024.0));
+	Con_Printf ("inflate time : %8.1f ms", fs_stats.inflatetime * 1000.0);
+	if (fs_stats.inflatetime > 0)
+		Con_Printf (" (%.1f MB/s)", fs_stats.inflatedbytes / (1024.0 * 1024.0) / fs_stats.inflatetime);
+	Con_Printf ("\n");
+	Con_Printf ("prefetched   : %6i files %8.2f MB, %i unused\n", fs_stats.prefetched,
+			fs_stats.prefetchedbytes / (1024.0 * 1024.0), fs_stats.prefetchwasted);
+	Con_Printf ("prefetch wait: %8.1f ms", fs_stats.prefetchwait * 1000.0);
+	Con_Printf ("\n");
+}
+
+/*
+============
+COM_HashPackFiles
+
+Builds the hashed name index of a pak/pk3 directory
+============
+*/
+static void COM_HashPackFiles (pack_t *pack)
+{
+	int		i, size;
+	unsigned int	h;
+
+	for (size = 64; size < pack->numfiles; size <<= 1)
+		;
+	pack->hashmask = size - 1;
+	pack->hashheads = (int *) Z_Malloc (size * sizeof(int));
+	for (i = 0; i < size; i++)
+		pack->hashheads[i] = -1;
+
+	// link backwards, so that the first of several equal names is found
+	for (i = pack->numfiles - 1; i >= 0; i--)
+	{
+		h = COM_HashString (pack->files[i].name) & pack->hashmask;
+		pack->files[i].hashnext = pack->hashheads[h];
+		pack->hashheads[h] = i;
+	}
+}
+
+/*
+============
+COM_FindPackFile
+============
+*/
+static packfile_t *COM_FindPackFile (pack_t *pack, const char *name)
+{
+	int		i;
+
+	i = pack->hashheads[COM_HashString (name) & pack->hashmask];
+	for ( ; i != -1; i = pack->files[i].hashnext)
+	{
+		if (!strcmp (pack->files[i].name, name))
+			return &pack->files[i];
+	}
+
+	return NULL;
+}
+
+/*
+============
+COM_InflateFile
+
+Decompresses a deflated pk3 entry straight into out, which must have room
+for filelen bytes.  The compressed data is inflated directly from a
+mapping of the pk3 when possible, otherwise it is streamed through a
+small buffer.
+============
+*/
+#define INFLATE_CHUNK	0x10000
+
+static qboolean COM_InflateMemory (const byte *in, int deflatedlen, byte *out, int filelen)
+{
+	tinfl_decompressor	*inflator;
+	tinfl_status	status;
+	size_t		insize, outsize;
+
+	inflator = (tinfl_decompressor *) malloc (sizeof(tinfl_decompressor));
+	if (!inflator)
+		return false;
+	tinfl_init (inflator);
+
+	insize = deflatedlen;
+	outsize = filelen;
+	status = tinfl_decompress (inflator, in, &insize, out, out, &outsize,
+				TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+	free (inflator);
+
+	return (status == TINFL_STATUS_DONE && outsize == (size_t) filelen);
+}
+
+static qboolean COM_InflateFile (int handle, int ofs, int deflatedlen, byte *out, int filelen)
+{
+	tinfl_decompressor	*inflator;
+	tinfl_status	status;
+	byte		*in, *chunk;
+	void		*view;
+	size_t		viewsize, insize, outsize, outpos;
+	int		left;
+	double		time1;
+	qboolean	ok;
+
+	time1 = Sys_DoubleTime ();
+
+	in = NULL;
+	if (!com_nommap)
+		in = (byte *) Sys_FileMap (handle, ofs, deflatedlen, &view, &viewsize);
+
+	if (in)
+	{
+		ok = COM_InflateMemory (in, deflatedlen, out, filelen);
+		Sys_FileUnmap (view, viewsize);
+	}
+	else
+	{
+		inflator = (tinfl_decompressor *) malloc (sizeof(tinfl_decompressor));
+		chunk = (byte *) malloc (INFLATE_CHUNK);
+		if (!inflator || !chunk)
+		{
+			free (inflator);
+			free (chunk);
+			return false;
+		}
+		tinfl_init (inflator);
+
+		Sys_FileSeek (handle, ofs);
+		status = TINFL_STATUS_NEEDS_MORE_INPUT;
+		outpos = 0;
+		for (left = deflatedlen; left > 0 && status == TINFL_STATUS_NEEDS_MORE_INPUT; )
+		{
+			insize = q_min (left, INFLATE_CHUNK);
+			if (Sys_FileRead (handle, chunk, (int) insize) != (int) insize)
+				break;
+			left -= (int) insize;
+
+			// with a non-wrapping output buffer the whole chunk is consumed
+			// unless the stream ends or is corrupt
+			outsize = filelen - outpos;
+			status = tinfl_decompress (inflator, chunk, &insize, out, out + outpos, &outsize,
+					TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (left ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+			outpos += outsize;
+		}
+		free (chunk);
+		free (inflator);
+
+		ok = (status == TINFL_STATUS_DONE && outpos == (size_t) filelen);
+	}
+
+	fs_stats.inflated++;
+	fs_stats.inflatedbytes += filelen;
+	fs_stats.deflatedbytes += deflatedlen;
+	fs_stats.inflatetime += Sys_DoubleTime () - time1;
+
+	return ok;
+}
+
+/*
+============
+COM_InflateToTempFile
+
+stdio users (music, demos, configs...) want a FILE * for pk3 entries, too.
+Deflated entries are extracted into an anonymous temporary file for them.
+============
+*/
+static FILE *COM_InflateToTempFile (pack_t *pack, packfile_t *pf)
+{
+	FILE	*f;
+	byte	*buf;
+
+	buf = (byte *) malloc (pf->filelen + 1);
+	if (!buf)
+		return NULL;
+
+	if (!COM_InflateFile (pack->handle, pf->filepos, pf->deflatedlen, buf, pf->filelen))
+	{
+		Con_Printf ("%s: error inflating %s\n", pack->filename, pf->name);
+		free (buf);
+		return NULL;
+	}
+
+	f = tmpfile ();
+	if (f)
+	{
+		if (fwrite (buf, 1, pf->filelen, f) != (size_t) pf->filelen)
+		{
+			fclose (f);
+			f = NULL;
+		}
+		else	rewind (f);
+	}
+	if (!f)
+		Con_Printf ("Couldn't extract %s to a temporary file\n", pf->name);
+
+	free (buf);
+	return f;
+}
+
 /*
 ============
 COM_WriteFile
@@ -1619,6 +1957,51 @@ void COM_WriteFile (const char *filename, const void *data, int len)
 	Sys_FileClose (handle);
 }
 
+/*
+============
+COM_OpenTempFile
+
+Opens a new file next to path, under a name of its own, for writing
+what goes to path.  COM_ReplaceFile then puts it in place, so that
+nobody reading path ever sees it half written, even when another
+thread or instance is writing the same file.
+============
+*/
+FILE *COM_OpenTempFile (const char *path, char *temppath, size_t size)
+{
+	static SDL_atomic_t	counter;
+	unsigned int	id;
+
+	id = (unsigned int)(Sys_DoubleTime () * 1000000.0) ^ ((unsigned int)(size_t)&id << 8);
+	id += (unsigned int) SDL_AtomicAdd (&counter, 1) * 0x9e3779b9u;
+	q_snprintf (temppath, size, "%s.%08x.tmp", path, id);
+
+	return fopen (temppath, "wb");
+}
+
+/*
+============
+COM_ReplaceFile
+
+Closes a file from COM_OpenTempFile and renames it to path if all of
+it was written, otherwise removes it.
+============
+*/
+qboolean COM_ReplaceFile (FILE *f, const char *temppath, const char *path)
+{
+	qboolean	ok;
+
+	ok = !ferror (f);
+	if (fclose (f) != 0)
+		ok = false;
+	if (ok)
+		ok = Sys_FileReplace (temppath, path);
+	if (!ok)
+		remove (temppath);
+
+	return ok;
+}
+
 /*
 ============
 COM_CreatePath
@@ -1672,6 +2055,7 @@ static int COM_FindFile (const char *filename, int *handle, FILE **file,
 	searchpath_t	*search;
 	char		netpath[MAX_OSPATH];
 	pack_t		*pak;
+	packfile_t	*pf;
 	int		i;
 
 	if (file && handle)
@@ -1687,32 +2071,38 @@ static int COM_FindFile (const char *filename, int *handle, FILE **file,
 		if (search->pack)	/* look through all the pak file elements */
 		{
 			pak = search->pack;
-			for (i = 0; i < pak->numfiles; i++)
+			pf = COM_FindPackFile (pak, filename);
+			if (!pf)
+				continue;
+			// found it!
+			com_filesize = pf->filelen;
+			com_fileofs = pf->filepos;
+			com_filedeflated = (pf->flags & PACKFILE_DEFLATED) ? pf->deflatedlen : 0;
+			q_strlcpy (com_filepath, pak->filename, sizeof(com_filepath));
+			file_from_pak = 1;
+			if (path_id)
+				*path_id = search->path_id;
+			if (handle)
 			{
-				if (strcmp(pak->files[i].name, filename) != 0)
-					continue;
-				// found it!
-				com_filesize = pak->files[i].filelen;
-				file_from_pak = 1;
-				if (path_id)
-					*path_id = search->path_id;
-				if (handle)
-				{
-					*handle = pak->handle;
-					Sys_FileSeek (pak->handle, pak->files[i].filepos);
-					return com_filesize;
-				}
-				else if (file)
-				{ /* open a new file on the pakfile */
-					*file = fopen (pak->filename, "rb");
-					if (*file)
-						fseek (*file, pak->files[i].filepos, SEEK_SET);
-					return com_filesize;
-				}
-				else /* for COM_FileExists() */
+				*handle = pak->handle;
+				Sys_FileSeek (pak->handle, pf->filepos);
+				return com_filesize;
+			}
+			else if (file)
+			{ /* open a new file on the pakfile */
+				if (com_filedeflated)
 				{
+					*file = COM_InflateToTempFile (pak, pf);
 					return com_filesize;
 				}
+				*file = fopen (pak->filename, "rb");
+				if (*file)
+					fseek (*file, pf->filepos, SEEK_SET);
+				return com_filesize;
+			}
+			else /* for COM_FileExists() */
+			{
+				return com_filesize;
 			}
 		}
 		else	/* check a file in the directory tree */
@@ -1727,6 +2117,9 @@ static int COM_FindFile (const char *filename, int *handle, FILE **file,
 			if (! (Sys_FileType(netpath) & FS_ENT_FILE))
 				continue;
 
+			com_fileofs = 0;
+			com_filedeflated = 0;
+			q_strlcpy (com_filepath, netpath, sizeof(com_filepath));
 			if (path_id)
 				*path_id = search->path_id;
 			if (handle)
@@ -1824,6 +2217,191 @@ void COM_CloseFile (int h)
 }
 
 
+/*
+==============================================================================
+
+BACKGROUND PREFETCH
+
+Once the list of models and sounds for a level is known, their bytes are
+read (and inflated, for pk3 entries) by the worker threads while the main
+thread is still busy loading the earlier ones.  COM_LoadFile and
+COM_MapFile hand out a prefetched copy when there is one, waiting for it
+if it is still being read.  Parsing the data stays on the main thread.
+
+The file is looked up on the main thread when it is queued, so the
+workers only ever see an os path and an offset.
+==============================================================================
+*/
+
+#define	MAX_PREFETCH_BYTES	(256 * 1024 * 1024)	// don't queue more than this at once
+
+typedef struct prefetch_s
+{
+	char		name[MAX_QPATH];
+	char		ospath[MAX_OSPATH];
+	unsigned int	path_id;
+	int		frompak;
+	int		ofs, len, deflated;
+	byte		*data;		// malloc'ed, len + 1 bytes, NULL if the read failed
+	taskgroup_t	group;
+	struct prefetch_s	*next;
+} prefetch_t;
+
+static prefetch_t	*com_prefetch;
+static int		com_prefetchbytes;
+
+/*
+============
+COM_PrefetchTask
+
+Runs on a worker thread: only stdio and the prefetch_t itself are touched.
+============
+*/
+static void COM_PrefetchTask (void *data, int unused)
+{
+	prefetch_t	*p = (prefetch_t *) data;
+	FILE		*f;
+	byte		*buf, *in;
+	int		inlen;
+
+	f = fopen (p->ospath, "rb");
+	if (!f)
+		return;
+
+	buf = (byte *) malloc (p->len + 1);
+	inlen = p->deflated ? p->deflated : p->len;
+	in = p->deflated ? (byte *) malloc (inlen) : buf;
+
+	if (!buf || !in || fseek (f, p->ofs, SEEK_SET) != 0 ||
+	    fread (in, 1, inlen, f) != (size_t) inlen ||
+	    (p->deflated && !COM_InflateMemory (in, inlen, buf, p->len)))
+	{
+		free (buf);
+		buf = NULL;
+	}
+	else	buf[p->len] = 0;
+
+	if (p->deflated)
+		free (in);
+	fclose (f);
+
+	p->data = buf;
+}
+
+/*
+============
+COM_PrefetchFile
+
+Queues a file to be read in the background.
+============
+*/
+void COM_PrefetchFile (const char *path)
+{
+	prefetch_t	*p;
+	int		h, len;
+	unsigned int	path_id;
+
+	if (!fs_prefetch.value || !Tasks_NumWorkers ())
+		return;
+
+	for (p = com_prefetch; p; p = p->next)
+	{
+		if (!strcmp (p->name, path))
+			return;
+	}
+
+	len = COM_OpenFile (path, &h, &path_id);
+	if (h == -1)
+		return;
+	COM_CloseFile (h);
+
+	if (com_prefetchbytes + len > MAX_PREFETCH_BYTES)
+		return;
+	com_prefetchbytes += len;
+
+	p = (prefetch_t *) Z_Malloc (sizeof(prefetch_t));
+	q_strlcpy (p->name, path, sizeof(p->name));
+	q_strlcpy (p->ospath, com_filepath, sizeof(p->ospath));
+	p->path_id = path_id;
+	p->frompak = file_from_pak;
+	p->ofs = com_fileofs;
+	p->len = len;
+	p->deflated = com_filedeflated;
+	p->next = com_prefetch;
+	com_prefetch = p;
+
+	Task_Submit (&p->group, COM_PrefetchTask, p, 0);
+}
+
+/*
+============
+COM_TakePrefetch
+
+Returns the prefetched contents of path as a malloc'ed buffer, or NULL if
+it wasn't prefetched.  Sets com_filesize and path_id like COM_FindFile.
+============
+*/
+static byte *COM_TakePrefetch (const char *path, unsigned int *path_id)
+{
+	prefetch_t	*p, **prev;
+	byte		*data;
+	double		time1;
+
+	for (prev = &com_prefetch; (p = *prev) != NULL; prev = &p->next)
+	{
+		if (!strcmp (p->name, path))
+			break;
+	}
+	if (!p)
+		return NULL;
+
+	*prev = p->next;
+
+	time1 = Sys_DoubleTime ();
+	Task_Wait (&p->group);
+	fs_stats.prefetchwait += Sys_DoubleTime () - time1;
+
+	data = p->data;
+	if (data)
+	{
+		com_filesize = p->len;
+		file_from_pak = p->frompak;
+		if (path_id)
+			*path_id = p->path_id;
+		fs_stats.prefetched++;
+		fs_stats.prefetchedbytes += p->len;
+	}
+	com_prefetchbytes -= p->len;
+	Z_Free (p);
+
+	return data;
+}
+
+/*
+============
+COM_FlushPrefetch
+
+Throws away whatever was prefetched but never asked for.
+============
+*/
+void COM_FlushPrefetch (void)
+{
+	prefetch_t	*p;
+
+	while (com_prefetch)
+	{
+		p = com_prefetch;
+		com_prefetch = p->next;
+		Task_Wait (&p->group);
+		if (p->data)
+			fs_stats.prefetchwasted++;
+		free (p->data);
+		Z_Free (p);
+	}
+	com_prefetchbytes = 0;
+}
+
+
 /*
 ============
 COM_LoadFile
@@ -1846,16 +2424,31 @@ static int	loadsize;
 byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 {
 	int		h;
-	byte	*buf;
+	byte	*buf, *prefetched;
 	char	base[32];
-	int	len, nread;
+	int	len, nread, ofs, deflated;
 
 	buf = NULL;	// quiet compiler warning
 
-// look for it in the filesystem or pack files
-	len = COM_OpenFile (path, &h, path_id);
-	if (h == -1)
-		return NULL;
+// see if the background loader already has it
+	prefetched = com_prefetch ? COM_TakePrefetch (path, path_id) : NULL;
+	if (prefetched)
+	{
+		if (usehunk == LOADFILE_MALLOC)
+			return prefetched;
+		h = -1;
+		len = com_filesize;
+		ofs = deflated = 0;
+	}
+	else
+	{
+	// look for it in the filesystem or pack files
+		len = COM_OpenFile (path, &h, path_id);
+		if (h == -1)
+			return NULL;
+		ofs = com_fileofs;
+		deflated = com_filedeflated;
+	}
 
 // extract the filename base name for hunk tag
 	COM_FileBase (path, base, sizeof(base));
@@ -1892,6 +2485,21 @@ byte *COM_LoadFile (const char *path, int usehunk, unsigned int *path_id)
 
 	((byte *)buf)[len] = 0;
 
+	if (prefetched)
+	{
+		memcpy (buf, prefetched, len);
+		free (prefetched);
+		return buf;
+	}
+
+	if (deflated)
+	{	// pk3 entry: inflate straight into the destination buffer
+		if (!COM_InflateFile (h, ofs, deflated, buf, len))
+			Sys_Error ("COM_LoadFile: Error inflating %s", path);
+		COM_CloseFile (h);
+		return buf;
+	}
+
 	nread = Sys_FileRead (h, buf, len);
 	COM_CloseFile (h);
 	if (nread != len)
@@ -1939,6 +2547,84 @@ byte *COM_LoadMallocFile (const char *path, unsigned int *path_id)
 	return COM_LoadFile (path, LOADFILE_MALLOC, path_id);
 }
 
+/*
+============
+COM_MapFile
+
+Maps the file straight from its pak (or from the loose file) so that
+loaders which only read the data don't need a copy of it in the hunk.
+Falls back to a malloc'ed copy if the platform can't map the file.
+============
+*/
+byte *COM_MapFile (const char *path, filemap_t *map, unsigned int *path_id)
+{
+	int		h, len;
+
+	memset (map, 0, sizeof(*map));
+
+	if (com_prefetch)
+	{
+		map->data = COM_TakePrefetch (path, path_id);
+		if (map->data)
+		{
+			map->size = com_filesize;
+			return map->data;
+		}
+	}
+
+	len = COM_OpenFile (path, &h, path_id);
+	if (h == -1)
+		return NULL;
+
+	if (!com_nommap && !com_filedeflated)
+		map->data = (byte *) Sys_FileMap (h, com_fileofs, len, &map->view, &map->viewsize);
+
+	if (map->data)
+	{
+		fs_stats.mapped++;
+		fs_stats.mappedbytes += len;
+	}
+	else
+	{
+		map->view = NULL;
+		map->data = (byte *) malloc (len + 1);
+		if (!map->data)
+			Sys_Error ("COM_MapFile: not enough space for %s", path);
+		map->data[len] = 0;
+		if (com_filedeflated)
+		{
+			if (!COM_InflateFile (h, com_fileofs, com_filedeflated, map->data, len))
+				Sys_Error ("COM_MapFile: Error inflating %s", path);
+		}
+		else
+		{
+			if (Sys_FileRead (h, map->data, len) != len)
+				Sys_Error ("COM_MapFile: Error reading %s", path);
+			fs_stats.copied++;
+			fs_stats.copiedbytes += len;
+		}
+	}
+
+	COM_CloseFile (h);
+	map->size = len;
+
+	return map->data;
+}
+
+/*
+============
+COM_UnmapFile
+============
+*/
+void COM_UnmapFile (filemap_t *map)
+{
+	if (map->view)
+		Sys_FileUnmap (map->view, map->viewsize);
+	else	free (map->data);
+
+	memset (map, 0, sizeof(*map));
+}
+
 byte *COM_LoadMallocFile_TextMode_OSPath (const char *path, long *len_out)
 {
 	FILE	*f;
@@ -2081,11 +2767,280 @@ static pack_t *COM_LoadPackFile (const char *packfile)
 	pack->handle = packhandle;
 	pack->numfiles = numpackfiles;
 	pack->files = newfiles;
+	COM_HashPackFiles (pack);
 
 	//Sys_Printf ("Added packfile %s (%i files)\n", packfile, numpackfiles);
 	return pack;
 }
 
+/*
+=================
+COM_ResolveZipFiles
+
+Points filepos of every pk3 entry past its local header to the data,
+and drops the entries with a bad header or data past the end of the
+file.  Returns how many are left.
+=================
+*/
+static int COM_ResolveZipFiles (const char *packfile, int packhandle, int filesize, packfile_t *files, int numfiles)
+{
+	byte		header[ZIP_LOCAL_SIZE];
+	const byte	*base, *h;
+	void		*view;
+	size_t		viewsize;
+	int		i, n, ofs, datalen;
+
+	// the headers are spread all over the file, map it if we can
+	base = com_nommap ? NULL : (const byte *) Sys_FileMap (packhandle, 0, filesize, &view, &viewsize);
+
+	for (i = n = 0; i < numfiles; i++)
+	{
+		ofs = files[i].filepos;
+		if (ofs > filesize - ZIP_LOCAL_SIZE)
+			h = NULL;
+		else if (base)
+			h = base + ofs;
+		else
+		{
+			Sys_FileSeek (packhandle, ofs);
+			h = (Sys_FileRead (packhandle, header, ZIP_LOCAL_SIZE) == ZIP_LOCAL_SIZE) ? header : NULL;
+		}
+		if (!h || MZ_READ_LE32 (h) != ZIP_LOCAL_SIG)
+		{
+			Con_DPrintf ("%s: ignoring %s (bad local header)\n", packfile, files[i].name);
+			continue;
+		}
+
+		ofs += ZIP_LOCAL_SIZE + MZ_READ_LE16 (h + 26) + MZ_READ_LE16 (h + 28);
+		datalen = (files[i].flags & PACKFILE_DEFLATED) ? files[i].deflatedlen : files[i].filelen;
+		if (datalen > filesize - ofs ||
+		    (!(files[i].flags & PACKFILE_DEFLATED) && files[i].deflatedlen != files[i].filelen))
+		{
+			Con_DPrintf ("%s: ignoring %s (truncated or corrupt)\n", packfile, files[i].name);
+			continue;
+		}
+
+		files[n] = files[i];
+		files[n].filepos = ofs;
+		n++;
+	}
+
+	if (base)
+		Sys_FileUnmap (view, viewsize);
+
+	return n;
+}
+
+/*
+=================
+COM_LoadZipFile
+
+Takes an explicit path to a pk3 (zip) file.
+
+Reads the central directory once and turns it into a pack directory.
+Stored entries are read like pak files; deflated ones are inflated
+when loaded.  The local headers are all skipped here, and entries whose
+data doesn't fit in the file are dropped, so the directory is never
+written again and every range in it can be mapped.
+=================
+*/
+static pack_t *COM_LoadZipFile (const char *packfile)
+{
+	int		packhandle, filesize, len;
+	int		i, numentries, numfiles, cdofs, cdsize;
+	int		flags, method, namelen;
+	byte		*buf, *p, *end;
+	packfile_t	*newfiles;
+	pack_t		*pack;
+
+	filesize = Sys_FileOpenRead (packfile, &packhandle);
+	if (filesize == -1)
+		return NULL;
+
+	// the end of central directory record is followed by a comment of
+	// at most 64k, so it must be somewhere in the tail of the file
+	len = q_min (filesize, ZIP_EOCD_SIZE + 0xffff);
+	buf = (byte *) malloc (len);
+	Sys_FileSeek (packhandle, filesize - len);
+	if (!buf || Sys_FileRead (packhandle, buf, len) != len)
+		Sys_Error ("Error reading %s", packfile);
+
+	for (p = buf + len - ZIP_EOCD_SIZE; p >= buf; p--)
+	{
+		if (MZ_READ_LE32 (p) == ZIP_EOCD_SIG)
+			break;
+	}
+	if (p < buf)
+	{
+		Sys_Printf ("WARNING: %s is not a zip file, ignored\n", packfile);
+		goto fail;
+	}
+
+	numentries = MZ_READ_LE16 (p + 10);
+	cdsize = (int) MZ_READ_LE32 (p + 12);
+	cdofs = (int) MZ_READ_LE32 (p + 16);
+	free (buf);
+	buf = NULL;
+
+	if (cdofs < 0 || cdsize < 0 || cdofs > filesize - cdsize)
+	{
+		Sys_Printf ("WARNING: %s has an invalid central directory (zip64?), ignored\n", packfile);
+		goto fail;
+	}
+	if (numentries >= MAX_FILES_IN_PK3)
+	{	// 0xffff means the real count is in a zip64 record
+		Sys_Printf ("WARNING: %s has too many files (zip64?), ignored\n", packfile);
+		goto fail;
+	}
+	if (!numentries)
+	{
+		Sys_Printf ("WARNING: %s has no files, ignored\n", packfile);
+		goto fail;
+	}
+
+	buf = (byte *) malloc (cdsize);
+	Sys_FileSeek (packhandle, cdofs);
+	if (!buf || Sys_FileRead (packhandle, buf, cdsize) != cdsize)
+		Sys_Error ("Error reading %s", packfile);
+
+	newfiles = (packfile_t *) Z_Malloc (numentries * sizeof(packfile_t));
+
+	// parse the central directory
+	end = buf + cdsize;
+	for (i = numfiles = 0, p = buf; i < numentries; i++)
+	{
+		if (p + ZIP_CDIR_SIZE > end || MZ_READ_LE32 (p) != ZIP_CDIR_SIG)
+		{
+			Sys_Printf ("WARNING: %s has a truncated central directory\n", packfile);
+			break;
+		}
+
+		flags = MZ_READ_LE16 (p + 8);
+		method = MZ_READ_LE16 (p + 10);
+		namelen = MZ_READ_LE16 (p + 28);
+		if (p + ZIP_CDIR_SIZE + namelen > end)
+			break;
+
+		if (namelen == 0 || p[ZIP_CDIR_SIZE + namelen - 1] == '/')
+			; // directory entry
+		else if (namelen >= MAX_QPATH)
+			Con_DPrintf ("%s: ignoring %.*s (name too long)\n", packfile, namelen, (char *)p + ZIP_CDIR_SIZE);
+		else if ((flags & 1) || (method != ZIP_METHOD_STORED && method != ZIP_METHOD_DEFLATED))
+			Con_DPrintf ("%s: ignoring %.*s (encrypted or unsupported compression)\n", packfile, namelen, (char *)p + ZIP_CDIR_SIZE);
+		else
+		{
+			memcpy (newfiles[numfiles].name, p + ZIP_CDIR_SIZE, namelen);
+			newfiles[numfiles].name[namelen] = 0;
+			newfiles[numfiles].filelen = (int) MZ_READ_LE32 (p + 24);
+			newfiles[numfiles].deflatedlen = (int) MZ_READ_LE32 (p + 20);
+			newfiles[numfiles].filepos = (int) MZ_READ_LE32 (p + 42);
+			newfiles[numfiles].flags = (method == ZIP_METHOD_DEFLATED) ? PACKFILE_DEFLATED : 0;
+			if (newfiles[numfiles].filelen >= 0 && newfiles[numfiles].deflatedlen >= 0 &&
+			    newfiles[numfiles].filepos >= 0 && newfiles[numfiles].filepos < filesize)
+				numfiles++;
+		}
+
+		p += ZIP_CDIR_SIZE + namelen + MZ_READ_LE16 (p + 30) + MZ_READ_LE16 (p + 32);
+	}
+	free (buf);
+
+	numfiles = COM_ResolveZipFiles (packfile, packhandle, filesize, newfiles, numfiles);
+	if (!numfiles)
+	{
+		Sys_Printf ("WARNING: %s has no usable files, ignored\n", packfile);
+		Z_Free (newfiles);
+		Sys_FileClose (packhandle);
+		return NULL;
+	}
+
+	com_modified = true;	// not the original game data
+
+	pack = (pack_t *) Z_Malloc (sizeof (pack_t));
+	q_strlcpy (pack->filename, packfile, sizeof(pack->filename));
+	pack->handle = packhandle;
+	pack->numfiles = numfiles;
+	pack->files = newfiles;
+	COM_HashPackFiles (pack);
+
+	return pack;
+
+fail:
+	free (buf);
+	Sys_FileClose (packhandle);
+	return NULL;
+}
+
+static int COM_SortStrings (const void *a, const void *b)
+{
+	return q_strcasecmp (*(const char **) a, *(const char **) b);
+}
+
+/*
+=================
+COM_AddZipFiles
+
+Adds all pk3 files of the current game directory to the search path in
+alphabetical order, so that later ones override earlier ones.
+=================
+*/
+static void COM_AddZipFiles (unsigned int path_id)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA	fdat;
+	HANDLE		fhnd;
+#else
+	DIR		*dir_p;
+	struct dirent	*dir_t;
+#endif
+	char		pakfile[MAX_OSPATH];
+	char		**names = NULL;
+	searchpath_t	*search;
+	pack_t		*pak;
+	size_t		i;
+
+#ifdef _WIN32
+	q_snprintf (pakfile, sizeof(pakfile), "%s/*.pk3", com_gamedir);
+	fhnd = FindFirstFile (pakfile, &fdat);
+	if (fhnd == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		VEC_PUSH (names, Z_Strdup (fdat.cFileName));
+	} while (FindNextFile (fhnd, &fdat));
+	FindClose (fhnd);
+#else
+	dir_p = opendir (com_gamedir);
+	if (dir_p == NULL)
+		return;
+	while ((dir_t = readdir (dir_p)) != NULL)
+	{
+		if (q_strcasecmp (COM_FileGetExtension (dir_t->d_name), "pk3") != 0)
+			continue;
+		VEC_PUSH (names, Z_Strdup (dir_t->d_name));
+	}
+	closedir (dir_p);
+#endif
+
+	if (!names)
+		return;
+	qsort (names, VEC_SIZE (names), sizeof(names[0]), COM_SortStrings);
+
+	for (i = 0; i < VEC_SIZE (names); i++)
+	{
+		q_snprintf (pakfile, sizeof(pakfile), "%s/%s", com_gamedir, names[i]);
+		Z_Free (names[i]);
+		pak = COM_LoadZipFile (pakfile);
+		if (!pak)
+			continue;
+		search = (searchpath_t *) Z_Malloc(sizeof(searchpath_t));
+		search->path_id = path_id;
+		search->pack = pak;
+		search->next = com_searchpaths;
+		com_searchpaths = search;
+	}
+	VEC_FREE (names);
+}
+
 /*
 =================
 COM_AddGameDirectory -- johnfitz -- modified based on topaz's tutorial
@@ -2146,6 +3101,9 @@ _add_path:
 		if (!pak) break;
 	}
 
+	// then any pk3 files, which override the numbered paks
+	COM_AddZipFiles (path_id);
+
 	if (!been_here && host_parms->userdir != host_parms->basedir)
 	{
 		been_here = true;
@@ -2230,6 +3188,8 @@ static void COM_Game_f (void)
 		//Write config file
 		Host_WriteConfiguration ();
 
+		COM_FlushPrefetch ();
+
 		//Kill the extra game if it is loaded
 		while (com_searchpaths != com_base_searchpaths)
 		{
@@ -2237,6 +3197,7 @@ static void COM_Game_f (void)
 			{
 				Sys_FileClose (com_searchpaths->pack->handle);
 				Z_Free (com_searchpaths->pack->files);
+				Z_Free (com_searchpaths->pack->hashheads);
 				Z_Free (com_searchpaths->pack);
 			}
 			search = com_searchpaths->next;
@@ -2320,9 +3281,13 @@ void COM_InitFilesystem (void) //johnfitz -- modified based on topaz's tutorial
 
 	Cvar_RegisterVariable (&registered);
 	Cvar_RegisterVariable (&cmdline);
+	Cvar_RegisterVariable (&fs_prefetch);
 	Cmd_AddCommand ("path", COM_Path_f);
+	Cmd_AddCommand ("fs_stats", FS_Stats_f);
 	Cmd_AddCommand ("game", COM_Game_f); //johnfitz
 
+	com_nommap = (COM_CheckParm ("-nommap") != 0);
+
 	i = COM_CheckParm ("-basedir");
 	if (i && i < com_argc-1)
 		q_strlcpy (com_basedir, com_argv[i + 1], sizeof(com_basedir));
@@ -168,6 +168,34 @@ void Vec_Free (void **pvec);
 
 extern	qboolean		host_bigendian;
 
+// vector instruction sets usable on this cpu, see q_simd.h
+#define	CPU_SSE2		(1 << 0)
+#define	CPU_AVX2		(1 << 1)
+#define	CPU_NEON		(1 << 2)
+extern	int			com_cpufeatures;
+
+// every kernel set starts with this, and each module keeps a list of
+// pointers to them, fastest first, ending with the plain C set
+typedef struct
+{
+	const char	*name;
+	int		cpu;	// com_cpufeatures bits needed
+} kernelinfo_t;
+
+// what one kernel set did in a benchmark run
+typedef struct
+{
+	double		time;		// the speedup column compares this
+	uint64_t	hash;		// of the output, must match the C set's
+	char		columns[80];	// printed between the name and the speedup
+} kernelbench_t;
+
+typedef void (*kernelbench_func_t) (const kernelinfo_t *kernels, void *data, kernelbench_t *result);
+
+qboolean COM_KernelsUsable (const kernelinfo_t *kernels);
+const kernelinfo_t *COM_PickKernels (const kernelinfo_t *const *list, int count, qboolean simd);
+void COM_BenchKernels (const kernelinfo_t *const *list, int count, kernelbench_func_t func, void *data);
+
 extern	short	(*BigShort) (short l);
 extern	short	(*LittleShort) (short l);
 extern	int	(*BigLong) (int l);
@@ -293,10 +321,15 @@ size_t LOC_Format (const char *format, const char* (*getarg_fn)(int idx, void* u
 //============================================================================
 
 // QUAKEFS
+#define	PACKFILE_DEFLATED	(1 << 0)	// pk3 entry compressed with deflate
+
 typedef struct
 {
 	char	name[MAX_QPATH];
 	int		filepos, filelen;
+	int		deflatedlen;	// pk3: size of the compressed data
+	int		flags;		// PACKFILE_* flags
+	int		hashnext;	// next file in the same hash chain, -1 terminates
 } packfile_t;
 
 typedef struct pack_s
@@ -305,6 +338,8 @@ typedef struct pack_s
 	int		handle;
 	int		numfiles;
 	packfile_t	*files;
+	int		*hashheads;	// first file of every hash chain, -1 if empty
+	unsigned int	hashmask;
 } pack_t;
 
 typedef struct searchpath_s
@@ -328,6 +363,8 @@ extern	char	com_gamedir[MAX_OSPATH];
 extern	int	file_from_pak;	// global indicating that file came from a pak
 
 void COM_WriteFile (const char *filename, const void *data, int len);
+FILE *COM_OpenTempFile (const char *path, char *temppath, size_t size);
+qboolean COM_ReplaceFile (FILE *f, const char *temppath, const char *path);
 int COM_OpenFile (const char *filename, int *handle, unsigned int *path_id);
 int COM_FOpenFile (const char *filename, FILE **file, unsigned int *path_id);
 qboolean COM_FileExists (const char *filename, unsigned int *path_id);
@@ -353,6 +390,29 @@ void COM_LoadCacheFile (const char *path, struct cache_user_s *cu,
 byte *COM_LoadMallocFile (const char *path, unsigned int *path_id);
 	// allocates the buffer on the system mem (malloc).
 
+// read-only access to a file without copying it into a buffer.  when the
+// file can be memory mapped, data points straight into the mapping and the
+// pages are shared with the OS file cache; otherwise the file is loaded into
+// malloc'ed memory.  the data is NOT guaranteed to be 0-terminated.  writes
+// to it are private to the caller (copy-on-write), but loaders should treat
+// it as const.  every successful COM_MapFile must be paired with
+// COM_UnmapFile once the caller is done with the data.
+typedef struct
+{
+	byte	*data;		// start of the file contents
+	int	size;		// file length
+	void	*view;		// mapped view, NULL if data is malloc'ed
+	size_t	viewsize;
+} filemap_t;
+
+byte *COM_MapFile (const char *path, filemap_t *map, unsigned int *path_id);
+void COM_UnmapFile (filemap_t *map);
+
+// queues a file to be read by the worker threads.  the next COM_LoadFile
+// or COM_MapFile of the same path picks up the data instead of reading it.
+void COM_PrefetchFile (const char *path);
+void COM_FlushPrefetch (void);	// discards unclaimed prefetched files
+
 // Opens the given path directly, ignoring search paths.
 // Returns NULL on failure, or else a '\0'-terminated malloc'ed buffer.
 // Loads in "t" mode so CRLF to LF translation is performed on Windows.
@@ -92,3 +92,31 @@ unsigned short CRC_Block (const byte *start, int count)
 
 	return crc;
 }
+
+/*
+================
+Hash_Block64
+
+Fast 64 bit hash for telling files apart (FNV-1a over 8 byte words, then
+mixed).  Not cryptographic, and not the same across byte orders.
+================
+*/
+uint64_t Hash_Block64 (const void *data, size_t len, uint64_t seed)
+{
+	const byte	*p = (const byte *) data;
+	uint64_t	h = 0xcbf29ce484222325ULL ^ seed;
+	uint64_t	w;
+
+	for ( ; len >= 8; len -= 8, p += 8)
+	{
+		memcpy (&w, p, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	for ( ; len; len--, p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
@@ -28,6 +28,7 @@ void CRC_Init(unsigned short *crcvalue);
 void CRC_ProcessByte(unsigned short *crcvalue, byte data);
 unsigned short CRC_Value(unsigned short crcvalue);
 unsigned short CRC_Block (const byte *start, int count); //johnfitz -- texture crc
+uint64_t Hash_Block64 (const void *data, size_t len, uint64_t seed);
 
 #endif	/* _QUAKE_CRC_H */
 
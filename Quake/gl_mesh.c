@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
+extern cvar_t gl_meshcache;
 
 /*
 =================================================================
@@ -279,6 +280,286 @@ static void BuildTris (void)
 	Con_DPrintf2 ("%3i tri %3i vert %3i cmd\n", pheader->numtris, numorder, numcommands);
 }
 
+/*
+=================================================================
+
+MESH CACHE
+
+BuildTris is quadratic in the number of triangles, and its result only
+depends on the triangles, the s/t verts and the skin size.  Results are
+kept in memory by a hash of those, across Mod_ClearAll, up to
+MESHCACHE_MAXBYTES with the least recently used ones dropped first, and
+saved to <userdir>/meshcache/<hash>.msh so that later runs skip the
+stripping too.
+
+=================================================================
+*/
+
+#define	MESHCACHE_MAGIC		(('C'<<24)|('M'<<16)|('S'<<8)|'Q')	// "QSMC"
+#define	MESHCACHE_VERSION	1
+#define	MESHCACHE_HASHSIZE	256
+#define	MESHCACHE_MAXBYTES	(4*1024*1024)
+
+typedef struct
+{
+	int		magic;
+	int		version;
+	uint64_t	key;
+	int		numcommands;
+	int		numorder;
+} meshcache_header_t;
+
+// the file is the header, the commands, then the vertex order
+
+typedef struct meshcache_s
+{
+	struct meshcache_s	*next;		// in the hash chain
+	struct meshcache_s	*lru_prev, *lru_next;	// most recently used first
+	uint64_t		key;
+	int			numcommands;
+	int			numorder;
+	int			data[1];	// commands, then vertexorder
+} meshcache_t;
+
+static meshcache_t	*meshcache[MESHCACHE_HASHSIZE];
+static meshcache_t	*meshcache_head, *meshcache_tail;
+static size_t		meshcache_bytes;
+
+/*
+================
+GL_MeshCacheKey
+================
+*/
+static uint64_t GL_MeshCacheKey (void)
+{
+	int		params[5];
+	uint64_t	key;
+
+	params[0] = MESHCACHE_VERSION;
+	params[1] = pheader->numtris;
+	params[2] = pheader->numverts;
+	params[3] = pheader->skinwidth;
+	params[4] = pheader->skinheight;
+	key = Hash_Block64 (params, sizeof(params), 0);
+	key = Hash_Block64 (triangles, pheader->numtris * sizeof(triangles[0]), key);
+	key = Hash_Block64 (stverts, pheader->numverts * sizeof(stverts[0]), key);
+
+	return key;
+}
+
+static void GL_MeshCachePath (char *path, size_t size, uint64_t key)
+{
+	q_snprintf (path, size, "%s/meshcache/%08x%08x.msh", host_parms->userdir,
+		    (unsigned int)(key >> 32), (unsigned int)key);
+}
+
+/*
+================
+GL_ValidateMesh
+
+checks a command list and vertex order for the current model, so that a
+damaged file can't put anything out of bounds
+================
+*/
+static qboolean GL_ValidateMesh (const int *cmds, int ncmds, const int *order, int norder)
+{
+	int		i, count, total;
+
+	if (ncmds < 1 || ncmds > (int)Q_COUNTOF(commands) || norder < 0 || norder > (int)Q_COUNTOF(vertexorder))
+		return false;
+
+	for (i = 0; i < norder; i++)
+	{
+		if (order[i] < 0 || order[i] >= pheader->numverts)
+			return false;
+	}
+
+	for (i = 0, total = 0; ; )
+	{
+		count = abs (cmds[i++]);
+		if (!count)
+			break;
+		if (count < 3 || count > (ncmds - i - 1) / 2)
+			return false;
+		i += count*2;
+		total += count;
+	}
+
+	return i == ncmds && total == norder;
+}
+
+static size_t GL_MeshSize (const meshcache_t *mc)
+{
+	return sizeof(meshcache_t) + (mc->numcommands + mc->numorder) * sizeof(int);
+}
+
+static void GL_UnlinkMeshLRU (meshcache_t *mc)
+{
+	if (mc->lru_prev)
+		mc->lru_prev->lru_next = mc->lru_next;
+	else
+		meshcache_head = mc->lru_next;
+	if (mc->lru_next)
+		mc->lru_next->lru_prev = mc->lru_prev;
+	else
+		meshcache_tail = mc->lru_prev;
+}
+
+static void GL_LinkMeshLRU (meshcache_t *mc)
+{
+	mc->lru_prev = NULL;
+	mc->lru_next = meshcache_head;
+	if (meshcache_head)
+		meshcache_head->lru_prev = mc;
+	else
+		meshcache_tail = mc;
+	meshcache_head = mc;
+}
+
+/*
+================
+GL_FreeOldestMesh
+================
+*/
+static void GL_FreeOldestMesh (void)
+{
+	meshcache_t	*mc = meshcache_tail;
+	meshcache_t	**link;
+
+	for (link = &meshcache[mc->key & (MESHCACHE_HASHSIZE-1)]; *link != mc; link = &(*link)->next)
+		;
+	*link = mc->next;
+	GL_UnlinkMeshLRU (mc);
+	meshcache_bytes -= GL_MeshSize (mc);
+	free (mc);
+}
+
+/*
+================
+GL_KeepMesh
+
+keeps the result of BuildTris in memory
+================
+*/
+static void GL_KeepMesh (uint64_t key)
+{
+	meshcache_t	*mc;
+	size_t		size;
+
+	size = sizeof(meshcache_t) + (numcommands + numorder) * sizeof(int);
+	if (size > MESHCACHE_MAXBYTES)
+		return;
+	while (meshcache_tail && meshcache_bytes + size > MESHCACHE_MAXBYTES)
+		GL_FreeOldestMesh ();
+
+	mc = (meshcache_t *) malloc (size);
+	if (!mc)
+		return;
+	mc->key = key;
+	mc->numcommands = numcommands;
+	mc->numorder = numorder;
+	memcpy (mc->data, commands, numcommands * sizeof(int));
+	memcpy (mc->data + numcommands, vertexorder, numorder * sizeof(int));
+	mc->next = meshcache[key & (MESHCACHE_HASHSIZE-1)];
+	meshcache[key & (MESHCACHE_HASHSIZE-1)] = mc;
+	GL_LinkMeshLRU (mc);
+	meshcache_bytes += size;
+}
+
+/*
+================
+GL_FindCachedMesh
+
+fills in commands and vertexorder from the memory or disk cache
+================
+*/
+static qboolean GL_FindCachedMesh (uint64_t key)
+{
+	meshcache_header_t	header;
+	meshcache_t		*mc;
+	char	path[MAX_OSPATH];
+	int		h, len, size;
+
+	for (mc = meshcache[key & (MESHCACHE_HASHSIZE-1)]; mc; mc = mc->next)
+	{
+		if (mc->key == key)
+		{
+			numcommands = mc->numcommands;
+			numorder = mc->numorder;
+			memcpy (commands, mc->data, numcommands * sizeof(int));
+			memcpy (vertexorder, mc->data + numcommands, numorder * sizeof(int));
+			GL_UnlinkMeshLRU (mc);
+			GL_LinkMeshLRU (mc);
+			return true;
+		}
+	}
+
+	GL_MeshCachePath (path, sizeof(path), key);
+	len = Sys_FileOpenRead (path, &h);
+	if (h == -1)
+		return false;
+
+	size = 0;
+	if (len >= (int)sizeof(header) && Sys_FileRead (h, &header, sizeof(header)) == sizeof(header) &&
+	    header.magic == MESHCACHE_MAGIC && header.version == MESHCACHE_VERSION && header.key == key &&
+	    header.numcommands > 0 && header.numcommands <= (int)Q_COUNTOF(commands) &&
+	    header.numorder >= 0 && header.numorder <= (int)Q_COUNTOF(vertexorder))
+	{
+		size = (header.numcommands + header.numorder) * sizeof(int);
+		if (len != (int)sizeof(header) + size ||
+		    Sys_FileRead (h, commands, header.numcommands * sizeof(int)) != header.numcommands * (int)sizeof(int) ||
+		    Sys_FileRead (h, vertexorder, header.numorder * sizeof(int)) != header.numorder * (int)sizeof(int))
+			size = 0;
+	}
+	Sys_FileClose (h);
+
+	if (!size || !GL_ValidateMesh (commands, header.numcommands, vertexorder, header.numorder))
+	{
+		Con_DPrintf ("ignored stale mesh cache %s\n", path);
+		return false;
+	}
+
+	numcommands = header.numcommands;
+	numorder = header.numorder;
+	GL_KeepMesh (key);
+	return true;
+}
+
+/*
+================
+GL_WriteMesh
+================
+*/
+static void GL_WriteMesh (uint64_t key)
+{
+	meshcache_header_t	header;
+	char	path[MAX_OSPATH];
+	char	temppath[MAX_OSPATH];
+	FILE	*f;
+
+	memset (&header, 0, sizeof(header));
+	header.magic = MESHCACHE_MAGIC;
+	header.version = MESHCACHE_VERSION;
+	header.key = key;
+	header.numcommands = numcommands;
+	header.numorder = numorder;
+
+	q_snprintf (path, sizeof(path), "%s/meshcache", host_parms->userdir);
+	Sys_mkdir (path);
+	GL_MeshCachePath (path, sizeof(path), key);
+	f = COM_OpenTempFile (path, temppath, sizeof(temppath));
+	if (f)
+	{
+		fwrite (&header, sizeof(header), 1, f);
+		fwrite (commands, sizeof(int), numcommands, f);
+		fwrite (vertexorder, sizeof(int), numorder, f);
+		if (!COM_ReplaceFile (f, temppath, path))
+			Con_Warning ("couldn't write %s\n", path);
+	}
+	else
+		Con_DPrintf ("couldn't open %s for writing\n", temppath);
+}
+
 static void GL_MakeAliasModelDisplayLists_VBO (qmodel_t *, aliashdr_t *);
 static void GLMesh_LoadVertexBuffer (qmodel_t *m, const aliashdr_t *hdr);
 
@@ -295,6 +576,7 @@ void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr)
 	float	hscale, vscale; //johnfitz -- padded skins
 	int		count; //johnfitz -- precompute texcoords for padded skins
 	int		*loadcmds; //johnfitz
+	uint64_t	key;
 	aliashdr_t	*paliashdr = hdr;	// (aliashdr_t *)Mod_Extradata (m);
 
 	//johnfitz -- padded skins
@@ -303,8 +585,22 @@ void GL_MakeAliasModelDisplayLists (qmodel_t *m, aliashdr_t *hdr)
 	//johnfitz
 
 //johnfitz -- generate meshes
-	Con_DPrintf2 ("meshing %s...\n",m->name);
-	BuildTris ();
+	if (gl_meshcache.value)
+	{
+		key = GL_MeshCacheKey ();
+		if (!GL_FindCachedMesh (key))
+		{
+			Con_DPrintf2 ("meshing %s...\n",m->name);
+			BuildTris ();
+			GL_KeepMesh (key);
+			GL_WriteMesh (key);
+		}
+	}
+	else
+	{
+		Con_DPrintf2 ("meshing %s...\n",m->name);
+		BuildTris ();
+	}
 
 	// save the data out
 
@@ -35,9 +35,12 @@ static void Mod_LoadAliasModel (qmodel_t *mod, void *buffer);
 static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash);
 
 static void Mod_Print (void);
+static void Mod_PVSCache_f (cvar_t *var);
 
 static cvar_t	external_ents = {"external_ents", "1", CVAR_ARCHIVE};
 static cvar_t	external_vis = {"external_vis", "1", CVAR_ARCHIVE};
+static cvar_t	mod_pvscache = {"mod_pvscache", "1024", CVAR_ARCHIVE};	// kilobytes of decompressed vis rows, 0 disables
+static cvar_t	mod_pvsfull = {"mod_pvsfull", "16384", CVAR_ARCHIVE};	// decompress all of the vis when it fits in this many kilobytes
 
 static byte	*mod_novis;
 static int	mod_novis_capacity;
@@ -62,6 +65,10 @@ void Mod_Init (void)
 	Cvar_RegisterVariable (&gl_subdivide_size);
 	Cvar_RegisterVariable (&external_vis);
 	Cvar_RegisterVariable (&external_ents);
+	Cvar_RegisterVariable (&mod_pvscache);
+	Cvar_SetCallback (&mod_pvscache, Mod_PVSCache_f);
+	Cvar_RegisterVariable (&mod_pvsfull);
+	Cvar_SetCallback (&mod_pvsfull, Mod_PVSCache_f);
 
 	Cmd_AddCommand ("mcache", Mod_Print);
 
@@ -131,35 +138,24 @@ mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model)
 
 /*
 ===================
-Mod_DecompressVis
+Mod_DecompressVisRow
+
+Returns false if the row ran past the end of out
 ===================
 */
-static byte *Mod_DecompressVis (byte *in, qmodel_t *model)
+static qboolean Mod_DecompressVisRow (const byte *in, byte *out, int row)
 {
 	int		c;
-	byte	*out;
+	byte	*outstart;
 	byte	*outend;
-	int		row;
 
-	row = (model->numleafs+7)>>3;
-	if (mod_decompressed == NULL || row > mod_decompressed_capacity)
-	{
-		mod_decompressed_capacity = row;
-		mod_decompressed = (byte *) realloc (mod_decompressed, mod_decompressed_capacity);
-		if (!mod_decompressed)
-			Sys_Error ("Mod_DecompressVis: realloc() failed on %d bytes", mod_decompressed_capacity);
-	}
-	out = mod_decompressed;
-	outend = mod_decompressed + row;
+	outstart = out;
+	outend = out + row;
 
 	if (!in)
 	{	// no vis info, so make all visible
-		while (row)
-		{
-			*out++ = 0xff;
-			row--;
-		}
-		return mod_decompressed;
+		memset (out, 0xff, row);
+		return true;
 	}
 
 	do
@@ -175,29 +171,289 @@ static byte *Mod_DecompressVis (byte *in, qmodel_t *model)
 		while (c)
 		{
 			if (out == outend)
-			{
-				if(!model->viswarn) {
-					model->viswarn = true;
-					Con_Warning("Mod_DecompressVis: output overrun on model \"%s\"\n", model->name);
-				}
-				return mod_decompressed;
-			}
+				return false;
 			*out++ = 0;
 			c--;
 		}
-	} while (out - mod_decompressed < row);
+	} while (out - outstart < row);
+
+	return true;
+}
+
+static void Mod_VisOverrun (qmodel_t *model)
+{
+	if(!model->viswarn) {
+		model->viswarn = true;
+		Con_Warning("Mod_DecompressVis: output overrun on model \"%s\"\n", model->name);
+	}
+}
+
+/*
+===================
+Mod_DecompressVis
+
+Into a scratch row, for what the PVS cache doesn't hold
+===================
+*/
+static byte *Mod_DecompressVis (byte *in, qmodel_t *model)
+{
+	int		row;
+
+	row = (model->numleafs+7)>>3;
+	if (mod_decompressed == NULL || row > mod_decompressed_capacity)
+	{
+		mod_decompressed_capacity = row;
+		mod_decompressed = (byte *) realloc (mod_decompressed, mod_decompressed_capacity);
+		if (!mod_decompressed)
+			Sys_Error ("Mod_DecompressVis: realloc() failed on %d bytes", mod_decompressed_capacity);
+	}
+
+	if (!Mod_DecompressVisRow (in, mod_decompressed, row))
+		Mod_VisOverrun (model);
 
 	return mod_decompressed;
 }
 
-byte *Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model)
+/*
+===============================================================================
+
+PVS CACHE
+
+Every brush model with vis data gets its own cache of decompressed rows
+when it is loaded, so the client's and the server's world can both be
+cached while a listen server changes levels.  The rows are kept in LRU
+order within mod_pvscache kilobytes or, when every row fits in
+mod_pvsfull kilobytes, all decompressed right there on the worker
+threads, so the first frame of the map doesn't pay for it.
+
+A row from Mod_LeafPVS stays valid for at least PVS_MINROWS more lookups
+of the same model, and until the model is freed when the whole vis is
+decompressed.
+===============================================================================
+*/
+
+#define	PVS_MINROWS	16
+#define	PVS_CHUNKS	64	// tasks for a full decompression
+
+struct pvscache_s
+{
+	int		rowbytes;
+	int		numleafs;	// leafs 1 .. numleafs can have a row
+	qboolean	full;		// leaf n is in slot n, nothing is evicted
+	int		numslots;
+	byte		*rows;		// numslots * rowbytes
+	int		*leafslot;	// per leaf: slot holding its row, -1 if none
+	int		*slotleaf;	// per slot: leaf it holds, -1 if free
+	int		*prev, *next;	// LRU list of slots, most recently used first
+	int		head, tail;
+	qboolean	overrun[PVS_CHUNKS];
+};
+
+/*
+===================
+Mod_FreePVSCache
+===================
+*/
+static void Mod_FreePVSCache (qmodel_t *model)
+{
+	pvscache_t	*cache = model->pvscache;
+
+	if (!cache)
+		return;
+
+	free (cache->rows);
+	free (cache->leafslot);
+	free (cache->slotleaf);
+	free (cache->prev);
+	free (cache->next);
+	free (cache);
+	model->pvscache = NULL;
+}
+
+/*
+===================
+Mod_DecompressAllVis
+
+Task_ParallelFor callback, fills every slot of a full cache
+===================
+*/
+static void Mod_DecompressAllVis (void *data, int index)
+{
+	qmodel_t	*model = (qmodel_t *) data;
+	pvscache_t	*cache = model->pvscache;
+	int		i, first, last, chunk;
+
+	chunk = (cache->numleafs + PVS_CHUNKS - 1) / PVS_CHUNKS;
+	first = 1 + index * chunk;
+	last = q_min (first + chunk, cache->numleafs + 1);
+
+	for (i = first; i < last; i++)
+	{
+		if (!Mod_DecompressVisRow (model->leafs[i].compressed_vis, cache->rows + i*cache->rowbytes, cache->rowbytes))
+			cache->overrun[index] = true;
+	}
+}
+
+/*
+===================
+Mod_SetupPVSCache
+
+Called when a brush model is loaded, and again when the cvars change
+===================
+*/
+static void Mod_SetupPVSCache (qmodel_t *model)
 {
+	pvscache_t	*cache;
+	size_t	budget, total;
+	int		i;
+
+	Mod_FreePVSCache (model);
+
+	budget = (size_t) mod_pvscache.value * 1024;
+	if (!budget || !model->numleafs || !model->visdata)
+		return;
+
+	cache = model->pvscache = (pvscache_t *) calloc (1, sizeof(pvscache_t));
+	if (!cache)
+		Sys_Error ("Mod_SetupPVSCache: calloc() failed");
+	cache->rowbytes = (model->numleafs+7)>>3;
+	cache->numleafs = model->numleafs;
+
+	total = (size_t) (cache->numleafs + 1) * cache->rowbytes;
+	if (total <= (size_t) q_max (mod_pvsfull.value, 0) * 1024)
+	{
+		cache->full = true;
+		cache->numslots = cache->numleafs + 1;
+	}
+	else
+	{
+		cache->numslots = (int) q_min (budget / cache->rowbytes, (size_t) cache->numleafs);
+		cache->numslots = q_max (cache->numslots, PVS_MINROWS);
+	}
+
+	cache->rows = (byte *) malloc ((size_t) cache->numslots * cache->rowbytes);
+	if (!cache->rows)
+		Sys_Error ("Mod_SetupPVSCache: malloc() failed on %d rows", cache->numslots);
+
+	if (cache->full)
+	{
+		Task_ParallelFor (PVS_CHUNKS, Mod_DecompressAllVis, model);
+		for (i = 0; i < PVS_CHUNKS; i++)
+		{
+			if (cache->overrun[i])
+				Mod_VisOverrun (model);
+		}
+		Con_DPrintf ("PVS cache: all %d rows of %s, %d KB\n", cache->numleafs, model->name, (int) (total / 1024));
+		return;
+	}
+
+	cache->leafslot = (int *) malloc ((cache->numleafs + 1) * sizeof(int));
+	cache->slotleaf = (int *) malloc (cache->numslots * sizeof(int));
+	cache->prev = (int *) malloc (cache->numslots * sizeof(int));
+	cache->next = (int *) malloc (cache->numslots * sizeof(int));
+	if (!cache->leafslot || !cache->slotleaf || !cache->prev || !cache->next)
+		Sys_Error ("Mod_SetupPVSCache: malloc() failed on %d rows", cache->numslots);
+
+	for (i = 0; i <= cache->numleafs; i++)
+		cache->leafslot[i] = -1;
+	for (i = 0; i < cache->numslots; i++)
+	{
+		cache->slotleaf[i] = -1;
+		cache->prev[i] = i - 1;
+		cache->next[i] = (i + 1 < cache->numslots) ? i + 1 : -1;
+	}
+	cache->head = 0;
+	cache->tail = cache->numslots - 1;
+
+	Con_DPrintf ("PVS cache: %d of %d rows of %s\n", cache->numslots, cache->numleafs, model->name);
+}
+
+/*
+===================
+Mod_PVSCache_f
+
+Sets the caches of the loaded brush models up again with the new sizes
+===================
+*/
+static void Mod_PVSCache_f (cvar_t *var)
+{
+	int		i;
+	qmodel_t	*mod;
+
+	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
+	{
+		if (mod->type == mod_brush && !mod->needload && mod->name[0] != '*')
+			Mod_SetupPVSCache (mod);
+	}
+}
+
+/*
+===================
+Mod_CachedPVS
+
+Returns the row of leaf number leafnum, decompressing it into the least
+recently used slot if it isn't there yet
+===================
+*/
+static const byte *Mod_CachedPVS (int leafnum, qmodel_t *model)
+{
+	pvscache_t	*cache = model->pvscache;
+	int		slot;
+
+	if (cache->full)
+		return cache->rows + leafnum*cache->rowbytes;
+
+	slot = cache->leafslot[leafnum];
+	if (slot < 0)
+	{	// take the oldest slot
+		slot = cache->tail;
+		if (cache->slotleaf[slot] >= 0)
+			cache->leafslot[cache->slotleaf[slot]] = -1;
+		cache->slotleaf[slot] = leafnum;
+		cache->leafslot[leafnum] = slot;
+
+		if (!Mod_DecompressVisRow (model->leafs[leafnum].compressed_vis, cache->rows + slot*cache->rowbytes, cache->rowbytes))
+			Mod_VisOverrun (model);
+	}
+
+	// move it to the front
+	if (slot != cache->head)
+	{
+		cache->next[cache->prev[slot]] = cache->next[slot];
+		if (cache->next[slot] >= 0)
+			cache->prev[cache->next[slot]] = cache->prev[slot];
+		else
+			cache->tail = cache->prev[slot];
+
+		cache->prev[slot] = -1;
+		cache->next[slot] = cache->head;
+		cache->prev[cache->head] = slot;
+		cache->head = slot;
+	}
+
+	return cache->rows + slot*cache->rowbytes;
+}
+
+/*
+===================
+Mod_LeafPVS
+===================
+*/
+const byte *Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model)
+{
+	int		leafnum;
+
 	if (leaf == model->leafs)
 		return Mod_NoVisPVS (model);
+
+	leafnum = leaf - model->leafs;
+	if (model->pvscache && leafnum > 0 && leafnum <= model->pvscache->numleafs)
+		return Mod_CachedPVS (leafnum, model);
+
 	return Mod_DecompressVis (leaf->compressed_vis, model);
 }
 
-byte *Mod_NoVisPVS (qmodel_t *model)
+const byte *Mod_NoVisPVS (qmodel_t *model)
 {
 	int pvsbytes;
  
@@ -228,6 +484,7 @@ void Mod_ClearAll (void)
 	{
 		if (mod->type != mod_alias)
 		{
+			Mod_FreePVSCache (mod);
 			mod->needload = true;
 			TexMgr_FreeTexturesForOwner (mod); //johnfitz
 		}
@@ -244,6 +501,7 @@ void Mod_ResetAll (void)
 
 	for (i=0 , mod=mod_known ; i<mod_numknown ; i++, mod++)
 	{
+		Mod_FreePVSCache (mod);
 		if (!mod->needload) //otherwise Mod_ClearAll() did it already
 			TexMgr_FreeTexturesForOwner (mod);
 		memset(mod, 0, sizeof(qmodel_t));
@@ -286,6 +544,18 @@ static qmodel_t *Mod_FindName (const char *name)
 	return mod;
 }
 
+/*
+==================
+Mod_Index
+
+Small, stable number for a model, for building sort keys
+==================
+*/
+int Mod_Index (qmodel_t *mod)
+{
+	return mod - mod_known;
+}
+
 /*
 ==================
 Mod_TouchModel
@@ -305,6 +575,27 @@ void Mod_TouchModel (const char *name)
 	}
 }
 
+/*
+==================
+Mod_Prefetch
+
+Starts reading a model in the background if it isn't loaded already.
+==================
+*/
+void Mod_Prefetch (const char *name)
+{
+	qmodel_t	*mod;
+
+	if (name[0] == '*')
+		return;		// inline brush model
+
+	mod = Mod_FindName (name);
+	if (!mod->needload && (mod->type != mod_alias || Cache_Peek (&mod->cache)))
+		return;
+
+	COM_PrefetchFile (name);
+}
+
 /*
 ==================
 Mod_LoadModel
@@ -314,8 +605,8 @@ Loads a model into the cache
 */
 static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 {
+	static filemap_t	map;	// static so that an aborted load can be cleaned up
 	byte	*buf;
-	byte	stackbuf[1024];		// avoid dirtying the cache heap
 	int	mod_type;
 
 	if (!mod->needload)
@@ -338,9 +629,11 @@ static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 	}
 
 //
-// load the file
+// map the file, the loaders copy what they need into the hunk
 //
-	buf = COM_LoadStackFile (mod->name, stackbuf, sizeof(stackbuf), & mod->path_id);
+	if (map.data)	// a previous load was aborted by Host_Error
+		COM_UnmapFile (&map);
+	buf = COM_MapFile (mod->name, &map, & mod->path_id);
 	if (!buf)
 	{
 		if (crash)
@@ -374,10 +667,13 @@ static qmodel_t *Mod_LoadModel (qmodel_t *mod, qboolean crash)
 		break;
 
 	default:
+		mod->filehash = Hash_Block64 (buf, map.size, 0);	// before the loader byte swaps it
 		Mod_LoadBrushModel (mod, buf);
 		break;
 	}
 
+	COM_UnmapFile (&map);
+
 	return mod;
 }
 
@@ -408,6 +704,162 @@ qmodel_t *Mod_ForName (const char *name, qboolean crash)
 
 static byte	*mod_base;
 
+/*
+===============================================================================
+
+LUMP CONVERSION
+
+Every lump is allocated and validated here on the main thread, in file
+order, and then handed to the worker pool to be byte swapped into its
+in-memory form.  The conversions only follow pointers the main thread
+has already set up, so most of them can run at once; the faces read the
+vertexes, edges, surfedges and texinfo, so they are started last.
+
+A converter must not call Con_Printf, Host_Error or Sys_Error; it
+counts the bad entries of its chunk instead, and the lump's report
+function complains about them once everything has been waited for.
+===============================================================================
+*/
+
+#define	MAX_LOADLUMPS	16
+#define	LUMP_MAXCHUNKS	32	// tasks per lump
+#define	LUMP_MINCHUNK	4096	// elements, smaller pieces aren't worth a task
+
+typedef struct loadlump_s
+{
+	// returns how many bad entries in [first, last), and the value of one of them
+	int		(*convert) (struct loadlump_s *lump, int first, int last, int *badvalue);
+	void		(*report) (struct loadlump_s *lump, int numbad, int badvalue);
+	const void	*in;
+	void		*out;
+	int		count;
+	int		chunksize;
+	int		numbad[LUMP_MAXCHUNKS];
+	int		badvalue[LUMP_MAXCHUNKS];
+} loadlump_t;
+
+static loadlump_t	mod_lumps[MAX_LOADLUMPS];
+static int		mod_numlumps;
+static taskgroup_t	mod_geomgroup;	// vertexes, edges and surfedges, which the faces need
+static taskgroup_t	mod_lumpgroup;	// everything else
+
+/*
+=================
+Mod_AddLump
+
+Describes a lump conversion, which doesn't start until Mod_StartLump
+=================
+*/
+static loadlump_t *Mod_AddLump (int (*convert) (loadlump_t *, int, int, int *), const void *in, void *out, int count)
+{
+	loadlump_t	*lump;
+
+	if (mod_numlumps == MAX_LOADLUMPS)
+		Sys_Error ("Mod_AddLump: MAX_LOADLUMPS");
+	lump = &mod_lumps[mod_numlumps++];
+
+	memset (lump, 0, sizeof(*lump));
+	lump->convert = convert;
+	lump->in = in;
+	lump->out = out;
+	lump->count = count;
+	lump->chunksize = q_max (LUMP_MINCHUNK, (count + LUMP_MAXCHUNKS - 1) / LUMP_MAXCHUNKS);
+
+	return lump;
+}
+
+/*
+=================
+Mod_ConvertLumpChunk
+=================
+*/
+static void Mod_ConvertLumpChunk (void *data, int index)
+{
+	loadlump_t	*lump = (loadlump_t *) data;
+	int		first, last;
+
+	first = index * lump->chunksize;
+	last = q_min (first + lump->chunksize, lump->count);
+	lump->numbad[index] = lump->convert (lump, first, last, &lump->badvalue[index]);
+}
+
+/*
+=================
+Mod_StartLump
+=================
+*/
+static void Mod_StartLump (taskgroup_t *group, loadlump_t *lump)
+{
+	int	i, numchunks;
+
+	numchunks = (lump->count + lump->chunksize - 1) / lump->chunksize;
+	for (i = 0; i < numchunks; i++)
+		Task_Submit (group, Mod_ConvertLumpChunk, lump, i);
+}
+
+/*
+=================
+Mod_QueueLump
+=================
+*/
+static loadlump_t *Mod_QueueLump (taskgroup_t *group, int (*convert) (loadlump_t *, int, int, int *), const void *in, void *out, int count)
+{
+	loadlump_t	*lump;
+
+	lump = Mod_AddLump (convert, in, out, count);
+	Mod_StartLump (group, lump);
+
+	return lump;
+}
+
+/*
+=================
+Mod_WaitLumps
+
+Must be called before a Host_Error while loading a brush model, so that
+nothing is still writing into the hunk when it is reused.
+=================
+*/
+static void Mod_WaitLumps (void)
+{
+	Task_Wait (&mod_geomgroup);
+	Task_Wait (&mod_lumpgroup);
+}
+
+/*
+=================
+Mod_FinishLumps
+
+Waits for all the conversions and reports what they found wrong
+=================
+*/
+static void Mod_FinishLumps (void)
+{
+	loadlump_t	*lump;
+	int		i, j, numbad, badvalue;
+
+	Mod_WaitLumps ();
+
+	for (i = 0, lump = mod_lumps; i < mod_numlumps; i++, lump++)
+	{
+		if (!lump->report)
+			continue;
+		numbad = badvalue = 0;
+		for (j = 0; j < LUMP_MAXCHUNKS; j++)
+		{
+			if (lump->numbad[j])
+			{
+				numbad += lump->numbad[j];
+				badvalue = lump->badvalue[j];
+			}
+		}
+		if (numbad)
+			lump->report (lump, numbad, badvalue);
+	}
+
+	mod_numlumps = 0;
+}
+
 /*
 =================
 Mod_CheckFullbrights -- johnfitz
@@ -760,6 +1212,51 @@ static void Mod_LoadTextures (lump_t *l)
 	}
 }
 
+/*
+=================
+Mod_ConvertLighting
+=================
+*/
+static int Mod_ConvertLighting (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const byte	*in = (const byte *) lump->in + first;
+	byte		*out = (byte *) lump->out + first*3;
+	byte		d;
+	int		i;
+
+	for (i = first; i < last; i++)
+	{
+		d = *in++;
+		*out++ = d;
+		*out++ = d;
+		*out++ = d;
+	}
+
+	return 0;
+}
+
+static int Mod_ConvertLighting_Q64 (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const byte	*in = (const byte *) lump->in + first*2;
+	byte		*out = (byte *) lump->out + first*3;
+	byte		q64_b0, q64_b1;
+	int		i;
+
+	// RGB lightmap samples are packed in 16bits.
+	// RRRRR GGGGG BBBBBB
+	for (i = first; i < last; i++)
+	{
+		q64_b0 = *in++;
+		q64_b1 = *in++;
+
+		*out++ = q64_b0 & 0xf8;/* 0b11111000 */
+		*out++ = ((q64_b0 & 0x07) << 5) + ((q64_b1 & 0xc0) >> 5);/* 0b00000111, 0b11000000 */
+		*out++ = (q64_b1 & 0x3f) << 2;/* 0b00111111 */
+	}
+
+	return 0;
+}
+
 /*
 =================
 Mod_LoadLighting -- johnfitz -- replaced with lit support code via lordhavoc
@@ -768,8 +1265,7 @@ Mod_LoadLighting -- johnfitz -- replaced with lit support code via lordhavoc
 static void Mod_LoadLighting (lump_t *l)
 {
 	int i, mark;
-	byte *in, *out, *data;
-	byte d, q64_b0, q64_b1;
+	byte *data;
 	char litfilename[MAX_OSPATH];
 	unsigned int path_id;
 
@@ -823,39 +1319,29 @@ static void Mod_LoadLighting (lump_t *l)
 	// Quake64 bsp lighmap data
 	if (loadmodel->bspversion == BSPVERSION_QUAKE64)
 	{
-		// RGB lightmap samples are packed in 16bits.
-		// RRRRR GGGGG BBBBBB
-
 		loadmodel->lightdata = (byte *) Hunk_AllocName ( (l->filelen / 2)*3, litfilename);
-		in = mod_base + l->fileofs;
-		out = loadmodel->lightdata;
-
-		for (i = 0;i < (l->filelen / 2) ;i++)
-		{
-			q64_b0 = *in++;
-			q64_b1 = *in++;
-
-			*out++ = q64_b0 & 0xf8;/* 0b11111000 */
-			*out++ = ((q64_b0 & 0x07) << 5) + ((q64_b1 & 0xc0) >> 5);/* 0b00000111, 0b11000000 */
-			*out++ = (q64_b1 & 0x3f) << 2;/* 0b00111111 */
-		}
+		Mod_QueueLump (&mod_lumpgroup, Mod_ConvertLighting_Q64, mod_base + l->fileofs, loadmodel->lightdata, l->filelen / 2);
 		return;
 	}
 
 	loadmodel->lightdata = (byte *) Hunk_AllocName ( l->filelen*3, litfilename);
-	in = loadmodel->lightdata + l->filelen*2; // place the file at the end, so it will not be overwritten until the very last write
-	out = loadmodel->lightdata;
-	memcpy (in, mod_base + l->fileofs, l->filelen);
-	for (i = 0;i < l->filelen;i++)
-	{
-		d = *in++;
-		*out++ = d;
-		*out++ = d;
-		*out++ = d;
-	}
+	Mod_QueueLump (&mod_lumpgroup, Mod_ConvertLighting, mod_base + l->fileofs, loadmodel->lightdata, l->filelen);
 }
 
 
+/*
+=================
+Mod_CopyLump
+
+For lumps that are used as they are in the file
+=================
+*/
+static int Mod_CopyLump (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	memcpy ((byte *) lump->out + first, (const byte *) lump->in + first, last - first);
+	return 0;
+}
+
 /*
 =================
 Mod_LoadVisibility
@@ -870,7 +1356,7 @@ static void Mod_LoadVisibility (lump_t *l)
 		return;
 	}
 	loadmodel->visdata = (byte *) Hunk_AllocName ( l->filelen, loadname);
-	memcpy (loadmodel->visdata, mod_base + l->fileofs, l->filelen);
+	Mod_QueueLump (&mod_lumpgroup, Mod_CopyLump, mod_base + l->fileofs, loadmodel->visdata, l->filelen);
 }
 
 
@@ -943,11 +1429,27 @@ _load_embedded:
 Mod_LoadVertexes
 =================
 */
+static int Mod_ConvertVertexes (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dvertex_t	*in = (const dvertex_t *) lump->in + first;
+	mvertex_t	*out = (mvertex_t *) lump->out + first;
+	int		i;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		out->position[0] = LittleFloat (in->point[0]);
+		out->position[1] = LittleFloat (in->point[1]);
+		out->position[2] = LittleFloat (in->point[2]);
+	}
+
+	return 0;
+}
+
 static void Mod_LoadVertexes (lump_t *l)
 {
 	dvertex_t	*in;
 	mvertex_t	*out;
-	int			i, count;
+	int			count;
 
 	in = (dvertex_t *)(mod_base + l->fileofs);
 	if (l->filelen % sizeof(*in))
@@ -958,12 +1460,7 @@ static void Mod_LoadVertexes (lump_t *l)
 	loadmodel->vertexes = out;
 	loadmodel->numvertexes = count;
 
-	for (i=0 ; i<count ; i++, in++, out++)
-	{
-		out->position[0] = LittleFloat (in->point[0]);
-		out->position[1] = LittleFloat (in->point[1]);
-		out->position[2] = LittleFloat (in->point[2]);
-	}
+	Mod_QueueLump (&mod_geomgroup, Mod_ConvertVertexes, in, out, count);
 }
 
 /*
@@ -971,10 +1468,40 @@ static void Mod_LoadVertexes (lump_t *l)
 Mod_LoadEdges
 =================
 */
+static int Mod_ConvertEdges_S (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dsedge_t	*in = (const dsedge_t *) lump->in + first;
+	medge_t		*out = (medge_t *) lump->out + first;
+	int		i;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		out->v[0] = (unsigned short)LittleShort(in->v[0]);
+		out->v[1] = (unsigned short)LittleShort(in->v[1]);
+	}
+
+	return 0;
+}
+
+static int Mod_ConvertEdges_L (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dledge_t	*in = (const dledge_t *) lump->in + first;
+	medge_t		*out = (medge_t *) lump->out + first;
+	int		i;
+
+	for (i=first ; i<last ; i++, in++, out++)
+	{
+		out->v[0] = LittleLong(in->v[0]);
+		out->v[1] = LittleLong(in->v[1]);
+	}
+
+	return 0;
+}
+
 static void Mod_LoadEdges (lump_t *l, int bsp2)
 {
 	medge_t *out;
-	int 	i, count;
+	int 	count;
 
 	if (bsp2)
 	{
@@ -986,14 +1513,7 @@ static void Mod_LoadEdges (lump_t *l, int bsp2)
 		count = l->filelen / sizeof(*in);
 		out = (medge_t *) Hunk_AllocName ( (count + 1) * sizeof(*out), loadname);
 
-		loadmodel->edges = out;
-		loadmodel->numedges = count;
-
-		for (i=0 ; i<count ; i++, in++, out++)
-		{
-			out->v[0] = LittleLong(in->v[0]);
-			out->v[1] = LittleLong(in->v[1]);
-		}
+		Mod_QueueLump (&mod_geomgroup, Mod_ConvertEdges_L, in, out, count);
 	}
 	else
 	{
@@ -1005,15 +1525,11 @@ static void Mod_LoadEdges (lump_t *l, int bsp2)
 		count = l->filelen / sizeof(*in);
 		out = (medge_t *) Hunk_AllocName ( (count + 1) * sizeof(*out), loadname);
 
-		loadmodel->edges = out;
-		loadmodel->numedges = count;
-
-		for (i=0 ; i<count ; i++, in++, out++)
-		{
-			out->v[0] = (unsigned short)LittleShort(in->v[0]);
-			out->v[1] = (unsigned short)LittleShort(in->v[1]);
-		}
+		Mod_QueueLump (&mod_geomgroup, Mod_ConvertEdges_S, in, out, count);
 	}
+
+	loadmodel->edges = out;
+	loadmodel->numedges = count;
 }
 
 /*
@@ -1076,6 +1592,7 @@ static void Mod_LoadTexinfo (lump_t *l)
 CalcSurfaceExtents
 
 Fills in s->texturemins[] and s->extents[]
+Runs on the worker threads, Mod_FinishFaces checks the result
 ================
 */
 static void CalcSurfaceExtents (msurface_t *s)
@@ -1135,9 +1652,6 @@ static void CalcSurfaceExtents (msurface_t *s)
 
 		s->texturemins[i] = bmins[i] * 16;
 		s->extents[i] = (bmaxs[i] - bmins[i]) * 16;
-
-		if ( !(tex->flags & TEX_SPECIAL) && s->extents[i] > 2000) //johnfitz -- was 512 in glquake, 256 in winquake
-			Sys_Error ("Bad surface extents");
 	}
 }
 
@@ -1220,31 +1734,134 @@ static void Mod_CalcSurfaceBounds (msurface_t *s)
 Mod_LoadFaces
 =================
 */
-static void Mod_LoadFaces (lump_t *l, qboolean bsp2)
+static void Mod_ConvertFace (msurface_t *out, int planenum, int side, int texinfon, int lofs)
+{
+	out->flags = 0;
+
+	if (side)
+		out->flags |= SURF_PLANEBACK;
+
+	out->plane = loadmodel->planes + planenum;
+
+	out->texinfo = loadmodel->texinfo + texinfon;
+
+	CalcSurfaceExtents (out);
+
+	Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+
+// lighting info
+	if (loadmodel->bspversion == BSPVERSION_QUAKE64)
+		lofs /= 2; // Q64 samples are 16bits instead 8 in normal Quake 
+
+	if (lofs == -1)
+		out->samples = NULL;
+	else
+		out->samples = loadmodel->lightdata + (lofs * 3); //johnfitz -- lit support via lordhavoc (was "+ i")
+
+	//johnfitz -- this section rewritten
+	if (!q_strncasecmp(out->texinfo->texture->name,"sky",3)) // sky surface //also note -- was Q_strncmp, changed to match qbsp
+	{
+		out->flags |= (SURF_DRAWSKY | SURF_DRAWTILED);
+	}
+	else if (out->texinfo->texture->name[0] == '*') // warp surface
+	{
+		out->flags |= SURF_DRAWTURB;
+		if (out->texinfo->flags & TEX_SPECIAL)
+			out->flags |= SURF_DRAWTILED;
+
+	// detect special liquid types
+		if (!strncmp (out->texinfo->texture->name, "*lava", 5))
+			out->flags |= SURF_DRAWLAVA;
+		else if (!strncmp (out->texinfo->texture->name, "*slime", 6))
+			out->flags |= SURF_DRAWSLIME;
+		else if (!strncmp (out->texinfo->texture->name, "*tele", 5))
+			out->flags |= SURF_DRAWTELE;
+		else out->flags |= SURF_DRAWWATER;
+	}
+	else if (out->texinfo->texture->name[0] == '{') // ericw -- fence textures
+	{
+		out->flags |= SURF_DRAWFENCE;
+	}
+	else if (out->texinfo->flags & TEX_MISSING) // texture is missing from bsp
+	{
+		if (out->samples) //lightmapped
+			out->flags |= SURF_NOTEXTURE;
+		else // not lightmapped
+			out->flags |= (SURF_NOTEXTURE | SURF_DRAWTILED);
+	}
+	//johnfitz
+}
+
+static int Mod_ConvertFaces_S (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dsface_t	*in = (const dsface_t *) lump->in + first;
+	msurface_t	*out = (msurface_t *) lump->out + first;
+	int		i, surfnum;
+
+	for (surfnum=first ; surfnum<last ; surfnum++, in++, out++)
+	{
+		out->firstedge = LittleLong(in->firstedge);
+		out->numedges = LittleShort(in->numedges);
+		for (i=0 ; i<MAXLIGHTMAPS ; i++)
+			out->styles[i] = in->styles[i];
+
+		Mod_ConvertFace (out, LittleShort(in->planenum), LittleShort(in->side), LittleShort(in->texinfo), LittleLong(in->lightofs));
+	}
+
+	return 0;
+}
+
+static int Mod_ConvertFaces_L (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dlface_t	*in = (const dlface_t *) lump->in + first;
+	msurface_t	*out = (msurface_t *) lump->out + first;
+	int		i, surfnum;
+
+	for (surfnum=first ; surfnum<last ; surfnum++, in++, out++)
+	{
+		out->firstedge = LittleLong(in->firstedge);
+		out->numedges = LittleLong(in->numedges);
+		for (i=0 ; i<MAXLIGHTMAPS ; i++)
+			out->styles[i] = in->styles[i];
+
+		Mod_ConvertFace (out, LittleLong(in->planenum), LittleLong(in->side), LittleLong(in->texinfo), LittleLong(in->lightofs));
+	}
+
+	return 0;
+}
+
+/*
+=================
+Mod_LoadFaces
+
+Only allocates the surfaces: they are converted once the textures are in,
+see Mod_LoadBrushModel
+=================
+*/
+static loadlump_t *Mod_LoadFaces (lump_t *l, qboolean bsp2)
 {
-	dsface_t	*ins;
-	dlface_t	*inl;
 	msurface_t 	*out;
-	int			i, count, surfnum, lofs;
-	int			planenum, side, texinfon;
+	int			count;
+	loadlump_t	*lump;
 
 	if (bsp2)
 	{
-		ins = NULL;
-		inl = (dlface_t *)(mod_base + l->fileofs);
-		if (l->filelen % sizeof(*inl))
+		dlface_t *in = (dlface_t *)(mod_base + l->fileofs);
+		if (l->filelen % sizeof(*in))
 			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-		count = l->filelen / sizeof(*inl);
+		count = l->filelen / sizeof(*in);
+		out = (msurface_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
+		lump = Mod_AddLump (Mod_ConvertFaces_L, in, out, count);
 	}
 	else
 	{
-		ins = (dsface_t *)(mod_base + l->fileofs);
-		inl = NULL;
-		if (l->filelen % sizeof(*ins))
+		dsface_t *in = (dsface_t *)(mod_base + l->fileofs);
+		if (l->filelen % sizeof(*in))
 			Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-		count = l->filelen / sizeof(*ins);
+		count = l->filelen / sizeof(*in);
+		out = (msurface_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
+		lump = Mod_AddLump (Mod_ConvertFaces_S, in, out, count);
 	}
-	out = (msurface_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
 
 	//johnfitz -- warn mappers about exceeding old limits
 	if (count > 32767 && !bsp2)
@@ -1254,108 +1871,45 @@ static void Mod_LoadFaces (lump_t *l, qboolean bsp2)
 	loadmodel->surfaces = out;
 	loadmodel->numsurfaces = count;
 
-	for (surfnum=0 ; surfnum<count ; surfnum++, out++)
-	{
-		if (bsp2)
-		{
-			out->firstedge = LittleLong(inl->firstedge);
-			out->numedges = LittleLong(inl->numedges);
-			planenum = LittleLong(inl->planenum);
-			side = LittleLong(inl->side);
-			texinfon = LittleLong (inl->texinfo);
-			for (i=0 ; i<MAXLIGHTMAPS ; i++)
-				out->styles[i] = inl->styles[i];
-			lofs = LittleLong(inl->lightofs);
-			inl++;
-		}
-		else
-		{
-			out->firstedge = LittleLong(ins->firstedge);
-			out->numedges = LittleShort(ins->numedges);
-			planenum = LittleShort(ins->planenum);
-			side = LittleShort(ins->side);
-			texinfon = LittleShort (ins->texinfo);
-			for (i=0 ; i<MAXLIGHTMAPS ; i++)
-				out->styles[i] = ins->styles[i];
-			lofs = LittleLong(ins->lightofs);
-			ins++;
-		}
-
-		out->flags = 0;
-		if (out->numedges < 3)
-			Con_Warning("surfnum %d: bad numedges %d\n", surfnum, out->numedges);
-
-		if (side)
-			out->flags |= SURF_PLANEBACK;
-
-		out->plane = loadmodel->planes + planenum;
-
-		out->texinfo = loadmodel->texinfo + texinfon;
-
-		CalcSurfaceExtents (out);
+	return lump;
+}
 
-		Mod_CalcSurfaceBounds (out); //johnfitz -- for per-surface frustum culling
+/*
+=================
+Mod_FinishFaces
 
-	// lighting info
-		if (loadmodel->bspversion == BSPVERSION_QUAKE64)
-			lofs /= 2; // Q64 samples are 16bits instead 8 in normal Quake 
+The parts of face loading that have to run on the main thread, after the
+conversion is done
+=================
+*/
+static void Mod_FinishFaces (void)
+{
+	msurface_t	*s;
+	int		i, surfnum;
 
-		if (lofs == -1)
-			out->samples = NULL;
-		else
-			out->samples = loadmodel->lightdata + (lofs * 3); //johnfitz -- lit support via lordhavoc (was "+ i")
+	for (surfnum=0, s=loadmodel->surfaces ; surfnum<loadmodel->numsurfaces ; surfnum++, s++)
+	{
+		if (s->numedges < 3)
+			Con_Warning("surfnum %d: bad numedges %d\n", surfnum, s->numedges);
 
-		//johnfitz -- this section rewritten
-		if (!q_strncasecmp(out->texinfo->texture->name,"sky",3)) // sky surface //also note -- was Q_strncmp, changed to match qbsp
+		for (i=0 ; i<2 ; i++)
 		{
-			out->flags |= (SURF_DRAWSKY | SURF_DRAWTILED);
-			Mod_PolyForUnlitSurface (out); //no more subdivision
+			if ( !(s->texinfo->flags & TEX_SPECIAL) && s->extents[i] > 2000) //johnfitz -- was 512 in glquake, 256 in winquake
+				Sys_Error ("Bad surface extents");
 		}
-		else if (out->texinfo->texture->name[0] == '*') // warp surface
-		{
-			out->flags |= SURF_DRAWTURB;
-			if (out->texinfo->flags & TEX_SPECIAL)
-				out->flags |= SURF_DRAWTILED;
-			else if (out->samples && !loadmodel->haslitwater)
-			{
-				Con_DPrintf ("Map has lit water\n");
-				loadmodel->haslitwater = true;
-			}
 
-		// detect special liquid types
-			if (!strncmp (out->texinfo->texture->name, "*lava", 5))
-				out->flags |= SURF_DRAWLAVA;
-			else if (!strncmp (out->texinfo->texture->name, "*slime", 6))
-				out->flags |= SURF_DRAWSLIME;
-			else if (!strncmp (out->texinfo->texture->name, "*tele", 5))
-				out->flags |= SURF_DRAWTELE;
-			else out->flags |= SURF_DRAWWATER;
-
-			// polys are only created for unlit water here.
-			// lit water is handled in BuildSurfaceDisplayList
-			if (out->flags & SURF_DRAWTILED)
-			{
-				Mod_PolyForUnlitSurface (out);
-				GL_SubdivideSurface (out);
-			}
-		}
-		else if (out->texinfo->texture->name[0] == '{') // ericw -- fence textures
-		{
-			out->flags |= SURF_DRAWFENCE;
-		}
-		else if (out->texinfo->flags & TEX_MISSING) // texture is missing from bsp
+		if ((s->flags & SURF_DRAWTURB) && !(s->flags & SURF_DRAWTILED) && s->samples && !loadmodel->haslitwater)
 		{
-			if (out->samples) //lightmapped
-			{
-				out->flags |= SURF_NOTEXTURE;
-			}
-			else // not lightmapped
-			{
-				out->flags |= (SURF_NOTEXTURE | SURF_DRAWTILED);
-				Mod_PolyForUnlitSurface (out);
-			}
+			Con_DPrintf ("Map has lit water\n");
+			loadmodel->haslitwater = true;
 		}
-		//johnfitz
+
+		// polys are only created for sky, unlit water and missing
+		// unlit textures here. lit water is handled in
+		// BuildSurfaceDisplayList. the r_oldwater subdivisions are
+		// made by GL_BuildLightmaps
+		if (s->flags & SURF_DRAWTILED)
+			Mod_PolyForUnlitSurface (s); //no more subdivision
 	}
 }
 
@@ -1379,27 +1933,16 @@ static void Mod_SetParent (mnode_t *node, mnode_t *parent)
 Mod_LoadNodes
 =================
 */
-static void Mod_LoadNodes_S (lump_t *l)
+static int Mod_ConvertNodes_S (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	int			i, j, count, p;
-	dsnode_t	*in;
-	mnode_t		*out;
+	const dsnode_t	*in = (const dsnode_t *) lump->in + first;
+	mnode_t		*out = (mnode_t *) lump->out + first;
+	int		i, j, p, count, numbad;
 
-	in = (dsnode_t *)(mod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
-		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-	count = l->filelen / sizeof(*in);
-	out = (mnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
+	count = lump->count;
+	numbad = 0;
 
-	//johnfitz -- warn mappers about exceeding old limits
-	if (count > 32767)
-		Con_DWarning ("%i nodes exceeds standard limit of 32767.\n", count);
-	//johnfitz
-
-	loadmodel->nodes = out;
-	loadmodel->numnodes = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1426,32 +1969,28 @@ static void Mod_LoadNodes_S (lump_t *l)
 					out->children[j] = (mnode_t *)(loadmodel->leafs + p);
 				else
 				{
-					Con_Printf("Mod_LoadNodes: invalid leaf index %i (file has only %i leafs)\n", p, loadmodel->numleafs);
+					*badvalue = p;
+					numbad++;
 					out->children[j] = (mnode_t *)(loadmodel->leafs); //map it to the solid leaf
 				}
 			}
 			//johnfitz
 		}
 	}
+
+	return numbad;
 }
 
-static void Mod_LoadNodes_L1 (lump_t *l)
+static int Mod_ConvertNodes_L1 (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	int			i, j, count, p;
-	dl1node_t	*in;
-	mnode_t		*out;
+	const dl1node_t	*in = (const dl1node_t *) lump->in + first;
+	mnode_t		*out = (mnode_t *) lump->out + first;
+	int		i, j, p, count, numbad;
 
-	in = (dl1node_t *)(mod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
-		Sys_Error ("Mod_LoadNodes: funny lump size in %s",loadmodel->name);
+	count = lump->count;
+	numbad = 0;
 
-	count = l->filelen / sizeof(*in);
-	out = (mnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
-
-	loadmodel->nodes = out;
-	loadmodel->numnodes = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1478,32 +2017,28 @@ static void Mod_LoadNodes_L1 (lump_t *l)
 					out->children[j] = (mnode_t *)(loadmodel->leafs + p);
 				else
 				{
-					Con_Printf("Mod_LoadNodes: invalid leaf index %i (file has only %i leafs)\n", p, loadmodel->numleafs);
+					*badvalue = p;
+					numbad++;
 					out->children[j] = (mnode_t *)(loadmodel->leafs); //map it to the solid leaf
 				}
 			}
 			//johnfitz
 		}
 	}
+
+	return numbad;
 }
 
-static void Mod_LoadNodes_L2 (lump_t *l)
+static int Mod_ConvertNodes_L2 (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	int			i, j, count, p;
-	dl2node_t	*in;
-	mnode_t		*out;
+	const dl2node_t	*in = (const dl2node_t *) lump->in + first;
+	mnode_t		*out = (mnode_t *) lump->out + first;
+	int		i, j, p, count, numbad;
 
-	in = (dl2node_t *)(mod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
-		Sys_Error ("Mod_LoadNodes: funny lump size in %s",loadmodel->name);
+	count = lump->count;
+	numbad = 0;
 
-	count = l->filelen / sizeof(*in);
-	out = (mnode_t *)Hunk_AllocName ( count*sizeof(*out), loadname);
-
-	loadmodel->nodes = out;
-	loadmodel->numnodes = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1530,46 +2065,73 @@ static void Mod_LoadNodes_L2 (lump_t *l)
 					out->children[j] = (mnode_t *)(loadmodel->leafs + p);
 				else
 				{
-					Con_Printf("Mod_LoadNodes: invalid leaf index %i (file has only %i leafs)\n", p, loadmodel->numleafs);
+					*badvalue = p;
+					numbad++;
 					out->children[j] = (mnode_t *)(loadmodel->leafs); //map it to the solid leaf
 				}
 			}
 			//johnfitz
 		}
 	}
+
+	return numbad;
+}
+
+static void Mod_ReportNodes (loadlump_t *lump, int numbad, int badvalue)
+{
+	Con_Printf("Mod_LoadNodes: invalid leaf index %i (file has only %i leafs)\n", badvalue, loadmodel->numleafs);
+	if (numbad > 1)
+		Con_Printf("Mod_LoadNodes: %i invalid leaf indexes in total\n", numbad);
 }
 
 static void Mod_LoadNodes (lump_t *l, int bsp2)
 {
+	int			count, size;
+	mnode_t		*out;
+	loadlump_t	*lump;
+	int		(*convert) (loadlump_t *, int, int, int *);
+
 	if (bsp2 == 2)
-		Mod_LoadNodes_L2(l);
+	{
+		size = sizeof(dl2node_t);
+		convert = Mod_ConvertNodes_L2;
+	}
 	else if (bsp2)
-		Mod_LoadNodes_L1(l);
+	{
+		size = sizeof(dl1node_t);
+		convert = Mod_ConvertNodes_L1;
+	}
 	else
-		Mod_LoadNodes_S(l);
+	{
+		size = sizeof(dsnode_t);
+		convert = Mod_ConvertNodes_S;
+	}
 
-	Mod_SetParent (loadmodel->nodes, NULL);	// sets nodes and leafs
-}
+	if (l->filelen % size)
+		Sys_Error ("Mod_LoadNodes: funny lump size in %s",loadmodel->name);
+	count = l->filelen / size;
+	out = (mnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
 
-static void Mod_ProcessLeafs_S (dsleaf_t *in, int filelen)
-{
-	mleaf_t		*out;
-	int			i, j, count, p;
+	//johnfitz -- warn mappers about exceeding old limits
+	if (count > 32767 && !bsp2)
+		Con_DWarning ("%i nodes exceeds standard limit of 32767.\n", count);
+	//johnfitz
 
-	if (filelen % sizeof(*in))
-		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
-	count = filelen / sizeof(*in);
-	out = (mleaf_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
+	loadmodel->nodes = out;
+	loadmodel->numnodes = count;
 
-	//johnfitz
-	if (count > 32767)
-		Host_Error ("Mod_LoadLeafs: %i leafs exceeds limit of 32767.", count);
-	//johnfitz
+	// Mod_SetParent runs in Mod_LoadBrushModel, once the leafs are in too
+	lump = Mod_QueueLump (&mod_lumpgroup, convert, mod_base + l->fileofs, out, count);
+	lump->report = Mod_ReportNodes;
+}
 
-	loadmodel->leafs = out;
-	loadmodel->numleafs = count;
+static int Mod_ConvertLeafs_S (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dsleaf_t	*in = (const dsleaf_t *) lump->in + first;
+	mleaf_t		*out = (mleaf_t *) lump->out + first;
+	int		i, j, p;
 
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1595,24 +2157,17 @@ static void Mod_ProcessLeafs_S (dsleaf_t *in, int filelen)
 
 		//johnfitz -- removed code to mark surfaces as SURF_UNDERWATER
 	}
+
+	return 0;
 }
 
-static void Mod_ProcessLeafs_L1 (dl1leaf_t *in, int filelen)
+static int Mod_ConvertLeafs_L1 (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	mleaf_t		*out;
-	int			i, j, count, p;
-
-	if (filelen % sizeof(*in))
-		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
-
-	count = filelen / sizeof(*in);
-
-	out = (mleaf_t *) Hunk_AllocName (count * sizeof(*out), loadname);
+	const dl1leaf_t	*in = (const dl1leaf_t *) lump->in + first;
+	mleaf_t		*out = (mleaf_t *) lump->out + first;
+	int		i, j, p;
 
-	loadmodel->leafs = out;
-	loadmodel->numleafs = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1638,24 +2193,17 @@ static void Mod_ProcessLeafs_L1 (dl1leaf_t *in, int filelen)
 
 		//johnfitz -- removed code to mark surfaces as SURF_UNDERWATER
 	}
+
+	return 0;
 }
 
-static void Mod_ProcessLeafs_L2 (dl2leaf_t *in, int filelen)
+static int Mod_ConvertLeafs_L2 (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	mleaf_t		*out;
-	int			i, j, count, p;
-
-	if (filelen % sizeof(*in))
-		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
-
-	count = filelen / sizeof(*in);
-
-	out = (mleaf_t *) Hunk_AllocName (count * sizeof(*out), loadname);
-
-	loadmodel->leafs = out;
-	loadmodel->numleafs = count;
+	const dl2leaf_t	*in = (const dl2leaf_t *) lump->in + first;
+	mleaf_t		*out = (mleaf_t *) lump->out + first;
+	int		i, j, p;
 
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		for (j=0 ; j<3 ; j++)
 		{
@@ -1681,6 +2229,68 @@ static void Mod_ProcessLeafs_L2 (dl2leaf_t *in, int filelen)
 
 		//johnfitz -- removed code to mark surfaces as SURF_UNDERWATER
 	}
+
+	return 0;
+}
+
+static void Mod_ProcessLeafs_S (dsleaf_t *in, int filelen)
+{
+	mleaf_t		*out;
+	int			count;
+
+	if (filelen % sizeof(*in))
+		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
+	count = filelen / sizeof(*in);
+	out = (mleaf_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
+
+	//johnfitz
+	if (count > 32767)
+	{
+		Mod_WaitLumps ();
+		Host_Error ("Mod_LoadLeafs: %i leafs exceeds limit of 32767.", count);
+	}
+	//johnfitz
+
+	loadmodel->leafs = out;
+	loadmodel->numleafs = count;
+
+	Mod_QueueLump (&mod_lumpgroup, Mod_ConvertLeafs_S, in, out, count);
+}
+
+static void Mod_ProcessLeafs_L1 (dl1leaf_t *in, int filelen)
+{
+	mleaf_t		*out;
+	int			count;
+
+	if (filelen % sizeof(*in))
+		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
+
+	count = filelen / sizeof(*in);
+
+	out = (mleaf_t *) Hunk_AllocName (count * sizeof(*out), loadname);
+
+	loadmodel->leafs = out;
+	loadmodel->numleafs = count;
+
+	Mod_QueueLump (&mod_lumpgroup, Mod_ConvertLeafs_L1, in, out, count);
+}
+
+static void Mod_ProcessLeafs_L2 (dl2leaf_t *in, int filelen)
+{
+	mleaf_t		*out;
+	int			count;
+
+	if (filelen % sizeof(*in))
+		Sys_Error ("Mod_ProcessLeafs: funny lump size in %s", loadmodel->name);
+
+	count = filelen / sizeof(*in);
+
+	out = (mleaf_t *) Hunk_AllocName (count * sizeof(*out), loadname);
+
+	loadmodel->leafs = out;
+	loadmodel->numleafs = count;
+
+	Mod_QueueLump (&mod_lumpgroup, Mod_ConvertLeafs_L2, in, out, count);
 }
 
 /*
@@ -1705,33 +2315,86 @@ static void Mod_LoadLeafs (lump_t *l, int bsp2)
 Mod_LoadClipnodes
 =================
 */
-static void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
+static int Mod_ConvertClipnodes_S (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	dsclipnode_t *ins;
-	dlclipnode_t *inl;
+	const dsclipnode_t	*in = (const dsclipnode_t *) lump->in + first;
+	mclipnode_t		*out = (mclipnode_t *) lump->out + first;
+	int			i, count, numbad;
 
-	mclipnode_t *out; //johnfitz -- was dclipnode_t
-	int			i, count;
-	hull_t		*hull;
+	count = lump->count;
+	numbad = 0;
 
-	if (bsp2)
+	for (i=first ; i<last ; i++, out++, in++)
 	{
-		ins = NULL;
-		inl = (dlclipnode_t *)(mod_base + l->fileofs);
-		if (l->filelen % sizeof(*inl))
-			Sys_Error ("Mod_LoadClipnodes: funny lump size in %s",loadmodel->name);
+		out->planenum = LittleLong(in->planenum);
+
+		//johnfitz -- bounds check
+		if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
+		{
+			*badvalue = out->planenum;
+			numbad++;
+		}
+		//johnfitz
+
+		//johnfitz -- support clipnodes > 32k
+		out->children[0] = (unsigned short)LittleShort(in->children[0]);
+		out->children[1] = (unsigned short)LittleShort(in->children[1]);
 
-		count = l->filelen / sizeof(*inl);
+		if (out->children[0] >= count)
+			out->children[0] -= 65536;
+		if (out->children[1] >= count)
+			out->children[1] -= 65536;
+		//johnfitz
 	}
-	else
+
+	return numbad;
+}
+
+static int Mod_ConvertClipnodes_L (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const dlclipnode_t	*in = (const dlclipnode_t *) lump->in + first;
+	mclipnode_t		*out = (mclipnode_t *) lump->out + first;
+	int			i, numbad;
+
+	numbad = 0;
+
+	for (i=first ; i<last ; i++, out++, in++)
 	{
-		ins = (dsclipnode_t *)(mod_base + l->fileofs);
-		inl = NULL;
-		if (l->filelen % sizeof(*ins))
-			Sys_Error ("Mod_LoadClipnodes: funny lump size in %s",loadmodel->name);
+		out->planenum = LittleLong(in->planenum);
+
+		//johnfitz -- bounds check
+		if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
+		{
+			*badvalue = out->planenum;
+			numbad++;
+		}
+		//johnfitz
 
-		count = l->filelen / sizeof(*ins);
+		out->children[0] = LittleLong(in->children[0]);
+		out->children[1] = LittleLong(in->children[1]);
+		//Spike: FIXME: bounds check
 	}
+
+	return numbad;
+}
+
+static void Mod_ReportClipnodes (loadlump_t *lump, int numbad, int badvalue)
+{
+	Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
+}
+
+static void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
+{
+	mclipnode_t *out; //johnfitz -- was dclipnode_t
+	int			count, size;
+	hull_t		*hull;
+	loadlump_t	*lump;
+
+	size = bsp2 ? sizeof(dlclipnode_t) : sizeof(dsclipnode_t);
+	if (l->filelen % size)
+		Sys_Error ("Mod_LoadClipnodes: funny lump size in %s",loadmodel->name);
+
+	count = l->filelen / size;
 	out = (mclipnode_t *) Hunk_AllocName ( count*sizeof(*out), loadname);
 
 	//johnfitz -- warn about exceeding old limits
@@ -1766,44 +2429,9 @@ static void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 	hull->clip_maxs[1] = 32;
 	hull->clip_maxs[2] = 64;
 
-	if (bsp2)
-	{
-		for (i=0 ; i<count ; i++, out++, inl++)
-		{
-			out->planenum = LittleLong(inl->planenum);
-
-			//johnfitz -- bounds check
-			if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-				Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-			//johnfitz
-
-			out->children[0] = LittleLong(inl->children[0]);
-			out->children[1] = LittleLong(inl->children[1]);
-			//Spike: FIXME: bounds check
-		}
-	}
-	else
-	{
-		for (i=0 ; i<count ; i++, out++, ins++)
-		{
-			out->planenum = LittleLong(ins->planenum);
-
-			//johnfitz -- bounds check
-			if (out->planenum < 0 || out->planenum >= loadmodel->numplanes)
-				Host_Error ("Mod_LoadClipnodes: planenum out of bounds");
-			//johnfitz
-
-			//johnfitz -- support clipnodes > 32k
-			out->children[0] = (unsigned short)LittleShort(ins->children[0]);
-			out->children[1] = (unsigned short)LittleShort(ins->children[1]);
-
-			if (out->children[0] >= count)
-				out->children[0] -= 65536;
-			if (out->children[1] >= count)
-				out->children[1] -= 65536;
-			//johnfitz
-		}
-	}
+	lump = Mod_QueueLump (&mod_lumpgroup, bsp2 ? Mod_ConvertClipnodes_L : Mod_ConvertClipnodes_S,
+		mod_base + l->fileofs, out, count);
+	lump->report = Mod_ReportClipnodes;
 }
 
 /*
@@ -1850,16 +2478,75 @@ static void Mod_MakeHull0 (void)
 Mod_LoadMarksurfaces
 =================
 */
+static int Mod_ConvertMarksurfaces_S (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const short	*in = (const short *) lump->in;
+	msurface_t	**out = (msurface_t **) lump->out;
+	int		i, j, numbad;
+
+	numbad = 0;
+
+	for (i=first ; i<last ; i++)
+	{
+		j = (unsigned short)LittleShort(in[i]); //johnfitz -- explicit cast as unsigned short
+		if (j >= loadmodel->numsurfaces)
+		{
+			*badvalue = j;
+			numbad++;
+		}
+		out[i] = loadmodel->surfaces + j;
+	}
+
+	return numbad;
+}
+
+static int Mod_ConvertMarksurfaces_L (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const unsigned int	*in = (const unsigned int *) lump->in;
+	msurface_t		**out = (msurface_t **) lump->out;
+	int			i, j, numbad;
+
+	numbad = 0;
+
+	for (i=first ; i<last ; i++)
+	{
+		j = LittleLong(in[i]);
+		if (j >= loadmodel->numsurfaces)
+		{
+			*badvalue = j;
+			numbad++;
+		}
+		out[i] = loadmodel->surfaces + j;
+	}
+
+	return numbad;
+}
+
+static void Mod_ReportMarksurfaces_S (loadlump_t *lump, int numbad, int badvalue)
+{
+	Sys_Error ("Mod_LoadMarksurfaces: bad surface number");
+}
+
+static void Mod_ReportMarksurfaces_L (loadlump_t *lump, int numbad, int badvalue)
+{
+	Host_Error ("Mod_LoadMarksurfaces: bad surface number");
+}
+
 static void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 {
-	int		i, j, count;
+	int		count;
 	msurface_t **out;
+	loadlump_t	*lump;
+
 	if (bsp2)
 	{
 		unsigned int *in = (unsigned int *)(mod_base + l->fileofs);
 
 		if (l->filelen % sizeof(*in))
+		{
+			Mod_WaitLumps ();
 			Host_Error ("Mod_LoadMarksurfaces: funny lump size in %s",loadmodel->name);
+		}
 
 		count = l->filelen / sizeof(*in);
 		out = (msurface_t **)Hunk_AllocName ( count*sizeof(*out), loadname);
@@ -1867,20 +2554,18 @@ static void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 		loadmodel->marksurfaces = out;
 		loadmodel->nummarksurfaces = count;
 
-		for (i=0 ; i<count ; i++)
-		{
-			j = LittleLong(in[i]);
-			if (j >= loadmodel->numsurfaces)
-				Host_Error ("Mod_LoadMarksurfaces: bad surface number");
-			out[i] = loadmodel->surfaces + j;
-		}
+		lump = Mod_QueueLump (&mod_lumpgroup, Mod_ConvertMarksurfaces_L, in, out, count);
+		lump->report = Mod_ReportMarksurfaces_L;
 	}
 	else
 	{
 		short *in = (short *)(mod_base + l->fileofs);
 
 		if (l->filelen % sizeof(*in))
+		{
+			Mod_WaitLumps ();
 			Host_Error ("Mod_LoadMarksurfaces: funny lump size in %s",loadmodel->name);
+		}
 
 		count = l->filelen / sizeof(*in);
 		out = (msurface_t **)Hunk_AllocName ( count*sizeof(*out), loadname);
@@ -1893,13 +2578,8 @@ static void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 			Con_DWarning ("%i marksurfaces exceeds standard limit of 32767.\n", count);
 		//johnfitz
 
-		for (i=0 ; i<count ; i++)
-		{
-			j = (unsigned short)LittleShort(in[i]); //johnfitz -- explicit cast as unsigned short
-			if (j >= loadmodel->numsurfaces)
-				Sys_Error ("Mod_LoadMarksurfaces: bad surface number");
-			out[i] = loadmodel->surfaces + j;
-		}
+		lump = Mod_QueueLump (&mod_lumpgroup, Mod_ConvertMarksurfaces_S, in, out, count);
+		lump->report = Mod_ReportMarksurfaces_S;
 	}
 }
 
@@ -1908,9 +2588,21 @@ static void Mod_LoadMarksurfaces (lump_t *l, int bsp2)
 Mod_LoadSurfedges
 =================
 */
+static int Mod_ConvertSurfedges (loadlump_t *lump, int first, int last, int *badvalue)
+{
+	const int	*in = (const int *) lump->in;
+	int		*out = (int *) lump->out;
+	int		i;
+
+	for (i=first ; i<last ; i++)
+		out[i] = LittleLong (in[i]);
+
+	return 0;
+}
+
 static void Mod_LoadSurfedges (lump_t *l)
 {
-	int		i, count;
+	int		count;
 	int		*in, *out;
 
 	in = (int *)(mod_base + l->fileofs);
@@ -1922,8 +2614,7 @@ static void Mod_LoadSurfedges (lump_t *l)
 	loadmodel->surfedges = out;
 	loadmodel->numsurfedges = count;
 
-	for (i=0 ; i<count ; i++)
-		out[i] = LittleLong (in[i]);
+	Mod_QueueLump (&mod_geomgroup, Mod_ConvertSurfedges, in, out, count);
 }
 
 
@@ -1932,24 +2623,13 @@ static void Mod_LoadSurfedges (lump_t *l)
 Mod_LoadPlanes
 =================
 */
-static void Mod_LoadPlanes (lump_t *l)
+static int Mod_ConvertPlanes (loadlump_t *lump, int first, int last, int *badvalue)
 {
-	int			i, j;
-	mplane_t	*out;
-	dplane_t 	*in;
-	int			count;
-	int			bits;
-
-	in = (dplane_t *)(mod_base + l->fileofs);
-	if (l->filelen % sizeof(*in))
-		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
-	count = l->filelen / sizeof(*in);
-	out = (mplane_t *) Hunk_AllocName ( count*2*sizeof(*out), loadname);
+	const dplane_t	*in = (const dplane_t *) lump->in + first;
+	mplane_t	*out = (mplane_t *) lump->out + first;
+	int		i, j, bits;
 
-	loadmodel->planes = out;
-	loadmodel->numplanes = count;
-
-	for (i=0 ; i<count ; i++, in++, out++)
+	for (i=first ; i<last ; i++, in++, out++)
 	{
 		bits = 0;
 		for (j=0 ; j<3 ; j++)
@@ -1963,6 +2643,26 @@ static void Mod_LoadPlanes (lump_t *l)
 		out->type = LittleLong (in->type);
 		out->signbits = bits;
 	}
+
+	return 0;
+}
+
+static void Mod_LoadPlanes (lump_t *l)
+{
+	mplane_t	*out;
+	dplane_t 	*in;
+	int			count;
+
+	in = (dplane_t *)(mod_base + l->fileofs);
+	if (l->filelen % sizeof(*in))
+		Sys_Error ("MOD_LoadBmodel: funny lump size in %s",loadmodel->name);
+	count = l->filelen / sizeof(*in);
+	out = (mplane_t *) Hunk_AllocName ( count*2*sizeof(*out), loadname);
+
+	loadmodel->planes = out;
+	loadmodel->numplanes = count;
+
+	Mod_QueueLump (&mod_lumpgroup, Mod_ConvertPlanes, in, out, count);
 }
 
 /*
@@ -2187,9 +2887,14 @@ static void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 	dheader_t	*header;
 	dmodel_t 	*bm;
 	float		radius; //johnfitz
+	loadlump_t	*faces;
+	qboolean	serial;
+	qmodel_t	*world = mod;	// mod moves on to the submodels
 
 	loadmodel->type = mod_brush;
 
+	Mod_FreePVSCache (mod);	// the submodels copy mod, so they never get one
+
 	header = (dheader_t *)buffer;
 
 	mod->bspversion = LittleLong (header->version);
@@ -2220,15 +2925,26 @@ static void Mod_LoadBrushModel (qmodel_t *mod, void *buffer)
 		((int *)header)[i] = LittleLong ( ((int *)header)[i]);
 
 // load into heap
+// the lumps are converted on the worker threads while the main thread
+// carries on allocating the next ones.  the textures have to be uploaded
+// from here, so they are loaded last, while the rest converts.  without
+// workers there is nothing to overlap, so the lumps load in the original
+// order.
+	mod_numlumps = 0;
+	serial = !Tasks_NumWorkers ();
 
 	Mod_LoadVertexes (&header->lumps[LUMP_VERTEXES]);
 	Mod_LoadEdges (&header->lumps[LUMP_EDGES], bsp2);
 	Mod_LoadSurfedges (&header->lumps[LUMP_SURFEDGES]);
-	Mod_LoadTextures (&header->lumps[LUMP_TEXTURES]);
+	if (serial)
+		Mod_LoadTextures (&header->lumps[LUMP_TEXTURES]);
 	Mod_LoadLighting (&header->lumps[LUMP_LIGHTING]);
 	Mod_LoadPlanes (&header->lumps[LUMP_PLANES]);
-	Mod_LoadTexinfo (&header->lumps[LUMP_TEXINFO]);
-	Mod_LoadFaces (&header->lumps[LUMP_FACES], bsp2);
+	if (serial)
+		Mod_LoadTexinfo (&header->lumps[LUMP_TEXINFO]);
+	faces = Mod_LoadFaces (&header->lumps[LUMP_FACES], bsp2);
+	if (serial)
+		Mod_StartLump (&mod_lumpgroup, faces);
 	Mod_LoadMarksurfaces (&header->lumps[LUMP_MARKSURFACES], bsp2);
 
 	if (mod->bspversion == BSPVERSION && external_vis.value && sv.modelname[0] && !q_strcasecmp(loadname, sv.name))
@@ -2261,7 +2977,19 @@ visdone:
 	Mod_LoadClipnodes (&header->lumps[LUMP_CLIPNODES], bsp2);
 	Mod_LoadEntities (&header->lumps[LUMP_ENTITIES]);
 	Mod_LoadSubmodels (&header->lumps[LUMP_MODELS]);
+	if (!serial)
+	{
+		Mod_LoadTextures (&header->lumps[LUMP_TEXTURES]);
+		Mod_LoadTexinfo (&header->lumps[LUMP_TEXINFO]);
 
+		// the faces read the texinfo, vertexes, edges and surfedges
+		Task_Wait (&mod_geomgroup);
+		Mod_StartLump (&mod_lumpgroup, faces);
+	}
+
+	Mod_FinishLumps ();
+	Mod_FinishFaces ();
+	Mod_SetParent (loadmodel->nodes, NULL);	// sets nodes and leafs
 	Mod_MakeHull0 ();
 
 	mod->numframes = 2;		// regular and alternate animation
@@ -2323,6 +3051,8 @@ visdone:
 			mod = loadmodel;
 		}
 	}
+
+	Mod_SetupPVSCache (world);
 }
 
 /*
@@ -173,6 +173,7 @@ typedef struct msurface_s
 	byte		styles[MAXLIGHTMAPS];
 	int			cached_light[MAXLIGHTMAPS];	// values currently used in lightmap
 	qboolean	cached_dlight;				// true if dynamic light in cache
+	qboolean	lightmapqueued;				// waiting in R_BuildDirtyLightmaps
 	byte		*samples;		// [numstyles*surfsize]
 } msurface_t;
 
@@ -411,6 +412,8 @@ typedef enum {mod_brush, mod_sprite, mod_alias} modtype_t;
 #define	MOD_FBRIGHTHACK	1024	//when fullbrights are disabled, use a hack to render this model brighter
 //johnfitz
 
+typedef struct pvscache_s pvscache_t;
+
 typedef struct qmodel_s
 {
 	char		name[MAX_QPATH];
@@ -486,9 +489,11 @@ typedef struct qmodel_s
 	char		*entities;
 
 	qboolean	viswarn; // for Mod_DecompressVis()
+	pvscache_t	*pvscache;	// decompressed vis rows, see gl_model.c
 
 	int			bspversion;
 	qboolean	haslitwater;
+	uint64_t	filehash;	// Hash_Block64 of the .bsp, keys the processed data cache
 //
 // alias model
 //
@@ -514,10 +519,12 @@ void	Mod_ResetAll (void); // for gamedir changes (Host_Game_f)
 qmodel_t *Mod_ForName (const char *name, qboolean crash);
 void	*Mod_Extradata (qmodel_t *mod);	// handles caching
 void	Mod_TouchModel (const char *name);
+void	Mod_Prefetch (const char *name);
+int	Mod_Index (qmodel_t *mod);	// index into the known models, for sorting
 
 mleaf_t *Mod_PointInLeaf (vec3_t p, qmodel_t *model);
-byte	*Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model);
-byte	*Mod_NoVisPVS (qmodel_t *model);
+const byte *Mod_LeafPVS (mleaf_t *leaf, qmodel_t *model);	// see the PVS CACHE comment in gl_model.c
+const byte *Mod_NoVisPVS (qmodel_t *model);
 
 void Mod_SetExtraFlags (qmodel_t *mod);
 
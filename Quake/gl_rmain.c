@@ -35,6 +35,7 @@ mplane_t	frustum[4];
 //johnfitz -- rendering statistics
 int rs_brushpolys, rs_aliaspolys, rs_skypolys;
 int rs_dynamiclightmaps, rs_brushpasses, rs_aliaspasses, rs_skypasses;
+int rs_entities, rs_entitychanges, rs_entitychangessaved;
 
 //
 // view origin
@@ -68,6 +69,7 @@ cvar_t	r_wateralpha = {"r_wateralpha","1",CVAR_ARCHIVE};
 cvar_t	r_litwater = {"r_litwater","1",CVAR_NONE};
 cvar_t	r_dynamic = {"r_dynamic","1",CVAR_ARCHIVE};
 cvar_t	r_novis = {"r_novis","0",CVAR_ARCHIVE};
+cvar_t	r_sortentities = {"r_sortentities","1",CVAR_NONE};
 
 cvar_t	gl_finish = {"gl_finish","0",CVAR_NONE};
 cvar_t	gl_clear = {"gl_clear","1",CVAR_NONE};
@@ -617,6 +619,133 @@ void R_SetupView (void)
 //
 //==============================================================================
 
+/*
+=============================================================
+
+	ENTITY DRAW ORDER
+
+Each pass gives every entity a 64 bit sort key and draws them in key
+order.  Opaque entities are grouped by renderer (brush, alias, sprite),
+then by model and skin, so consecutive draws share programs, vertex
+buffers and textures, and within a group go front to back to help the
+depth test.  Translucent entities only sort back to front.  Equal keys
+keep their cl_visedicts order, since qsort isn't stable and a tie would
+otherwise flicker from frame to frame.
+
+=============================================================
+*/
+
+typedef struct
+{
+	uint64_t	key;
+	entity_t	*ent;
+	int		index;	// in cl_visedicts
+} drawent_t;
+
+static drawent_t	r_drawents[MAX_VISEDICTS];
+
+#define DEPTH_BITS	24
+
+/*
+=============
+R_EntityDepth -- distance in front of the view, clamped to DEPTH_BITS
+=============
+*/
+static uint64_t R_EntityDepth (entity_t *e)
+{
+	vec3_t	center;
+	float	dist;
+
+	VectorAdd (e->model->mins, e->model->maxs, center);
+	VectorMA (e->origin, 0.5f, center, center);
+	VectorSubtract (center, r_origin, center);
+	dist = DotProduct (center, vpn);
+
+	if (dist <= 0)
+		return 0;
+	if (dist >= (1 << DEPTH_BITS) - 1)
+		return (1 << DEPTH_BITS) - 1;
+	return (uint64_t)dist;
+}
+
+/*
+=============
+R_EntitySortKey
+
+opaque: | renderer 4 | model 16 | skin 20 | depth 24 |
+translucent: | far to near depth 24 |
+=============
+*/
+static uint64_t R_EntitySortKey (entity_t *e, qboolean alphapass)
+{
+	uint64_t	renderer, skin;
+
+	if (alphapass)
+		return ((1 << DEPTH_BITS) - 1) - R_EntityDepth (e);
+
+	switch (e->model->type)
+	{
+	case mod_brush:
+		renderer = 0; // big occluders first
+		skin = 0;
+		break;
+	case mod_alias:
+		renderer = 1;
+		skin = e->skinnum & 0x7fff;
+		// colormapped players each get their own skin texture; clients
+		// are 1 to MAX_SCOREBOARD (16), which takes the top 5 bits
+		if (e->colormap != vid.colormap && e >= &cl_entities[1] && e <= &cl_entities[cl.maxclients])
+			skin |= (uint64_t)(e - cl_entities) << 15;
+		break;
+	default:
+		renderer = 2;
+		skin = e->frame & 0xfffff;
+		break;
+	}
+
+	return (renderer << 60) |
+		((uint64_t)(Mod_Index (e->model) & 0xffff) << 44) |
+		((skin & 0xfffff) << DEPTH_BITS) |
+		R_EntityDepth (e);
+}
+
+/*
+=============
+R_CompareDrawEnts
+=============
+*/
+static int R_CompareDrawEnts (const void *a, const void *b)
+{
+	const drawent_t *x = (const drawent_t *)a;
+	const drawent_t *y = (const drawent_t *)b;
+
+	if (x->key != y->key)
+		return (x->key < y->key) ? -1 : 1;
+	return x->index - y->index;
+}
+
+/*
+=============
+R_CountEntityChanges -- how often the model or skin changes going down the list
+=============
+*/
+static int R_CountEntityChanges (int count)
+{
+	entity_t	*prev, *e;
+	int		i, changes;
+
+	changes = 0;
+	for (i = 1; i < count; i++)
+	{
+		prev = r_drawents[i - 1].ent;
+		e = r_drawents[i].ent;
+		if (e->model != prev->model || e->skinnum != prev->skinnum || e->colormap != prev->colormap)
+			changes++;
+	}
+
+	return changes;
+}
+
 /*
 =============
 R_DrawEntitiesOnList
@@ -624,22 +753,48 @@ R_DrawEntitiesOnList
 */
 void R_DrawEntitiesOnList (qboolean alphapass) //johnfitz -- added parameter
 {
-	int		i;
+	int		i, count, changes;
 
 	if (!r_drawentities.value)
 		return;
 
-	//johnfitz -- sprites are not a special case
-	for (i=0 ; i<cl_numvisedicts ; i++)
+	//johnfitz -- if alphapass is true, draw only alpha entites this time
+	//if alphapass is false, draw only nonalpha entities this time
+	for (i=0, count=0 ; i<cl_numvisedicts ; i++)
 	{
 		currententity = cl_visedicts[i];
 
-		//johnfitz -- if alphapass is true, draw only alpha entites this time
-		//if alphapass is false, draw only nonalpha entities this time
 		if ((ENTALPHA_DECODE(currententity->alpha) < 1 && !alphapass) ||
 			(ENTALPHA_DECODE(currententity->alpha) == 1 && alphapass))
 			continue;
 
+		r_drawents[count].ent = currententity;
+		r_drawents[count].key = R_EntitySortKey (currententity, alphapass);
+		r_drawents[count].index = i;
+		count++;
+	}
+
+	if (r_sortentities.value)
+	{
+		changes = r_speeds.value ? R_CountEntityChanges (count) : 0;
+		qsort (r_drawents, count, sizeof(r_drawents[0]), R_CompareDrawEnts);
+		if (r_speeds.value)
+			rs_entitychangessaved += changes - R_CountEntityChanges (count);
+	}
+	if (r_speeds.value)
+	{
+		rs_entities += count;
+		rs_entitychanges += R_CountEntityChanges (count);
+	}
+
+	if (!alphapass)
+		R_BeginAliasInstances ();
+
+	//johnfitz -- sprites are not a special case
+	for (i=0 ; i<count ; i++)
+	{
+		currententity = r_drawents[i].ent;
+
 		//johnfitz -- chasecam
 		if (currententity == &cl_entities[cl.viewentity])
 			currententity->angles[0] *= 0.3;
@@ -658,6 +813,9 @@ void R_DrawEntitiesOnList (qboolean alphapass) //johnfitz -- added parameter
 				break;
 		}
 	}
+
+	if (!alphapass)
+		R_FlushAliasInstances ();
 }
 
 /*
@@ -1086,6 +1244,7 @@ void R_RenderView (void)
 		//johnfitz -- rendering statistics
 		rs_brushpolys = rs_aliaspolys = rs_skypolys =
 		rs_dynamiclightmaps = rs_aliaspasses = rs_skypasses = rs_brushpasses = 0;
+		rs_entities = rs_entitychanges = rs_entitychangessaved = 0;
 	}
 	else if (gl_finish.value)
 		glFinish ();
@@ -1140,7 +1299,8 @@ void R_RenderView (void)
 					(int)cl.viewangles[PITCH],
 					(int)cl.viewangles[YAW],
 					(int)cl.viewangles[ROLL]);
-	else if (r_speeds.value == 2)
+	else if (r_speeds.value >= 2)
+	{
 		Con_Printf ("%3i ms  %4i/%4i wpoly %4i/%4i epoly %3i lmap %4i/%4i sky %1.1f mtex\n",
 					(int)((time2-time1)*1000),
 					rs_brushpolys,
@@ -1151,6 +1311,12 @@ void R_RenderView (void)
 					rs_skypolys,
 					rs_skypasses,
 					TexMgr_FrameUsage ());
+		if (r_speeds.value >= 3)
+			Con_Printf ("%4i ents %4i model/skin changes %4i saved by sorting\n",
+						rs_entities,
+						rs_entitychanges,
+						rs_entitychangessaved);
+	}
 	else if (r_speeds.value)
 		Con_Printf ("%3i ms  %4i wpoly %4i epoly %3i lmap\n",
 					(int)((time2-time1)*1000),
@@ -52,6 +52,11 @@ extern cvar_t gl_zfix; // QuakeSpasm z-fighting fix
 extern gltexture_t *playertextures[MAX_SCOREBOARD]; //johnfitz
 
 cvar_t	r_lightmapwide = {"r_lightmapwide","0",CVAR_ROM};
+cvar_t	gl_lightmapsize = {"gl_lightmapsize","1024",CVAR_ARCHIVE};
+cvar_t	gl_lightmappbo = {"gl_lightmappbo","1",CVAR_ARCHIVE};
+cvar_t	gl_bspcache = {"gl_bspcache","1",CVAR_ARCHIVE};
+cvar_t	gl_meshcache = {"gl_meshcache","1",CVAR_ARCHIVE};
+cvar_t	r_instancemodels = {"r_instancemodels","1",CVAR_ARCHIVE};
 
 
 /*
@@ -180,6 +185,7 @@ void R_Init (void)
 	Cvar_RegisterVariable (&r_litwater);
 	Cvar_RegisterVariable (&r_dynamic);
 	Cvar_RegisterVariable (&r_novis);
+	Cvar_RegisterVariable (&r_sortentities);
 	Cvar_RegisterVariable (&r_speeds);
 	Cvar_RegisterVariable (&r_pos);
 
@@ -222,6 +228,11 @@ void R_Init (void)
 	//johnfitz
 	Cvar_RegisterVariable (&r_lightmapwide);
 	Cvar_SetROM ("r_lightmapwide", gl_packed_pixels ? "1" : "0");
+	Cvar_RegisterVariable (&gl_lightmapsize);
+	Cvar_RegisterVariable (&gl_lightmappbo);
+	Cvar_RegisterVariable (&gl_bspcache);
+	Cvar_RegisterVariable (&gl_meshcache);
+	Cvar_RegisterVariable (&r_instancemodels);
 
 	Cvar_RegisterVariable (&gl_zfix); // QuakeSpasm z-fighting fix
 	Cvar_RegisterVariable (&r_lavaalpha);
@@ -233,6 +244,7 @@ void R_Init (void)
 	Cvar_SetCallback (&r_slimealpha, R_SetSlimealpha_f);
 
 	R_InitParticles ();
+	R_InitLightmapKernels ();
 	R_SetClearColor_f (&r_clearcolor); //johnfitz
 
 	Sky_Init (); //johnfitz
@@ -390,6 +402,7 @@ void R_NewMap (void)
 		cl.worldmodel->leafs[i].efrags = NULL;
 
 	r_viewleaf = NULL;
+	R_ClearVisCache ();
 	R_ClearParticles ();
 
 	GL_BuildLightmaps ();
@@ -1109,6 +1109,8 @@ void SCR_UpdateScreen (void)
 
 	GL_BeginRendering (&glx, &gly, &glwidth, &glheight);
 
+	TexMgr_UploadTextures ();
+
 	//
 	// determine size of refresh window
 	//
@@ -23,6 +23,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 //gl_texmgr.c -- fitzquake's texture manager. manages opengl texture images
 
 #include "quakedef.h"
+#include "q_simd.h"
+#include "texcache.h"
 
 static const int	gl_solid_format = 3;
 static const int	gl_alpha_format = 4;
@@ -31,6 +33,9 @@ static cvar_t	gl_texturemode = {"gl_texturemode", "", CVAR_ARCHIVE};
 static cvar_t	gl_texture_anisotropy = {"gl_texture_anisotropy", "1", CVAR_ARCHIVE};
 static cvar_t	gl_max_size = {"gl_max_size", "0", CVAR_NONE};
 static cvar_t	gl_picmip = {"gl_picmip", "0", CVAR_NONE};
+static cvar_t	gl_texturesimd = {"gl_texturesimd", "1", CVAR_NONE};
+static cvar_t	gl_texture_uploadms = {"gl_texture_uploadms", "2", CVAR_NONE}; // per frame, for finished threaded loads
+static cvar_t	gl_texturecache = {"gl_texturecache", "0", CVAR_ARCHIVE};
 static GLint	gl_hardware_maxsize;
 
 #define	MAX_GLTEXTURES	4096
@@ -441,6 +446,9 @@ void TexMgr_DeleteTextureObjects (void)
 	}
 }
 
+static void TexMgr_SetKernels_f (cvar_t *var);
+static void TexMgr_TextureBench_f (void);
+
 /*
 ================================================================================
 
@@ -616,6 +624,11 @@ void TexMgr_Init (void)
 
 	Cvar_RegisterVariable (&gl_max_size);
 	Cvar_RegisterVariable (&gl_picmip);
+	Cvar_RegisterVariable (&gl_texture_uploadms);
+	Cvar_RegisterVariable (&gl_texturecache);
+	Cvar_RegisterVariable (&gl_texturesimd);
+	Cvar_SetCallback (&gl_texturesimd, TexMgr_SetKernels_f);
+	TexMgr_SetKernels_f (&gl_texturesimd);
 	Cvar_RegisterVariable (&gl_texture_anisotropy);
 	Cvar_SetCallback (&gl_texture_anisotropy, &TexMgr_Anisotropy_f);
 	gl_texturemode.string = glmodes[glmode_idx].name;
@@ -624,6 +637,7 @@ void TexMgr_Init (void)
 	Cmd_AddCommand ("gl_describetexturemodes", &TexMgr_DescribeTextureModes_f);
 	Cmd_AddCommand ("imagelist", &TexMgr_Imagelist_f);
 	Cmd_AddCommand ("imagedump", &TexMgr_Imagedump_f);
+	Cmd_AddCommand ("gl_texturebench", &TexMgr_TextureBench_f);
 
 	// poll max size from hardware
 	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &gl_hardware_maxsize);
@@ -694,15 +708,16 @@ int TexMgr_PadConditional (int s)
 
 /*
 ================
-TexMgr_MipMapW
+TexMgr_MipMapW_C -- in and out may be the same
 ================
 */
-static unsigned *TexMgr_MipMapW (unsigned *data, int width, int height)
+static void TexMgr_MipMapW_C (unsigned *indata, unsigned *outdata, int width, int height)
 {
 	int	i, size;
 	byte	*out, *in;
 
-	out = in = (byte *)data;
+	out = (byte *)outdata;
+	in = (byte *)indata;
 	size = (width*height)>>1;
 
 	for (i = 0; i < size; i++, out += 4, in += 8)
@@ -712,21 +727,20 @@ static unsigned *TexMgr_MipMapW (unsigned *data, int width, int height)
 		out[2] = (in[2] + in[6])>>1;
 		out[3] = (in[3] + in[7])>>1;
 	}
-
-	return data;
 }
 
 /*
 ================
-TexMgr_MipMapH
+TexMgr_MipMapH_C -- in and out may be the same
 ================
 */
-static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
+static void TexMgr_MipMapH_C (unsigned *indata, unsigned *outdata, int width, int height)
 {
 	int	i, j;
 	byte	*out, *in;
 
-	out = in = (byte *)data;
+	out = (byte *)outdata;
+	in = (byte *)indata;
 	height>>=1;
 	width<<=2;
 
@@ -740,28 +754,23 @@ static unsigned *TexMgr_MipMapH (unsigned *data, int width, int height)
 			out[3] = (in[3] + in[width+3])>>1;
 		}
 	}
-
-	return data;
 }
 
 /*
 ================
-TexMgr_ResampleTexture -- bilinear resample
+TexMgr_ResampleTexture_C -- bilinear resample up to power of two dimensions
+
+out must hold TexMgr_Pad(inwidth) * TexMgr_Pad(inheight) pixels
 ================
 */
-static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight, qboolean alpha)
+static void TexMgr_ResampleTexture_C (unsigned *in, int inwidth, int inheight, unsigned *out, qboolean alpha)
 {
 	byte *nwpx, *nepx, *swpx, *sepx, *dest;
 	unsigned xfrac, yfrac, x, y, modx, mody, imodx, imody, injump, outjump;
-	unsigned *out;
 	int i, j, outwidth, outheight;
 
-	if (inwidth == TexMgr_Pad(inwidth) && inheight == TexMgr_Pad(inheight))
-		return in;
-
 	outwidth = TexMgr_Pad(inwidth);
 	outheight = TexMgr_Pad(inheight);
-	out = (unsigned *) Hunk_Alloc(outwidth*outheight*4);
 
 	xfrac = ((inwidth-1) << 16) / (outwidth-1);
 	yfrac = ((inheight-1) << 16) / (outheight-1);
@@ -799,8 +808,413 @@ static unsigned *TexMgr_ResampleTexture (unsigned *in, int inwidth, int inheight
 		outjump += outwidth;
 		y += yfrac;
 	}
+}
+
+/*
+================================================================================
+
+	SIMD KERNELS
+
+The mipmap and resample loops above are the reference versions.  The
+others must write exactly the same bytes: the box filter rounds down,
+where the averaging instructions round up, and the resample keeps the
+C version's integer weights all the way through.
+
+================================================================================
+*/
+
+typedef struct
+{
+	kernelinfo_t	info;
+	void	(*mipmapw) (unsigned *indata, unsigned *outdata, int width, int height);
+	void	(*mipmaph) (unsigned *indata, unsigned *outdata, int width, int height);
+	void	(*resample) (unsigned *in, int inwidth, int inheight, unsigned *out, qboolean alpha);
+} texkernels_t;
+
+static const texkernels_t	*tex_kernels;
+
+static const texkernels_t tex_kernels_c =
+{
+	{"C", 0},
+	TexMgr_MipMapW_C, TexMgr_MipMapH_C, TexMgr_ResampleTexture_C
+};
 
-	return out;
+#if defined(USE_SSE2)
+
+/*
+================
+TexMgr_Average_SSE2 -- (a + b) >> 1 for each byte
+================
+*/
+static SIMD_TARGET_SSE2 __m128i TexMgr_Average_SSE2 (__m128i a, __m128i b)
+{
+	return _mm_sub_epi8 (_mm_avg_epu8 (a, b), _mm_and_si128 (_mm_xor_si128 (a, b), _mm_set1_epi8 (1)));
+}
+
+static SIMD_TARGET_SSE2 void TexMgr_MipMapW_SSE2 (unsigned *indata, unsigned *outdata, int width, int height)
+{
+	const int	size = (width*height)>>1;
+	__m128		a, b;
+	int		i;
+
+	// each store lands behind everything still to be read, so in place is fine
+	for (i = 0; i + 4 <= size; i += 4)
+	{
+		a = _mm_loadu_ps ((const float *)(indata + 2*i));
+		b = _mm_loadu_ps ((const float *)(indata + 2*i + 4));
+		_mm_storeu_si128 ((__m128i *)(outdata + i),
+			TexMgr_Average_SSE2 (_mm_castps_si128 (_mm_shuffle_ps (a, b, _MM_SHUFFLE(2,0,2,0))),
+					     _mm_castps_si128 (_mm_shuffle_ps (a, b, _MM_SHUFFLE(3,1,3,1)))));
+	}
+
+	if (i < size)
+		TexMgr_MipMapW_C (indata + 2*i, outdata + i, 2*(size - i), 1);
+}
+
+static SIMD_TARGET_SSE2 void TexMgr_MipMapH_SSE2 (unsigned *indata, unsigned *outdata, int width, int height)
+{
+	const byte	*in, *in2;
+	byte		*out;
+	int		i, j;
+
+	height >>= 1;
+	for (i = 0; i < height; i++)
+	{
+		in = (const byte *)(indata + 2*i*width);
+		in2 = in + width*4;
+		out = (byte *)(outdata + i*width);
+
+		for (j = 0; j + 16 <= width*4; j += 16)
+			_mm_storeu_si128 ((__m128i *)(out + j),
+				TexMgr_Average_SSE2 (_mm_loadu_si128 ((const __m128i *)(in + j)),
+						     _mm_loadu_si128 ((const __m128i *)(in2 + j))));
+		for ( ; j < width*4; j++)
+			out[j] = (in[j] + in2[j])>>1;
+	}
+}
+
+/*
+================
+TexMgr_ResampleTexel_SSE2
+
+texels p[0] and p[1] weighted by the low and high halves of w, summed into the
+low four 16 bit lanes (at most 255 * 256, so nothing overflows)
+================
+*/
+static SIMD_TARGET_SSE2 __m128i TexMgr_ResampleTexel_SSE2 (const unsigned *p, __m128i w)
+{
+	__m128i	v;
+
+	v = _mm_mullo_epi16 (_mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)p), _mm_setzero_si128 ()), w);
+	return _mm_add_epi16 (v, _mm_srli_si128 (v, 8));
+}
+
+static SIMD_TARGET_SSE2 void TexMgr_ResampleTexture_SSE2 (unsigned *in, int inwidth, int inheight, unsigned *out, qboolean alpha)
+{
+	const __m128i	alphamask = _mm_set1_epi32 (alpha ? 0 : 0xff000000);
+	unsigned	xfrac, yfrac, x, y, modx, mody, imodx, imody;
+	const unsigned	*row;
+	unsigned	*dest;
+	int		i, j, outwidth, outheight;
+	__m128i		iy, my, wa, wb, n, s, lo, hi, a0, a1;
+	byte		*nwpx, *nepx, *swpx, *sepx, *d;
+
+	outwidth = TexMgr_Pad(inwidth);
+	outheight = TexMgr_Pad(inheight);
+
+	xfrac = ((inwidth-1) << 16) / (outwidth-1);
+	yfrac = ((inheight-1) << 16) / (outheight-1);
+	y = 0;
+
+	for (i = 0; i < outheight; i++, y += yfrac)
+	{
+		mody = (y>>8) & 0xFF;
+		imody = 256 - mody;
+		iy = _mm_set1_epi16 (imody);
+		my = _mm_set1_epi16 (mody);
+		row = in + (y>>16) * inwidth;
+		dest = out + i * outwidth;
+		x = 0;
+
+		// two texels at a time: blend each across, then the rows together in 32 bits
+		for (j = 0; j + 2 <= outwidth; j += 2, x += 2*xfrac)
+		{
+			modx = (x>>8) & 0xFF;
+			imodx = 256 - modx;
+			wa = _mm_set_epi16 (modx, modx, modx, modx, imodx, imodx, imodx, imodx);
+			modx = ((x + xfrac)>>8) & 0xFF;
+			imodx = 256 - modx;
+			wb = _mm_set_epi16 (modx, modx, modx, modx, imodx, imodx, imodx, imodx);
+
+			n = _mm_unpacklo_epi64 (TexMgr_ResampleTexel_SSE2 (row + (x>>16), wa),
+						TexMgr_ResampleTexel_SSE2 (row + ((x + xfrac)>>16), wb));
+			s = _mm_unpacklo_epi64 (TexMgr_ResampleTexel_SSE2 (row + (x>>16) + inwidth, wa),
+						TexMgr_ResampleTexel_SSE2 (row + ((x + xfrac)>>16) + inwidth, wb));
+
+			lo = _mm_mullo_epi16 (n, iy);
+			hi = _mm_mulhi_epu16 (n, iy);
+			a0 = _mm_unpacklo_epi16 (lo, hi);
+			a1 = _mm_unpackhi_epi16 (lo, hi);
+			lo = _mm_mullo_epi16 (s, my);
+			hi = _mm_mulhi_epu16 (s, my);
+			a0 = _mm_srli_epi32 (_mm_add_epi32 (a0, _mm_unpacklo_epi16 (lo, hi)), 16);
+			a1 = _mm_srli_epi32 (_mm_add_epi32 (a1, _mm_unpackhi_epi16 (lo, hi)), 16);
+
+			a0 = _mm_packs_epi32 (a0, a1);
+			_mm_storel_epi64 ((__m128i *)(dest + j), _mm_or_si128 (_mm_packus_epi16 (a0, a0), alphamask));
+		}
+
+		// outwidth is a power of two, so this is only for the 1 wide case
+		for ( ; j < outwidth; j++, x += xfrac)
+		{
+			modx = (x>>8) & 0xFF;
+			imodx = 256 - modx;
+			nwpx = (byte *)(row + (x>>16));
+			nepx = nwpx + 4;
+			swpx = nwpx + inwidth*4;
+			sepx = swpx + 4;
+			d = (byte *)(dest + j);
+			d[0] = (nwpx[0]*imodx*imody + nepx[0]*modx*imody + swpx[0]*imodx*mody + sepx[0]*modx*mody)>>16;
+			d[1] = (nwpx[1]*imodx*imody + nepx[1]*modx*imody + swpx[1]*imodx*mody + sepx[1]*modx*mody)>>16;
+			d[2] = (nwpx[2]*imodx*imody + nepx[2]*modx*imody + swpx[2]*imodx*mody + sepx[2]*modx*mody)>>16;
+			if (alpha)
+				d[3] = (nwpx[3]*imodx*imody + nepx[3]*modx*imody + swpx[3]*imodx*mody + sepx[3]*modx*mody)>>16;
+			else
+				d[3] = 255;
+		}
+	}
+}
+
+static const texkernels_t tex_kernels_sse2 =
+{
+	{"SSE2", CPU_SSE2},
+	TexMgr_MipMapW_SSE2, TexMgr_MipMapH_SSE2, TexMgr_ResampleTexture_SSE2
+};
+
+#endif	/* USE_SSE2 */
+
+#if defined(USE_AVX2)
+
+static SIMD_TARGET_AVX2 __m256i TexMgr_Average_AVX2 (__m256i a, __m256i b)
+{
+	return _mm256_sub_epi8 (_mm256_avg_epu8 (a, b), _mm256_and_si256 (_mm256_xor_si256 (a, b), _mm256_set1_epi8 (1)));
+}
+
+static SIMD_TARGET_AVX2 void TexMgr_MipMapW_AVX2 (unsigned *indata, unsigned *outdata, int width, int height)
+{
+	const int	size = (width*height)>>1;
+	__m256		a, b;
+	__m256i		avg;
+	int		i;
+
+	for (i = 0; i + 8 <= size; i += 8)
+	{
+		a = _mm256_loadu_ps ((const float *)(indata + 2*i));
+		b = _mm256_loadu_ps ((const float *)(indata + 2*i + 8));
+		avg = TexMgr_Average_AVX2 (_mm256_castps_si256 (_mm256_shuffle_ps (a, b, _MM_SHUFFLE(2,0,2,0))),
+					   _mm256_castps_si256 (_mm256_shuffle_ps (a, b, _MM_SHUFFLE(3,1,3,1))));
+		// the shuffles work within 128 bit lanes, put the pairs back in order
+		_mm256_storeu_si256 ((__m256i *)(outdata + i), _mm256_permute4x64_epi64 (avg, _MM_SHUFFLE(3,1,2,0)));
+	}
+
+	if (i < size)
+		TexMgr_MipMapW_C (indata + 2*i, outdata + i, 2*(size - i), 1);
+}
+
+static SIMD_TARGET_AVX2 void TexMgr_MipMapH_AVX2 (unsigned *indata, unsigned *outdata, int width, int height)
+{
+	const byte	*in, *in2;
+	byte		*out;
+	int		i, j;
+
+	height >>= 1;
+	for (i = 0; i < height; i++)
+	{
+		in = (const byte *)(indata + 2*i*width);
+		in2 = in + width*4;
+		out = (byte *)(outdata + i*width);
+
+		for (j = 0; j + 32 <= width*4; j += 32)
+			_mm256_storeu_si256 ((__m256i *)(out + j),
+				TexMgr_Average_AVX2 (_mm256_loadu_si256 ((const __m256i *)(in + j)),
+						     _mm256_loadu_si256 ((const __m256i *)(in2 + j))));
+		for ( ; j < width*4; j++)
+			out[j] = (in[j] + in2[j])>>1;
+	}
+}
+
+// the resample is bound by its scattered loads, wider vectors don't help it
+static const texkernels_t tex_kernels_avx2 =
+{
+	{"AVX2", CPU_AVX2},
+	TexMgr_MipMapW_AVX2, TexMgr_MipMapH_AVX2, TexMgr_ResampleTexture_SSE2
+};
+
+#endif	/* USE_AVX2 */
+
+// fastest first
+static const kernelinfo_t *tex_kernellist[] =
+{
+#if defined(USE_AVX2)
+	&tex_kernels_avx2.info,
+#endif
+#if defined(USE_SSE2)
+	&tex_kernels_sse2.info,
+#endif
+	&tex_kernels_c.info
+};
+
+/*
+================
+TexMgr_SetKernels_f -- called when gl_texturesimd changes
+================
+*/
+static void TexMgr_SetKernels_f (cvar_t *var)
+{
+	tex_kernels = (const texkernels_t *) COM_PickKernels (tex_kernellist, Q_COUNTOF(tex_kernellist), var->value != 0);
+}
+
+/*
+================================================================================
+
+	BENCHMARK
+
+gl_texturebench [size] [iterations] checks a hash of what every kernel
+set this cpu can run makes, in place and not, on a handful of awkward
+sizes against the C kernels, then times each kernel on a size x size
+image.  Speeds
+are megabytes of input per second for the mipmaps, and of output for the
+resample (which goes from about 3/4 size up to size).
+
+================================================================================
+*/
+
+// odd sizes on purpose, to get the scalar tails
+static const int texbench_sizes[][2] = {{2, 2}, {3, 5}, {7, 1}, {17, 9}, {33, 64}, {101, 37}, {256, 255}};
+
+/*
+================
+TexMgr_BenchImage -- random pixels, with room for the resample to read past the end
+================
+*/
+static unsigned *TexMgr_BenchImage (int width, int height)
+{
+	unsigned	*data;
+	int		i;
+
+	data = (unsigned *) malloc ((width * height + width + 1) * 4);
+	if (!data)
+		Sys_Error ("TexMgr_BenchImage: out of memory");
+	for (i = 0; i < width * height + width + 1; i++)
+		data[i] = (rand () & 0xffff) | ((unsigned)(rand () & 0xffff) << 16);
+	return data;
+}
+
+/*
+================
+TexMgr_HashKernels -- hashes the output of k on all the awkward sizes
+================
+*/
+static uint64_t TexMgr_HashKernels (const texkernels_t *k)
+{
+	unsigned	*src, *out;
+	uint64_t	hash = 0;
+	int		i, w, h;
+
+	srand (1234);
+	for (i = 0; i < (int)Q_COUNTOF(texbench_sizes); i++)
+	{
+		w = texbench_sizes[i][0];
+		h = texbench_sizes[i][1];
+		src = TexMgr_BenchImage (w, h);
+		out = TexMgr_BenchImage (TexMgr_Pad (w), TexMgr_Pad (h));
+
+		// mipmaps, into another buffer and then in place
+		k->mipmapw (src, out, w, h);
+		hash = Hash_Block64 (out, ((w*h)>>1) * 4, hash);
+		memcpy (out, src, w*h*4);
+		k->mipmapw (out, out, w, h);
+		hash = Hash_Block64 (out, ((w*h)>>1) * 4, hash);
+
+		k->mipmaph (src, out, w, h);
+		hash = Hash_Block64 (out, (h>>1) * w * 4, hash);
+		memcpy (out, src, w*h*4);
+		k->mipmaph (out, out, w, h);
+		hash = Hash_Block64 (out, (h>>1) * w * 4, hash);
+
+		// the C resample divides by zero on 1 wide images
+		if (w > 1 && h > 1)
+		{
+			k->resample (src, w, h, out, true);
+			hash = Hash_Block64 (out, TexMgr_Pad (w) * TexMgr_Pad (h) * 4, hash);
+			k->resample (src, w, h, out, false);
+			hash = Hash_Block64 (out, TexMgr_Pad (w) * TexMgr_Pad (h) * 4, hash);
+		}
+
+		free (src);
+		free (out);
+	}
+
+	return hash;
+}
+
+typedef struct
+{
+	unsigned	*src, *dst;
+	int		size, small, iterations;
+} texbench_t;
+
+static void TexMgr_BenchKernels (const kernelinfo_t *kernels, void *data, kernelbench_t *result)
+{
+	const texkernels_t	*k = (const texkernels_t *) kernels;
+	texbench_t		*bench = (texbench_t *) data;
+	double			start, t_mipw, t_miph, t_resample, mb;
+	int			j;
+
+	result->hash = TexMgr_HashKernels (k);
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < bench->iterations; j++)
+		k->mipmapw (bench->src, bench->dst, bench->size, bench->size);
+	t_mipw = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < bench->iterations; j++)
+		k->mipmaph (bench->src, bench->dst, bench->size, bench->size);
+	t_miph = Sys_DoubleTime () - start;
+
+	start = Sys_DoubleTime ();
+	for (j = 0; j < bench->iterations; j++)
+		k->resample (bench->src, bench->small, bench->small, bench->dst, true);
+	t_resample = Sys_DoubleTime () - start;
+
+	mb = (double) bench->size * bench->size * 4 * bench->iterations / (1024 * 1024);
+	result->time = t_mipw + t_miph + t_resample;
+	q_snprintf (result->columns, sizeof(result->columns), "%8.0f %8.0f %8.0f",
+		    mb / q_max (t_mipw, 0.000001), mb / q_max (t_miph, 0.000001), mb / q_max (t_resample, 0.000001));
+}
+
+static void TexMgr_TextureBench_f (void)
+{
+	texbench_t	bench;
+
+	bench.size = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 1024;
+	bench.size = TexMgr_Pad (CLAMP (16, bench.size, 8192));
+	bench.iterations = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 10;
+	bench.iterations = q_max (bench.iterations, 1);
+	bench.small = bench.size * 3 / 4 + 1;
+
+	srand (1234);
+	bench.src = TexMgr_BenchImage (bench.size, bench.size);
+	bench.dst = TexMgr_BenchImage (bench.size, bench.size);
+
+	Con_Printf ("texture kernels, %dx%d x %d iterations, using %s\n", bench.size, bench.size, bench.iterations, tex_kernels->info.name);
+	Con_Printf ("       mipmapw  mipmaph  resample (MB/s)  speedup\n");
+
+	COM_BenchKernels (tex_kernellist, Q_COUNTOF(tex_kernellist), TexMgr_BenchKernels, &bench);
+
+	free (bench.src);
+	free (bench.dst);
 }
 
 /*
@@ -860,15 +1274,13 @@ static void TexMgr_AlphaEdgeFix (byte *data, int width, int height)
 TexMgr_PadEdgeFixW -- special case of AlphaEdgeFix for textures that only need it because they were padded
 
 operates in place on 32bit data, and expects unpadded height and width values
+along with the padded ones
 ===============
 */
-static void TexMgr_PadEdgeFixW (byte *data, int width, int height)
+static void TexMgr_PadEdgeFixW (byte *data, int width, int height, int padw, int padh)
 {
 	byte *src, *dst;
-	int i, padw, padh;
-
-	padw = TexMgr_PadConditional(width);
-	padh = TexMgr_PadConditional(height);
+	int i;
 
 	//copy last full column to first empty column, leaving alpha byte at zero
 	src = data + (width - 1) * 4;
@@ -898,15 +1310,13 @@ static void TexMgr_PadEdgeFixW (byte *data, int width, int height)
 TexMgr_PadEdgeFixH -- special case of AlphaEdgeFix for textures that only need it because they were padded
 
 operates in place on 32bit data, and expects unpadded height and width values
+along with the padded ones
 ===============
 */
-static void TexMgr_PadEdgeFixH (byte *data, int width, int height)
+static void TexMgr_PadEdgeFixH (byte *data, int width, int height, int padw, int padh)
 {
 	byte *src, *dst;
-	int i, padw, padh;
-
-	padw = TexMgr_PadConditional(width);
-	padh = TexMgr_PadConditional(height);
+	int i;
 
 	//copy last full row to first empty row, leaving alpha byte at zero
 	dst = data + height * padw * 4;
@@ -938,36 +1348,25 @@ static void TexMgr_PadEdgeFixH (byte *data, int width, int height)
 TexMgr_8to32
 ================
 */
-static unsigned *TexMgr_8to32 (byte *in, int pixels, unsigned int *usepal)
+static void TexMgr_8to32 (byte *in, unsigned *out, int pixels, unsigned int *usepal)
 {
 	int i;
-	unsigned *out, *data;
-
-	out = data = (unsigned *) Hunk_Alloc(pixels*4);
 
 	for (i = 0; i < pixels; i++)
 		*out++ = usepal[*in++];
-
-	return data;
 }
 
 /*
 ================
-TexMgr_PadImageW -- return image with width padded up to power-of-two dimentions
+TexMgr_PadImageW -- pad width up to power-of-two dimentions
 ================
 */
-static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
+static void TexMgr_PadImageW (byte *in, byte *out, int width, int height, byte padbyte)
 {
 	int i, j, outwidth;
-	byte *out, *data;
-
-	if (width == TexMgr_Pad(width))
-		return in;
 
 	outwidth = TexMgr_Pad(width);
 
-	out = data = (byte *) Hunk_Alloc(outwidth*height);
-
 	for (i = 0; i < height; i++)
 	{
 		for (j = 0; j < width; j++)
@@ -975,112 +1374,527 @@ static byte *TexMgr_PadImageW (byte *in, int width, int height, byte padbyte)
 		for (  ; j < outwidth; j++)
 			*out++ = padbyte;
 	}
-
-	return data;
 }
 
 /*
 ================
-TexMgr_PadImageH -- return image with height padded up to power-of-two dimentions
+TexMgr_PadImageH -- pad height up to power-of-two dimentions, in and out may be the same
 ================
 */
-static byte *TexMgr_PadImageH (byte *in, int width, int height, byte padbyte)
+static void TexMgr_PadImageH (byte *in, byte *out, int width, int height, byte padbyte)
 {
 	int i, srcpix, dstpix;
-	byte *data, *out;
-
-	if (height == TexMgr_Pad(height))
-		return in;
 
 	srcpix = width * height;
 	dstpix = width * TexMgr_Pad(height);
 
-	out = data = (byte *) Hunk_Alloc(dstpix);
-
 	for (i = 0; i < srcpix; i++)
 		*out++ = *in++;
 	for (     ; i < dstpix; i++)
 		*out++ = padbyte;
-
-	return data;
 }
 
+/*
+================================================================================
+
+	THREADED LOADING
+
+Everything between the source pixels and glTexImage2D -- padding, palette
+conversion, edge fixing, resampling and the whole mip chain -- is done by
+a texjob_t on the worker threads.  The main thread works out the final
+size up front, so gltexture_t is complete as soon as TexMgr_LoadImage
+returns, and only the upload is left for later: finished jobs are
+uploaded a few milliseconds' worth per frame, and GL_Bind uploads a
+texture on the spot if its turn hasn't come yet.
+
+A job is a single malloc holding its own copy of the source and every
+buffer the worker needs, so the worker never allocates anything.
+
+With gl_texturecache on, mipmapped replacement textures are stored as
+S3TC blocks: the worker looks for <userdir>/texcache/<key>.qtc, where
+TexCache_Key covers the source path, crc, flags, sizes and pixels, and
+on a miss builds the mip chain as usual, encodes it and writes the file.
+Either way the blocks go up with glCompressedTexImage2D.
+
+================================================================================
+*/
+
+#define	MAX_TEXJOB_LEVELS	32
+#define	MAX_TEXJOB_BYTES	(128 * 1024 * 1024)	// finished or not, before we start uploading to make room
+#define	TEXJOB_ALIGN(n)		(((size_t)(n) + 15) & ~(size_t)15)
+
+typedef struct texjob_s
+{
+	struct texjob_s	*next;
+	gltexture_t	*glt;
+	taskgroup_t	group;
+	size_t		size;
+
+// set up by the main thread
+	qboolean	indexed;
+	unsigned int	flags;
+	int		width, height;		// of src
+	int		padwidth, padheight;	// indexed images are padded to this
+	int		source_width, source_height;
+	byte		padbyte;
+	int		mipwidth, mipheight;	// shrink to this before the mip chain
+	qboolean	mipmap;
+	unsigned int	palette[256];
+	byte		*src;
+	byte		*pad8;			// NULL if not padded
+	unsigned	*rgba;			// padwidth * padheight, or src for SRC_RGBA
+	unsigned	*resampled;		// NULL if already a power of two
+	unsigned	*mips;
+	const texkernels_t	*kernels;
+	byte		*blocks;		// NULL if not cached, else the encoded chain
+	texcache_header_t	cache;		// all but the key
+	char		cachesource[MAX_QPATH];	// glt source_file and source_crc, for the key
+	unsigned short	cachecrc;
+
+// filled in by the worker
+	int		numlevels;
+	unsigned	*levels[MAX_TEXJOB_LEVELS];
+	int		levelwidth[MAX_TEXJOB_LEVELS];
+	int		levelheight[MAX_TEXJOB_LEVELS];
+	int		cacheresult;
+	char		cachepath[MAX_OSPATH];
+} texjob_t;
+
+enum
+{
+	TEXJOB_CACHE_NONE,
+	TEXJOB_CACHE_HIT,
+	TEXJOB_CACHE_WRITTEN,
+	TEXJOB_CACHE_WRITEFAILED
+};
+
+static texjob_t	*texjobs;		// oldest first
+static size_t	texjobs_bytes;
+static char	texcache_dir[MAX_OSPATH];
+
 /*
 ================
-TexMgr_LoadImage32 -- handles 32bit source data
+TexMgr_BuildLevels -- pixels to the final rgba mip chain
 ================
 */
-static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
+static void TexMgr_BuildLevels (texjob_t *job)
 {
-	int	internalformat,	miplevel, mipwidth, mipheight, picmip;
+	unsigned	*pixels, *mip;
+	byte		*indexed;
+	int		width, height;
 
-	if (!gl_texture_NPOT)
+	width = job->width;
+	height = job->height;
+
+	if (job->indexed)
+	{
+		// pad each dimention
+		indexed = job->src;
+		if (job->padwidth != width)
+		{
+			TexMgr_PadImageW (indexed, job->pad8, width, height, job->padbyte);
+			indexed = job->pad8;
+			width = job->padwidth;
+		}
+		if (job->padheight != height)
+		{
+			TexMgr_PadImageH (indexed, job->pad8, width, height, job->padbyte);
+			indexed = job->pad8;
+			height = job->padheight;
+		}
+
+		// convert to 32bit
+		pixels = job->rgba;
+		TexMgr_8to32 (indexed, pixels, width * height, job->palette);
+
+		// fix edges
+		if (job->flags & TEXPREF_ALPHA)
+			TexMgr_AlphaEdgeFix ((byte *)pixels, width, height);
+		else
+		{
+			if (job->padwidth != job->width)
+				TexMgr_PadEdgeFixW ((byte *)pixels, job->source_width, job->source_height, width, height);
+			if (job->padheight != job->height)
+				TexMgr_PadEdgeFixH ((byte *)pixels, job->source_width, job->source_height, width, height);
+		}
+	}
+	else
+		pixels = job->rgba;
+
+	// resample up
+	if (job->resampled)
 	{
-		// resample up
-		data = TexMgr_ResampleTexture (data, glt->width, glt->height, glt->flags & TEXPREF_ALPHA);
-		glt->width = TexMgr_Pad(glt->width);
-		glt->height = TexMgr_Pad(glt->height);
+		job->kernels->resample (pixels, width, height, job->resampled, job->flags & TEXPREF_ALPHA);
+		pixels = job->resampled;
+		width = TexMgr_Pad(width);
+		height = TexMgr_Pad(height);
 	}
 
 	// mipmap down
-	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
-	mipwidth = TexMgr_SafeTextureSize (glt->width >> picmip);
-	mipheight = TexMgr_SafeTextureSize (glt->height >> picmip);
-	while ((int) glt->width > mipwidth)
+	while (width > job->mipwidth)
 	{
-		TexMgr_MipMapW (data, glt->width, glt->height);
-		glt->width >>= 1;
-		if (glt->flags & TEXPREF_ALPHA)
-			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+		job->kernels->mipmapw (pixels, pixels, width, height);
+		width >>= 1;
+		if (job->flags & TEXPREF_ALPHA)
+			TexMgr_AlphaEdgeFix ((byte *)pixels, width, height);
 	}
-	while ((int) glt->height > mipheight)
+	while (height > job->mipheight)
 	{
-		TexMgr_MipMapH (data, glt->width, glt->height);
-		glt->height >>= 1;
-		if (glt->flags & TEXPREF_ALPHA)
-			TexMgr_AlphaEdgeFix ((byte *)data, glt->width, glt->height);
+		job->kernels->mipmaph (pixels, pixels, width, height);
+		height >>= 1;
+		if (job->flags & TEXPREF_ALPHA)
+			TexMgr_AlphaEdgeFix ((byte *)pixels, width, height);
 	}
 
-	// upload
-	GL_Bind (glt);
-	internalformat = (glt->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
-	glTexImage2D (GL_TEXTURE_2D, 0, internalformat, glt->width, glt->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	job->levels[0] = pixels;
+	job->levelwidth[0] = width;
+	job->levelheight[0] = height;
+	job->numlevels = 1;
 
-	// upload mipmaps
-	if (glt->flags & TEXPREF_MIPMAP && !(glt->flags & TEXPREF_WARPIMAGE)) // warp image mipmaps are generated later
-	{
-		mipwidth = glt->width;
-		mipheight = glt->height;
+	// the mip chain, each level in its own slot so they can all be uploaded later
+	if (!job->mipmap)
+		return;
 
-		for (miplevel = 1; mipwidth > 1 || mipheight > 1; miplevel++)
+	for (mip = job->mips; width > 1 || height > 1; pixels = mip, mip += width * height)
+	{
+		if (width > 1)
 		{
-			if (mipwidth > 1)
-			{
-				TexMgr_MipMapW (data, mipwidth, mipheight);
-				mipwidth >>= 1;
-			}
-			if (mipheight > 1)
+			job->kernels->mipmapw (pixels, mip, width, height);
+			width >>= 1;
+			if (height > 1)
 			{
-				TexMgr_MipMapH (data, mipwidth, mipheight);
-				mipheight >>= 1;
+				job->kernels->mipmaph (mip, mip, width, height);
+				height >>= 1;
 			}
-			glTexImage2D (GL_TEXTURE_2D, miplevel, internalformat, mipwidth, mipheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		}
+		else
+		{
+			job->kernels->mipmaph (pixels, mip, width, height);
+			height >>= 1;
+		}
+
+		job->levels[job->numlevels] = mip;
+		job->levelwidth[job->numlevels] = width;
+		job->levelheight[job->numlevels] = height;
+		job->numlevels++;
+	}
+}
+
+/*
+================
+TexMgr_BuildImage -- the cpu stage, runs on a worker thread
+================
+*/
+static void TexMgr_BuildImage (void *data, int index)
+{
+	texjob_t	*job = (texjob_t *) data;
+	byte		*out;
+	int		i;
+
+	if (job->blocks)
+	{
+		job->cache.key = TexCache_Key (job->cachesource, job->cachecrc, job->flags, job->width, job->height,
+					       job->cache.width, job->cache.height, (const unsigned *) job->src);
+		TexCache_Path (job->cachepath, sizeof(job->cachepath), texcache_dir, job->cache.key);
+		if (TexCache_Read (job->cachepath, &job->cache, job->blocks))
+		{
+			job->cacheresult = TEXJOB_CACHE_HIT;
+			return;
+		}
+	}
+
+	TexMgr_BuildLevels (job);
+
+	if (job->blocks)
+	{
+		for (i = 0, out = job->blocks; i < job->numlevels; i++)
+		{
+			TexCache_EncodeLevel (job->cache.format, job->levels[i], job->levelwidth[i], job->levelheight[i], out);
+			out += TexCache_LevelSize (job->cache.format, job->levelwidth[i], job->levelheight[i]);
+		}
+		if (TexCache_Write (job->cachepath, &job->cache, job->blocks))
+			job->cacheresult = TEXJOB_CACHE_WRITTEN;
+		else
+			job->cacheresult = TEXJOB_CACHE_WRITEFAILED;
+	}
+}
+
+/*
+================
+TexMgr_UploadJob
+================
+*/
+static void TexMgr_UploadJob (texjob_t *job)
+{
+	int	internalformat, width, height, size, i;
+	byte	*blocks;
+
+	GL_Bind (job->glt);
+	if (job->blocks)
+	{
+		internalformat = (job->cache.format == TEXCACHE_BC3) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		width = job->cache.width;
+		height = job->cache.height;
+		for (i = 0, blocks = job->blocks; i < job->cache.numlevels; i++, blocks += size)
+		{
+			size = TexCache_LevelSize (job->cache.format, width, height);
+			GL_CompressedTexImage2DFunc (GL_TEXTURE_2D, i, internalformat, width, height, 0, size, blocks);
+			width = q_max(width >> 1, 1);
+			height = q_max(height >> 1, 1);
 		}
 	}
+	else
+	{
+		internalformat = (job->flags & TEXPREF_ALPHA) ? gl_alpha_format : gl_solid_format;
+		for (i = 0; i < job->numlevels; i++)
+			glTexImage2D (GL_TEXTURE_2D, i, internalformat, job->levelwidth[i], job->levelheight[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, job->levels[i]);
+	}
 
 	// set filter modes
-	TexMgr_SetFilterModes (glt);
+	TexMgr_SetFilterModes (job->glt);
+}
+
+/*
+================
+TexMgr_FinishJob -- waits for the cpu stage, then uploads the result unless cancelled
+================
+*/
+static void TexMgr_FinishJob (texjob_t *job, qboolean upload)
+{
+	texjob_t	**link;
+
+	Task_Wait (&job->group);
+
+	for (link = &texjobs; *link != job; link = &(*link)->next)
+		;
+	*link = job->next;
+	texjobs_bytes -= job->size;
+	job->glt->job = NULL;
+
+	if (job->cacheresult == TEXJOB_CACHE_WRITEFAILED)
+		Con_DPrintf ("couldn't write %s\n", job->cachepath);
+
+	if (upload)
+		TexMgr_UploadJob (job);
+
+	free (job);
+}
+
+/*
+================
+TexMgr_SubmitJob
+================
+*/
+static void TexMgr_SubmitJob (texjob_t *job)
+{
+	gltexture_t	*glt = job->glt;
+	texjob_t	**link;
+
+	// whatever was still on the way is stale now
+	if (glt->job)
+		TexMgr_FinishJob (glt->job, false);
+
+	// keep the memory held by jobs bounded
+	while (texjobs && texjobs_bytes + job->size > MAX_TEXJOB_BYTES)
+		TexMgr_FinishJob (texjobs, true);
+
+	for (link = &texjobs; *link; link = &(*link)->next)
+		;
+	*link = job;
+	job->next = NULL;
+	texjobs_bytes += job->size;
+	glt->job = job;
+
+	job->group.pending = 0;
+	if (Tasks_NumWorkers ())
+		Task_Submit (&job->group, TexMgr_BuildImage, job, 0);
+	else
+	{
+		TexMgr_BuildImage (job, 0);
+		TexMgr_FinishJob (job, true);
+	}
+}
+
+/*
+================
+TexMgr_UploadTextures -- uploads finished jobs, called once a frame
+
+stops after gl_texture_uploadms milliseconds
+================
+*/
+void TexMgr_UploadTextures (void)
+{
+	texjob_t	*job, *next;
+	double		end;
+
+	end = Sys_DoubleTime () + gl_texture_uploadms.value * 0.001;
+
+	for (job = texjobs; job; job = next)
+	{
+		next = job->next;
+		if (!Task_Done (&job->group))
+			continue;
+		TexMgr_FinishJob (job, true);
+		if (Sys_DoubleTime () >= end)
+			break;
+	}
+}
+
+/*
+================
+TexMgr_QueueImage -- sets up a job for an indexed or 32bit image
+
+indexed images are padded up to padwidth * padheight
+================
+*/
+static void TexMgr_QueueImage (gltexture_t *glt, byte *data, qboolean indexed, int padwidth, int padheight,
+			       byte padbyte, unsigned int *usepal)
+{
+	size_t		srcbytes, pad8bytes, rgbabytes, resampledbytes, mipbytes, blockbytes;
+	int		width, height, mipwidth, mipheight, picmip, numlevels;
+	qboolean	resample, mipmap;
+	texcache_header_t	cache;
+	texjob_t	*job;
+	byte		*mem;
+
+	width = padwidth;
+	height = padheight;
+
+	resample = !gl_texture_NPOT && (width != TexMgr_Pad(width) || height != TexMgr_Pad(height));
+	if (resample)
+	{
+		width = TexMgr_Pad(width);
+		height = TexMgr_Pad(height);
+	}
+
+	// work out the final size here, since glt has to be right when we return
+	picmip = (glt->flags & TEXPREF_NOPICMIP) ? 0 : q_max((int)gl_picmip.value, 0);
+	mipwidth = TexMgr_SafeTextureSize (width >> picmip);
+	mipheight = TexMgr_SafeTextureSize (height >> picmip);
+	while (width > mipwidth)
+		width >>= 1;
+	while (height > mipheight)
+		height >>= 1;
+
+	// warp image mipmaps are generated later
+	mipmap = (glt->flags & TEXPREF_MIPMAP) && !(glt->flags & TEXPREF_WARPIMAGE);
+	mipbytes = 0;
+	numlevels = 1;
+	if (mipmap)
+	{
+		// the mipmapw kernels write (w*h)/2 pixels, more than a level holds when w is odd
+		size_t	ofs = 0, end = 0;
+		int	w = width, h = height;
+
+		while (w > 1 || h > 1)
+		{
+			end = q_max(end, ofs + ((w > 1) ? (w * h) >> 1 : w * (h >> 1)));
+			w = q_max(w >> 1, 1);
+			h = q_max(h >> 1, 1);
+			ofs += w * h;
+			numlevels++;
+		}
+		mipbytes = q_max(end, ofs) * 4;
+	}
+
+	// mipmapped replacement textures can go through the compressed texture cache
+	blockbytes = 0;
+	if (gl_texturecache.value && gl_texture_s3tc_able && !indexed && mipmap && glt->source_file[0] &&
+	    !(width & 3) && !(height & 3))
+	{
+		if (!texcache_dir[0])
+		{
+			q_snprintf (texcache_dir, sizeof(texcache_dir), "%s/texcache", host_parms->userdir);
+			Sys_mkdir (texcache_dir);
+		}
+
+		memset (&cache, 0, sizeof(cache));
+		cache.magic = TEXCACHE_MAGIC;
+		cache.version = TEXCACHE_VERSION;
+		cache.format = (glt->flags & TEXPREF_ALPHA) ? TEXCACHE_BC3 : TEXCACHE_BC1;
+		cache.width = width;
+		cache.height = height;
+		cache.numlevels = numlevels;
+		cache.size = TexCache_ChainSize (cache.format, width, height, numlevels);
+
+		blockbytes = TEXJOB_ALIGN(cache.size);
+	}
+
+	// the resample kernels read up to a row and a pixel past their input
+	srcbytes = TEXJOB_ALIGN(glt->width * glt->height * (indexed ? 1 : 4) + (indexed ? 0 : (glt->width + 1) * 4));
+	pad8bytes = (indexed && (padwidth != (int) glt->width || padheight != (int) glt->height)) ? TEXJOB_ALIGN(padwidth * padheight) : 0;
+	rgbabytes = indexed ? TEXJOB_ALIGN((padwidth * padheight + padwidth + 1) * 4) : 0;
+	resampledbytes = resample ? TexMgr_Pad(padwidth) * TexMgr_Pad(padheight) * 4 : 0;
+
+	mem = (byte *) malloc (TEXJOB_ALIGN(sizeof(texjob_t)) + srcbytes + pad8bytes + rgbabytes + resampledbytes + mipbytes + blockbytes);
+	if (!mem)
+		Sys_Error ("TexMgr_QueueImage: out of memory for %s", glt->name);
+
+	job = (texjob_t *) mem;
+	job->size = TEXJOB_ALIGN(sizeof(texjob_t)) + srcbytes + pad8bytes + rgbabytes + resampledbytes + mipbytes + blockbytes;
+	job->glt = glt;
+	job->indexed = indexed;
+	job->flags = glt->flags;
+	job->width = glt->width;
+	job->height = glt->height;
+	job->padwidth = padwidth;
+	job->padheight = padheight;
+	job->source_width = glt->source_width;
+	job->source_height = glt->source_height;
+	job->padbyte = padbyte;
+	job->mipwidth = mipwidth;
+	job->mipheight = mipheight;
+	job->mipmap = mipmap;
+	job->kernels = tex_kernels;
+	job->cacheresult = TEXJOB_CACHE_NONE;
+	if (blockbytes)
+	{
+		job->cache = cache;
+		q_strlcpy (job->cachesource, glt->source_file, sizeof(job->cachesource));
+		job->cachecrc = glt->source_crc;
+	}
+	if (usepal)
+		memcpy (job->palette, usepal, sizeof(job->palette));
+
+	mem += TEXJOB_ALIGN(sizeof(texjob_t));
+	job->src = mem;
+	memcpy (job->src, data, glt->width * glt->height * (indexed ? 1 : 4));
+	mem += srcbytes;
+	job->pad8 = pad8bytes ? mem : NULL;
+	mem += pad8bytes;
+	job->rgba = indexed ? (unsigned *) mem : (unsigned *) job->src;
+	mem += rgbabytes;
+	job->resampled = resampledbytes ? (unsigned *) mem : NULL;
+	mem += resampledbytes;
+	job->mips = (unsigned *) mem;
+	mem += mipbytes;
+	job->blocks = blockbytes ? mem : NULL;
+
+	glt->width = width;
+	glt->height = height;
+
+	TexMgr_SubmitJob (job);
 }
 
 /*
 ================
-TexMgr_LoadImage8 -- handles 8bit source data, then passes it to LoadImage32
+TexMgr_LoadImage32 -- handles 32bit source data
+================
+*/
+static void TexMgr_LoadImage32 (gltexture_t *glt, unsigned *data)
+{
+	TexMgr_QueueImage (glt, (byte *)data, false, glt->width, glt->height, 0, NULL);
+}
+
+/*
+================
+TexMgr_LoadImage8 -- handles 8bit source data, then passes it to the cpu stage
 ================
 */
 static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 {
 	extern cvar_t gl_fullbrights;
-	qboolean padw = false, padh = false;
+	int padwidth, padheight;
 	byte padbyte;
 	unsigned int *usepal;
 	int i;
@@ -1135,38 +1949,17 @@ static void TexMgr_LoadImage8 (gltexture_t *glt, byte *data)
 	}
 
 	// pad each dimention, but only if it's not going to be downsampled later
+	padwidth = glt->width;
+	padheight = glt->height;
 	if (glt->flags & TEXPREF_PAD)
 	{
 		if ((int) glt->width < TexMgr_SafeTextureSize(glt->width))
-		{
-			data = TexMgr_PadImageW (data, glt->width, glt->height, padbyte);
-			glt->width = TexMgr_Pad(glt->width);
-			padw = true;
-		}
+			padwidth = TexMgr_Pad(glt->width);
 		if ((int) glt->height < TexMgr_SafeTextureSize(glt->height))
-		{
-			data = TexMgr_PadImageH (data, glt->width, glt->height, padbyte);
-			glt->height = TexMgr_Pad(glt->height);
-			padh = true;
-		}
+			padheight = TexMgr_Pad(glt->height);
 	}
 
-	// convert to 32bit
-	data = (byte *)TexMgr_8to32(data, glt->width * glt->height, usepal);
-
-	// fix edges
-	if (glt->flags & TEXPREF_ALPHA)
-		TexMgr_AlphaEdgeFix (data, glt->width, glt->height);
-	else
-	{
-		if (padw)
-			TexMgr_PadEdgeFixW (data, glt->source_width, glt->source_height);
-		if (padh)
-			TexMgr_PadEdgeFixH (data, glt->source_width, glt->source_height);
-	}
-
-	// upload it
-	TexMgr_LoadImage32 (glt, (unsigned *)data);
+	TexMgr_QueueImage (glt, data, true, padwidth, padheight, padbyte, usepal);
 }
 
 /*
@@ -1505,6 +2298,10 @@ void GL_Bind (gltexture_t *texture)
 	if (!texture)
 		texture = nulltexture;
 
+	// don't wait for TexMgr_UploadTextures to get to it
+	if (texture->job)
+		TexMgr_FinishJob (texture->job, true);
+
 	if (texture->texnum != currenttexture[currenttarget - GL_TEXTURE0_ARB])
 	{
 		currenttexture[currenttarget - GL_TEXTURE0_ARB] = texture->texnum;
@@ -1523,6 +2320,9 @@ from our per-TMU cached texture binding table.
 */
 static void GL_DeleteTexture (gltexture_t *texture)
 {
+	if (texture->job)
+		TexMgr_FinishJob (texture->job, false);
+
 	glDeleteTextures (1, &texture->texnum);
 
 	if (texture->texnum == currenttexture[0]) currenttexture[0] = GL_UNUSED_TEXTURE;
@@ -48,6 +48,7 @@ typedef struct gltexture_s {
 	GLuint			texnum;
 	struct gltexture_s	*next;
 	qmodel_t		*owner;
+	struct texjob_s		*job; //still being built or not uploaded yet
 //managed by image loading
 	char			name[64];
 	unsigned int		width; //size of image as it exists in opengl
@@ -91,6 +92,7 @@ gltexture_t *TexMgr_LoadImage (qmodel_t *owner, const char *name, int width, int
 void TexMgr_ReloadImage (gltexture_t *glt, int shirt, int pants);
 void TexMgr_ReloadImages (void);
 void TexMgr_ReloadNobrightImages (void);
+void TexMgr_UploadTextures (void);
 
 int TexMgr_Pad(int s);
 int TexMgr_SafeTextureSize (int s);
@@ -106,10 +106,14 @@ qboolean gl_anisotropy_able = false; //johnfitz
 float gl_max_anisotropy; //johnfitz
 qboolean gl_texture_NPOT = false; //ericw
 qboolean gl_vbo_able = false; //ericw
+qboolean gl_pbo_able = false;
 qboolean gl_glsl_able = false; //ericw
 GLint gl_max_texture_units = 0; //ericw
 qboolean gl_glsl_gamma_able = false; //ericw
 qboolean gl_glsl_alias_able = false; //ericw
+qboolean gl_instancing_able = false;
+qboolean gl_buffer_storage_able = false;
+qboolean gl_texture_s3tc_able = false;
 int gl_stencilbits;
 
 PFNGLMULTITEXCOORD2FARBPROC GL_MTexCoord2fFunc = NULL; //johnfitz
@@ -120,6 +124,8 @@ PFNGLBUFFERDATAARBPROC GL_BufferDataFunc = NULL; //ericw
 PFNGLBUFFERSUBDATAARBPROC GL_BufferSubDataFunc = NULL; //ericw
 PFNGLDELETEBUFFERSARBPROC GL_DeleteBuffersFunc = NULL; //ericw
 PFNGLGENBUFFERSARBPROC GL_GenBuffersFunc = NULL; //ericw
+PFNGLMAPBUFFERARBPROC GL_MapBufferFunc = NULL;
+PFNGLUNMAPBUFFERARBPROC GL_UnmapBufferFunc = NULL;
 
 QS_PFNGLCREATESHADERPROC GL_CreateShaderFunc = NULL; //ericw
 QS_PFNGLDELETESHADERPROC GL_DeleteShaderFunc = NULL; //ericw
@@ -147,6 +153,17 @@ QS_PFNGLUNIFORM4FPROC GL_Uniform4fFunc = NULL; //ericw
 
 QS_PFNGENERATEMIPMAP GL_GenerateMipmap = NULL;
 
+QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc = NULL;
+QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc = NULL;
+
+QS_PFNGLBUFFERSTORAGEPROC GL_BufferStorageFunc = NULL;
+QS_PFNGLMAPBUFFERRANGEPROC GL_MapBufferRangeFunc = NULL;
+QS_PFNGLFENCESYNCPROC GL_FenceSyncFunc = NULL;
+QS_PFNGLCLIENTWAITSYNCPROC GL_ClientWaitSyncFunc = NULL;
+QS_PFNGLDELETESYNCPROC GL_DeleteSyncFunc = NULL;
+
+QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc = NULL;
+
 //====================================
 
 //johnfitz -- new cvars
@@ -816,7 +833,10 @@ static void VID_Restart (void)
 	R_ScaleView_DeleteTexture ();
 	R_DeleteShaders ();
 	GL_DeleteBModelVertexBuffer ();
+	GL_DeleteLightmapBuffers ();
 	GLMesh_DeleteVertexBuffers ();
+	GLAlias_DeleteInstanceBuffer ();
+	GLParticles_DeleteBuffers ();
 
 //
 // set new mode
@@ -1028,6 +1048,32 @@ static void GL_CheckExtensions (void)
 		}
 	}
 
+	// ARB_pixel_buffer_object
+	//
+	if (COM_CheckParm("-nopbo"))
+		Con_Warning ("Pixel buffer objects disabled at command line\n");
+	else if (!gl_vbo_able)
+		Con_Warning ("Vertex buffer objects not available, skipping ARB_pixel_buffer_object check\n");
+	else if (gl_version_major >= 3 || (gl_version_major == 2 && gl_version_minor >= 1) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_pixel_buffer_object"))
+	{
+		GL_MapBufferFunc = (PFNGLMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glMapBufferARB");
+		GL_UnmapBufferFunc = (PFNGLUNMAPBUFFERARBPROC) SDL_GL_GetProcAddress("glUnmapBufferARB");
+		if (GL_MapBufferFunc && GL_UnmapBufferFunc)
+		{
+			Con_Printf("FOUND: ARB_pixel_buffer_object\n");
+			gl_pbo_able = true;
+		}
+		else
+		{
+			Con_Warning ("Couldn't link to pixel buffer object functions\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("ARB_pixel_buffer_object not available\n");
+	}
+
 	// multitexture
 	//
 	if (COM_CheckParm("-nomtex"))
@@ -1325,6 +1371,87 @@ static void GL_CheckExtensions (void)
 		if (GL_GenerateMipmap == NULL)
 			Con_Warning ("glGenerateMipmap not available, liquids won't have mipmaps\n");
 	}
+
+	// instanced arrays, for drawing every copy of an alias model in one call
+	//
+	if (COM_CheckParm("-noinstancing"))
+		Con_Warning ("Instanced rendering disabled at command line\n");
+	else if (gl_glsl_alias_able)
+	{
+		if (gl_version_major > 3 || (gl_version_major == 3 && gl_version_minor >= 3))
+		{
+			GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstanced");
+			GL_VertexAttribDivisorFunc = (QS_PFNGLVERTEXATTRIBDIVISORPROC) SDL_GL_GetProcAddress("glVertexAttribDivisor");
+		}
+		else if (GL_ParseExtensionList(gl_extensions, "GL_ARB_instanced_arrays"))
+		{
+			GL_DrawElementsInstancedFunc = (QS_PFNGLDRAWELEMENTSINSTANCEDPROC) SDL_GL_GetProcAddress("glDrawElementsInstancedARB");
+			GL_VertexAttribDivisorFunc = (QS_PFNGLVERTEXATTRIBDIVISORPROC) SDL_GL_GetProcAddress("glVertexAttribDivisorARB");
+		}
+
+		if (GL_DrawElementsInstancedFunc && GL_VertexAttribDivisorFunc)
+		{
+			Con_Printf("FOUND: ARB_instanced_arrays\n");
+			gl_instancing_able = true;
+		}
+		else
+		{
+			Con_Warning ("Instanced arrays not available\n");
+		}
+	}
+
+	// persistently mapped buffers, for streaming particles
+	//
+	if (COM_CheckParm("-nobufferstorage"))
+		Con_Warning ("ARB_buffer_storage disabled at command line\n");
+	else if (gl_vbo_able && (gl_version_major > 4 || (gl_version_major == 4 && gl_version_minor >= 4) ||
+		 GL_ParseExtensionList(gl_extensions, "GL_ARB_buffer_storage")))
+	{
+		GL_BufferStorageFunc = (QS_PFNGLBUFFERSTORAGEPROC) SDL_GL_GetProcAddress("glBufferStorage");
+		GL_MapBufferRangeFunc = (QS_PFNGLMAPBUFFERRANGEPROC) SDL_GL_GetProcAddress("glMapBufferRange");
+		GL_FenceSyncFunc = (QS_PFNGLFENCESYNCPROC) SDL_GL_GetProcAddress("glFenceSync");
+		GL_ClientWaitSyncFunc = (QS_PFNGLCLIENTWAITSYNCPROC) SDL_GL_GetProcAddress("glClientWaitSync");
+		GL_DeleteSyncFunc = (QS_PFNGLDELETESYNCPROC) SDL_GL_GetProcAddress("glDeleteSync");
+
+		if (GL_BufferStorageFunc && GL_MapBufferRangeFunc && GL_FenceSyncFunc && GL_ClientWaitSyncFunc && GL_DeleteSyncFunc)
+		{
+			Con_Printf("FOUND: ARB_buffer_storage\n");
+			gl_buffer_storage_able = true;
+		}
+		else
+		{
+			Con_Warning ("ARB_buffer_storage not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("ARB_buffer_storage not available\n");
+	}
+
+	// s3tc compressed textures, for the texture cache
+	//
+	if (COM_CheckParm("-nos3tc"))
+		Con_Warning ("EXT_texture_compression_s3tc disabled at command line\n");
+	else if (GL_ParseExtensionList(gl_extensions, "GL_EXT_texture_compression_s3tc"))
+	{
+		GL_CompressedTexImage2DFunc = (QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) SDL_GL_GetProcAddress("glCompressedTexImage2D");
+		if (!GL_CompressedTexImage2DFunc)
+			GL_CompressedTexImage2DFunc = (QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) SDL_GL_GetProcAddress("glCompressedTexImage2DARB");
+
+		if (GL_CompressedTexImage2DFunc)
+		{
+			Con_Printf("FOUND: EXT_texture_compression_s3tc\n");
+			gl_texture_s3tc_able = true;
+		}
+		else
+		{
+			Con_Warning ("EXT_texture_compression_s3tc not available\n");
+		}
+	}
+	else
+	{
+		Con_Warning ("EXT_texture_compression_s3tc not supported\n");
+	}
 }
 
 /*
@@ -1403,6 +1530,7 @@ static void GL_Init (void)
 
 	GLAlias_CreateShaders ();
 	GLWorld_CreateShaders ();
+	GLParticles_CreateShaders ();
 	GL_ClearBufferBindings ();
 }
 
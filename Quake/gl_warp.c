@@ -76,8 +76,6 @@ static void SubdividePolygon (int numverts, float *verts)
 	int		f, b;
 	float	dist[64];
 	float	frac;
-	glpoly_t	*poly;
-	float	s, t;
 
 	if (numverts > 60)
 		Sys_Error ("SubdividePolygon: numverts = %i", numverts);
@@ -135,15 +133,32 @@ static void SubdividePolygon (int numverts, float *verts)
 		return;
 	}
 
+	GL_AddWarpPoly (warpface, numverts, verts);
+}
+
+/*
+================
+GL_AddWarpPoly
+
+links a subdivided poly in right after the surface's first, undivided one.
+verts are numverts xyz triples.
+================
+*/
+void GL_AddWarpPoly (msurface_t *fa, int numverts, const float *verts)
+{
+	glpoly_t	*poly;
+	int		i;
+	float	s, t;
+
 	poly = (glpoly_t *) Hunk_Alloc (sizeof(glpoly_t) + (numverts-4) * VERTEXSIZE*sizeof(float));
-	poly->next = warpface->polys->next;
-	warpface->polys->next = poly;
+	poly->next = fa->polys->next;
+	fa->polys->next = poly;
 	poly->numverts = numverts;
 	for (i=0 ; i<numverts ; i++, verts+= 3)
 	{
 		VectorCopy (verts, poly->verts[i]);
-		s = DotProduct (verts, warpface->texinfo->vecs[0]);
-		t = DotProduct (verts, warpface->texinfo->vecs[1]);
+		s = DotProduct (verts, fa->texinfo->vecs[0]);
+		t = DotProduct (verts, fa->texinfo->vecs[1]);
 		poly->verts[i][3] = s;
 		poly->verts[i][4] = t;
 	}
@@ -85,14 +85,12 @@ typedef enum {
 	pt_static, pt_grav, pt_slowgrav, pt_fire, pt_explode, pt_explode2, pt_blob, pt_blob2
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
+// a new particle, as filled in by the effect code; r_part.c keeps the
+// live ones in per type arrays
 typedef struct particle_s
 {
-// driver-usable fields
 	vec3_t		org;
 	float		color;
-// drivers never touch the following fields
-	struct particle_s	*next;
 	vec3_t		vel;
 	float		ramp;
 	float		die;
@@ -143,6 +141,7 @@ extern	cvar_t	r_slimealpha;
 extern	cvar_t	r_litwater;
 extern	cvar_t	r_dynamic;
 extern	cvar_t	r_novis;
+extern	cvar_t	r_sortentities;
 extern	cvar_t	r_scale;
 
 extern	cvar_t	gl_clear;
@@ -184,6 +183,11 @@ extern PFNGLGENBUFFERSARBPROC  GL_GenBuffersFunc;
 extern	qboolean	gl_vbo_able;
 //ericw
 
+// pixel buffer objects, for streaming lightmap updates
+extern PFNGLMAPBUFFERARBPROC  GL_MapBufferFunc;
+extern PFNGLUNMAPBUFFERARBPROC  GL_UnmapBufferFunc;
+extern	qboolean	gl_pbo_able;
+
 //ericw -- GLSL
 
 // SDL 1.2 has a bug where it doesn't provide these typedefs on OS X!
@@ -243,6 +247,49 @@ extern	qboolean	gl_glsl_alias_able;
 //mipmapped warp textures
 extern QS_PFNGENERATEMIPMAP GL_GenerateMipmap;
 
+//instanced alias models
+typedef void (APIENTRYP QS_PFNGLDRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount);
+typedef void (APIENTRYP QS_PFNGLVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+extern QS_PFNGLDRAWELEMENTSINSTANCEDPROC GL_DrawElementsInstancedFunc;
+extern QS_PFNGLVERTEXATTRIBDIVISORPROC GL_VertexAttribDivisorFunc;
+extern	qboolean	gl_instancing_able;
+
+//persistently mapped streaming buffers
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT		0x0002
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT		0x0040
+#define GL_MAP_COHERENT_BIT		0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE	0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT	0x00000001
+#define GL_TIMEOUT_EXPIRED		0x911B
+#define GL_WAIT_FAILED			0x911D
+#endif
+typedef struct __GLsync *QS_GLsync;
+typedef void (APIENTRYP QS_PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptrARB size, const void *data, GLbitfield flags);
+typedef void *(APIENTRYP QS_PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptrARB offset, GLsizeiptrARB length, GLbitfield access);
+typedef QS_GLsync (APIENTRYP QS_PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRYP QS_PFNGLCLIENTWAITSYNCPROC) (QS_GLsync sync, GLbitfield flags, uint64_t timeout);
+typedef void (APIENTRYP QS_PFNGLDELETESYNCPROC) (QS_GLsync sync);
+extern QS_PFNGLBUFFERSTORAGEPROC GL_BufferStorageFunc;
+extern QS_PFNGLMAPBUFFERRANGEPROC GL_MapBufferRangeFunc;
+extern QS_PFNGLFENCESYNCPROC GL_FenceSyncFunc;
+extern QS_PFNGLCLIENTWAITSYNCPROC GL_ClientWaitSyncFunc;
+extern QS_PFNGLDELETESYNCPROC GL_DeleteSyncFunc;
+extern	qboolean	gl_buffer_storage_able;
+
+//s3tc compressed textures, for the texture cache
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+#endif
+typedef void (APIENTRYP QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const void *data);
+extern QS_PFNGLCOMPRESSEDTEXIMAGE2DPROC GL_CompressedTexImage2DFunc;
+extern	qboolean	gl_texture_s3tc_able;
+
 //ericw -- NPOT texture support
 extern	qboolean	gl_texture_NPOT;
 
@@ -306,8 +353,11 @@ extern overflowtimes_t dev_overflows; //this stores the last time overflow messa
 //johnfitz -- moved here from r_brush.c
 extern int gl_lightmap_format, lightmap_bytes;
 
-#define LMBLOCK_WIDTH	256	//FIXME: make dynamic. if we have a decent card there's no real reason not to use 4k or 16k (assuming there's no lightstyles/dynamics that need uploading...)
-#define LMBLOCK_HEIGHT	256 //Alternatively, use texture arrays, which would avoid the need to switch textures as often.
+// lightmap atlas size, picked from gl_lightmapsize by GL_BuildLightmaps at map load
+#define	MIN_LMBLOCK_SIZE	256
+#define	MAX_LMBLOCK_SIZE	4096
+#define	MAX_SURF_LIGHTMAP	256	// surface extents are limited to 2000 (126 luxels) by Mod_LoadFaces
+extern int lmblock_width, lmblock_height;
 
 typedef struct glRect_s {
 	unsigned short l,t,w,h;
@@ -321,11 +371,41 @@ struct lightmap_s
 
 	// the lightmap texture data needs to be kept in
 	// main memory so texsubimage can update properly
-	byte		*data;//[4*LMBLOCK_WIDTH*LMBLOCK_HEIGHT];
+	byte		*data;//[4*lmblock_width*lmblock_height];
 };
 extern struct lightmap_s *lightmaps;
 extern int lightmap_count;	//allocated lightmaps
 
+// per-texel lightmap kernels (r_lightmap.c), picked at runtime for the cpu
+typedef struct
+{
+	float	local[2];	// light position on the surface, relative to texturemins
+	float	rad;		// radius left after the distance to the plane
+	float	minlight;	// texels this far away or more are not lit
+	float	color[3];	// 8.8 fixed point color
+} lmdlight_t;
+
+typedef enum
+{
+	LMPACK_RGBA8,
+	LMPACK_BGRA8,
+	LMPACK_RGB10A2,
+	LMPACK_BGR10A2
+} lmpack_t;
+
+typedef struct
+{
+	kernelinfo_t	info;
+	// blocklights += lightmap * scale, count channels
+	void	(*accumulate) (unsigned *bl, const byte *lightmap, int count, unsigned scale);
+	void	(*dlight) (unsigned *bl, int smax, int tmax, const lmdlight_t *light);
+	// blocklights >> shift, clamped to maxval, packed into dest
+	void	(*store) (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift, unsigned maxval, lmpack_t pack);
+} lmkernels_t;
+
+extern const lmkernels_t *lm_kernels;
+void R_InitLightmapKernels (void);
+
 extern int gl_warpimagesize; //johnfitz -- for water warp
 
 extern qboolean r_drawflat_cheatsafe, r_fullbright_cheatsafe, r_lightmap_cheatsafe, r_drawworld_cheatsafe; //johnfitz
@@ -357,6 +437,7 @@ void R_NewGame (void);
 
 void R_AnimateLight (void);
 void R_MarkSurfaces (void);
+void R_ClearVisCache (void);
 qboolean R_CullBox (vec3_t emins, vec3_t emaxs);
 void R_StoreEfrags (efrag_t **ppefrag);
 qboolean R_CullModelForEntity (entity_t *e);
@@ -382,6 +463,7 @@ void R_DrawTextureChains_Water (qmodel_t *model, entity_t *ent, texchain_t chain
 void R_RenderDlights (void);
 void GL_BuildLightmaps (void);
 void GL_DeleteBModelVertexBuffer (void);
+void GL_DeleteLightmapBuffers (void);
 void GL_BuildBModelVertexBuffer (void);
 void GLMesh_LoadVertexBuffers (void);
 void GLMesh_DeleteVertexBuffers (void);
@@ -390,6 +472,7 @@ void R_RebuildAllLightmaps (void);
 int R_LightPoint (vec3_t p);
 
 void GL_SubdivideSurface (msurface_t *fa);
+void GL_AddWarpPoly (msurface_t *fa, int numverts, const float *verts);
 void R_BuildLightMap (msurface_t *surf, byte *dest, int stride);
 void R_RenderDynamicLightmaps (msurface_t *fa);
 void R_UploadLightmaps (void);
@@ -405,6 +488,11 @@ void R_DeleteShaders (void);
 
 void GLWorld_CreateShaders (void);
 void GLAlias_CreateShaders (void);
+void GLAlias_DeleteInstanceBuffer (void);
+void GLParticles_CreateShaders (void);
+void GLParticles_DeleteBuffers (void);
+void R_BeginAliasInstances (void);
+void R_FlushAliasInstances (void);
 void GL_DrawAliasShadow (entity_t *e);
 void DrawGLTriangleFan (glpoly_t *p);
 void DrawGLPoly (glpoly_t *p);
@@ -836,6 +836,7 @@ void Host_Init (void)
 	Cmd_Init ();
 	LOG_Init (host_parms);
 	Cvar_Init (); //johnfitz
+	Tasks_Init ();
 	COM_Init ();
 	COM_InitFilesystem ();
 	Host_InitLocal ();
@@ -943,6 +944,8 @@ void Host_Shutdown(void)
 		VID_Shutdown();
 	}
 
+	Tasks_Shutdown ();
+
 	LOG_Close ();
 
 	LOC_Shutdown ();
@@ -36,8 +36,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 static char loadfilename[MAX_OSPATH]; //file scope so that error messages can use it
 
+/* images are decoded through a small reader that is either backed by a
+ * FILE (buffered freads) or by the file contents mapped into memory, in
+ * which case the bytes are read straight from the mapping. */
 typedef struct stdio_buffer_s {
-	FILE *f;
+	FILE *f;		/* NULL if reading from memory */
+	long start;		/* file position of the first image byte */
+	long length;		/* image file length */
+	const byte *data;	/* points to buffer or to the mapped file */
 	unsigned char buffer[1024];
 	int size;
 	int pos;
@@ -47,11 +53,25 @@ static stdio_buffer_t *Buf_Alloc(FILE *f)
 {
 	stdio_buffer_t *buf = (stdio_buffer_t *) calloc(1, sizeof(stdio_buffer_t));
 	buf->f = f;
+	buf->start = ftell(f);
+	buf->length = com_filesize;
+	buf->data = buf->buffer;
+	return buf;
+}
+
+static stdio_buffer_t *Buf_AllocMem(const byte *data, int length)
+{
+	stdio_buffer_t *buf = (stdio_buffer_t *) calloc(1, sizeof(stdio_buffer_t));
+	buf->length = length;
+	buf->data = data;
+	buf->size = length;
 	return buf;
 }
 
 static void Buf_Free(stdio_buffer_t *buf)
 {
+	if (buf->f)
+		fclose(buf->f);
 	free(buf);
 }
 
@@ -59,6 +79,9 @@ static inline int Buf_GetC(stdio_buffer_t *buf)
 {
 	if (buf->pos >= buf->size)
 	{
+		if (!buf->f)
+			return EOF;
+
 		buf->size = fread(buf->buffer, 1, sizeof(buf->buffer), buf->f);
 		buf->pos = 0;
 		
@@ -66,9 +89,49 @@ static inline int Buf_GetC(stdio_buffer_t *buf)
 			return EOF;
 	}
 
-	return buf->buffer[buf->pos++];
+	return buf->data[buf->pos++];
+}
+
+static int Buf_GetLittleShort(stdio_buffer_t *buf)
+{
+	byte	b1, b2;
+
+	b1 = Buf_GetC(buf);
+	b2 = Buf_GetC(buf);
+
+	return (short)(b1 + b2*256);
+}
+
+static qboolean Buf_Read(stdio_buffer_t *buf, void *dest, int count)
+{
+	byte	*out = (byte *) dest;
+	int	c;
+
+	while (count--)
+	{
+		if ((c = Buf_GetC(buf)) == EOF)
+			return false;
+		*out++ = c;
+	}
+	return true;
+}
+
+/* seek to ofs relative to the start of the image file */
+static void Buf_Seek(stdio_buffer_t *buf, long ofs)
+{
+	if (!buf->f)
+	{
+		buf->pos = (int) CLAMP(0L, ofs, buf->length);
+		return;
+	}
+
+	fseek(buf->f, buf->start + ofs, SEEK_SET);
+	buf->size = buf->pos = 0;
 }
 
+static byte *Image_DecodeTGA (stdio_buffer_t *buf, int *width, int *height);
+static byte *Image_DecodePCX (stdio_buffer_t *buf, int *width, int *height);
+
 /*
 ============
 Image_LoadImage
@@ -80,17 +143,29 @@ TODO: search order: tga png jpg pcx lmp
 */
 byte *Image_LoadImage (const char *name, int *width, int *height)
 {
-	FILE	*f;
+	filemap_t	map;
+	stdio_buffer_t	*buf;
+	byte		*data;
 
 	q_snprintf (loadfilename, sizeof(loadfilename), "%s.tga", name);
-	COM_FOpenFile (loadfilename, &f, NULL);
-	if (f)
-		return Image_LoadTGA (f, width, height);
+	if (COM_MapFile (loadfilename, &map, NULL))
+	{
+		buf = Buf_AllocMem (map.data, map.size);
+		data = Image_DecodeTGA (buf, width, height);
+		Buf_Free (buf);
+		COM_UnmapFile (&map);
+		return data;
+	}
 
 	q_snprintf (loadfilename, sizeof(loadfilename), "%s.pcx", name);
-	COM_FOpenFile (loadfilename, &f, NULL);
-	if (f)
-		return Image_LoadPCX (f, width, height);
+	if (COM_MapFile (loadfilename, &map, NULL))
+	{
+		buf = Buf_AllocMem (map.data, map.size);
+		data = Image_DecodePCX (buf, width, height);
+		Buf_Free (buf);
+		COM_UnmapFile (&map);
+		return data;
+	}
 
 	return NULL;
 }
@@ -187,6 +262,18 @@ Image_LoadTGA
 =============
 */
 byte *Image_LoadTGA (FILE *fin, int *width, int *height)
+{
+	stdio_buffer_t	*buf;
+	byte		*data;
+
+	buf = Buf_Alloc(fin);
+	data = Image_DecodeTGA(buf, width, height);
+	Buf_Free(buf);
+
+	return data;
+}
+
+static byte *Image_DecodeTGA (stdio_buffer_t *buf, int *width, int *height)
 {
 	int				columns, rows, numPixels;
 	byte			*pixbuf;
@@ -194,22 +281,21 @@ byte *Image_LoadTGA (FILE *fin, int *width, int *height)
 	byte			*targa_rgba;
 	int				realrow; //johnfitz -- fix for upside-down targas
 	qboolean		upside_down; //johnfitz -- fix for upside-down targas
-	stdio_buffer_t	*buf;
 	targaheader_t	targa_header;
 
-	targa_header.id_length = fgetc(fin);
-	targa_header.colormap_type = fgetc(fin);
-	targa_header.image_type = fgetc(fin);
+	targa_header.id_length = Buf_GetC(buf);
+	targa_header.colormap_type = Buf_GetC(buf);
+	targa_header.image_type = Buf_GetC(buf);
 
-	targa_header.colormap_index = fgetLittleShort(fin);
-	targa_header.colormap_length = fgetLittleShort(fin);
-	targa_header.colormap_size = fgetc(fin);
-	targa_header.x_origin = fgetLittleShort(fin);
-	targa_header.y_origin = fgetLittleShort(fin);
-	targa_header.width = fgetLittleShort(fin);
-	targa_header.height = fgetLittleShort(fin);
-	targa_header.pixel_size = fgetc(fin);
-	targa_header.attributes = fgetc(fin);
+	targa_header.colormap_index = Buf_GetLittleShort(buf);
+	targa_header.colormap_length = Buf_GetLittleShort(buf);
+	targa_header.colormap_size = Buf_GetC(buf);
+	targa_header.x_origin = Buf_GetLittleShort(buf);
+	targa_header.y_origin = Buf_GetLittleShort(buf);
+	targa_header.width = Buf_GetLittleShort(buf);
+	targa_header.height = Buf_GetLittleShort(buf);
+	targa_header.pixel_size = Buf_GetC(buf);
+	targa_header.attributes = Buf_GetC(buf);
 
 	if (targa_header.image_type==1)
 	{
@@ -233,9 +319,7 @@ byte *Image_LoadTGA (FILE *fin, int *width, int *height)
 	targa_rgba = (byte *) Hunk_Alloc (numPixels*4);
 
 	if (targa_header.id_length != 0)
-		fseek(fin, targa_header.id_length, SEEK_CUR);  // skip TARGA image comment
-
-	buf = Buf_Alloc(fin);
+		Buf_Seek(buf, TARGAHEADERSIZE + targa_header.id_length);  // skip TARGA image comment
 
 	if (targa_header.image_type==1) // Uncompressed, paletted images
 	{
@@ -404,9 +488,6 @@ byte *Image_LoadTGA (FILE *fin, int *width, int *height)
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(fin);
-
 	*width = (int)(targa_header.width);
 	*height = (int)(targa_header.height);
 	return targa_rgba;
@@ -440,16 +521,25 @@ Image_LoadPCX
 ============
 */
 byte *Image_LoadPCX (FILE *f, int *width, int *height)
+{
+	stdio_buffer_t	*buf;
+	byte		*data;
+
+	buf = Buf_Alloc(f); //remembers the start of file (since we might be inside a pak file, SEEK_SET might not be the start of the pcx)
+	data = Image_DecodePCX(buf, width, height);
+	Buf_Free(buf);
+
+	return data;
+}
+
+static byte *Image_DecodePCX (stdio_buffer_t *buf, int *width, int *height)
 {
 	pcxheader_t	pcx;
-	int			x, y, w, h, readbyte, runlength, start;
+	int			x, y, w, h, readbyte, runlength;
 	byte		*p, *data;
 	byte		palette[768];
-	stdio_buffer_t  *buf;
-
-	start = ftell (f); //save start of file (since we might be inside a pak file, SEEK_SET might not be the start of the pcx)
 
-	if (!fread(&pcx, sizeof(pcx), 1, f))
+	if (!Buf_Read(buf, &pcx, sizeof(pcx)))
 		Sys_Error ("Failed reading header from '%s'", loadfilename);
 	pcx.xmin = (unsigned short)LittleShort (pcx.xmin);
 	pcx.ymin = (unsigned short)LittleShort (pcx.ymin);
@@ -472,14 +562,12 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 	data = (byte *) Hunk_Alloc((w*h+1)*4); //+1 to allow reading padding byte on last line
 
 	//load palette
-	fseek (f, start + com_filesize - 768, SEEK_SET);
-	if (!fread (palette, 768, 1, f))
+	Buf_Seek (buf, buf->length - 768);
+	if (!Buf_Read (buf, palette, 768))
 		Sys_Error ("Failed reading palette from '%s'", loadfilename);
 
 	//back to start of image data
-	fseek (f, start + sizeof(pcx), SEEK_SET);
-
-	buf = Buf_Alloc(f);
+	Buf_Seek (buf, sizeof(pcx));
 
 	for (y=0; y<h; y++)
 	{
@@ -509,9 +597,6 @@ byte *Image_LoadPCX (FILE *f, int *width, int *height)
 		}
 	}
 
-	Buf_Free(buf);
-	fclose(f);
-
 	*width = w;
 	*height = h;
 	return data;
@@ -752,17 +752,13 @@ static void PF_checkpos (void)
 
 //============================================================================
 
-static byte	*checkpvs;	//ericw -- changed to malloc
-static int	checkpvs_capacity;
+static mleaf_t	*checkleaf;	// PF_checkclient gets its PVS from the PVS cache, no copy is kept
 
 static int PF_newcheckclient (int check)
 {
 	int		i;
-	byte	*pvs;
 	edict_t	*ent;
-	mleaf_t	*leaf;
 	vec3_t	org;
-	int	pvsbytes;
 
 // cycle to the next one
 
@@ -799,18 +795,7 @@ static int PF_newcheckclient (int check)
 
 // get the PVS for the entity
 	VectorAdd (ent->v.origin, ent->v.view_ofs, org);
-	leaf = Mod_PointInLeaf (org, sv.worldmodel);
-	pvs = Mod_LeafPVS (leaf, sv.worldmodel);
-	
-	pvsbytes = (sv.worldmodel->numleafs+7)>>3;
-	if (checkpvs == NULL || pvsbytes > checkpvs_capacity)
-	{
-		checkpvs_capacity = pvsbytes;
-		checkpvs = (byte *) realloc (checkpvs, checkpvs_capacity);
-		if (!checkpvs)
-			Sys_Error ("PF_newcheckclient: realloc() failed on %d bytes", checkpvs_capacity);
-	}
-	memcpy (checkpvs, pvs, pvsbytes);
+	checkleaf = Mod_PointInLeaf (org, sv.worldmodel);
 
 	return i;
 }
@@ -836,6 +821,7 @@ static void PF_checkclient (void)
 {
 	edict_t	*ent, *self;
 	mleaf_t	*leaf;
+	const byte	*checkpvs;
 	int		l;
 	vec3_t	view;
 
@@ -859,6 +845,7 @@ static void PF_checkclient (void)
 	VectorAdd (self->v.origin, self->v.view_ofs, view);
 	leaf = Mod_PointInLeaf (view, sv.worldmodel);
 	l = (leaf - sv.worldmodel->leafs) - 1;
+	checkpvs = Mod_LeafPVS (checkleaf, sv.worldmodel);
 	if ( (l < 0) || !(checkpvs[l>>3] & (1 << (l & 7))) )
 	{
 		c_notvis++;
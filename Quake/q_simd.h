@@ -0,0 +1,74 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef _Q_SIMD_H
+#define _Q_SIMD_H
+
+/*
+ vector instruction sets
+
+Only included by the files that carry SIMD code paths.  Each path is
+compiled in when the compiler can generate it, and picked at runtime
+from com_cpufeatures, so one binary runs on every cpu of its arch.
+Every SIMD path must give exactly the same results as the C one.
+
+Kernel sets start with a kernelinfo_t; COM_PickKernels chooses one and
+COM_BenchKernels times them and checks them against C (common.h).
+
+USE_SSE2 / USE_AVX2 / USE_NEON say what was compiled in.  Functions
+using an instruction set the compiler doesn't enable by default must be
+marked with the matching SIMD_TARGET_ attribute.
+*/
+
+#if defined(_MSC_VER)
+#  define SIMD_TARGET_SSE2
+#  define SIMD_TARGET_AVX2
+#  if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define USE_SSE2	1
+#  endif
+#  if (_MSC_VER >= 1700) && (defined(_M_X64) || defined(_M_AMD64))
+#    define USE_AVX2	1
+#  endif
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  if defined(__clang__) || (__GNUC__ >= 5)
+#    define SIMD_TARGET_SSE2	__attribute__((target("sse2")))
+#    define SIMD_TARGET_AVX2	__attribute__((target("avx2")))
+#    define USE_SSE2	1
+#    define USE_AVX2	1
+#  elif defined(__SSE2__)
+#    define SIMD_TARGET_SSE2
+#    define USE_SSE2	1
+#  endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define USE_NEON	1
+#endif
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+#elif defined(USE_SSE2)
+#include <emmintrin.h>
+#endif
+#if defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
+#endif	/* _Q_SIMD_H */
+
@@ -65,6 +65,7 @@ typedef struct
 typedef struct
 {
 	sfx_t	*sfx;			/* sfx number					*/
+	sfxcache_t	*sc;		/* its data, pinned in the cache while playing	*/
 	int	leftvol;		/* 0-255 volume					*/
 	int	rightvol;		/* 0-255 volume					*/
 	int	end;			/* end time in global paintsamples		*/
@@ -105,6 +106,7 @@ void S_UnblockSound (void);
 
 sfx_t *S_PrecacheSound (const char *sample);
 void S_TouchSound (const char *sample);
+void S_PrefetchSound (const char *sample);
 void S_ClearPrecache (void);
 void S_BeginPrecaching (void);
 void S_EndPrecaching (void);
@@ -117,9 +119,26 @@ channel_t *SND_PickChannel (int entnum, int entchannel);
 /* spatializes a channel */
 void SND_Spatialize (channel_t *ch);
 
+/* stops a channel and hands its sound back to the main thread */
+void S_ReleaseChannel (channel_t *ch);
+
+/* called by the device when it has consumed some of the dma buffer */
+void S_WakeMixer (void);
+
 /* music stream support */
+typedef enum
+{
+	RAW_IDLE,
+	RAW_PLAY,
+	RAW_PAUSE
+} rawstate_t;
+
+int S_RawSpace (void);
 void S_RawSamples(int samples, int rate, int width, int channels, byte * data, float volume);
 				/* Expects data in signed 16 bit, or unsigned 8 bit format. */
+void S_RawClear (void);
+void S_RawSetState (rawstate_t state);
+int S_RawUnderruns (void);
 
 /* initializes cycling through a DMA buffer and returns information on it */
 qboolean SNDDMA_Init(dma_t *dma);
@@ -161,7 +180,6 @@ extern	volatile dma_t	*shm;
 extern	int		total_channels;
 extern	int		soundtime;
 extern	int		paintedtime;
-extern	int		s_rawend;
 
 extern	vec3_t		listener_origin;
 extern	vec3_t		listener_forward;
@@ -174,17 +192,23 @@ extern	cvar_t		snd_filterquality;
 extern	cvar_t		sfxvolume;
 extern	cvar_t		loadas8bit;
 
-#define	MAX_RAW_SAMPLES	8192
+#define	MAX_RAW_SAMPLES	32768	/* power of two, over 600 ms at 48kHz */
 extern	portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
+extern	SDL_atomic_t	s_rawhead, s_rawtail, s_rawdiscard, s_rawclears;
+extern	SDL_atomic_t	s_rawstate, s_rawunderruns;
 
 extern	cvar_t		bgmvolume;
 
 void S_LocalSound (const char *name);
 sfxcache_t *S_LoadSound (sfx_t *s);
+void S_PreloadSound (sfx_t *s);	/* resampled by the workers when precaching */
+void S_InitSoundCache (void);
 
 wavinfo_t GetWavinfo (const char *name, byte *wav, int wavlength);
 
 void SND_InitScaletable (void);
+void SND_InitMixKernels (void);
+void SND_UpdateLowpass (void);
 
 #endif	/* __QUAKE_SOUND__ */
 
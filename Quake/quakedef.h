@@ -218,6 +218,7 @@ typedef struct
 
 #include "cmd.h"
 #include "crc.h"
+#include "tasks.h"
 
 #include "progs.h"
 #include "server.h"
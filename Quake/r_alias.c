@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 extern cvar_t r_drawflat, gl_overbright_models, gl_fullbrights, r_lerpmodels, r_lerpmove; //johnfitz
 extern cvar_t scr_fov, cl_gun_fovscale;
+extern cvar_t r_instancemodels;
 
 //up to 16 color translated skins
 gltexture_t *playertextures[MAX_SCOREBOARD]; //johnfitz -- changed to an array of pointers
@@ -83,6 +84,21 @@ static GLint  useAlphaTestLoc;
 #define pose2NormalAttrIndex 3
 #define texCoordsAttrIndex 4
 
+// the instanced program reads these once per entity instead of once per vertex
+static GLuint r_alias_instanced_program;
+
+static GLint  instTexLoc;
+static GLint  instFullbrightTexLoc;
+static GLint  instUseFullbrightTexLoc;
+static GLint  instUseOverbrightLoc;
+static GLint  instUseAlphaTestLoc;
+
+#define modelRow0AttrIndex 5
+#define modelRow1AttrIndex 6
+#define modelRow2AttrIndex 7
+#define lightColorAttrIndex 8
+#define shadeBlendAttrIndex 9
+
 /*
 =============
 GLARB_GetXYZOffset
@@ -91,10 +107,10 @@ Returns the offset of the first vertex's meshxyz_t.xyz in the vbo for the given
 model and pose.
 =============
 */
-static void *GLARB_GetXYZOffset (aliashdr_t *hdr, int pose)
+static void *GLARB_GetXYZOffset (qmodel_t *m, aliashdr_t *hdr, int pose)
 {
 	const int xyzoffs = offsetof (meshxyz_t, xyz);
-	return (void *) (currententity->model->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + xyzoffs);
+	return (void *) (m->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + xyzoffs);
 }
 
 /*
@@ -105,10 +121,10 @@ Returns the offset of the first vertex's meshxyz_t.normal in the vbo for the
 given model and pose.
 =============
 */
-static void *GLARB_GetNormalOffset (aliashdr_t *hdr, int pose)
+static void *GLARB_GetNormalOffset (qmodel_t *m, aliashdr_t *hdr, int pose)
 {
 	const int normaloffs = offsetof (meshxyz_t, normal);
-	return (void *)(currententity->model->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + normaloffs);
+	return (void *)(m->vboxyzofs + (hdr->numverts_vbo * pose * sizeof (meshxyz_t)) + normaloffs);
 }
 
 /*
@@ -125,6 +141,18 @@ void GLAlias_CreateShaders (void)
 		{ "Pose2Vert", pose2VertexAttrIndex },
 		{ "Pose2Normal", pose2NormalAttrIndex }
 	};
+	const glsl_attrib_binding_t instbindings[] = {
+		{ "TexCoords", texCoordsAttrIndex },
+		{ "Pose1Vert", pose1VertexAttrIndex },
+		{ "Pose1Normal", pose1NormalAttrIndex },
+		{ "Pose2Vert", pose2VertexAttrIndex },
+		{ "Pose2Normal", pose2NormalAttrIndex },
+		{ "ModelRow0", modelRow0AttrIndex },
+		{ "ModelRow1", modelRow1AttrIndex },
+		{ "ModelRow2", modelRow2AttrIndex },
+		{ "LightColor", lightColorAttrIndex },
+		{ "ShadeBlend", shadeBlendAttrIndex }
+	};
 
 	const GLchar *vertSource = \
 		"#version 110\n"
@@ -160,6 +188,42 @@ void GLAlias_CreateShaders (void)
 		"	gl_FrontColor = LightColor * vec4(vec3(mix(dot1, dot2, Blend)), 1.0);\n"
 		"}\n";
 
+	const GLchar *instVertSource = \
+		"#version 110\n"
+		"\n"
+		"attribute vec4 TexCoords; // only xy are used \n"
+		"attribute vec4 Pose1Vert;\n"
+		"attribute vec3 Pose1Normal;\n"
+		"attribute vec4 Pose2Vert;\n"
+		"attribute vec3 Pose2Normal;\n"
+		"attribute vec4 ModelRow0; // the rest are per instance \n"
+		"attribute vec4 ModelRow1;\n"
+		"attribute vec4 ModelRow2;\n"
+		"attribute vec4 LightColor;\n"
+		"attribute vec4 ShadeBlend; // xyz is the shade vector, w the blend \n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"float r_avertexnormal_dot(vec3 vertexnormal) // from MH \n"
+		"{\n"
+		"        float dot = dot(vertexnormal, ShadeBlend.xyz);\n"
+		"        if (dot < 0.0)\n"
+		"            return 1.0 + dot * (13.0 / 44.0);\n"
+		"        else\n"
+		"            return 1.0 + dot;\n"
+		"}\n"
+		"void main()\n"
+		"{\n"
+		"	gl_TexCoord[0] = TexCoords;\n"
+		"	vec4 lerpedVert = mix(vec4(Pose1Vert.xyz, 1.0), vec4(Pose2Vert.xyz, 1.0), ShadeBlend.w);\n"
+		"	vec4 worldVert = vec4(dot(ModelRow0, lerpedVert), dot(ModelRow1, lerpedVert), dot(ModelRow2, lerpedVert), 1.0);\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * worldVert;\n"
+		"	FogFragCoord = gl_Position.w;\n"
+		"	float dot1 = r_avertexnormal_dot(Pose1Normal);\n"
+		"	float dot2 = r_avertexnormal_dot(Pose2Normal);\n"
+		"	gl_FrontColor = LightColor * vec4(vec3(mix(dot1, dot2, ShadeBlend.w)), 1.0);\n"
+		"}\n";
+
 	const GLchar *fragSource = \
 		"#version 110\n"
 		"\n"
@@ -189,6 +253,8 @@ void GLAlias_CreateShaders (void)
 		"	gl_FragColor = result;\n"
 		"}\n";
 
+	r_alias_instanced_program = 0;
+
 	if (!gl_glsl_alias_able)
 		return;
 
@@ -206,6 +272,20 @@ void GLAlias_CreateShaders (void)
 		useOverbrightLoc = GL_GetUniformLocation (&r_alias_program, "UseOverbright");
 		useAlphaTestLoc = GL_GetUniformLocation (&r_alias_program, "UseAlphaTest");
 	}
+
+	if (!gl_instancing_able)
+		return;
+
+	r_alias_instanced_program = GL_CreateProgram (instVertSource, fragSource, Q_COUNTOF(instbindings), instbindings);
+
+	if (r_alias_instanced_program != 0)
+	{
+		instTexLoc = GL_GetUniformLocation (&r_alias_instanced_program, "Tex");
+		instFullbrightTexLoc = GL_GetUniformLocation (&r_alias_instanced_program, "FullbrightTex");
+		instUseFullbrightTexLoc = GL_GetUniformLocation (&r_alias_instanced_program, "UseFullbrightTex");
+		instUseOverbrightLoc = GL_GetUniformLocation (&r_alias_instanced_program, "UseOverbright");
+		instUseAlphaTestLoc = GL_GetUniformLocation (&r_alias_instanced_program, "UseAlphaTest");
+	}
 }
 
 /*
@@ -247,11 +327,11 @@ void GL_DrawAliasFrame_GLSL (aliashdr_t *paliashdr, lerpdata_t lerpdata, gltextu
 	GL_EnableVertexAttribArrayFunc (pose2NormalAttrIndex);
 
 	GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)(intptr_t)currententity->model->vbostofs);
-	GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (paliashdr, lerpdata.pose1));
-	GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (paliashdr, lerpdata.pose2));
+	GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (currententity->model, paliashdr, lerpdata.pose1));
+	GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (currententity->model, paliashdr, lerpdata.pose2));
 // GL_TRUE to normalize the signed bytes to [-1 .. 1]
-	GL_VertexAttribPointerFunc (pose1NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (paliashdr, lerpdata.pose1));
-	GL_VertexAttribPointerFunc (pose2NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (paliashdr, lerpdata.pose2));
+	GL_VertexAttribPointerFunc (pose1NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (currententity->model, paliashdr, lerpdata.pose1));
+	GL_VertexAttribPointerFunc (pose2NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (currententity->model, paliashdr, lerpdata.pose2));
 
 // set uniforms
 	GL_Uniform1fFunc (blendLoc, blend);
@@ -625,6 +705,324 @@ void R_SetupAliasLighting (entity_t	*e)
 	VectorScale (lightcolor, 1.0f / 200.0f, lightcolor);
 }
 
+/*
+=================
+R_SetupAliasSkin -- picks the skin and fullbright textures, broken out from R_DrawAliasModel
+=================
+*/
+static void R_SetupAliasSkin (entity_t *e, aliashdr_t *paliashdr, gltexture_t **tx, gltexture_t **fb)
+{
+	int		anim, skinnum;
+
+	anim = (int)(cl.time*10) & 3;
+	skinnum = e->skinnum;
+	if ((skinnum >= paliashdr->numskins) || (skinnum < 0))
+	{
+		Con_DPrintf ("R_DrawAliasModel: no such skin # %d for '%s'\n", skinnum, e->model->name);
+		// ericw -- display skin 0 for winquake compatibility
+		skinnum = 0;
+	}
+	*tx = paliashdr->gltextures[skinnum][anim];
+	*fb = paliashdr->fbtextures[skinnum][anim];
+	if (e->colormap != vid.colormap && !gl_nocolors.value)
+	{
+		if ((uintptr_t)e >= (uintptr_t)&cl_entities[1] && (uintptr_t)e <= (uintptr_t)&cl_entities[cl.maxclients]) /* && !strcmp (currententity->model->name, "progs/player.mdl") */
+			*tx = playertextures[e - cl_entities - 1];
+	}
+	if (!gl_fullbrights.value)
+		*fb = NULL;
+}
+
+/*
+=============================================================
+
+	INSTANCED DRAWING
+
+During the opaque entity pass, alias models that would take the GLSL
+path are queued instead of drawn.  At the end of the pass the queue is
+sorted so that all entities sharing a model, skin and pose pair become
+one instanced draw, reading their transform, lighting and lerp from a
+single buffer uploaded once per pass.  The poses are vertex array
+offsets into the model's vbo, so they have to be part of the key.
+Colormapped players already get their own skin texture, so the skin
+covers the colormap too.
+
+=============================================================
+*/
+
+#define INSTANCE_FLOATS	20	// 3x4 model matrix, light color, shade vector + blend
+
+typedef struct
+{
+	qmodel_t	*model;
+	aliashdr_t	*paliashdr;
+	gltexture_t	*tx, *fb;
+	short		pose1, pose2;
+	float		data[INSTANCE_FLOATS];
+} aliasinstance_t;
+
+static aliasinstance_t	aliasinstances[MAX_VISEDICTS];
+static aliasinstance_t	*sortedinstances[MAX_VISEDICTS];
+static float		instancedata[MAX_VISEDICTS][INSTANCE_FLOATS];
+static int		numaliasinstances;
+static qboolean		aliasbatching;
+static GLuint		aliasinstancevbo;
+
+/*
+=================
+GLAlias_DeleteInstanceBuffer -- called before the GL context goes away
+=================
+*/
+void GLAlias_DeleteInstanceBuffer (void)
+{
+	if (!aliasinstancevbo)
+		return;
+
+	GL_DeleteBuffersFunc (1, &aliasinstancevbo);
+	aliasinstancevbo = 0;
+
+	GL_ClearBufferBindings ();
+}
+
+/*
+=================
+R_AliasInstanceMatrix
+
+Builds the rows of the matrix R_DrawAliasModel gets from R_RotateForEntity
+and the model's scale_origin/scale, for the shader to apply.
+=================
+*/
+static void R_AliasInstanceMatrix (lerpdata_t *lerpdata, unsigned char scale, aliashdr_t *paliashdr, float *rows)
+{
+	float	sy, cy, sp, cp, sr, cr, s;
+	float	rot[3][3];
+	int	i;
+
+	// yaw around z, then -pitch around y, then roll around x
+	sy = sin (DEG2RAD (lerpdata->angles[1]));
+	cy = cos (DEG2RAD (lerpdata->angles[1]));
+	sp = sin (DEG2RAD (-lerpdata->angles[0]));
+	cp = cos (DEG2RAD (-lerpdata->angles[0]));
+	sr = sin (DEG2RAD (lerpdata->angles[2]));
+	cr = cos (DEG2RAD (lerpdata->angles[2]));
+
+	rot[0][0] = cy*cp;	rot[0][1] = cy*sp*sr - sy*cr;	rot[0][2] = cy*sp*cr + sy*sr;
+	rot[1][0] = sy*cp;	rot[1][1] = sy*sp*sr + cy*cr;	rot[1][2] = sy*sp*cr - cy*sr;
+	rot[2][0] = -sp;	rot[2][1] = cp*sr;		rot[2][2] = cp*cr;
+
+	s = ENTSCALE_DECODE(scale);
+	for (i = 0; i < 3; i++, rows += 4)
+	{
+		rows[0] = rot[i][0] * s * paliashdr->scale[0];
+		rows[1] = rot[i][1] * s * paliashdr->scale[1];
+		rows[2] = rot[i][2] * s * paliashdr->scale[2];
+		rows[3] = lerpdata->origin[i] + s * DotProduct (rot[i], paliashdr->scale_origin);
+	}
+}
+
+/*
+=================
+R_AliasInstanceable
+=================
+*/
+static qboolean R_AliasInstanceable (entity_t *e)
+{
+	return aliasbatching && numaliasinstances < MAX_VISEDICTS &&
+		e != &cl.viewent && ENTALPHA_DECODE(e->alpha) == 1 &&
+		!r_drawflat_cheatsafe && !r_fullbright_cheatsafe && !r_lightmap_cheatsafe;
+}
+
+/*
+=================
+R_QueueAliasInstance
+
+Does the per entity part of R_DrawAliasModel and saves the results for
+R_FlushAliasInstances.
+=================
+*/
+static void R_QueueAliasInstance (entity_t *e, aliashdr_t *paliashdr, lerpdata_t *lerpdata)
+{
+	aliasinstance_t	*inst = &aliasinstances[numaliasinstances++];
+	float		*data = inst->data;
+
+	overbright = !!gl_overbright_models.value;
+	rs_aliaspolys += paliashdr->numtris;
+	R_SetupAliasLighting (e);
+
+	inst->model = e->model;
+	inst->paliashdr = paliashdr;
+	R_SetupAliasSkin (e, paliashdr, &inst->tx, &inst->fb);
+	inst->pose1 = lerpdata->pose1;
+	inst->pose2 = lerpdata->pose2;
+
+	R_AliasInstanceMatrix (lerpdata, e->scale, paliashdr, data);
+	data[12] = lightcolor[0];
+	data[13] = lightcolor[1];
+	data[14] = lightcolor[2];
+	data[15] = 1.0f;
+	data[16] = shadevector[0];
+	data[17] = shadevector[1];
+	data[18] = shadevector[2];
+	// poses the same means the animation is paused or r_lerpmodels is off
+	data[19] = (lerpdata->pose1 != lerpdata->pose2) ? lerpdata->blend : 0;
+}
+
+/*
+=================
+R_CompareAliasInstances
+=================
+*/
+static int R_CompareAliasInstances (const void *a, const void *b)
+{
+	const aliasinstance_t *x = *(aliasinstance_t * const *)a;
+	const aliasinstance_t *y = *(aliasinstance_t * const *)b;
+
+	if (x->model != y->model)
+		return ((uintptr_t)x->model < (uintptr_t)y->model) ? -1 : 1;
+	if (x->tx != y->tx)
+		return ((uintptr_t)x->tx < (uintptr_t)y->tx) ? -1 : 1;
+	if (x->fb != y->fb)
+		return ((uintptr_t)x->fb < (uintptr_t)y->fb) ? -1 : 1;
+	if (x->pose1 != y->pose1)
+		return x->pose1 - y->pose1;
+	return x->pose2 - y->pose2;
+}
+
+/*
+=================
+R_BeginAliasInstances -- called before the opaque entity pass
+=================
+*/
+void R_BeginAliasInstances (void)
+{
+	numaliasinstances = 0;
+	aliasbatching = (r_alias_instanced_program != 0 && r_instancemodels.value);
+}
+
+/*
+=================
+R_FlushAliasInstances -- called after the opaque entity pass, draws everything queued
+=================
+*/
+void R_FlushAliasInstances (void)
+{
+	const int	stride = INSTANCE_FLOATS * sizeof(float);
+	aliasinstance_t	*first;
+	aliashdr_t	*paliashdr;
+	qmodel_t	*m;
+	int		i, j, ofs;
+
+	aliasbatching = false;
+	if (!numaliasinstances)
+		return;
+
+	for (i = 0; i < numaliasinstances; i++)
+		sortedinstances[i] = &aliasinstances[i];
+	qsort (sortedinstances, numaliasinstances, sizeof(sortedinstances[0]), R_CompareAliasInstances);
+	for (i = 0; i < numaliasinstances; i++)
+		memcpy (instancedata[i], sortedinstances[i]->data, sizeof(instancedata[i]));
+
+	// orphan the old storage so we never wait for last frame's draws
+	if (!aliasinstancevbo)
+		GL_GenBuffersFunc (1, &aliasinstancevbo);
+	GL_BindBuffer (GL_ARRAY_BUFFER, aliasinstancevbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, numaliasinstances * stride, instancedata, GL_STREAM_DRAW_ARB);
+
+	if (gl_smoothmodels.value)
+		glShadeModel (GL_SMOOTH);
+	if (gl_affinemodels.value)
+		glHint (GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST);
+
+	GL_UseProgramFunc (r_alias_instanced_program);
+	GL_Uniform1iFunc (instTexLoc, 0);
+	GL_Uniform1iFunc (instFullbrightTexLoc, 1);
+	GL_Uniform1fFunc (instUseOverbrightLoc, !!gl_overbright_models.value);
+
+	GL_EnableVertexAttribArrayFunc (texCoordsAttrIndex);
+	GL_EnableVertexAttribArrayFunc (pose1VertexAttrIndex);
+	GL_EnableVertexAttribArrayFunc (pose2VertexAttrIndex);
+	GL_EnableVertexAttribArrayFunc (pose1NormalAttrIndex);
+	GL_EnableVertexAttribArrayFunc (pose2NormalAttrIndex);
+	GL_EnableVertexAttribArrayFunc (modelRow0AttrIndex);
+	GL_EnableVertexAttribArrayFunc (modelRow1AttrIndex);
+	GL_EnableVertexAttribArrayFunc (modelRow2AttrIndex);
+	GL_EnableVertexAttribArrayFunc (lightColorAttrIndex);
+	GL_EnableVertexAttribArrayFunc (shadeBlendAttrIndex);
+	GL_VertexAttribDivisorFunc (modelRow0AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (modelRow1AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (modelRow2AttrIndex, 1);
+	GL_VertexAttribDivisorFunc (lightColorAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (shadeBlendAttrIndex, 1);
+
+	for (i = 0; i < numaliasinstances; i = j)
+	{
+		first = sortedinstances[i];
+		for (j = i + 1; j < numaliasinstances; j++)
+			if (R_CompareAliasInstances (&sortedinstances[i], &sortedinstances[j]))
+				break;
+
+		m = first->model;
+		paliashdr = first->paliashdr;
+
+	// this group's slice of the instance buffer
+		ofs = i * stride;
+		GL_BindBuffer (GL_ARRAY_BUFFER, aliasinstancevbo);
+		GL_VertexAttribPointerFunc (modelRow0AttrIndex, 4, GL_FLOAT, GL_FALSE, stride, (void *)(intptr_t)(ofs + 0 * sizeof(float)));
+		GL_VertexAttribPointerFunc (modelRow1AttrIndex, 4, GL_FLOAT, GL_FALSE, stride, (void *)(intptr_t)(ofs + 4 * sizeof(float)));
+		GL_VertexAttribPointerFunc (modelRow2AttrIndex, 4, GL_FLOAT, GL_FALSE, stride, (void *)(intptr_t)(ofs + 8 * sizeof(float)));
+		GL_VertexAttribPointerFunc (lightColorAttrIndex, 4, GL_FLOAT, GL_FALSE, stride, (void *)(intptr_t)(ofs + 12 * sizeof(float)));
+		GL_VertexAttribPointerFunc (shadeBlendAttrIndex, 4, GL_FLOAT, GL_FALSE, stride, (void *)(intptr_t)(ofs + 16 * sizeof(float)));
+
+	// shared mesh, same as GL_DrawAliasFrame_GLSL
+		GL_BindBuffer (GL_ARRAY_BUFFER, m->meshvbo);
+		GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, m->meshindexesvbo);
+		GL_VertexAttribPointerFunc (texCoordsAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)(intptr_t)m->vbostofs);
+		GL_VertexAttribPointerFunc (pose1VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (m, paliashdr, first->pose1));
+		GL_VertexAttribPointerFunc (pose2VertexAttrIndex, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof (meshxyz_t), GLARB_GetXYZOffset (m, paliashdr, first->pose2));
+		GL_VertexAttribPointerFunc (pose1NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (m, paliashdr, first->pose1));
+		GL_VertexAttribPointerFunc (pose2NormalAttrIndex, 4, GL_BYTE, GL_TRUE, sizeof (meshxyz_t), GLARB_GetNormalOffset (m, paliashdr, first->pose2));
+
+		GL_Uniform1iFunc (instUseFullbrightTexLoc, (first->fb != NULL) ? 1 : 0);
+		GL_Uniform1iFunc (instUseAlphaTestLoc, (m->flags & MF_HOLEY) ? 1 : 0);
+
+		GL_SelectTexture (GL_TEXTURE0);
+		GL_Bind (first->tx);
+		if (first->fb)
+		{
+			GL_SelectTexture (GL_TEXTURE1);
+			GL_Bind (first->fb);
+		}
+
+		GL_DrawElementsInstancedFunc (GL_TRIANGLES, paliashdr->numindexes, GL_UNSIGNED_SHORT, (void *)(intptr_t)m->vboindexofs, j - i);
+
+		rs_aliaspasses += paliashdr->numtris * (j - i);
+	}
+
+// clean up
+	GL_VertexAttribDivisorFunc (modelRow0AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (modelRow1AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (modelRow2AttrIndex, 0);
+	GL_VertexAttribDivisorFunc (lightColorAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (shadeBlendAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (texCoordsAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose1VertexAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose2VertexAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose1NormalAttrIndex);
+	GL_DisableVertexAttribArrayFunc (pose2NormalAttrIndex);
+	GL_DisableVertexAttribArrayFunc (modelRow0AttrIndex);
+	GL_DisableVertexAttribArrayFunc (modelRow1AttrIndex);
+	GL_DisableVertexAttribArrayFunc (modelRow2AttrIndex);
+	GL_DisableVertexAttribArrayFunc (lightColorAttrIndex);
+	GL_DisableVertexAttribArrayFunc (shadeBlendAttrIndex);
+
+	GL_UseProgramFunc (0);
+	GL_SelectTexture (GL_TEXTURE0);
+	glHint (GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+	glShadeModel (GL_FLAT);
+
+	numaliasinstances = 0;
+}
+
 /*
 =================
 R_DrawAliasModel -- johnfitz -- almost completely rewritten
@@ -633,7 +1031,6 @@ R_DrawAliasModel -- johnfitz -- almost completely rewritten
 void R_DrawAliasModel (entity_t *e)
 {
 	aliashdr_t	*paliashdr;
-	int		anim, skinnum;
 	gltexture_t	*tx, *fb;
 	lerpdata_t	lerpdata;
 	qboolean	alphatest = !!(e->model->flags & MF_HOLEY);
@@ -652,6 +1049,15 @@ void R_DrawAliasModel (entity_t *e)
 	if (R_CullModelForEntity(e))
 		return;
 
+	//
+	// opaque models in the entity pass are drawn together later
+	//
+	if (R_AliasInstanceable (e))
+	{
+		R_QueueAliasInstance (e, paliashdr, &lerpdata);
+		return;
+	}
+
 	//
 	// transform it
 	//
@@ -701,23 +1107,7 @@ void R_DrawAliasModel (entity_t *e)
 	// set up textures
 	//
 	GL_DisableMultitexture();
-	anim = (int)(cl.time*10) & 3;
-	skinnum = e->skinnum;
-	if ((skinnum >= paliashdr->numskins) || (skinnum < 0))
-	{
-		Con_DPrintf ("R_DrawAliasModel: no such skin # %d for '%s'\n", skinnum, e->model->name);
-		// ericw -- display skin 0 for winquake compatibility
-		skinnum = 0;
-	}
-	tx = paliashdr->gltextures[skinnum][anim];
-	fb = paliashdr->fbtextures[skinnum][anim];
-	if (e->colormap != vid.colormap && !gl_nocolors.value)
-	{
-		if ((uintptr_t)e >= (uintptr_t)&cl_entities[1] && (uintptr_t)e <= (uintptr_t)&cl_entities[cl.maxclients]) /* && !strcmp (currententity->model->name, "progs/player.mdl") */
-			tx = playertextures[e - cl_entities - 1];
-	}
-	if (!gl_fullbrights.value)
-		fb = NULL;
+	R_SetupAliasSkin (e, paliashdr, &tx, &fb);
 
 	//
 	// draw it
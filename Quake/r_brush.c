@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 extern cvar_t gl_fullbrights, r_drawflat, gl_overbright, r_oldwater; //johnfitz
 extern cvar_t gl_zfix; // QuakeSpasm z-fighting fix
+extern cvar_t gl_lightmapsize, gl_lightmappbo, gl_bspcache, gl_subdivide_size;
 
 int		gl_lightmap_format;
 int		lightmap_bytes;
@@ -34,10 +35,37 @@ int		lightmap_bytes;
 struct lightmap_s	*lightmaps;
 int		lightmap_count;
 
-static int	allocated[LMBLOCK_WIDTH];
+int		lmblock_width = MIN_LMBLOCK_SIZE, lmblock_height = MIN_LMBLOCK_SIZE;
+
+static int	allocated[MAX_LMBLOCK_SIZE];
 static int	last_lightmap_allocated;
 
-static unsigned	blocklights[LMBLOCK_WIDTH*LMBLOCK_HEIGHT*3]; //johnfitz -- was 18*18, added lit support (*3) and loosened surface extents maximum (LMBLOCK_WIDTH*LMBLOCK_HEIGHT)
+static unsigned	blocklights[MAX_SURF_LIGHTMAP*MAX_SURF_LIGHTMAP*3]; //johnfitz -- was 18*18, added lit support (*3) and loosened surface extents maximum (MAX_SURF_LIGHTMAP*MAX_SURF_LIGHTMAP)
+
+// ring of pixel buffer objects that lightmap updates are streamed through,
+// so that glTexSubImage2D can return before the driver has read the data
+#define	NUM_LIGHTMAP_PBOS	4
+static GLuint	lightmap_pbos[NUM_LIGHTMAP_PBOS];
+static int	lightmap_pbo_next;
+
+// surfaces whose lightmaps need rebuilding before the next upload, and
+// one accumulation buffer per lightmap building job
+#define	MAX_LIGHTMAP_JOBS	17
+#define	MIN_SURFS_PER_JOB	8		// not worth a thread below this
+static msurface_t	**dirtysurfs;
+static unsigned		*jobblocklights[MAX_LIGHTMAP_JOBS];
+static int		numlightmapjobs;
+
+// how blocklights are stored, taken from the cvars on the main thread,
+// since the jobs must not read them
+typedef struct
+{
+	lmpack_t	pack;
+	int		shift, maxval;
+} lmstore_t;
+
+static void R_GetLightmapStore (lmstore_t *store);
+static void R_BuildLightMapInto (msurface_t *surf, byte *dest, int stride, unsigned *blocklights, const lmstore_t *store);
 
 
 /*
@@ -284,7 +312,6 @@ called during rendering
 */
 void R_RenderDynamicLightmaps (msurface_t *fa)
 {
-	byte		*base;
 	int			maps;
 	glRect_t    *theRect;
 	int smax, tmax;
@@ -326,11 +353,80 @@ dynamic:
 				theRect->w = (fa->light_s-theRect->l)+smax;
 			if ((theRect->h + theRect->t) < (fa->light_t + tmax))
 				theRect->h = (fa->light_t-theRect->t)+tmax;
-			base = lm->data;
-			base += fa->light_t * LMBLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, LMBLOCK_WIDTH*lightmap_bytes);
+			// built in R_BuildDirtyLightmaps, before the next upload
+			if (!fa->lightmapqueued)
+			{
+				fa->lightmapqueued = true;
+				VEC_PUSH (dirtysurfs, fa);
+			}
+		}
+	}
+}
+
+/*
+================
+R_BuildDirtyLightmapsJob
+
+Each job has its own accumulation buffer and takes every numlightmapjobs'th
+surface.  Surfaces never share lightmap texels, so the jobs don't overlap.
+================
+*/
+static void R_BuildDirtyLightmapsJob (void *data, int job)
+{
+	const lmstore_t	*store = (const lmstore_t *) data;
+	msurface_t	*fa;
+	byte		*base;
+	int			i, count;
+
+	count = VEC_SIZE (dirtysurfs);
+	for (i = job; i < count; i += numlightmapjobs)
+	{
+		fa = dirtysurfs[i];
+		fa->lightmapqueued = false;
+		base = lightmaps[fa->lightmaptexturenum].data;
+		base += fa->light_t * lmblock_width * lightmap_bytes + fa->light_s * lightmap_bytes;
+		R_BuildLightMapInto (fa, base, lmblock_width*lightmap_bytes, jobblocklights[job], store);
+	}
+}
+
+/*
+================
+R_BuildDirtyLightmaps
+
+Rebuilds the lightmaps queued by R_RenderDynamicLightmaps, spread over
+the worker threads.
+================
+*/
+static void R_BuildDirtyLightmaps (void)
+{
+	lmstore_t	store;
+	int	count, i;
+
+	count = VEC_SIZE (dirtysurfs);
+	if (!count)
+		return;
+
+	numlightmapjobs = q_min (Tasks_NumWorkers () + 1, MAX_LIGHTMAP_JOBS);
+	numlightmapjobs = CLAMP (1, count / MIN_SURFS_PER_JOB, numlightmapjobs);
+
+	// allocate the buffers here, jobs must not call Sys_Error
+	for (i = 0; i < numlightmapjobs; i++)
+	{
+		if (!jobblocklights[i])
+		{
+			jobblocklights[i] = (unsigned *) malloc (sizeof(blocklights));
+			if (!jobblocklights[i])
+				Sys_Error ("R_BuildDirtyLightmaps: out of memory");
 		}
 	}
+
+	R_GetLightmapStore (&store);
+	if (numlightmapjobs == 1)
+		R_BuildDirtyLightmapsJob (&store, 0);
+	else
+		Task_ParallelFor (numlightmapjobs, R_BuildDirtyLightmapsJob, &store);
+
+	VEC_CLEAR (dirtysurfs);
 }
 
 /*
@@ -356,13 +452,13 @@ int AllocBlock (int w, int h, int *x, int *y)
 			lightmap_count++;
 			lightmaps = (struct lightmap_s *) realloc(lightmaps, sizeof(*lightmaps)*lightmap_count);
 			memset(&lightmaps[texnum], 0, sizeof(lightmaps[texnum]));
-			lightmaps[texnum].data = (byte *) calloc(1, 4*LMBLOCK_WIDTH*LMBLOCK_HEIGHT);
+			lightmaps[texnum].data = (byte *) calloc(1, 4*lmblock_width*lmblock_height);
 			//as we're only tracking one texture, we don't need multiple copies of allocated any more.
 			memset(allocated, 0, sizeof(allocated));
 		}
-		best = LMBLOCK_HEIGHT;
+		best = lmblock_height;
 
-		for (i=0 ; i<LMBLOCK_WIDTH-w ; i++)
+		for (i=0 ; i<lmblock_width-w ; i++)
 		{
 			best2 = 0;
 
@@ -380,7 +476,7 @@ int AllocBlock (int w, int h, int *x, int *y)
 			}
 		}
 
-		if (best + h > LMBLOCK_HEIGHT)
+		if (best + h > lmblock_height)
 			continue;
 
 		for (i=0 ; i<w ; i++)
@@ -419,8 +515,349 @@ void GL_CreateSurfaceLightmap (msurface_t *surf)
 
 	surf->lightmaptexturenum = AllocBlock (smax, tmax, &surf->light_s, &surf->light_t);
 	base = lightmaps[surf->lightmaptexturenum].data;
-	base += (surf->light_t * LMBLOCK_WIDTH + surf->light_s) * lightmap_bytes;
-	R_BuildLightMap (surf, base, LMBLOCK_WIDTH*lightmap_bytes);
+	base += (surf->light_t * lmblock_width + surf->light_s) * lightmap_bytes;
+	R_BuildLightMap (surf, base, lmblock_width*lightmap_bytes);
+}
+
+/*
+=============================================================
+
+	PROCESSED BSP CACHE
+
+The lightmap atlas layout (what AllocBlock works out) and the r_oldwater
+subdivisions only depend on the brush models loaded, the atlas size and
+gl_subdivide_size.  After a map has been set up the slow way they are
+saved to <userdir>/bspcache/<hash>.lmc, next to the mesh and texture
+caches, and the next load of the same models maps that file and takes
+the results straight from it.  The lightmap texels themselves are still
+built every time: they depend on the light styles and on gl_overbright
+and r_lightmapwide, and are rebuilt as soon as any of those change.  The file name hashes the full path of
+the map, so the same map name in two game directories doesn't share a
+file.
+
+=============================================================
+*/
+
+#define	BSPCACHE_MAGIC		(('C'<<24)|('B'<<16)|('S'<<8)|'Q')	// "QSBC", also rejects the other byte order
+#define	BSPCACHE_VERSION	1
+
+typedef struct
+{
+	int		magic;
+	int		version;
+	uint64_t	key;		// R_BSPCacheKey
+	int		lightmapcount;
+	int		numsurfaces;	// over all the brush models, in GL_BuildLightmaps order
+	int		numwarppolys;
+	int		numwarpverts;
+} bspcache_header_t;
+
+typedef struct
+{
+	int		lightmaptexturenum;	// -1 if not lightmapped
+	unsigned short	light_s, light_t;
+	int		firstwarppoly, numwarppolys;
+} bspcache_surf_t;
+
+typedef struct
+{
+	int		firstvert, numverts;
+} bspcache_poly_t;
+
+// the file is the header, the surfs, the polys, then numwarpverts xyz floats
+
+typedef struct
+{
+	filemap_t		map;
+	const bspcache_header_t	*header;
+	const bspcache_surf_t	*surfs;
+	const bspcache_poly_t	*polys;
+	const float		*verts;
+} bspcache_t;
+
+/*
+==================
+R_BSPCachePath
+==================
+*/
+static void R_BSPCachePath (char *path, size_t size)
+{
+	uint64_t	hash;
+
+	q_snprintf (path, size, "%s/%s", com_gamedir, cl.worldmodel->name);
+	hash = Hash_Block64 (path, strlen (path), 0);
+	q_snprintf (path, size, "%s/bspcache/%08x%08x.lmc", host_parms->userdir,
+		    (unsigned int)(hash >> 32), (unsigned int)hash);
+}
+
+/*
+==================
+R_BSPCacheKey
+
+covers everything the cached results depend on
+==================
+*/
+static uint64_t R_BSPCacheKey (void)
+{
+	int		params[3];
+	float		subdivide;
+	uint64_t	key;
+	qmodel_t	*m;
+	int		i;
+
+	params[0] = BSPCACHE_VERSION;
+	params[1] = lmblock_width;
+	params[2] = lmblock_height;
+	subdivide = gl_subdivide_size.value;
+	key = Hash_Block64 (params, sizeof(params), 0);
+	key = Hash_Block64 (&subdivide, sizeof(subdivide), key);
+
+	for (i=1 ; i<MAX_MODELS ; i++)
+	{
+		m = cl.model_precache[i];
+		if (!m)
+			break;
+		if (m->name[0] == '*' || m->type != mod_brush)
+			continue;
+		key = Hash_Block64 (&m->filehash, sizeof(m->filehash), key);
+	}
+
+	return key;
+}
+
+/*
+==================
+R_ValidateBSPCache
+
+checks every entry against the loaded surfaces, so that a damaged or
+stale file can't put anything out of bounds
+==================
+*/
+static qboolean R_ValidateBSPCache (const bspcache_t *cache)
+{
+	const bspcache_header_t	*header = cache->header;
+	const bspcache_surf_t	*cs = cache->surfs;
+	const bspcache_poly_t	*cp;
+	msurface_t	*fa;
+	qmodel_t	*m;
+	int		i, j, n;
+
+	if (header->lightmapcount < 0 || header->lightmapcount > (int)MAX_SANITY_LIGHTMAPS)
+		return false;
+
+	for (j=1, n=0 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m)
+			break;
+		if (m->name[0] == '*')
+			continue;
+		for (i=0, fa=m->surfaces ; i<m->numsurfaces ; i++, fa++, n++, cs++)
+		{
+			if (n >= header->numsurfaces)
+				return false;
+			if (fa->flags & SURF_DRAWTILED)
+			{
+				if (cs->lightmaptexturenum != -1)
+					return false;
+			}
+			else if (cs->lightmaptexturenum < 0 || cs->lightmaptexturenum >= header->lightmapcount ||
+				 cs->light_s + (fa->extents[0]>>4)+1 > lmblock_width ||
+				 cs->light_t + (fa->extents[1]>>4)+1 > lmblock_height)
+				return false;
+
+			if (cs->numwarppolys && !(fa->flags & SURF_DRAWTURB))
+				return false;
+			if (cs->firstwarppoly < 0 || cs->numwarppolys < 0 ||
+			    cs->firstwarppoly > header->numwarppolys - cs->numwarppolys)
+				return false;
+			for (cp = cache->polys + cs->firstwarppoly ; cp < cache->polys + cs->firstwarppoly + cs->numwarppolys ; cp++)
+			{
+				if (cp->numverts < 3 || cp->numverts > 64 || cp->firstvert < 0 ||
+				    cp->firstvert > header->numwarpverts - cp->numverts)
+					return false;
+			}
+		}
+	}
+
+	return n == header->numsurfaces;
+}
+
+/*
+==================
+R_OpenBSPCache
+==================
+*/
+static qboolean R_OpenBSPCache (bspcache_t *cache, uint64_t key)
+{
+	const bspcache_header_t	*header;
+	char		path[MAX_OSPATH];
+	int		h, len;
+	int64_t		expected;
+
+	memset (cache, 0, sizeof(*cache));
+
+	R_BSPCachePath (path, sizeof(path));
+	len = Sys_FileOpenRead (path, &h);
+	if (h == -1)
+		return false;
+	if (len < (int)sizeof(bspcache_header_t))
+	{
+		Sys_FileClose (h);
+		return false;
+	}
+
+	cache->map.data = (byte *) Sys_FileMap (h, 0, len, &cache->map.view, &cache->map.viewsize);
+	if (!cache->map.data)
+	{
+		cache->map.view = NULL;
+		cache->map.data = (byte *) malloc (len);
+		if (!cache->map.data || Sys_FileRead (h, cache->map.data, len) != len)
+		{
+			free (cache->map.data);
+			cache->map.data = NULL;
+		}
+	}
+	Sys_FileClose (h);
+	if (!cache->map.data)
+		return false;
+	cache->map.size = len;
+
+	header = cache->header = (const bspcache_header_t *) cache->map.data;
+	if (header->magic != BSPCACHE_MAGIC || header->version != BSPCACHE_VERSION || header->key != key)
+		goto stale;
+	if (header->numsurfaces < 0 || header->numwarppolys < 0 || header->numwarpverts < 0)
+		goto stale;
+	expected = sizeof(bspcache_header_t) + (int64_t)header->numsurfaces * sizeof(bspcache_surf_t) +
+		   (int64_t)header->numwarppolys * sizeof(bspcache_poly_t) + (int64_t)header->numwarpverts * 3 * sizeof(float);
+	if (expected != len)
+		goto stale;
+
+	cache->surfs = (const bspcache_surf_t *) (header + 1);
+	cache->polys = (const bspcache_poly_t *) (cache->surfs + header->numsurfaces);
+	cache->verts = (const float *) (cache->polys + header->numwarppolys);
+	if (!R_ValidateBSPCache (cache))
+		goto stale;
+
+	return true;
+
+stale:
+	COM_UnmapFile (&cache->map);
+	return false;
+}
+
+/*
+==================
+R_WriteBSPCache
+==================
+*/
+static void R_WriteBSPCache (uint64_t key)
+{
+	bspcache_header_t	header;
+	bspcache_surf_t		*surfs, *cs;
+	bspcache_poly_t		*polys = NULL;
+	float			*verts = NULL;
+	char		path[MAX_OSPATH], temppath[MAX_OSPATH];
+	msurface_t	*fa;
+	glpoly_t	*p;
+	qmodel_t	*m;
+	FILE		*f;
+	int		i, j, k;
+
+	memset (&header, 0, sizeof(header));
+	header.magic = BSPCACHE_MAGIC;
+	header.version = BSPCACHE_VERSION;
+	header.key = key;
+	header.lightmapcount = lightmap_count;
+
+	for (j=1 ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m)
+			break;
+		if (m->name[0] != '*')
+			header.numsurfaces += m->numsurfaces;
+	}
+	surfs = (bspcache_surf_t *) malloc (q_max (header.numsurfaces, 1) * sizeof(*surfs));
+
+	for (j=1, cs=surfs ; j<MAX_MODELS ; j++)
+	{
+		m = cl.model_precache[j];
+		if (!m)
+			break;
+		if (m->name[0] == '*')
+			continue;
+		for (i=0, fa=m->surfaces ; i<m->numsurfaces ; i++, fa++, cs++)
+		{
+			cs->lightmaptexturenum = (fa->flags & SURF_DRAWTILED) ? -1 : fa->lightmaptexturenum;
+			cs->light_s = (fa->flags & SURF_DRAWTILED) ? 0 : fa->light_s;
+			cs->light_t = (fa->flags & SURF_DRAWTILED) ? 0 : fa->light_t;
+			cs->firstwarppoly = header.numwarppolys;
+			cs->numwarppolys = 0;
+			if (!(fa->flags & SURF_DRAWTURB) || !fa->polys)
+				continue;
+			// the first poly is the undivided one, the rest are the subdivisions
+			for (p = fa->polys->next ; p ; p = p->next)
+			{
+				VEC_PUSH (polys, ((bspcache_poly_t){header.numwarpverts, p->numverts}));
+				for (k=0 ; k<p->numverts ; k++)
+				{
+					VEC_PUSH (verts, p->verts[k][0]);
+					VEC_PUSH (verts, p->verts[k][1]);
+					VEC_PUSH (verts, p->verts[k][2]);
+				}
+				header.numwarpverts += p->numverts;
+				header.numwarppolys++;
+				cs->numwarppolys++;
+			}
+		}
+	}
+
+	q_snprintf (path, sizeof(path), "%s/bspcache", host_parms->userdir);
+	Sys_mkdir (path);
+	R_BSPCachePath (path, sizeof(path));
+	f = COM_OpenTempFile (path, temppath, sizeof(temppath));
+	if (f)
+	{
+		fwrite (&header, sizeof(header), 1, f);
+		fwrite (surfs, sizeof(*surfs), header.numsurfaces, f);
+		fwrite (polys, sizeof(*polys), header.numwarppolys, f);
+		fwrite (verts, 3 * sizeof(float), header.numwarpverts, f);
+		if (!COM_ReplaceFile (f, temppath, path))
+			Con_Warning ("couldn't write %s\n", path);
+	}
+	else
+		Con_DPrintf ("couldn't open %s for writing\n", temppath);
+
+	free (surfs);
+	VEC_FREE (polys);
+	VEC_FREE (verts);
+}
+
+/*
+==================
+R_SubdivideWarpSurface -- makes the r_oldwater polys, from the cache if there is one
+==================
+*/
+static void R_SubdivideWarpSurface (msurface_t *fa, const bspcache_t *cache, int surfnum)
+{
+	const bspcache_surf_t	*cs;
+	const bspcache_poly_t	*cp;
+	int			i;
+
+	if (!cache)
+	{
+		GL_SubdivideSurface (fa);
+		return;
+	}
+
+	// GL_AddWarpPoly links each one in at the front, so go backwards
+	cs = &cache->surfs[surfnum];
+	for (i = cs->numwarppolys - 1; i >= 0; i--)
+	{
+		cp = &cache->polys[cs->firstwarppoly + i];
+		GL_AddWarpPoly (fa, cp->numverts, cache->verts + cp->firstvert * 3);
+	}
 }
 
 /*
@@ -500,13 +937,13 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 		s -= fa->texturemins[0];
 		s += fa->light_s*16;
 		s += 8;
-		s /= LMBLOCK_WIDTH*16; //fa->texinfo->texture->width;
+		s /= lmblock_width*16; //fa->texinfo->texture->width;
 
 		t = DotProduct (vec, fa->texinfo->vecs[1]) + fa->texinfo->vecs[1][3];
 		t -= fa->texturemins[1];
 		t += fa->light_t*16;
 		t += 8;
-		t /= LMBLOCK_HEIGHT*16; //fa->texinfo->texture->height;
+		t /= lmblock_height*16; //fa->texinfo->texture->height;
 
 		poly->verts[i][5] = s;
 		poly->verts[i][6] = t;
@@ -515,10 +952,6 @@ void BuildSurfaceDisplayList (msurface_t *fa)
 	//johnfitz -- removed gl_keeptjunctions code
 
 	poly->numverts = lnumverts;
-
-	// support r_oldwater 1 on lit water
-	if (fa->flags & SURF_DRAWTURB)
-		GL_SubdivideSurface (fa);
 }
 
 /*
@@ -532,11 +965,19 @@ with all the surfaces from all brush models
 void GL_BuildLightmaps (void)
 {
 	char	name[24];
-	int		i, j;
+	int		i, j, n;
 	struct lightmap_s *lm;
 	qmodel_t	*m;
+	msurface_t	*fa;
+	uint64_t	key;
+	bspcache_t	cache;
+	qboolean	cached;
+	byte		*base;
+	double		start;
 
+	start = Sys_DoubleTime ();
 	r_framecount = 1; // no dlightcache
+	VEC_CLEAR (dirtysurfs);	// belonged to the previous map
 
 	//Spike -- wipe out all the lightmap data (johnfitz -- the gltexture objects were already freed by Mod_ClearAll)
 	for (i=0; i < lightmap_count; i++)
@@ -546,6 +987,16 @@ void GL_BuildLightmaps (void)
 	last_lightmap_allocated = 0;
 	lightmap_count = 0;
 
+	// atlas size is a power of two that the card can take,
+	// and big enough for the largest surface
+	i = 1;
+	while (i < (int)gl_lightmapsize.value && i < MAX_LMBLOCK_SIZE)
+		i <<= 1;
+	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &j);
+	while (i > j && i > MIN_LMBLOCK_SIZE)
+		i >>= 1;
+	lmblock_width = lmblock_height = q_max (i, MIN_LMBLOCK_SIZE);
+
 	gl_lightmap_format = GL_RGBA;//FIXME: hardcoded for now!
 
 	switch (gl_lightmap_format)
@@ -560,7 +1011,17 @@ void GL_BuildLightmaps (void)
 		Sys_Error ("GL_BuildLightmaps: bad lightmap format");
 	}
 
-	for (j=1 ; j<MAX_MODELS ; j++)
+	key = R_BSPCacheKey ();
+	cached = gl_bspcache.value && R_OpenBSPCache (&cache, key);
+	if (cached)
+	{
+		lightmap_count = cache.header->lightmapcount;
+		lightmaps = (struct lightmap_s *) calloc (q_max (lightmap_count, 1), sizeof(*lightmaps));
+		for (i=0 ; i<lightmap_count ; i++)
+			lightmaps[i].data = (byte *) calloc (1, 4*lmblock_width*lmblock_height);
+	}
+
+	for (j=1, n=0 ; j<MAX_MODELS ; j++)
 	{
 		m = cl.model_precache[j];
 		if (!m)
@@ -569,17 +1030,37 @@ void GL_BuildLightmaps (void)
 			continue;
 		r_pcurrentvertbase = m->vertexes;
 		currentmodel = m;
-		for (i=0 ; i<m->numsurfaces ; i++)
+		for (i=0, fa=m->surfaces ; i<m->numsurfaces ; i++, fa++, n++)
 		{
 			//johnfitz -- rewritten to use SURF_DRAWTILED instead of the sky/water flags
-			if (m->surfaces[i].flags & SURF_DRAWTILED)
-				continue;
-			GL_CreateSurfaceLightmap (m->surfaces + i);
-			BuildSurfaceDisplayList (m->surfaces + i);
+			if (!(fa->flags & SURF_DRAWTILED))
+			{
+				if (cached)
+				{
+					fa->lightmaptexturenum = cache.surfs[n].lightmaptexturenum;
+					fa->light_s = cache.surfs[n].light_s;
+					fa->light_t = cache.surfs[n].light_t;
+					base = lightmaps[fa->lightmaptexturenum].data;
+					base += (fa->light_t * lmblock_width + fa->light_s) * lightmap_bytes;
+					R_BuildLightMap (fa, base, lmblock_width*lightmap_bytes);
+				}
+				else
+					GL_CreateSurfaceLightmap (fa);
+				BuildSurfaceDisplayList (fa);
+			}
 			//johnfitz
+
+			// support r_oldwater 1 on lit and unlit water
+			if (fa->flags & SURF_DRAWTURB)
+				R_SubdivideWarpSurface (fa, cached ? &cache : NULL, n);
 		}
 	}
 
+	if (cached)
+		COM_UnmapFile (&cache.map);
+	else if (gl_bspcache.value)
+		R_WriteBSPCache (key);
+
 	//
 	// upload all lightmaps that were filled
 	//
@@ -587,25 +1068,28 @@ void GL_BuildLightmaps (void)
 	{
 		lm = &lightmaps[i];
 		lm->modified = false;
-		lm->rectchange.l = LMBLOCK_WIDTH;
-		lm->rectchange.t = LMBLOCK_HEIGHT;
+		lm->rectchange.l = lmblock_width;
+		lm->rectchange.t = lmblock_height;
 		lm->rectchange.w = 0;
 		lm->rectchange.h = 0;
 
 		//johnfitz -- use texture manager
 		sprintf(name, "lightmap%07i",i);
-		lm->texture = TexMgr_LoadImage (cl.worldmodel, name, LMBLOCK_WIDTH, LMBLOCK_HEIGHT,
+		lm->texture = TexMgr_LoadImage (cl.worldmodel, name, lmblock_width, lmblock_height,
 						SRC_LIGHTMAP, lm->data, "", (src_offset_t)lm->data, TEXPREF_LINEAR | TEXPREF_NOPICMIP);
 		//johnfitz
 	}
 
 	//johnfitz -- warn about exceeding old limits
 	//GLQuake limit was 64 textures of 128x128. Estimate how many 128x128 textures we would need
-	//given that we are using lightmap_count of LMBLOCK_WIDTH x LMBLOCK_HEIGHT
-	i = lightmap_count * ((LMBLOCK_WIDTH / 128) * (LMBLOCK_HEIGHT / 128));
+	//given that we are using lightmap_count of lmblock_width x lmblock_height
+	i = lightmap_count * ((lmblock_width / 128) * (lmblock_height / 128));
 	if (i > 64)
 		Con_DWarning("%i lightmaps exceeds standard limit of 64.\n",i);
 	//johnfitz
+
+	Con_DPrintf ("%d %dx%d lightmaps, layout %s, %.0f ms\n", lightmap_count, lmblock_width, lmblock_height,
+		     cached ? "cached" : "built", (Sys_DoubleTime () - start) * 1000.0);
 }
 
 /*
@@ -699,20 +1183,15 @@ void GL_BuildBModelVertexBuffer (void)
 R_AddDynamicLights
 ===============
 */
-void R_AddDynamicLights (msurface_t *surf)
+static void R_AddDynamicLights (msurface_t *surf, unsigned *blocklights)
 {
 	int			lnum;
-	int			sd, td;
-	float		dist, rad, minlight;
-	vec3_t		impact, local;
-	int			s, t;
+	float		dist, minlight;
+	vec3_t		impact;
 	int			i;
 	int			smax, tmax;
 	mtexinfo_t	*tex;
-	//johnfitz -- lit support via lordhavoc
-	float		cred, cgreen, cblue, brightness;
-	unsigned	*bl;
-	//johnfitz
+	lmdlight_t	light;
 
 	smax = (surf->extents[0]>>4)+1;
 	tmax = (surf->extents[1]>>4)+1;
@@ -723,14 +1202,14 @@ void R_AddDynamicLights (msurface_t *surf)
 		if (! (surf->dlightbits[lnum >> 5] & (1U << (lnum & 31))))
 			continue;		// not lit by this light
 
-		rad = cl_dlights[lnum].radius;
+		light.rad = cl_dlights[lnum].radius;
 		dist = DotProduct (cl_dlights[lnum].origin, surf->plane->normal) -
 				surf->plane->dist;
-		rad -= fabs(dist);
+		light.rad -= fabs(dist);
 		minlight = cl_dlights[lnum].minlight;
-		if (rad < minlight)
+		if (light.rad < minlight)
 			continue;
-		minlight = rad - minlight;
+		light.minlight = light.rad - minlight;
 
 		for (i=0 ; i<3 ; i++)
 		{
@@ -738,44 +1217,19 @@ void R_AddDynamicLights (msurface_t *surf)
 					surf->plane->normal[i]*dist;
 		}
 
-		local[0] = DotProduct (impact, tex->vecs[0]) + tex->vecs[0][3];
-		local[1] = DotProduct (impact, tex->vecs[1]) + tex->vecs[1][3];
+		light.local[0] = DotProduct (impact, tex->vecs[0]) + tex->vecs[0][3];
+		light.local[1] = DotProduct (impact, tex->vecs[1]) + tex->vecs[1][3];
 
-		local[0] -= surf->texturemins[0];
-		local[1] -= surf->texturemins[1];
+		light.local[0] -= surf->texturemins[0];
+		light.local[1] -= surf->texturemins[1];
 
 		//johnfitz -- lit support via lordhavoc
-		bl = blocklights;
-		cred = cl_dlights[lnum].color[0] * 256.0f;
-		cgreen = cl_dlights[lnum].color[1] * 256.0f;
-		cblue = cl_dlights[lnum].color[2] * 256.0f;
+		light.color[0] = cl_dlights[lnum].color[0] * 256.0f;
+		light.color[1] = cl_dlights[lnum].color[1] * 256.0f;
+		light.color[2] = cl_dlights[lnum].color[2] * 256.0f;
 		//johnfitz
-		for (t = 0 ; t<tmax ; t++)
-		{
-			td = local[1] - t*16;
-			if (td < 0)
-				td = -td;
-			for (s=0 ; s<smax ; s++)
-			{
-				sd = local[0] - s*16;
-				if (sd < 0)
-					sd = -sd;
-				if (sd > td)
-					dist = sd + (td>>1);
-				else
-					dist = td + (sd>>1);
-				if (dist < minlight)
-				//johnfitz -- lit support via lordhavoc
-				{
-					brightness = rad - dist;
-					bl[0] += (int) (brightness * cred);
-					bl[1] += (int) (brightness * cgreen);
-					bl[2] += (int) (brightness * cblue);
-				}
-				bl += 3;
-				//johnfitz
-			}
-		}
+
+		lm_kernels->dlight (blocklights, smax, tmax, &light);
 	}
 }
 
@@ -788,17 +1242,59 @@ Combine and scale multiple lightmaps into the 8.8 format in blocklights
 ===============
 */
 void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
+{
+	lmstore_t	store;
+
+	R_GetLightmapStore (&store);
+	R_BuildLightMapInto (surf, dest, stride, blocklights, &store);
+}
+
+/*
+===============
+R_GetLightmapStore
+
+Main thread only, it reads the cvars
+===============
+*/
+static void R_GetLightmapStore (lmstore_t *store)
 {
 	const int overbright = !!gl_overbright.value;
 	const int wide10bits = !!r_lightmapwide.value;
 
+	switch (gl_lightmap_format)
+	{
+	case GL_RGBA:
+		store->pack = wide10bits ? LMPACK_RGB10A2 : LMPACK_RGBA8;
+		break;
+	case GL_BGRA:
+		store->pack = wide10bits ? LMPACK_BGR10A2 : LMPACK_BGRA8;
+		break;
+	default:
+		Sys_Error ("R_BuildLightMap: bad lightmap format");
+		return;
+	}
+
+	// without overbright, wide lightmaps are still clamped to 255 so
+	// gl_overbright 0 renders as expected
+	store->shift = overbright ? 8 : 7;
+	store->maxval = (overbright && wide10bits) ? 1023 : 255;
+}
+
+/*
+===============
+R_BuildLightMapInto
+
+Re-entrant: only touches surf, its part of dest and the given
+accumulation buffer, so several can run at once on worker threads.
+===============
+*/
+static void R_BuildLightMapInto (msurface_t *surf, byte *dest, int stride, unsigned *blocklights, const lmstore_t *store)
+{
 	int			smax, tmax;
-	unsigned		r, g, b;
-	int			i, j, size;
+	int			size;
 	byte		*lightmap;
 	unsigned	scale;
 	int			maps;
-	unsigned	*bl;
 
 	surf->cached_dlight = (surf->dlightframe == r_framecount);
 
@@ -821,20 +1317,15 @@ void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 				scale = d_lightstylevalue[surf->styles[maps]];
 				surf->cached_light[maps] = scale;	// 8.8 fraction
 				//johnfitz -- lit support via lordhavoc
-				bl = blocklights;
-				for (i=0 ; i<size ; i++)
-				{
-					*bl++ += *lightmap++ * scale;
-					*bl++ += *lightmap++ * scale;
-					*bl++ += *lightmap++ * scale;
-				}
+				lm_kernels->accumulate (blocklights, lightmap, size*3, scale);
+				lightmap += size*3;
 				//johnfitz
 			}
 		}
 
 	// add all the dynamic lights
 		if (surf->dlightframe == r_framecount)
-			R_AddDynamicLights (surf);
+			R_AddDynamicLights (surf, blocklights);
 	}
 	else
 	{
@@ -844,101 +1335,66 @@ void R_BuildLightMap (msurface_t *surf, byte *dest, int stride)
 
 // bound, invert, and shift
 // store:
-	switch (gl_lightmap_format)
+	lm_kernels->store (dest, stride, blocklights, smax, tmax, store->shift, store->maxval, store->pack);
+}
+
+/*
+===============
+GL_DeleteLightmapBuffers -- called before the GL context goes away
+===============
+*/
+void GL_DeleteLightmapBuffers (void)
+{
+	if (!gl_pbo_able)
+		return;
+
+	GL_DeleteBuffersFunc (NUM_LIGHTMAP_PBOS, lightmap_pbos);
+	memset (lightmap_pbos, 0, sizeof(lightmap_pbos));
+	lightmap_pbo_next = 0;
+}
+
+/*
+===============
+R_UploadLightmapPBO
+
+copies the changed rectangle into the next pixel buffer in the ring and
+uploads from there. returns false if the buffer couldn't be mapped.
+===============
+*/
+static qboolean R_UploadLightmapPBO (struct lightmap_s *lm, GLenum type)
+{
+	const glRect_t	*rect = &lm->rectchange;
+	const int	rowbytes = rect->w * lightmap_bytes;
+	const int	stride = lmblock_width * lightmap_bytes;
+	const byte	*src;
+	byte		*dest;
+	GLuint		*pbo;
+	int		i;
+
+	pbo = &lightmap_pbos[lightmap_pbo_next];
+	lightmap_pbo_next = (lightmap_pbo_next + 1) % NUM_LIGHTMAP_PBOS;
+	if (!*pbo)
+		GL_GenBuffersFunc (1, pbo);
+
+	GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, *pbo);
+	// orphan the old storage so we never wait for a previous upload to finish
+	GL_BufferDataFunc (GL_PIXEL_UNPACK_BUFFER_ARB, rowbytes * rect->h, NULL, GL_STREAM_DRAW_ARB);
+	dest = (byte *) GL_MapBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	if (!dest)
 	{
-	case GL_RGBA:
-		stride -= smax * 4;
-		bl = blocklights;
-		for (i=0 ; i<tmax ; i++, dest += stride)
-		{
-			for (j=0 ; j<smax ; j++)
-			{
-				if (overbright)
-				{
-					r = *bl++ >> 8;
-					g = *bl++ >> 8;
-					b = *bl++ >> 8;
-				}
-				else
-				{
-					r = *bl++ >> 7;
-					g = *bl++ >> 7;
-					b = *bl++ >> 7;
-					if (wide10bits) {
-						// artifically clamp to 255 so gl_overbright 0 renders as expected in the wide10bits case
-						r = (r > 255) ? 255 : r;
-						g = (g > 255) ? 255 : g;
-						b = (b > 255) ? 255 : b;
-						goto loc0;
-					}
-				}
-				if (wide10bits)
-				{
-					r = (r > 1023)? 1023 : r;
-					g = (g > 1023)? 1023 : g;
-					b = (b > 1023)? 1023 : b;
-					loc0:
-					*(unsigned int*)dest = (r<<22) | (g<<12) | (b<<2) | 3;
-					dest += 4;
-				}
-				else
-				{
-					*dest++ = (r > 255)? 255 : r;
-					*dest++ = (g > 255)? 255 : g;
-					*dest++ = (b > 255)? 255 : b;
-					*dest++ = 255;
-				}
-			}
-		}
-		break;
-	case GL_BGRA:
-		stride -= smax * 4;
-		bl = blocklights;
-		for (i=0 ; i<tmax ; i++, dest += stride)
-		{
-			for (j=0 ; j<smax ; j++)
-			{
-				if (overbright)
-				{
-					r = *bl++ >> 8;
-					g = *bl++ >> 8;
-					b = *bl++ >> 8;
-				}
-				else
-				{
-					r = *bl++ >> 7;
-					g = *bl++ >> 7;
-					b = *bl++ >> 7;
-					if (wide10bits) {
-						// artifically clamp to 255 so gl_overbright 0 renders as expected in the wide10bits case
-						r = (r > 255) ? 255 : r;
-						g = (g > 255) ? 255 : g;
-						b = (b > 255) ? 255 : b;
-						goto loc1;
-					}
-				}
-				if (wide10bits)
-				{
-					r = (r > 1023)? 1023 : r;
-					g = (g > 1023)? 1023 : g;
-					b = (b > 1023)? 1023 : b;
-					loc1:
-					*(unsigned int*)dest = (b<<22) | (g<<12) | (r<<2) | 3;
-					dest += 4;
-				}
-				else
-				{
-					*dest++ = (b > 255)? 255 : b;
-					*dest++ = (g > 255)? 255 : g;
-					*dest++ = (r > 255)? 255 : r;
-					*dest++ = 255;
-				}
-			}
-		}
-		break;
-	default:
-		Sys_Error ("R_BuildLightMap: bad lightmap format");
+		GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+		return false;
 	}
+
+	src = lm->data + rect->t * stride + rect->l * lightmap_bytes;
+	for (i = 0; i < rect->h; i++, src += stride, dest += rowbytes)
+		memcpy (dest, src, rowbytes);
+
+	if (GL_UnmapBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB))
+		glTexSubImage2D (GL_TEXTURE_2D, 0, rect->l, rect->t, rect->w, rect->h, gl_lightmap_format, type, NULL);
+	GL_BindBufferFunc (GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+
+	return true;
 }
 
 /*
@@ -954,16 +1410,23 @@ static void R_UploadLightmap(int lmap)
 	const GLenum type = wide10bits ?
 	    GL_UNSIGNED_INT_10_10_10_2 : GL_UNSIGNED_BYTE;
 	struct lightmap_s *lm = &lightmaps[lmap];
+	const glRect_t *rect = &lm->rectchange;
 
 	if (!lm->modified)
 		return;
 
 	lm->modified = false;
 
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, lm->rectchange.t, LMBLOCK_WIDTH, lm->rectchange.h, gl_lightmap_format,
-			type, lm->data + lm->rectchange.t*LMBLOCK_WIDTH*lightmap_bytes);
-	lm->rectchange.l = LMBLOCK_WIDTH;
-	lm->rectchange.t = LMBLOCK_HEIGHT;
+	// only send the changed rectangle, not whole rows of the atlas
+	if (!(gl_pbo_able && gl_lightmappbo.value && R_UploadLightmapPBO (lm, type)))
+	{
+		glPixelStorei (GL_UNPACK_ROW_LENGTH, lmblock_width);
+		glTexSubImage2D (GL_TEXTURE_2D, 0, rect->l, rect->t, rect->w, rect->h, gl_lightmap_format,
+				type, lm->data + (rect->t*lmblock_width + rect->l)*lightmap_bytes);
+		glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+	}
+	lm->rectchange.l = lmblock_width;
+	lm->rectchange.t = lmblock_height;
 	lm->rectchange.h = 0;
 	lm->rectchange.w = 0;
 
@@ -974,6 +1437,8 @@ void R_UploadLightmaps (void)
 {
 	int lmap;
 
+	R_BuildDirtyLightmaps ();
+
 	for (lmap = 0; lmap < lightmap_count; lmap++)
 	{
 		if (!lightmaps[lmap].modified)
@@ -1013,8 +1478,8 @@ void R_RebuildAllLightmaps (void)
 			if (fa->flags & SURF_DRAWTILED)
 				continue;
 			base = lightmaps[fa->lightmaptexturenum].data;
-			base += fa->light_t * LMBLOCK_WIDTH * lightmap_bytes + fa->light_s * lightmap_bytes;
-			R_BuildLightMap (fa, base, LMBLOCK_WIDTH*lightmap_bytes);
+			base += fa->light_t * lmblock_width * lightmap_bytes + fa->light_s * lightmap_bytes;
+			R_BuildLightMap (fa, base, lmblock_width*lightmap_bytes);
 		}
 	}
 
@@ -1022,7 +1487,7 @@ void R_RebuildAllLightmaps (void)
 	for (i=0; i<lightmap_count; i++)
 	{
 		GL_Bind (lightmaps[i].texture);
-		glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, LMBLOCK_WIDTH, LMBLOCK_HEIGHT, gl_lightmap_format,
+		glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, lmblock_width, lmblock_height, gl_lightmap_format,
 				 type, lightmaps[i].data);
 	}
 }
@@ -0,0 +1,801 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2002-2009 John Fitzgibbons and others
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_lightmap.c -- per-texel lightmap kernels used by R_BuildLightMap
+
+#include "quakedef.h"
+#include "q_simd.h"
+
+cvar_t	r_lightmapsimd = {"r_lightmapsimd","1",CVAR_NONE};
+
+const lmkernels_t	*lm_kernels;
+
+/*
+=============================================================================
+
+PLAIN C
+
+These are the reference versions: the loops that used to live in
+r_brush.c.  Every other set must write exactly the same bytes.
+
+=============================================================================
+*/
+
+static void LM_Accumulate_C (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	int	i;
+
+	for (i = 0; i < count; i++)
+		bl[i] += lightmap[i] * scale;
+}
+
+/*
+===============
+LM_DLightSpan_C
+
+texels first..smax-1 of one row, bl pointing at texel first
+===============
+*/
+static void LM_DLightSpan_C (unsigned *bl, int first, int smax, int td, const lmdlight_t *light)
+{
+	int	s, sd;
+	float	dist, brightness;
+
+	for (s = first; s < smax; s++, bl += 3)
+	{
+		sd = light->local[0] - s*16;
+		if (sd < 0)
+			sd = -sd;
+		if (sd > td)
+			dist = sd + (td>>1);
+		else
+			dist = td + (sd>>1);
+		if (dist < light->minlight)
+		{
+			brightness = light->rad - dist;
+			bl[0] += (int) (brightness * light->color[0]);
+			bl[1] += (int) (brightness * light->color[1]);
+			bl[2] += (int) (brightness * light->color[2]);
+		}
+	}
+}
+
+static int LM_RowDistance (int t, const lmdlight_t *light)
+{
+	int	td;
+
+	td = light->local[1] - t*16;
+	if (td < 0)
+		td = -td;
+	return td;
+}
+
+static void LM_DLight_C (unsigned *bl, int smax, int tmax, const lmdlight_t *light)
+{
+	int	t;
+
+	for (t = 0; t < tmax; t++, bl += smax*3)
+		LM_DLightSpan_C (bl, 0, smax, LM_RowDistance (t, light), light);
+}
+
+/*
+===============
+LM_StoreSpan_C
+
+bound, invert, shift and pack count texels
+===============
+*/
+static void LM_StoreSpan_C (byte *dest, const unsigned *bl, int count, int shift, unsigned maxval, lmpack_t pack)
+{
+	unsigned	r, g, b;
+	int		i;
+
+	for (i = 0; i < count; i++, bl += 3, dest += 4)
+	{
+		r = bl[0] >> shift;
+		g = bl[1] >> shift;
+		b = bl[2] >> shift;
+		r = (r > maxval) ? maxval : r;
+		g = (g > maxval) ? maxval : g;
+		b = (b > maxval) ? maxval : b;
+
+		switch (pack)
+		{
+		case LMPACK_RGBA8:
+			dest[0] = r;
+			dest[1] = g;
+			dest[2] = b;
+			dest[3] = 255;
+			break;
+		case LMPACK_BGRA8:
+			dest[0] = b;
+			dest[1] = g;
+			dest[2] = r;
+			dest[3] = 255;
+			break;
+		case LMPACK_RGB10A2:
+			*(unsigned int *)dest = (r<<22) | (g<<12) | (b<<2) | 3;
+			break;
+		case LMPACK_BGR10A2:
+			*(unsigned int *)dest = (b<<22) | (g<<12) | (r<<2) | 3;
+			break;
+		}
+	}
+}
+
+static void LM_Store_C (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift, unsigned maxval, lmpack_t pack)
+{
+	int	t;
+
+	for (t = 0; t < tmax; t++, dest += stride, bl += smax*3)
+		LM_StoreSpan_C (dest, bl, smax, shift, maxval, pack);
+}
+
+static const lmkernels_t lm_kernels_c =
+{
+	{"C", 0},
+	LM_Accumulate_C, LM_DLight_C, LM_Store_C
+};
+
+/*
+=============================================================================
+
+SSE2
+
+=============================================================================
+*/
+
+#if defined(USE_SSE2)
+
+static SIMD_TARGET_SSE2 void LM_Accumulate_SSE2 (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	const __m128i	zero = _mm_setzero_si128 ();
+	const __m128i	vscale = _mm_set1_epi16 ((short)scale);
+	__m128i		v, lo, hi, plo, phi;
+	int		i = 0;
+
+	// SSE2 has no 32 bit multiply, so build the products from 16x16 halves
+	if (scale <= 0xffff)
+	{
+		for ( ; i + 16 <= count; i += 16)
+		{
+			v = _mm_loadu_si128 ((const __m128i *)(lightmap + i));
+
+			lo = _mm_unpacklo_epi8 (v, zero);
+			plo = _mm_mullo_epi16 (lo, vscale);
+			phi = _mm_mulhi_epu16 (lo, vscale);
+			_mm_storeu_si128 ((__m128i *)(bl + i), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i)), _mm_unpacklo_epi16 (plo, phi)));
+			_mm_storeu_si128 ((__m128i *)(bl + i + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i + 4)), _mm_unpackhi_epi16 (plo, phi)));
+
+			hi = _mm_unpackhi_epi8 (v, zero);
+			plo = _mm_mullo_epi16 (hi, vscale);
+			phi = _mm_mulhi_epu16 (hi, vscale);
+			_mm_storeu_si128 ((__m128i *)(bl + i + 8), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i + 8)), _mm_unpacklo_epi16 (plo, phi)));
+			_mm_storeu_si128 ((__m128i *)(bl + i + 12), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(bl + i + 12)), _mm_unpackhi_epi16 (plo, phi)));
+		}
+	}
+
+	LM_Accumulate_C (bl + i, lightmap + i, count - i, scale);
+}
+
+/*
+===============
+LM_DLight_SSE2
+
+four texels at a time.  the per-channel results are interleaved back
+into r g b order with shuffles before adding them to blocklights.
+===============
+*/
+static SIMD_TARGET_SSE2 void LM_DLight_SSE2 (unsigned *bl, int smax, int tmax, const lmdlight_t *light)
+{
+	const __m128	step = _mm_set_ps (48.f, 32.f, 16.f, 0.f);
+	const __m128	local0 = _mm_set1_ps (light->local[0]);
+	const __m128	rad = _mm_set1_ps (light->rad);
+	const __m128	minlight = _mm_set1_ps (light->minlight);
+	const __m128	cr = _mm_set1_ps (light->color[0]);
+	const __m128	cg = _mm_set1_ps (light->color[1]);
+	const __m128	cb = _mm_set1_ps (light->color[2]);
+	__m128i		vtd, vtdhalf, sd, sign, gt, di, r, g, b;
+	__m128		dist, lit, brightness, rg0, rg1, br, o0, o1, o2;
+	unsigned	*row;
+	int		s, t, td;
+
+	for (t = 0; t < tmax; t++, bl += smax*3)
+	{
+		td = LM_RowDistance (t, light);
+		vtd = _mm_set1_epi32 (td);
+		vtdhalf = _mm_set1_epi32 (td>>1);
+
+		row = bl;
+		for (s = 0; s + 4 <= smax; s += 4, row += 12)
+		{
+			sd = _mm_cvttps_epi32 (_mm_sub_ps (local0, _mm_add_ps (_mm_set1_ps ((float)(s*16)), step)));
+			sign = _mm_srai_epi32 (sd, 31);
+			sd = _mm_sub_epi32 (_mm_xor_si128 (sd, sign), sign);
+
+			gt = _mm_cmpgt_epi32 (sd, vtd);
+			di = _mm_or_si128 (_mm_and_si128 (gt, _mm_add_epi32 (sd, vtdhalf)),
+					_mm_andnot_si128 (gt, _mm_add_epi32 (vtd, _mm_srai_epi32 (sd, 1))));
+			dist = _mm_cvtepi32_ps (di);
+			lit = _mm_cmplt_ps (dist, minlight);
+			if (!_mm_movemask_ps (lit))
+				continue;
+
+			brightness = _mm_sub_ps (rad, dist);
+			r = _mm_and_si128 (_mm_cvttps_epi32 (_mm_mul_ps (brightness, cr)), _mm_castps_si128 (lit));
+			g = _mm_and_si128 (_mm_cvttps_epi32 (_mm_mul_ps (brightness, cg)), _mm_castps_si128 (lit));
+			b = _mm_and_si128 (_mm_cvttps_epi32 (_mm_mul_ps (brightness, cb)), _mm_castps_si128 (lit));
+
+			// r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+			rg0 = _mm_castsi128_ps (_mm_unpacklo_epi32 (r, g));	// r0 g0 r1 g1
+			rg1 = _mm_castsi128_ps (_mm_unpackhi_epi32 (r, g));	// r2 g2 r3 g3
+			br = _mm_shuffle_ps (_mm_castsi128_ps (b), rg0, _MM_SHUFFLE(3,2,1,0));	// b0 b1 r1 g1
+			o0 = _mm_shuffle_ps (rg0, br, _MM_SHUFFLE(2,0,1,0));
+			o1 = _mm_shuffle_ps (br, rg1, _MM_SHUFFLE(1,0,1,3));
+			o2 = _mm_shuffle_ps (_mm_castsi128_ps (b), rg1, _MM_SHUFFLE(3,2,3,2));	// b2 b3 r3 g3
+			o2 = _mm_shuffle_ps (o2, o2, _MM_SHUFFLE(1,3,2,0));
+
+			_mm_storeu_si128 ((__m128i *)row, _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)row), _mm_castps_si128 (o0)));
+			_mm_storeu_si128 ((__m128i *)(row + 4), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(row + 4)), _mm_castps_si128 (o1)));
+			_mm_storeu_si128 ((__m128i *)(row + 8), _mm_add_epi32 (_mm_loadu_si128 ((__m128i *)(row + 8)), _mm_castps_si128 (o2)));
+		}
+
+		LM_DLightSpan_C (row, s, smax, td, light);
+	}
+}
+
+static SIMD_TARGET_SSE2 void LM_Store_SSE2 (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift, unsigned maxval, lmpack_t pack)
+{
+	const __m128i	vshift = _mm_cvtsi32_si128 (shift);
+	const __m128i	vmax = _mm_set1_epi32 (maxval);
+	const qboolean	swap = (pack == LMPACK_BGRA8 || pack == LMPACK_BGR10A2);
+	const qboolean	wide = (pack == LMPACK_RGB10A2 || pack == LMPACK_BGR10A2);
+	__m128		v0, v1, v2, c, tmp0, tmp1;
+	__m128i		r, g, b, m, out;
+	const unsigned	*in;
+	byte		*out_texel;
+	int		s, t;
+
+	for (t = 0; t < tmax; t++, dest += stride, bl += smax*3)
+	{
+		in = bl;
+		out_texel = dest;
+		for (s = 0; s + 4 <= smax; s += 4, in += 12, out_texel += 16)
+		{
+			// r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+			v0 = _mm_castsi128_ps (_mm_loadu_si128 ((const __m128i *)in));
+			v1 = _mm_castsi128_ps (_mm_loadu_si128 ((const __m128i *)(in + 4)));
+			v2 = _mm_castsi128_ps (_mm_loadu_si128 ((const __m128i *)(in + 8)));
+
+			c = _mm_shuffle_ps (v1, v2, _MM_SHUFFLE(1,0,3,2));	// r2 g2 b2 r3
+			r = _mm_castps_si128 (_mm_shuffle_ps (v0, c, _MM_SHUFFLE(3,0,3,0)));
+			tmp0 = _mm_shuffle_ps (v0, v1, _MM_SHUFFLE(0,0,1,1));	// g0 g0 g1 g1
+			tmp1 = _mm_shuffle_ps (c, v2, _MM_SHUFFLE(2,2,1,1));	// g2 g2 g3 g3
+			g = _mm_castps_si128 (_mm_shuffle_ps (tmp0, tmp1, _MM_SHUFFLE(2,0,2,0)));
+			tmp0 = _mm_shuffle_ps (v0, v1, _MM_SHUFFLE(1,1,2,2));	// b0 b0 b1 b1
+			tmp1 = _mm_shuffle_ps (c, v2, _MM_SHUFFLE(3,3,2,2));	// b2 b2 b3 b3
+			b = _mm_castps_si128 (_mm_shuffle_ps (tmp0, tmp1, _MM_SHUFFLE(2,0,2,0)));
+
+			// after the shift everything fits in 31 bits, so a signed compare will do
+			r = _mm_srl_epi32 (r, vshift);
+			m = _mm_cmpgt_epi32 (r, vmax);
+			r = _mm_or_si128 (_mm_and_si128 (m, vmax), _mm_andnot_si128 (m, r));
+			g = _mm_srl_epi32 (g, vshift);
+			m = _mm_cmpgt_epi32 (g, vmax);
+			g = _mm_or_si128 (_mm_and_si128 (m, vmax), _mm_andnot_si128 (m, g));
+			b = _mm_srl_epi32 (b, vshift);
+			m = _mm_cmpgt_epi32 (b, vmax);
+			b = _mm_or_si128 (_mm_and_si128 (m, vmax), _mm_andnot_si128 (m, b));
+
+			if (swap)
+			{
+				m = r;
+				r = b;
+				b = m;
+			}
+			if (wide)
+				out = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi32 (r, 22), _mm_slli_epi32 (g, 12)),
+						_mm_or_si128 (_mm_slli_epi32 (b, 2), _mm_set1_epi32 (3)));
+			else
+				out = _mm_or_si128 (_mm_or_si128 (r, _mm_slli_epi32 (g, 8)),
+						_mm_or_si128 (_mm_slli_epi32 (b, 16), _mm_set1_epi32 (0xff000000)));
+			_mm_storeu_si128 ((__m128i *)out_texel, out);
+		}
+
+		LM_StoreSpan_C (out_texel, in, smax - s, shift, maxval, pack);
+	}
+}
+
+static const lmkernels_t lm_kernels_sse2 =
+{
+	{"SSE2", CPU_SSE2},
+	LM_Accumulate_SSE2, LM_DLight_SSE2, LM_Store_SSE2
+};
+
+#endif	/* USE_SSE2 */
+
+/*
+=============================================================================
+
+AVX2
+
+Eight texels make 24 channels, three registers.  Texel k's red channel
+is channel 3k, which lands in lane 3k mod 8 of register 3k/8; those lanes
+are all different, so a blend of the three registers followed by one
+lane permute gathers all eight reds (and the same for green and blue).
+That permute is its own inverse, which gives the interleave too.
+
+=============================================================================
+*/
+
+#if defined(USE_AVX2)
+
+static SIMD_TARGET_AVX2 void LM_Accumulate_AVX2 (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	const __m256i	vscale = _mm256_set1_epi32 (scale);
+	__m256i		v;
+	int		i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		v = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *)(lightmap + i)));
+		v = _mm256_mullo_epi32 (v, vscale);
+		_mm256_storeu_si256 ((__m256i *)(bl + i), _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)(bl + i)), v));
+	}
+
+	_mm256_zeroupper ();
+	LM_Accumulate_C (bl + i, lightmap + i, count - i, scale);
+}
+
+static SIMD_TARGET_AVX2 void LM_DLight_AVX2 (unsigned *bl, int smax, int tmax, const lmdlight_t *light)
+{
+	const __m256	step = _mm256_set_ps (112.f, 96.f, 80.f, 64.f, 48.f, 32.f, 16.f, 0.f);
+	const __m256	local0 = _mm256_set1_ps (light->local[0]);
+	const __m256	rad = _mm256_set1_ps (light->rad);
+	const __m256	minlight = _mm256_set1_ps (light->minlight);
+	const __m256	cr = _mm256_set1_ps (light->color[0]);
+	const __m256	cg = _mm256_set1_ps (light->color[1]);
+	const __m256	cb = _mm256_set1_ps (light->color[2]);
+	const __m256i	permr = _mm256_setr_epi32 (0, 3, 6, 1, 4, 7, 2, 5);
+	const __m256i	permg = _mm256_setr_epi32 (5, 0, 3, 6, 1, 4, 7, 2);
+	const __m256i	permb = _mm256_setr_epi32 (2, 5, 0, 3, 6, 1, 4, 7);
+	const int	simdmax = smax & ~7;
+	__m256i		vtd, vtdhalf, sd, gt, di, r, g, b;
+	__m256		dist, lit, brightness;
+	unsigned	*row;
+	int		s, t, td;
+
+	for (t = 0, row = bl; t < tmax; t++, row += (smax - simdmax)*3)
+	{
+		td = LM_RowDistance (t, light);
+		vtd = _mm256_set1_epi32 (td);
+		vtdhalf = _mm256_set1_epi32 (td>>1);
+
+		for (s = 0; s < simdmax; s += 8, row += 24)
+		{
+			sd = _mm256_cvttps_epi32 (_mm256_sub_ps (local0, _mm256_add_ps (_mm256_set1_ps ((float)(s*16)), step)));
+			sd = _mm256_abs_epi32 (sd);
+
+			gt = _mm256_cmpgt_epi32 (sd, vtd);
+			di = _mm256_blendv_epi8 (_mm256_add_epi32 (vtd, _mm256_srai_epi32 (sd, 1)), _mm256_add_epi32 (sd, vtdhalf), gt);
+			dist = _mm256_cvtepi32_ps (di);
+			lit = _mm256_cmp_ps (dist, minlight, _CMP_LT_OQ);
+			if (!_mm256_movemask_ps (lit))
+				continue;
+
+			brightness = _mm256_sub_ps (rad, dist);
+			r = _mm256_and_si256 (_mm256_cvttps_epi32 (_mm256_mul_ps (brightness, cr)), _mm256_castps_si256 (lit));
+			g = _mm256_and_si256 (_mm256_cvttps_epi32 (_mm256_mul_ps (brightness, cg)), _mm256_castps_si256 (lit));
+			b = _mm256_and_si256 (_mm256_cvttps_epi32 (_mm256_mul_ps (brightness, cb)), _mm256_castps_si256 (lit));
+
+			r = _mm256_permutevar8x32_epi32 (r, permr);
+			g = _mm256_permutevar8x32_epi32 (g, permg);
+			b = _mm256_permutevar8x32_epi32 (b, permb);
+
+			_mm256_storeu_si256 ((__m256i *)row, _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)row),
+					_mm256_blend_epi32 (_mm256_blend_epi32 (r, g, 0x92), b, 0x24)));
+			_mm256_storeu_si256 ((__m256i *)(row + 8), _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)(row + 8)),
+					_mm256_blend_epi32 (_mm256_blend_epi32 (b, r, 0x92), g, 0x24)));
+			_mm256_storeu_si256 ((__m256i *)(row + 16), _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *)(row + 16)),
+					_mm256_blend_epi32 (_mm256_blend_epi32 (g, b, 0x92), r, 0x24)));
+		}
+	}
+
+	// leave AVX state before running the plain C tails, mixing the two is slow
+	_mm256_zeroupper ();
+	if (simdmax < smax)
+		for (t = 0; t < tmax; t++)
+			LM_DLightSpan_C (bl + (t*smax + simdmax)*3, simdmax, smax, LM_RowDistance (t, light), light);
+}
+
+static SIMD_TARGET_AVX2 void LM_Store_AVX2 (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift, unsigned maxval, lmpack_t pack)
+{
+	const __m128i	vshift = _mm_cvtsi32_si128 (shift);
+	const __m256i	vmax = _mm256_set1_epi32 (maxval);
+	const __m256i	permr = _mm256_setr_epi32 (0, 3, 6, 1, 4, 7, 2, 5);
+	const __m256i	permg = _mm256_setr_epi32 (1, 4, 7, 2, 5, 0, 3, 6);
+	const __m256i	permb = _mm256_setr_epi32 (2, 5, 0, 3, 6, 1, 4, 7);
+	const qboolean	swap = (pack == LMPACK_BGRA8 || pack == LMPACK_BGR10A2);
+	const qboolean	wide = (pack == LMPACK_RGB10A2 || pack == LMPACK_BGR10A2);
+	const int	simdmax = smax & ~7;
+	__m256i		y0, y1, y2, r, g, b, out;
+	const unsigned	*in;
+	byte		*out_texel;
+	int		s, t;
+
+	for (t = 0; t < tmax; t++)
+	{
+		in = bl + t*smax*3;
+		out_texel = dest + t*stride;
+		for (s = 0; s < simdmax; s += 8, in += 24, out_texel += 32)
+		{
+			y0 = _mm256_loadu_si256 ((const __m256i *)in);
+			y1 = _mm256_loadu_si256 ((const __m256i *)(in + 8));
+			y2 = _mm256_loadu_si256 ((const __m256i *)(in + 16));
+
+			r = _mm256_permutevar8x32_epi32 (_mm256_blend_epi32 (_mm256_blend_epi32 (y0, y1, 0x92), y2, 0x24), permr);
+			g = _mm256_permutevar8x32_epi32 (_mm256_blend_epi32 (_mm256_blend_epi32 (y0, y1, 0x24), y2, 0x49), permg);
+			b = _mm256_permutevar8x32_epi32 (_mm256_blend_epi32 (_mm256_blend_epi32 (y0, y1, 0x49), y2, 0x92), permb);
+
+			r = _mm256_min_epu32 (_mm256_srl_epi32 (r, vshift), vmax);
+			g = _mm256_min_epu32 (_mm256_srl_epi32 (g, vshift), vmax);
+			b = _mm256_min_epu32 (_mm256_srl_epi32 (b, vshift), vmax);
+
+			if (swap)
+			{
+				out = r;
+				r = b;
+				b = out;
+			}
+			if (wide)
+				out = _mm256_or_si256 (_mm256_or_si256 (_mm256_slli_epi32 (r, 22), _mm256_slli_epi32 (g, 12)),
+						_mm256_or_si256 (_mm256_slli_epi32 (b, 2), _mm256_set1_epi32 (3)));
+			else
+				out = _mm256_or_si256 (_mm256_or_si256 (r, _mm256_slli_epi32 (g, 8)),
+						_mm256_or_si256 (_mm256_slli_epi32 (b, 16), _mm256_set1_epi32 (0xff000000)));
+			_mm256_storeu_si256 ((__m256i *)out_texel, out);
+		}
+	}
+
+	_mm256_zeroupper ();
+	if (simdmax < smax)
+		for (t = 0; t < tmax; t++)
+			LM_StoreSpan_C (dest + t*stride + simdmax*4, bl + (t*smax + simdmax)*3, smax - simdmax, shift, maxval, pack);
+}
+
+static const lmkernels_t lm_kernels_avx2 =
+{
+	{"AVX2", CPU_AVX2},
+	LM_Accumulate_AVX2, LM_DLight_AVX2, LM_Store_AVX2
+};
+
+#endif	/* USE_AVX2 */
+
+/*
+=============================================================================
+
+NEON
+
+vld3/vst3 do the r g b (de)interleaving for us.
+
+=============================================================================
+*/
+
+#if defined(USE_NEON)
+
+static void LM_Accumulate_NEON (unsigned *bl, const byte *lightmap, int count, unsigned scale)
+{
+	uint8x16_t	v;
+	uint16x8_t	lo, hi;
+	int		i = 0;
+
+	if (scale <= 0xffff)
+	{
+		for ( ; i + 16 <= count; i += 16)
+		{
+			v = vld1q_u8 (lightmap + i);
+			lo = vmovl_u8 (vget_low_u8 (v));
+			hi = vmovl_u8 (vget_high_u8 (v));
+			vst1q_u32 (bl + i, vmlal_n_u16 (vld1q_u32 (bl + i), vget_low_u16 (lo), (uint16_t)scale));
+			vst1q_u32 (bl + i + 4, vmlal_n_u16 (vld1q_u32 (bl + i + 4), vget_high_u16 (lo), (uint16_t)scale));
+			vst1q_u32 (bl + i + 8, vmlal_n_u16 (vld1q_u32 (bl + i + 8), vget_low_u16 (hi), (uint16_t)scale));
+			vst1q_u32 (bl + i + 12, vmlal_n_u16 (vld1q_u32 (bl + i + 12), vget_high_u16 (hi), (uint16_t)scale));
+		}
+	}
+
+	LM_Accumulate_C (bl + i, lightmap + i, count - i, scale);
+}
+
+static void LM_DLight_NEON (unsigned *bl, int smax, int tmax, const lmdlight_t *light)
+{
+	static const float	stepf[4] = {0.f, 16.f, 32.f, 48.f};
+	const float32x4_t	step = vld1q_f32 (stepf);
+	const float32x4_t	local0 = vdupq_n_f32 (light->local[0]);
+	const float32x4_t	rad = vdupq_n_f32 (light->rad);
+	const float32x4_t	minlight = vdupq_n_f32 (light->minlight);
+	int32x4_t	vtd, vtdhalf, sd, di;
+	uint32x4_t	gt, lit;
+	uint32x2_t	any;
+	float32x4_t	dist, brightness;
+	uint32x4x3_t	rgb;
+	unsigned	*row;
+	int		s, t, td;
+
+	for (t = 0; t < tmax; t++, bl += smax*3)
+	{
+		td = LM_RowDistance (t, light);
+		vtd = vdupq_n_s32 (td);
+		vtdhalf = vdupq_n_s32 (td>>1);
+
+		row = bl;
+		for (s = 0; s + 4 <= smax; s += 4, row += 12)
+		{
+			sd = vabsq_s32 (vcvtq_s32_f32 (vsubq_f32 (local0, vaddq_f32 (vdupq_n_f32 ((float)(s*16)), step))));
+			gt = vcgtq_s32 (sd, vtd);
+			di = vbslq_s32 (gt, vaddq_s32 (sd, vtdhalf), vaddq_s32 (vtd, vshrq_n_s32 (sd, 1)));
+			dist = vcvtq_f32_s32 (di);
+			lit = vcltq_f32 (dist, minlight);
+			any = vorr_u32 (vget_low_u32 (lit), vget_high_u32 (lit));
+			if (!(vget_lane_u32 (any, 0) | vget_lane_u32 (any, 1)))
+				continue;
+
+			brightness = vsubq_f32 (rad, dist);
+			rgb = vld3q_u32 (row);
+			rgb.val[0] = vaddq_u32 (rgb.val[0], vandq_u32 (vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (brightness, light->color[0]))), lit));
+			rgb.val[1] = vaddq_u32 (rgb.val[1], vandq_u32 (vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (brightness, light->color[1]))), lit));
+			rgb.val[2] = vaddq_u32 (rgb.val[2], vandq_u32 (vreinterpretq_u32_s32 (vcvtq_s32_f32 (vmulq_n_f32 (brightness, light->color[2]))), lit));
+			vst3q_u32 (row, rgb);
+		}
+
+		LM_DLightSpan_C (row, s, smax, td, light);
+	}
+}
+
+static void LM_Store_NEON (byte *dest, int stride, const unsigned *bl, int smax, int tmax, int shift, unsigned maxval, lmpack_t pack)
+{
+	const int32x4_t		vshift = vdupq_n_s32 (-shift);
+	const uint32x4_t	vmax = vdupq_n_u32 (maxval);
+	const qboolean	swap = (pack == LMPACK_BGRA8 || pack == LMPACK_BGR10A2);
+	const qboolean	wide = (pack == LMPACK_RGB10A2 || pack == LMPACK_BGR10A2);
+	uint32x4x3_t	rgb;
+	uint32x4_t	r, g, b, out;
+	const unsigned	*in;
+	byte		*out_texel;
+	int		s, t;
+
+	for (t = 0; t < tmax; t++, dest += stride, bl += smax*3)
+	{
+		in = bl;
+		out_texel = dest;
+		for (s = 0; s + 4 <= smax; s += 4, in += 12, out_texel += 16)
+		{
+			rgb = vld3q_u32 (in);
+			r = vminq_u32 (vshlq_u32 (rgb.val[swap ? 2 : 0], vshift), vmax);
+			g = vminq_u32 (vshlq_u32 (rgb.val[1], vshift), vmax);
+			b = vminq_u32 (vshlq_u32 (rgb.val[swap ? 0 : 2], vshift), vmax);
+			if (wide)
+				out = vorrq_u32 (vorrq_u32 (vshlq_n_u32 (r, 22), vshlq_n_u32 (g, 12)),
+						vorrq_u32 (vshlq_n_u32 (b, 2), vdupq_n_u32 (3)));
+			else
+				out = vorrq_u32 (vorrq_u32 (r, vshlq_n_u32 (g, 8)),
+						vorrq_u32 (vshlq_n_u32 (b, 16), vdupq_n_u32 (0xff000000)));
+			vst1q_u32 ((uint32_t *)out_texel, out);
+		}
+
+		LM_StoreSpan_C (out_texel, in, smax - s, shift, maxval, pack);
+	}
+}
+
+static const lmkernels_t lm_kernels_neon =
+{
+	{"NEON", CPU_NEON},
+	LM_Accumulate_NEON, LM_DLight_NEON, LM_Store_NEON
+};
+
+#endif	/* USE_NEON */
+
+//==============================================================================
+
+// fastest first
+static const kernelinfo_t *lm_kernellist[] =
+{
+#if defined(USE_AVX2)
+	&lm_kernels_avx2.info,
+#endif
+#if defined(USE_SSE2)
+	&lm_kernels_sse2.info,
+#endif
+#if defined(USE_NEON)
+	&lm_kernels_neon.info,
+#endif
+	&lm_kernels_c.info
+};
+
+/*
+===============
+R_SetLightmapKernels_f -- called when r_lightmapsimd changes
+===============
+*/
+static void R_SetLightmapKernels_f (cvar_t *var)
+{
+	lm_kernels = (const lmkernels_t *) COM_PickKernels (lm_kernellist, Q_COUNTOF(lm_kernellist), var->value != 0);
+}
+
+/*
+=============================================================================
+
+BENCHMARK
+
+r_lightmapbench [iterations] builds a few made up surfaces with every
+kernel set this cpu can run, checks a hash of the output in all the
+pack modes against the C kernels, and times each stage.
+
+=============================================================================
+*/
+
+#define	BENCH_STYLES	4
+#define	BENCH_LIGHTS	3
+
+typedef struct
+{
+	int		smax, tmax;
+	byte		*samples;
+	unsigned	scale[BENCH_STYLES];
+	lmdlight_t	lights[BENCH_LIGHTS];
+} benchsurf_t;
+
+// odd sizes on purpose, to get the scalar tails
+static const int bench_sizes[][2] = {{3, 3}, {18, 18}, {33, 9}, {17, 64}, {126, 126}};
+#define	NUM_BENCH_SURFS	Q_COUNTOF(bench_sizes)
+
+typedef struct
+{
+	benchsurf_t	surfs[NUM_BENCH_SURFS];
+	unsigned	*bl;
+	byte		*dest;
+	int		iterations;
+} lmbench_t;
+
+static void LM_BenchBuild (const lmkernels_t *k, const benchsurf_t *surf, unsigned *bl, byte *dest,
+			   int shift, unsigned maxval, lmpack_t pack)
+{
+	const int	size = surf->smax * surf->tmax * 3;
+	int		i;
+
+	memset (bl, 0, size * sizeof(*bl));
+	for (i = 0; i < BENCH_STYLES; i++)
+		k->accumulate (bl, surf->samples + i*size, size, surf->scale[i]);
+	for (i = 0; i < BENCH_LIGHTS; i++)
+		k->dlight (bl, surf->smax, surf->tmax, &surf->lights[i]);
+	k->store (dest, surf->smax*4, bl, surf->smax, surf->tmax, shift, maxval, pack);
+}
+
+static void LM_BenchKernels (const kernelinfo_t *kernels, void *data, kernelbench_t *result)
+{
+	static const struct { int shift; unsigned maxval; lmpack_t pack; } modes[] =
+	{
+		{7, 255, LMPACK_RGBA8}, {8, 255, LMPACK_RGBA8}, {7, 255, LMPACK_BGRA8}, {8, 255, LMPACK_BGRA8},
+		{7, 255, LMPACK_RGB10A2}, {8, 1023, LMPACK_RGB10A2}, {7, 255, LMPACK_BGR10A2}, {8, 1023, LMPACK_BGR10A2}
+	};
+	const lmkernels_t	*k = (const lmkernels_t *) kernels;
+	lmbench_t		*bench = (lmbench_t *) data;
+	benchsurf_t		*surf;
+	double			start, t_accum, t_dlight, t_store;
+	int			j, m, size;
+
+	for (j = 0, surf = bench->surfs; j < (int)NUM_BENCH_SURFS; j++, surf++)
+	{
+		for (m = 0; m < (int)Q_COUNTOF(modes); m++)
+		{
+			LM_BenchBuild (k, surf, bench->bl, bench->dest, modes[m].shift, modes[m].maxval, modes[m].pack);
+			result->hash = Hash_Block64 (bench->dest, surf->smax * surf->tmax * 4, result->hash);
+		}
+	}
+
+	t_accum = t_dlight = t_store = 0;
+	for (j = 0, surf = bench->surfs; j < (int)NUM_BENCH_SURFS; j++, surf++)
+	{
+		size = surf->smax * surf->tmax * 3;
+
+		memset (bench->bl, 0, size * sizeof(*bench->bl));
+		start = Sys_DoubleTime ();
+		for (m = 0; m < bench->iterations * BENCH_STYLES; m++)
+			k->accumulate (bench->bl, surf->samples + (m % BENCH_STYLES)*size, size, surf->scale[m % BENCH_STYLES]);
+		t_accum += Sys_DoubleTime () - start;
+
+		start = Sys_DoubleTime ();
+		for (m = 0; m < bench->iterations * BENCH_LIGHTS; m++)
+			k->dlight (bench->bl, surf->smax, surf->tmax, &surf->lights[m % BENCH_LIGHTS]);
+		t_dlight += Sys_DoubleTime () - start;
+
+		start = Sys_DoubleTime ();
+		for (m = 0; m < bench->iterations; m++)
+			k->store (bench->dest, surf->smax*4, bench->bl, surf->smax, surf->tmax, 7, 255, LMPACK_RGBA8);
+		t_store += Sys_DoubleTime () - start;
+	}
+
+	result->time = t_accum + t_dlight + t_store;
+	q_snprintf (result->columns, sizeof(result->columns), "%6.1fms %6.1fms %6.1fms %6.1fms",
+		    t_accum * 1000.0, t_dlight * 1000.0, t_store * 1000.0, result->time * 1000.0);
+}
+
+static void R_LightmapBench_f (void)
+{
+	lmbench_t	bench;
+	benchsurf_t	*surf;
+	int		i, j, maxsize;
+	lmdlight_t	*l;
+
+	bench.iterations = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 200;
+	bench.iterations = q_max (bench.iterations, 1);
+
+	srand (1234);
+	maxsize = 0;
+	for (i = 0, surf = bench.surfs; i < (int)NUM_BENCH_SURFS; i++, surf++)
+	{
+		surf->smax = bench_sizes[i][0];
+		surf->tmax = bench_sizes[i][1];
+		maxsize = q_max (maxsize, surf->smax * surf->tmax * 3);
+		surf->samples = (byte *) malloc (surf->smax * surf->tmax * 3 * BENCH_STYLES);
+		for (j = 0; j < surf->smax * surf->tmax * 3 * BENCH_STYLES; j++)
+			surf->samples[j] = rand () & 255;
+		for (j = 0; j < BENCH_STYLES; j++)
+			surf->scale[j] = (rand () % 26) * 22;	// what lightstyle strings give
+		for (j = 0; j < BENCH_LIGHTS; j++)
+		{
+			l = &surf->lights[j];
+			l->local[0] = (rand () % (surf->smax * 16 + 64)) - 32 + (rand () & 255) / 256.f;
+			l->local[1] = (rand () % (surf->tmax * 16 + 64)) - 32 + (rand () & 255) / 256.f;
+			l->rad = 100 + rand () % 300;
+			l->minlight = l->rad - (rand () % 16);
+			l->color[0] = (rand () & 255);
+			l->color[1] = (rand () & 255);
+			l->color[2] = (rand () & 255);
+		}
+	}
+	bench.bl = (unsigned *) malloc (maxsize * sizeof(*bench.bl));
+	bench.dest = (byte *) malloc (maxsize / 3 * 4);
+
+	Con_Printf ("lightmap kernels, %d surfaces x %d iterations, using %s\n",
+		    (int)NUM_BENCH_SURFS, bench.iterations, lm_kernels->info.name);
+	Con_Printf ("       accum  dlight   store   total   speedup\n");
+
+	COM_BenchKernels (lm_kernellist, Q_COUNTOF(lm_kernellist), LM_BenchKernels, &bench);
+
+	for (i = 0; i < (int)NUM_BENCH_SURFS; i++)
+		free (bench.surfs[i].samples);
+	free (bench.bl);
+	free (bench.dest);
+}
+
+/*
+===============
+R_InitLightmapKernels
+===============
+*/
+void R_InitLightmapKernels (void)
+{
+	Cvar_RegisterVariable (&r_lightmapsimd);
+	Cvar_SetCallback (&r_lightmapsimd, R_SetLightmapKernels_f);
+	Cmd_AddCommand ("r_lightmapbench", R_LightmapBench_f);
+
+	R_SetLightmapKernels_f (&r_lightmapsimd);
+}
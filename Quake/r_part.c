@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include "q_simd.h"
 
 #define ABSOLUTE_MAX_PARTICLES	32768		// default max # of particles at one time
 #define ABSOLUTE_MIN_PARTICLES	512		// no fewer than this no matter what's
@@ -32,7 +33,65 @@ static int	ramp1[8] = {0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61};
 static int	ramp2[8] = {0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66};
 static int	ramp3[8] = {0x6d, 0x6b, 6, 5, 4, 3};
 
-static particle_t	*active_particles, *free_particles, *particles;
+/*
+=============================================================================
+
+PARTICLE STORE
+
+Live particles are kept per type, one array per field, so each type can
+be moved by a single loop with no branches and no pointer chasing.  A
+dead particle is replaced by the last one of its type.
+
+Spawning code fills particle_t structs from R_NewParticle, which are
+sorted into the arrays the next time the particles are moved or drawn.
+
+=============================================================================
+*/
+
+#define NUM_PARTICLE_TYPES	(pt_blob2 + 1)
+
+typedef struct
+{
+	float	*org[3];
+	float	*vel[3];
+	float	*ramp;
+	float	*die;
+	float	*color;
+	int	count;
+} partlist_t;
+
+typedef struct
+{
+	partlist_t	lists[NUM_PARTICLE_TYPES];
+	particle_t	*spawned;	// waiting to be sorted into lists
+	int		numspawned;
+	int		numactive;	// in lists
+	int		max;
+	unsigned int	version;	// bumped whenever the lists change
+} partstore_t;
+
+#define PARTLIST_ARRAYS	9	// org, vel, ramp, die, color
+
+static partstore_t	r_parts;
+static partstore_t	*partstore = &r_parts;	// where R_NewParticle puts things
+
+typedef struct
+{
+	float	xyz[3];
+	float	st[2];
+	byte	color[4];
+} partvert_t;
+
+static partvert_t	*partverts;
+
+// what the streamed path uploads, sizes and corners come from the shader
+typedef struct
+{
+	float	org[3];
+	byte	color[4];
+} partinstance_t;
+
+static partinstance_t	*partinstances;	// staging when the buffer can't be mapped
 
 static int	r_numparticles;
 
@@ -41,6 +100,114 @@ static float texturescalefactor; //johnfitz -- compensate for apparent size of d
 
 cvar_t	r_particles = {"r_particles","1", CVAR_ARCHIVE}; //johnfitz
 cvar_t	r_quadparticles = {"r_quadparticles","1", CVAR_ARCHIVE}; //johnfitz
+cvar_t	r_particlesimd = {"r_particlesimd","1",CVAR_NONE};
+cvar_t	r_particlestream = {"r_particlestream","1",CVAR_NONE};
+
+/*
+===============
+R_ParticleStoreSize
+
+bytes needed by R_InitParticleStore for max particles
+===============
+*/
+static size_t R_ParticleStoreSize (int max)
+{
+	const int	cap = (max + 7) & ~7;
+
+	return NUM_PARTICLE_TYPES * PARTLIST_ARRAYS * cap * sizeof(float) +
+		max * sizeof(particle_t) + 32;
+}
+
+/*
+===============
+R_InitParticleStore
+
+carves the arrays out of mem, which must be R_ParticleStoreSize (max) bytes
+===============
+*/
+static void R_InitParticleStore (partstore_t *ps, int max, byte *mem)
+{
+	const int	cap = (max + 7) & ~7;
+	float		*f;
+	partlist_t	*pl;
+	int		i, j;
+
+	// every array starts on a 32 byte boundary
+	f = (float *)(((uintptr_t)mem + 31) & ~(uintptr_t)31);
+	for (i = 0, pl = ps->lists; i < NUM_PARTICLE_TYPES; i++, pl++)
+	{
+		for (j = 0; j < 3; j++, f += cap)
+			pl->org[j] = f;
+		for (j = 0; j < 3; j++, f += cap)
+			pl->vel[j] = f;
+		pl->ramp = f;
+		f += cap;
+		pl->die = f;
+		f += cap;
+		pl->color = f;
+		f += cap;
+		pl->count = 0;
+	}
+	ps->spawned = (particle_t *)f;
+	ps->numspawned = 0;
+	ps->numactive = 0;
+	ps->max = max;
+	ps->version = 0;
+}
+
+/*
+===============
+R_NewParticle
+
+returns NULL when the store is full
+===============
+*/
+static particle_t *R_NewParticle (void)
+{
+	partstore_t	*ps = partstore;
+	particle_t	*p;
+
+	if (ps->numactive + ps->numspawned >= ps->max)
+		return NULL;
+
+	p = &ps->spawned[ps->numspawned++];
+	memset (p, 0, sizeof(*p));
+	return p;
+}
+
+/*
+===============
+R_SortSpawnedParticles
+===============
+*/
+static void R_SortSpawnedParticles (partstore_t *ps)
+{
+	const particle_t	*p;
+	partlist_t		*pl;
+	int			i, n;
+
+	if (!ps->numspawned)
+		return;
+
+	for (i = 0, p = ps->spawned; i < ps->numspawned; i++, p++)
+	{
+		pl = &ps->lists[p->type];
+		n = pl->count++;
+		pl->org[0][n] = p->org[0];
+		pl->org[1][n] = p->org[1];
+		pl->org[2][n] = p->org[2];
+		pl->vel[0][n] = p->vel[0];
+		pl->vel[1][n] = p->vel[1];
+		pl->vel[2][n] = p->vel[2];
+		pl->ramp[n] = p->ramp;
+		pl->die[n] = p->die;
+		pl->color[n] = p->color;
+	}
+
+	ps->numactive += ps->numspawned;
+	ps->numspawned = 0;
+	ps->version++;
+}
 
 /*
 ===============
@@ -139,6 +306,505 @@ static void R_SetParticleTexture_f (cvar_t *var)
 	}
 }
 
+/*
+=============================================================================
+
+MOVEMENT KERNELS
+
+Every type moves the same way, only with different constants:
+	org += vel * frametime
+	vel += vel * k		(kxy for x and y, kz for z)
+	vel[2] += grav
+	ramp += ramp speed
+so one kernel per instruction set covers all of them.  The ramp colors
+and ramp deaths are table lookups and stay scalar.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	float	frametime;
+	float	kxy, kz;
+	float	grav;
+	float	ramp;
+} partmove_t;
+
+typedef struct
+{
+	kernelinfo_t	info;
+	void	(*move) (partlist_t *pl, const partmove_t *m);
+} partkernels_t;
+
+static const partkernels_t	*part_kernels;
+
+/*
+===============
+Part_MoveSpan_C
+
+particles first..count-1
+===============
+*/
+static void Part_MoveSpan_C (partlist_t *pl, int first, const partmove_t *m)
+{
+	float	*ox = pl->org[0], *oy = pl->org[1], *oz = pl->org[2];
+	float	*vx = pl->vel[0], *vy = pl->vel[1], *vz = pl->vel[2];
+	float	*ramp = pl->ramp;
+	int	i;
+
+	for (i = first; i < pl->count; i++)
+	{
+		ox[i] += vx[i] * m->frametime;
+		oy[i] += vy[i] * m->frametime;
+		oz[i] += vz[i] * m->frametime;
+		vx[i] += vx[i] * m->kxy;
+		vy[i] += vy[i] * m->kxy;
+		vz[i] += vz[i] * m->kz;
+		vz[i] += m->grav;
+		ramp[i] += m->ramp;
+	}
+}
+
+static void Part_Move_C (partlist_t *pl, const partmove_t *m)
+{
+	Part_MoveSpan_C (pl, 0, m);
+}
+
+static const partkernels_t part_kernels_c =
+{
+	{"C", 0},
+	Part_Move_C
+};
+
+#if defined(USE_SSE2)
+
+static SIMD_TARGET_SSE2 void Part_Move_SSE2 (partlist_t *pl, const partmove_t *m)
+{
+	const __m128	ft = _mm_set1_ps (m->frametime);
+	const __m128	kxy = _mm_set1_ps (m->kxy);
+	const __m128	kz = _mm_set1_ps (m->kz);
+	const __m128	grav = _mm_set1_ps (m->grav);
+	const __m128	rampspeed = _mm_set1_ps (m->ramp);
+	__m128		vx, vy, vz;
+	int		i;
+
+	for (i = 0; i + 4 <= pl->count; i += 4)
+	{
+		vx = _mm_loadu_ps (pl->vel[0] + i);
+		vy = _mm_loadu_ps (pl->vel[1] + i);
+		vz = _mm_loadu_ps (pl->vel[2] + i);
+
+		_mm_storeu_ps (pl->org[0] + i, _mm_add_ps (_mm_loadu_ps (pl->org[0] + i), _mm_mul_ps (vx, ft)));
+		_mm_storeu_ps (pl->org[1] + i, _mm_add_ps (_mm_loadu_ps (pl->org[1] + i), _mm_mul_ps (vy, ft)));
+		_mm_storeu_ps (pl->org[2] + i, _mm_add_ps (_mm_loadu_ps (pl->org[2] + i), _mm_mul_ps (vz, ft)));
+
+		vx = _mm_add_ps (vx, _mm_mul_ps (vx, kxy));
+		vy = _mm_add_ps (vy, _mm_mul_ps (vy, kxy));
+		vz = _mm_add_ps (vz, _mm_mul_ps (vz, kz));
+		vz = _mm_add_ps (vz, grav);
+		_mm_storeu_ps (pl->vel[0] + i, vx);
+		_mm_storeu_ps (pl->vel[1] + i, vy);
+		_mm_storeu_ps (pl->vel[2] + i, vz);
+
+		_mm_storeu_ps (pl->ramp + i, _mm_add_ps (_mm_loadu_ps (pl->ramp + i), rampspeed));
+	}
+
+	Part_MoveSpan_C (pl, i, m);
+}
+
+static const partkernels_t part_kernels_sse2 =
+{
+	{"SSE2", CPU_SSE2},
+	Part_Move_SSE2
+};
+
+#endif	/* USE_SSE2 */
+
+#if defined(USE_AVX2)
+
+static SIMD_TARGET_AVX2 void Part_Move_AVX2 (partlist_t *pl, const partmove_t *m)
+{
+	const __m256	ft = _mm256_set1_ps (m->frametime);
+	const __m256	kxy = _mm256_set1_ps (m->kxy);
+	const __m256	kz = _mm256_set1_ps (m->kz);
+	const __m256	grav = _mm256_set1_ps (m->grav);
+	const __m256	rampspeed = _mm256_set1_ps (m->ramp);
+	__m256		vx, vy, vz;
+	int		i;
+
+	for (i = 0; i + 8 <= pl->count; i += 8)
+	{
+		vx = _mm256_loadu_ps (pl->vel[0] + i);
+		vy = _mm256_loadu_ps (pl->vel[1] + i);
+		vz = _mm256_loadu_ps (pl->vel[2] + i);
+
+		_mm256_storeu_ps (pl->org[0] + i, _mm256_add_ps (_mm256_loadu_ps (pl->org[0] + i), _mm256_mul_ps (vx, ft)));
+		_mm256_storeu_ps (pl->org[1] + i, _mm256_add_ps (_mm256_loadu_ps (pl->org[1] + i), _mm256_mul_ps (vy, ft)));
+		_mm256_storeu_ps (pl->org[2] + i, _mm256_add_ps (_mm256_loadu_ps (pl->org[2] + i), _mm256_mul_ps (vz, ft)));
+
+		vx = _mm256_add_ps (vx, _mm256_mul_ps (vx, kxy));
+		vy = _mm256_add_ps (vy, _mm256_mul_ps (vy, kxy));
+		vz = _mm256_add_ps (vz, _mm256_mul_ps (vz, kz));
+		vz = _mm256_add_ps (vz, grav);
+		_mm256_storeu_ps (pl->vel[0] + i, vx);
+		_mm256_storeu_ps (pl->vel[1] + i, vy);
+		_mm256_storeu_ps (pl->vel[2] + i, vz);
+
+		_mm256_storeu_ps (pl->ramp + i, _mm256_add_ps (_mm256_loadu_ps (pl->ramp + i), rampspeed));
+	}
+
+	Part_MoveSpan_C (pl, i, m);
+}
+
+static const partkernels_t part_kernels_avx2 =
+{
+	{"AVX2", CPU_AVX2},
+	Part_Move_AVX2
+};
+
+#endif	/* USE_AVX2 */
+
+// fastest first
+static const kernelinfo_t *part_kernellist[] =
+{
+#if defined(USE_AVX2)
+	&part_kernels_avx2.info,
+#endif
+#if defined(USE_SSE2)
+	&part_kernels_sse2.info,
+#endif
+	&part_kernels_c.info
+};
+
+/*
+===============
+R_SetParticleKernels_f -- called when r_particlesimd changes
+===============
+*/
+static void R_SetParticleKernels_f (cvar_t *var)
+{
+	part_kernels = (const partkernels_t *) COM_PickKernels (part_kernellist, Q_COUNTOF(part_kernellist), var->value != 0);
+}
+
+/*
+===============
+R_KillParticles -- swap-removes everything that died before time
+===============
+*/
+static void R_KillParticles (partstore_t *ps, partlist_t *pl, double time)
+{
+	int	i, last;
+
+	for (i = 0; i < pl->count; )
+	{
+		if (pl->die[i] >= time)
+		{
+			i++;
+			continue;
+		}
+
+		last = --pl->count;
+		pl->org[0][i] = pl->org[0][last];
+		pl->org[1][i] = pl->org[1][last];
+		pl->org[2][i] = pl->org[2][last];
+		pl->vel[0][i] = pl->vel[0][last];
+		pl->vel[1][i] = pl->vel[1][last];
+		pl->vel[2][i] = pl->vel[2][last];
+		pl->ramp[i] = pl->ramp[last];
+		pl->die[i] = pl->die[last];
+		pl->color[i] = pl->color[last];
+		ps->numactive--;
+	}
+}
+
+/*
+===============
+R_RampParticles -- colors from the ramp, and death at the end of it
+===============
+*/
+static void R_RampParticles (partlist_t *pl, const int *ramp, float end)
+{
+	int	i;
+
+	for (i = 0; i < pl->count; i++)
+	{
+		if (pl->ramp[i] >= end)
+			pl->die[i] = -1;
+		else
+			pl->color[i] = ramp[(int)pl->ramp[i]];
+	}
+}
+
+/*
+===============
+R_MoveParticles
+===============
+*/
+static void R_MoveParticles (partstore_t *ps, float frametime, float gravity, double time)
+{
+	partmove_t	moves[NUM_PARTICLE_TYPES];
+	float		time1, time2, time3, dvel, grav;
+	partlist_t	*pl;
+	int		i;
+
+	time3 = frametime * 15;
+	time2 = frametime * 10;
+	time1 = frametime * 5;
+	grav = frametime * gravity * 0.05;
+	dvel = 4*frametime;
+
+	for (i = 0; i < NUM_PARTICLE_TYPES; i++)
+	{
+		moves[i].frametime = frametime;
+		moves[i].kxy = moves[i].kz = 0;
+		moves[i].grav = -grav;
+		moves[i].ramp = 0;
+	}
+	moves[pt_static].grav = 0;
+	moves[pt_fire].grav = grav;
+	moves[pt_fire].ramp = time1;
+	moves[pt_explode].kxy = moves[pt_explode].kz = dvel;
+	moves[pt_explode].ramp = time2;
+	moves[pt_explode2].kxy = moves[pt_explode2].kz = -frametime;
+	moves[pt_explode2].ramp = time3;
+	moves[pt_blob].kxy = moves[pt_blob].kz = dvel;
+	moves[pt_blob2].kxy = -dvel;
+
+	R_SortSpawnedParticles (ps);
+
+	for (i = 0, pl = ps->lists; i < NUM_PARTICLE_TYPES; i++, pl++)
+	{
+		R_KillParticles (ps, pl, time);
+		if (pl->count)
+			part_kernels->move (pl, &moves[i]);
+	}
+
+	R_RampParticles (&ps->lists[pt_fire], ramp3, 6);
+	R_RampParticles (&ps->lists[pt_explode], ramp1, 8);
+	R_RampParticles (&ps->lists[pt_explode2], ramp2, 8);
+
+	ps->version++;
+}
+
+/*
+===============
+R_BuildParticleVerts
+
+quads or triangles facing the current view, returns the vertex count
+===============
+*/
+static int R_BuildParticleVerts (partstore_t *ps, partvert_t *verts, qboolean quads)
+{
+	const float	st = quads ? 0.5 : 1;
+	vec3_t		up, right;
+	partlist_t	*pl;
+	partvert_t	*v = verts;
+	const byte	*c;
+	float		scale, x, y, z;
+	int		i, j;
+
+	VectorScale (vup, 1.5, up);
+	VectorScale (vright, 1.5, right);
+
+	for (i = 0, pl = ps->lists; i < NUM_PARTICLE_TYPES; i++, pl++)
+	{
+		for (j = 0; j < pl->count; j++)
+		{
+			x = pl->org[0][j];
+			y = pl->org[1][j];
+			z = pl->org[2][j];
+
+			// hack a scale up to keep particles from disapearing
+			scale = (x - r_origin[0]) * vpn[0]
+				  + (y - r_origin[1]) * vpn[1]
+				  + (z - r_origin[2]) * vpn[2];
+			if (scale < 20)
+				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
+			else
+				scale = 1 + scale * 0.004;
+
+			if (quads)
+				scale /= 2.0; //quad is half the size of triangle
+
+			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
+
+			c = (const byte *) &d_8to24table[(int)pl->color[j]];
+
+			v[0].xyz[0] = x;
+			v[0].xyz[1] = y;
+			v[0].xyz[2] = z;
+			v[0].st[0] = 0;
+			v[0].st[1] = 0;
+
+			v[1].xyz[0] = x + up[0] * scale;
+			v[1].xyz[1] = y + up[1] * scale;
+			v[1].xyz[2] = z + up[2] * scale;
+			v[1].st[0] = st;
+			v[1].st[1] = 0;
+
+			if (quads)
+			{
+				v[2].xyz[0] = v[1].xyz[0] + right[0] * scale;
+				v[2].xyz[1] = v[1].xyz[1] + right[1] * scale;
+				v[2].xyz[2] = v[1].xyz[2] + right[2] * scale;
+				v[2].st[0] = st;
+				v[2].st[1] = st;
+				v[3].xyz[0] = x + right[0] * scale;
+				v[3].xyz[1] = y + right[1] * scale;
+				v[3].xyz[2] = z + right[2] * scale;
+				v[3].st[0] = 0;
+				v[3].st[1] = st;
+			}
+			else
+			{
+				v[2].xyz[0] = x + right[0] * scale;
+				v[2].xyz[1] = y + right[1] * scale;
+				v[2].xyz[2] = z + right[2] * scale;
+				v[2].st[0] = 0;
+				v[2].st[1] = st;
+			}
+
+			//johnfitz -- particle transparency and fade out
+			v[0].color[0] = c[0];
+			v[0].color[1] = c[1];
+			v[0].color[2] = c[2];
+			v[0].color[3] = 255;
+			memcpy (v[1].color, v[0].color, 4);
+			memcpy (v[2].color, v[0].color, 4);
+			if (quads)
+			{
+				memcpy (v[3].color, v[0].color, 4);
+				v += 4;
+			}
+			else
+				v += 3;
+		}
+	}
+
+	return v - verts;
+}
+
+/*
+=============================================================================
+
+BENCHMARK
+
+r_particlebench [explosions] [frames] sets off rocket explosions in a
+private store and runs them at 90 frames a second with every kernel set
+this cpu can run, timing the update and the vertex generation, and
+checking a hash of every frame's particles against the C kernels.
+
+=============================================================================
+*/
+
+#define	BENCH_FRAMETIME	(1.0 / 90)
+
+static uint64_t R_HashParticles (partstore_t *ps, uint64_t h)
+{
+	partlist_t	*pl;
+	int		i, j;
+
+	for (i = 0, pl = ps->lists; i < NUM_PARTICLE_TYPES; i++, pl++)
+	{
+		h = Hash_Block64 (&pl->count, sizeof(pl->count), h);
+		for (j = 0; j < 3; j++)
+		{
+			h = Hash_Block64 (pl->org[j], pl->count * sizeof(float), h);
+			h = Hash_Block64 (pl->vel[j], pl->count * sizeof(float), h);
+		}
+		h = Hash_Block64 (pl->ramp, pl->count * sizeof(float), h);
+		h = Hash_Block64 (pl->color, pl->count * sizeof(float), h);
+	}
+
+	return h;
+}
+
+typedef struct
+{
+	partstore_t	store;
+	partvert_t	*verts;
+	byte		*mem;
+	int		explosions, frames;
+} partbench_t;
+
+static void R_BenchParticleKernels (const kernelinfo_t *kernels, void *data, kernelbench_t *result)
+{
+	extern cvar_t	sv_gravity;
+	partbench_t	*bench = (partbench_t *) data;
+	double		start, t_move, t_verts, time;
+	vec3_t		org;
+	int		j, k, peak;
+
+	part_kernels = (const partkernels_t *) kernels;
+
+	R_InitParticleStore (&bench->store, bench->explosions * 1024, bench->mem);
+	partstore = &bench->store;
+	srand (1234);
+	for (j = 0; j < bench->explosions; j++)
+	{
+		for (k = 0; k < 3; k++)
+			org[k] = (rand () % 2048) - 1024;
+		R_ParticleExplosion (org);
+	}
+	partstore = &r_parts;
+
+	t_move = t_verts = 0;
+	peak = 0;
+	time = cl.time;
+	for (j = 0; j < bench->frames; j++)
+	{
+		time += BENCH_FRAMETIME;
+
+		start = Sys_DoubleTime ();
+		R_MoveParticles (&bench->store, BENCH_FRAMETIME, sv_gravity.value, time);
+		t_move += Sys_DoubleTime () - start;
+
+		start = Sys_DoubleTime ();
+		R_BuildParticleVerts (&bench->store, bench->verts, true);
+		t_verts += Sys_DoubleTime () - start;
+
+		peak = q_max (peak, bench->store.numactive);
+		result->hash = R_HashParticles (&bench->store, result->hash);
+	}
+
+	result->time = t_move;
+	q_snprintf (result->columns, sizeof(result->columns), "%6.1fms %6.1fms %6.1fms  %5d",
+		    t_move * 1000.0, t_verts * 1000.0, (t_move + t_verts) * 1000.0, peak);
+}
+
+static void R_ParticleBench_f (void)
+{
+	const partkernels_t	*saved = part_kernels;
+	partbench_t		bench;
+
+	bench.explosions = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 32;
+	bench.explosions = CLAMP (1, bench.explosions, 1024);
+	bench.frames = (Cmd_Argc () > 2) ? atoi (Cmd_Argv (2)) : 450;
+	bench.frames = q_max (bench.frames, 1);
+
+	bench.mem = (byte *) malloc (R_ParticleStoreSize (bench.explosions * 1024));
+	bench.verts = (partvert_t *) malloc (bench.explosions * 1024 * 4 * sizeof(partvert_t));
+	if (!bench.mem || !bench.verts)
+	{
+		Con_Printf ("r_particlebench: out of memory\n");
+		free (bench.mem);
+		free (bench.verts);
+		return;
+	}
+
+	Con_Printf ("particle kernels, %d explosions x %d frames, using %s\n",
+		    bench.explosions, bench.frames, part_kernels->info.name);
+	Con_Printf ("       update   verts   total   peak  speedup\n");
+
+	COM_BenchKernels (part_kernellist, Q_COUNTOF(part_kernellist), R_BenchParticleKernels, &bench);
+
+	part_kernels = saved;
+	free (bench.mem);
+	free (bench.verts);
+}
+
+//==============================================================================
+
 /*
 ===============
 R_InitParticles
@@ -163,12 +829,20 @@ void R_InitParticles (void)
 		r_numparticles = DEFAULT_NUM_PARTICLES;
 	}
 
-	particles = (particle_t *)
-			Hunk_AllocName (r_numparticles * sizeof(particle_t), "particles");
+	R_InitParticleStore (&r_parts, r_numparticles,
+			(byte *) Hunk_AllocName (R_ParticleStoreSize (r_numparticles), "particles"));
+	partverts = (partvert_t *) Hunk_AllocName (r_numparticles * 4 * sizeof(partvert_t), "partverts");
+	partinstances = (partinstance_t *) Hunk_AllocName (r_numparticles * sizeof(partinstance_t), "partinsts");
 
 	Cvar_RegisterVariable (&r_particles); //johnfitz
 	Cvar_SetCallback (&r_particles, R_SetParticleTexture_f);
 	Cvar_RegisterVariable (&r_quadparticles); //johnfitz
+	Cvar_RegisterVariable (&r_particlesimd);
+	Cvar_SetCallback (&r_particlesimd, R_SetParticleKernels_f);
+	Cvar_RegisterVariable (&r_particlestream);
+	Cmd_AddCommand ("r_particlebench", R_ParticleBench_f);
+
+	R_SetParticleKernels_f (&r_particlesimd);
 
 	R_InitParticleTextures (); //johnfitz
 }
@@ -221,12 +895,8 @@ void R_EntityParticles (entity_t *ent)
 		forward[1] = cp*sy;
 		forward[2] = -sp;
 
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->die = cl.time + 0.01;
 		p->color = 0x6f;
@@ -247,12 +917,11 @@ void R_ClearParticles (void)
 {
 	int		i;
 
-	free_particles = &particles[0];
-	active_particles = NULL;
-
-	for (i=0 ;i<r_numparticles ; i++)
-		particles[i].next = &particles[i+1];
-	particles[r_numparticles-1].next = NULL;
+	for (i = 0; i < NUM_PARTICLE_TYPES; i++)
+		r_parts.lists[i].count = 0;
+	r_parts.numspawned = 0;
+	r_parts.numactive = 0;
+	r_parts.version++;
 }
 
 /*
@@ -291,15 +960,11 @@ void R_ReadPointFile_f (void)
 			break;
 		c++;
 
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 		{
 			Con_Printf ("Not enough free particles\n");
 			break;
 		}
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->die = 99999;
 		p->color = (-c)&15;
@@ -351,12 +1016,8 @@ void R_ParticleExplosion (vec3_t org)
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->die = cl.time + 5;
 		p->color = ramp1[0];
@@ -395,12 +1056,8 @@ void R_ParticleExplosion2 (vec3_t org, int colorStart, int colorLength)
 
 	for (i=0; i<512; i++)
 	{
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->die = cl.time + 0.3;
 		p->color = colorStart + (colorMod % colorLength);
@@ -427,12 +1084,8 @@ void R_BlobExplosion (vec3_t org)
 
 	for (i=0 ; i<1024 ; i++)
 	{
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		p->die = cl.time + 1 + (rand()&8)*0.05;
 
@@ -471,12 +1124,8 @@ void R_RunParticleEffect (vec3_t org, vec3_t dir, int color, int count)
 
 	for (i=0 ; i<count ; i++)
 	{
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		if (count == 1024)
 		{	// rocket explosion
@@ -532,12 +1181,8 @@ void R_LavaSplash (vec3_t org)
 		for (j=-16 ; j<16 ; j++)
 			for (k=0 ; k<1 ; k++)
 			{
-				if (!free_particles)
+				if (!(p = R_NewParticle ()))
 					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
 				p->die = cl.time + 2 + (rand()&31) * 0.02;
 				p->color = 224 + (rand()&7);
@@ -575,12 +1220,8 @@ void R_TeleportSplash (vec3_t org)
 		{
 			for (k=-24 ; k<32 ; k+=4)
 			{
-				if (!free_particles)
+				if (!(p = R_NewParticle ()))
 					return;
-				p = free_particles;
-				free_particles = p->next;
-				p->next = active_particles;
-				active_particles = p;
 
 				p->die = cl.time + 0.2 + (rand()&7) * 0.02;
 				p->color = 7 + (rand()&7);
@@ -632,12 +1273,8 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 	{
 		len -= dec;
 
-		if (!free_particles)
+		if (!(p = R_NewParticle ()))
 			return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
 		VectorCopy (vec3_origin, p->vel);
 		p->die = cl.time + 2;
@@ -713,109 +1350,338 @@ void R_RocketTrail (vec3_t start, vec3_t end, int type)
 }
 
 /*
-===============
-CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
-===============
+=============================================================================
+
+STREAMED DRAWING
+
+Each particle is one instance of a quad or triangle that the vertex shader
+expands and sizes, so all the cpu writes per particle is a position and a
+color.  The instances go into a ring of PARTSTREAM_SEGMENTS slices of a
+persistently mapped buffer, each fenced after its last draw, or are
+re-specified with glBufferData when buffer storage isn't available.  They
+are only written when the particles have changed, so the second eye of a
+stereo frame draws straight from the slice the first one filled.
+
+=============================================================================
 */
-void CL_RunParticles (void)
+
+#define PARTSTREAM_SEGMENTS	3
+
+#define partCornerAttrIndex	0
+#define partOriginAttrIndex	1
+#define partColorAttrIndex	2
+
+static GLuint	r_particle_program;
+
+static GLint	partTexLoc;
+static GLint	partViewOrgLoc;
+static GLint	partViewForwardLoc;
+static GLint	partUpLoc;
+static GLint	partRightLoc;
+static GLint	partSizeScaleLoc;
+static GLint	partTexScaleLoc;
+
+static GLuint		partcornervbo;
+static GLuint		partindexvbo;
+static GLuint		partstreamvbo;
+static byte		*partstreammap;		// NULL when orphaning instead
+static QS_GLsync	partstreamfences[PARTSTREAM_SEGMENTS];
+static int		partstreamsegment;
+static unsigned int	partstreamversion;
+static qboolean		partstreamfilled;	// partstreamversion is valid
+
+// corner (a,b) is org + a*up + b*right, the same layout R_BuildParticleVerts uses
+static const float partcorners[4][2] = {{0,0}, {1,0}, {1,1}, {0,1}};
+static const unsigned short partindexes[9] = {0,1,2, 0,2,3, 0,1,3}; // quad, then triangle
+
+/*
+=============
+GLParticles_CreateShaders
+=============
+*/
+void GLParticles_CreateShaders (void)
 {
-	particle_t		*p, *kill;
-	int				i;
-	float			time1, time2, time3, dvel, frametime, grav;
-	extern	cvar_t	sv_gravity;
+	const glsl_attrib_binding_t bindings[] = {
+		{ "Corner", partCornerAttrIndex },
+		{ "Origin", partOriginAttrIndex },
+		{ "Color", partColorAttrIndex }
+	};
+
+	const GLchar *vertSource = \
+		"#version 110\n"
+		"\n"
+		"uniform vec3 ViewOrg;\n"
+		"uniform vec3 ViewForward;\n"
+		"uniform vec3 Up;\n"
+		"uniform vec3 Right;\n"
+		"uniform float SizeScale;\n"
+		"uniform float TexScale;\n"
+		"attribute vec2 Corner;\n"
+		"attribute vec3 Origin; // per instance \n"
+		"attribute vec4 Color; // per instance \n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	// hack a scale up to keep particles from disapearing \n"
+		"	float scale = dot(Origin - ViewOrg, ViewForward);\n"
+		"	scale = (scale < 20.0) ? 1.08 : 1.0 + scale * 0.004;\n"
+		"	scale *= SizeScale;\n"
+		"	vec3 pos = Origin + (Up * Corner.x + Right * Corner.y) * scale;\n"
+		"	gl_Position = gl_ModelViewProjectionMatrix * vec4(pos, 1.0);\n"
+		"	gl_TexCoord[0] = vec4(Corner * TexScale, 0.0, 1.0);\n"
+		"	gl_FrontColor = Color;\n"
+		"	FogFragCoord = gl_Position.w;\n"
+		"}\n";
+
+	const GLchar *fragSource = \
+		"#version 110\n"
+		"\n"
+		"uniform sampler2D Tex;\n"
+		"\n"
+		"varying float FogFragCoord;\n"
+		"\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 result = texture2D(Tex, gl_TexCoord[0].xy) * gl_Color;\n"
+		"	float fog = exp(-gl_Fog.density * gl_Fog.density * FogFragCoord * FogFragCoord);\n"
+		"	fog = clamp(fog, 0.0, 1.0);\n"
+		"	result.rgb = mix(gl_Fog.color.rgb, result.rgb, fog);\n"
+		"	gl_FragColor = result;\n"
+		"}\n";
+
+	r_particle_program = 0;
+
+	if (!gl_instancing_able)
+		return;
 
-	frametime = cl.time - cl.oldtime;
-	time3 = frametime * 15;
-	time2 = frametime * 10;
-	time1 = frametime * 5;
-	grav = frametime * sv_gravity.value * 0.05;
-	dvel = 4*frametime;
+	r_particle_program = GL_CreateProgram (vertSource, fragSource, Q_COUNTOF(bindings), bindings);
 
-	for ( ;; )
+	if (r_particle_program != 0)
 	{
-		kill = active_particles;
-		if (kill && kill->die < cl.time)
+		partTexLoc = GL_GetUniformLocation (&r_particle_program, "Tex");
+		partViewOrgLoc = GL_GetUniformLocation (&r_particle_program, "ViewOrg");
+		partViewForwardLoc = GL_GetUniformLocation (&r_particle_program, "ViewForward");
+		partUpLoc = GL_GetUniformLocation (&r_particle_program, "Up");
+		partRightLoc = GL_GetUniformLocation (&r_particle_program, "Right");
+		partSizeScaleLoc = GL_GetUniformLocation (&r_particle_program, "SizeScale");
+		partTexScaleLoc = GL_GetUniformLocation (&r_particle_program, "TexScale");
+	}
+}
+
+/*
+=============
+GLParticles_DeleteBuffers -- called before the GL context goes away
+=============
+*/
+void GLParticles_DeleteBuffers (void)
+{
+	int		i;
+
+	for (i = 0; i < PARTSTREAM_SEGMENTS; i++)
+	{
+		if (partstreamfences[i])
 		{
-			active_particles = kill->next;
-			kill->next = free_particles;
-			free_particles = kill;
-			continue;
+			GL_DeleteSyncFunc (partstreamfences[i]);
+			partstreamfences[i] = NULL;
 		}
-		break;
 	}
 
-	for (p=active_particles ; p ; p=p->next)
+	if (!partstreamvbo)
+		return;
+
+	// deleting the buffer unmaps it
+	GL_DeleteBuffersFunc (1, &partstreamvbo);
+	GL_DeleteBuffersFunc (1, &partcornervbo);
+	GL_DeleteBuffersFunc (1, &partindexvbo);
+	partstreamvbo = partcornervbo = partindexvbo = 0;
+	partstreammap = NULL;
+	partstreamfilled = false;
+
+	GL_ClearBufferBindings ();
+}
+
+/*
+=============
+R_InitParticleStream
+=============
+*/
+static void R_InitParticleStream (void)
+{
+	const GLbitfield	flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptrARB	size = PARTSTREAM_SEGMENTS * r_numparticles * sizeof(partinstance_t);
+
+	GL_GenBuffersFunc (1, &partcornervbo);
+	GL_BindBuffer (GL_ARRAY_BUFFER, partcornervbo);
+	GL_BufferDataFunc (GL_ARRAY_BUFFER, sizeof(partcorners), partcorners, GL_STATIC_DRAW_ARB);
+
+	GL_GenBuffersFunc (1, &partindexvbo);
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, partindexvbo);
+	GL_BufferDataFunc (GL_ELEMENT_ARRAY_BUFFER, sizeof(partindexes), partindexes, GL_STATIC_DRAW_ARB);
+
+	GL_GenBuffersFunc (1, &partstreamvbo);
+	GL_BindBuffer (GL_ARRAY_BUFFER, partstreamvbo);
+
+	if (gl_buffer_storage_able)
 	{
-		for ( ;; )
+		GL_BufferStorageFunc (GL_ARRAY_BUFFER, size, NULL, flags);
+		partstreammap = (byte *) GL_MapBufferRangeFunc (GL_ARRAY_BUFFER, 0, size, flags);
+		if (!partstreammap)
 		{
-			kill = p->next;
-			if (kill && kill->die < cl.time)
-			{
-				p->next = kill->next;
-				kill->next = free_particles;
-				free_particles = kill;
-				continue;
-			}
-			break;
+			// storage is immutable, so start over with a buffer we can orphan
+			Con_Warning ("Couldn't map particle buffer, streaming with glBufferData\n");
+			GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+			GL_DeleteBuffersFunc (1, &partstreamvbo);
+			GL_GenBuffersFunc (1, &partstreamvbo);
 		}
+	}
 
-		p->org[0] += p->vel[0]*frametime;
-		p->org[1] += p->vel[1]*frametime;
-		p->org[2] += p->vel[2]*frametime;
+	partstreamsegment = 0;
+	partstreamfilled = false;
+}
 
-		switch (p->type)
+/*
+=============
+R_FillParticleInstances
+=============
+*/
+static void R_FillParticleInstances (partstore_t *ps, partinstance_t *out)
+{
+	partlist_t	*pl;
+	int		i, j;
+
+	for (i = 0, pl = ps->lists; i < NUM_PARTICLE_TYPES; i++, pl++)
+	{
+		for (j = 0; j < pl->count; j++, out++)
 		{
-		case pt_static:
-			break;
-		case pt_fire:
-			p->ramp += time1;
-			if (p->ramp >= 6)
-				p->die = -1;
-			else
-				p->color = ramp3[(int)p->ramp];
-			p->vel[2] += grav;
-			break;
+			out->org[0] = pl->org[0][j];
+			out->org[1] = pl->org[1][j];
+			out->org[2] = pl->org[2][j];
+			memcpy (out->color, &d_8to24table[(int)pl->color[j]], 3);
+			out->color[3] = 255;
+		}
+	}
+}
 
-		case pt_explode:
-			p->ramp += time2;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp1[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+/*
+=============
+R_UploadParticleInstances
 
-		case pt_explode2:
-			p->ramp += time3;
-			if (p->ramp >=8)
-				p->die = -1;
-			else
-				p->color = ramp2[(int)p->ramp];
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] -= p->vel[i]*frametime;
-			p->vel[2] -= grav;
-			break;
+returns the byte offset of this frame's instances in partstreamvbo
+=============
+*/
+static int R_UploadParticleInstances (partstore_t *ps)
+{
+	const int	segsize = r_numparticles * sizeof(partinstance_t);
+	QS_GLsync	*fence;
+	GLenum		status;
 
-		case pt_blob:
-			for (i=0 ; i<3 ; i++)
-				p->vel[i] += p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	if (partstreamfilled && partstreamversion == ps->version)
+		return partstreamsegment * segsize;
 
-		case pt_blob2:
-			for (i=0 ; i<2 ; i++)
-				p->vel[i] -= p->vel[i]*dvel;
-			p->vel[2] -= grav;
-			break;
+	GL_BindBuffer (GL_ARRAY_BUFFER, partstreamvbo);
 
-		case pt_grav:
-		case pt_slowgrav:
-			p->vel[2] -= grav;
-			break;
+	if (partstreammap)
+	{
+		partstreamsegment = (partstreamsegment + 1) % PARTSTREAM_SEGMENTS;
+		fence = &partstreamfences[partstreamsegment];
+		if (*fence)
+		{
+			// normally signalled long ago, unless the gpu is frames behind
+			status = GL_ClientWaitSyncFunc (*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+				Con_DPrintf ("R_UploadParticleInstances: fence wait failed\n");
+			GL_DeleteSyncFunc (*fence);
+			*fence = NULL;
 		}
+		R_FillParticleInstances (ps, (partinstance_t *)(partstreammap + partstreamsegment * segsize));
+	}
+	else
+	{
+		R_FillParticleInstances (ps, partinstances);
+		GL_BufferDataFunc (GL_ARRAY_BUFFER, ps->numactive * sizeof(partinstance_t), partinstances, GL_STREAM_DRAW_ARB);
+	}
+
+	partstreamversion = ps->version;
+	partstreamfilled = true;
+
+	return partstreamsegment * segsize;
+}
+
+/*
+=============
+R_DrawParticlesStreamed
+
+one instanced draw for every particle, the caller sets up blending
+=============
+*/
+static void R_DrawParticlesStreamed (partstore_t *ps)
+{
+	const qboolean	quads = r_quadparticles.value != 0;
+	QS_GLsync	*fence;
+	int		ofs;
+
+	if (!partstreamvbo)
+		R_InitParticleStream ();
+	ofs = R_UploadParticleInstances (ps);
+
+	GL_UseProgramFunc (r_particle_program);
+	GL_Uniform1iFunc (partTexLoc, 0);
+	GL_Uniform3fFunc (partViewOrgLoc, r_origin[0], r_origin[1], r_origin[2]);
+	GL_Uniform3fFunc (partViewForwardLoc, vpn[0], vpn[1], vpn[2]);
+	GL_Uniform3fFunc (partUpLoc, vup[0] * 1.5, vup[1] * 1.5, vup[2] * 1.5);
+	GL_Uniform3fFunc (partRightLoc, vright[0] * 1.5, vright[1] * 1.5, vright[2] * 1.5);
+	//quad is half the size of triangle
+	GL_Uniform1fFunc (partSizeScaleLoc, quads ? texturescalefactor / 2.0 : texturescalefactor);
+	GL_Uniform1fFunc (partTexScaleLoc, quads ? 0.5 : 1);
+
+	GL_EnableVertexAttribArrayFunc (partCornerAttrIndex);
+	GL_EnableVertexAttribArrayFunc (partOriginAttrIndex);
+	GL_EnableVertexAttribArrayFunc (partColorAttrIndex);
+
+	GL_BindBuffer (GL_ARRAY_BUFFER, partcornervbo);
+	GL_VertexAttribPointerFunc (partCornerAttrIndex, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
+	GL_BindBuffer (GL_ARRAY_BUFFER, partstreamvbo);
+	GL_VertexAttribPointerFunc (partOriginAttrIndex, 3, GL_FLOAT, GL_FALSE, sizeof(partinstance_t), (void *)(intptr_t)(ofs + offsetof(partinstance_t, org)));
+	GL_VertexAttribPointerFunc (partColorAttrIndex, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(partinstance_t), (void *)(intptr_t)(ofs + offsetof(partinstance_t, color)));
+	GL_VertexAttribDivisorFunc (partOriginAttrIndex, 1);
+	GL_VertexAttribDivisorFunc (partColorAttrIndex, 1);
+	GL_BindBuffer (GL_ELEMENT_ARRAY_BUFFER, partindexvbo);
+
+	//johnfitz -- quads save fillrate, triangles save verts
+	GL_DrawElementsInstancedFunc (GL_TRIANGLES, quads ? 6 : 3, GL_UNSIGNED_SHORT,
+			(void *)(intptr_t)(quads ? 0 : 6 * sizeof(unsigned short)), ps->numactive);
+
+	// the slice can't be rewritten until this draw is done with it
+	if (partstreammap)
+	{
+		fence = &partstreamfences[partstreamsegment];
+		if (*fence)
+			GL_DeleteSyncFunc (*fence);
+		*fence = GL_FenceSyncFunc (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 	}
+
+// clean up
+	GL_VertexAttribDivisorFunc (partOriginAttrIndex, 0);
+	GL_VertexAttribDivisorFunc (partColorAttrIndex, 0);
+	GL_DisableVertexAttribArrayFunc (partCornerAttrIndex);
+	GL_DisableVertexAttribArrayFunc (partOriginAttrIndex);
+	GL_DisableVertexAttribArrayFunc (partColorAttrIndex);
+
+	GL_UseProgramFunc (0);
+}
+
+/*
+===============
+CL_RunParticles -- johnfitz -- all the particle behavior, separated from R_DrawParticles
+===============
+*/
+void CL_RunParticles (void)
+{
+	extern	cvar_t	sv_gravity;
+
+	R_MoveParticles (&r_parts, cl.time - cl.oldtime, sv_gravity.value, cl.time);
 }
 
 /*
@@ -825,111 +1691,43 @@ R_DrawParticles -- johnfitz -- moved all non-drawing code to CL_RunParticles
 */
 void R_DrawParticles (void)
 {
-	particle_t		*p;
-	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright; //johnfitz -- p_ vectors
-	GLubyte			color[4], *c; //johnfitz -- particle transparency
+	int			numverts;
 	extern	cvar_t	r_particles; //johnfitz
-	//float			alpha; //johnfitz -- particle transparency
 
 	if (!r_particles.value)
 		return;
 
+	R_SortSpawnedParticles (&r_parts);
+
 	//ericw -- avoid empty glBegin(),glEnd() pair below; causes issues on AMD
-	if (!active_particles)
+	if (!r_parts.numactive)
 		return;
 
-	VectorScale (vup, 1.5, up);
-	VectorScale (vright, 1.5, right);
-
 	GL_Bind(particletexture);
 	glEnable (GL_BLEND);
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 	glDepthMask (GL_FALSE); //johnfitz -- fix for particle z-buffer bug
 
-	if (r_quadparticles.value) //johnitz -- quads save fillrate
-	{
-		glBegin (GL_QUADS);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale /= 2.0; //quad is half the size of triangle
-
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
-
-			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
-			color[0] = c[0];
-			color[1] = c[1];
-			color[2] = c[2];
-			//alpha = CLAMP(0, p->die + 0.5 - cl.time, 1);
-			color[3] = 255; //(int)(alpha * 255);
-			glColor4ubv(color);
-			//johnfitz
-
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
-
-			glTexCoord2f (0.5,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
-
-			glTexCoord2f (0.5,0.5);
-			VectorMA (p_up, scale, right, p_upright);
-			glVertex3fv (p_upright);
-
-			glTexCoord2f (0,0.5);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
-		}
-		glEnd ();
-	}
-	else //johnitz --  triangles save verts
+	if (r_particle_program != 0 && r_particlestream.value)
+		R_DrawParticlesStreamed (&r_parts);
+	else
 	{
-		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale *= texturescalefactor; //johnfitz -- compensate for apparent size of different particle textures
-
-			//johnfitz -- particle transparency and fade out
-			c = (GLubyte *) &d_8to24table[(int)p->color];
-			color[0] = c[0];
-			color[1] = c[1];
-			color[2] = c[2];
-			//alpha = CLAMP(0, p->die + 0.5 - cl.time, 1);
-			color[3] = 255; //(int)(alpha * 255);
-			glColor4ubv(color);
-			//johnfitz
-
-			glTexCoord2f (0,0);
-			glVertex3fv (p->org);
-
-			glTexCoord2f (1,0);
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
-
-			glTexCoord2f (0,1);
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
-		}
-		glEnd ();
+		numverts = R_BuildParticleVerts (&r_parts, partverts, r_quadparticles.value != 0);
+
+		GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+		glEnableClientState (GL_VERTEX_ARRAY);
+		glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState (GL_COLOR_ARRAY);
+		glVertexPointer (3, GL_FLOAT, sizeof(partvert_t), partverts->xyz);
+		glTexCoordPointer (2, GL_FLOAT, sizeof(partvert_t), partverts->st);
+		glColorPointer (4, GL_UNSIGNED_BYTE, sizeof(partvert_t), partverts->color);
+
+		//johnfitz -- quads save fillrate, triangles save verts
+		glDrawArrays (r_quadparticles.value ? GL_QUADS : GL_TRIANGLES, 0, numverts);
+
+		glDisableClientState (GL_VERTEX_ARRAY);
+		glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState (GL_COLOR_ARRAY);
 	}
 
 	glDepthMask (GL_TRUE); //johnfitz -- fix for particle z-buffer bug
@@ -946,75 +1744,21 @@ R_DrawParticles_ShowTris -- johnfitz
 */
 void R_DrawParticles_ShowTris (void)
 {
-	particle_t		*p;
-	float			scale;
-	vec3_t			up, right, p_up, p_right, p_upright;
+	int			numverts;
 	extern	cvar_t	r_particles;
 
 	if (!r_particles.value)
 		return;
 
-	VectorScale (vup, 1.5, up);
-	VectorScale (vright, 1.5, right);
-
-	if (r_quadparticles.value)
-	{
-		for (p=active_particles ; p ; p=p->next)
-		{
-			glBegin (GL_TRIANGLE_FAN);
-
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale /= 2.0; //quad is half the size of triangle
-
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
-
-			glVertex3fv (p->org);
-
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
-
-			VectorMA (p_up, scale, right, p_upright);
-			glVertex3fv (p_upright);
-
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
-
-			glEnd ();
-		}
-	}
-	else
-	{
-		glBegin (GL_TRIANGLES);
-		for (p=active_particles ; p ; p=p->next)
-		{
-			// hack a scale up to keep particles from disapearing
-			scale = (p->org[0] - r_origin[0]) * vpn[0]
-				  + (p->org[1] - r_origin[1]) * vpn[1]
-				  + (p->org[2] - r_origin[2]) * vpn[2];
-			if (scale < 20)
-				scale = 1 + 0.08; //johnfitz -- added .08 to be consistent
-			else
-				scale = 1 + scale * 0.004;
-
-			scale *= texturescalefactor; //compensate for apparent size of different particle textures
-
-			glVertex3fv (p->org);
+	R_SortSpawnedParticles (&r_parts);
+	if (!r_parts.numactive)
+		return;
 
-			VectorMA (p->org, scale, up, p_up);
-			glVertex3fv (p_up);
+	numverts = R_BuildParticleVerts (&r_parts, partverts, r_quadparticles.value != 0);
 
-			VectorMA (p->org, scale, right, p_right);
-			glVertex3fv (p_right);
-		}
-		glEnd ();
-	}
+	GL_BindBuffer (GL_ARRAY_BUFFER, 0);
+	glEnableClientState (GL_VERTEX_ARRAY);
+	glVertexPointer (3, GL_FLOAT, sizeof(partvert_t), partverts->xyz);
+	glDrawArrays (r_quadparticles.value ? GL_QUADS : GL_TRIANGLES, 0, numverts);
+	glDisableClientState (GL_VERTEX_ARRAY);
 }
-
@@ -89,35 +89,123 @@ qboolean R_BackFaceCull (msurface_t *surf)
 
 /*
 ===============
-R_MarkSurfaces -- johnfitz -- mark surfaces based on PVS and rebuild texture chains
+R_MarkSurfaces cache
+
+The leafs in the PVS only change when the view moves into another leaf (or
+when the fat PVS is in use and the view moves at all), so they are kept in
+a compact list.  Each frame only that list is frustum culled, instead of
+testing the vis bit of every leaf in the map.
 ===============
 */
-void R_MarkSurfaces (void)
+typedef enum
 {
-	byte		*vis;
-	mleaf_t		*leaf;
-	msurface_t	*surf, **mark;
-	int			i, j;
-	qboolean	nearwaterportal;
+	VIS_NONE,		// r_novis, or outside the map
+	VIS_LEAF,		// the PVS of the view leaf
+	VIS_FAT			// SV_FatPVS, near a water portal
+} vissource_t;
 
-	// clear lightmap chains
-	for (i=0 ; i<lightmap_count ; i++)
-		lightmaps[i].polys = NULL;
+static mleaf_t	**r_visleafs;	// VEC of the leafs in the current PVS
+
+static struct
+{
+	qboolean	valid;
+	mleaf_t		*viewleaf;
+	qboolean	nearwaterportal;	// for viewleaf
+	vissource_t	source;
+	vec3_t		origin;			// for VIS_FAT
+} r_viscache;
+
+/*
+===============
+R_ClearVisCache -- called when the world model changes
+===============
+*/
+void R_ClearVisCache (void)
+{
+	r_viscache.valid = false;
+	VEC_CLEAR (r_visleafs);
+}
+
+/*
+===============
+R_UpdateVisLeafs -- rebuilds r_visleafs if the PVS has changed
+===============
+*/
+static void R_UpdateVisLeafs (void)
+{
+	const byte	*vis;
+	mleaf_t		*leaf;
+	msurface_t	**mark;
+	vissource_t	source;
+	int			i;
 
 	// check this leaf for water portals
 	// TODO: loop through all water surfs and use distance to leaf cullbox
-	nearwaterportal = false;
-	for (i=0, mark = r_viewleaf->firstmarksurface; i < r_viewleaf->nummarksurfaces; i++, mark++)
-		if ((*mark)->flags & SURF_DRAWTURB)
-			nearwaterportal = true;
+	if (!r_viscache.valid || r_viscache.viewleaf != r_viewleaf)
+	{
+		r_viscache.nearwaterportal = false;
+		for (i=0, mark = r_viewleaf->firstmarksurface; i < r_viewleaf->nummarksurfaces; i++, mark++)
+			if ((*mark)->flags & SURF_DRAWTURB)
+				r_viscache.nearwaterportal = true;
+	}
 
 	// choose vis data
 	if (r_novis.value || r_viewleaf->contents == CONTENTS_SOLID || r_viewleaf->contents == CONTENTS_SKY)
+		source = VIS_NONE;
+	else if (r_viscache.nearwaterportal)
+		source = VIS_FAT;
+	else
+		source = VIS_LEAF;
+
+	if (r_viscache.valid && r_viscache.source == source &&
+	    (source == VIS_NONE || r_viscache.viewleaf == r_viewleaf) &&
+	    (source != VIS_FAT || VectorCompare (r_viscache.origin, r_origin)))
+	{
+		r_viscache.viewleaf = r_viewleaf;
+		return;
+	}
+
+	r_viscache.valid = true;
+	r_viscache.viewleaf = r_viewleaf;
+	r_viscache.source = source;
+	VectorCopy (r_origin, r_viscache.origin);
+
+	switch (source)
+	{
+	case VIS_NONE:
 		vis = Mod_NoVisPVS (cl.worldmodel);
-	else if (nearwaterportal)
+		break;
+	case VIS_FAT:
 		vis = SV_FatPVS (r_origin, cl.worldmodel);
-	else
+		break;
+	default:
 		vis = Mod_LeafPVS (r_viewleaf, cl.worldmodel);
+		break;
+	}
+
+	VEC_CLEAR (r_visleafs);
+	leaf = &cl.worldmodel->leafs[1];
+	for (i=0 ; i<cl.worldmodel->numleafs ; i++, leaf++)
+		if (vis[i>>3] & (1<<(i&7)))
+			VEC_PUSH (r_visleafs, leaf);
+}
+
+/*
+===============
+R_MarkSurfaces -- johnfitz -- mark surfaces based on PVS and rebuild texture chains
+===============
+*/
+void R_MarkSurfaces (void)
+{
+	mleaf_t		*leaf;
+	msurface_t	*surf, **mark;
+	int			i, j, numvisleafs;
+
+	// clear lightmap chains
+	for (i=0 ; i<lightmap_count ; i++)
+		lightmaps[i].polys = NULL;
+
+	R_UpdateVisLeafs ();
 
 	r_visframecount++;
 
@@ -126,37 +214,36 @@ void R_MarkSurfaces (void)
 		if (cl.worldmodel->textures[i])
 			cl.worldmodel->textures[i]->texturechains[chain_world] = NULL;
 
-	// iterate through leaves, marking surfaces
-	leaf = &cl.worldmodel->leafs[1];
-	for (i=0 ; i<cl.worldmodel->numleafs ; i++, leaf++)
+	// iterate through visible leaves, marking surfaces
+	numvisleafs = VEC_SIZE (r_visleafs);
+	for (i=0 ; i<numvisleafs ; i++)
 	{
-		if (vis[i>>3] & (1<<(i&7)))
-		{
-			if (R_CullBox(leaf->minmaxs, leaf->minmaxs + 3))
-				continue;
+		leaf = r_visleafs[i];
+
+		if (R_CullBox(leaf->minmaxs, leaf->minmaxs + 3))
+			continue;
 
-			if (r_oldskyleaf.value || leaf->contents != CONTENTS_SKY)
-				for (j=0, mark = leaf->firstmarksurface; j<leaf->nummarksurfaces; j++, mark++)
+		if (r_oldskyleaf.value || leaf->contents != CONTENTS_SKY)
+			for (j=0, mark = leaf->firstmarksurface; j<leaf->nummarksurfaces; j++, mark++)
+			{
+				surf = *mark;
+				if (surf->visframe != r_visframecount)
 				{
-					surf = *mark;
-					if (surf->visframe != r_visframecount)
+					surf->visframe = r_visframecount;
+					if (!R_CullBox(surf->mins, surf->maxs) && !R_BackFaceCull (surf))
 					{
-						surf->visframe = r_visframecount;
-						if (!R_CullBox(surf->mins, surf->maxs) && !R_BackFaceCull (surf))
-						{
-							rs_brushpolys++; //count wpolys here
-							R_ChainSurface(surf, chain_world);
-							R_RenderDynamicLightmaps(surf);
-							if (surf->texinfo->texture->warpimage)
-								surf->texinfo->texture->update_warp = true;
-						}
+						rs_brushpolys++; //count wpolys here
+						R_ChainSurface(surf, chain_world);
+						R_RenderDynamicLightmaps(surf);
+						if (surf->texinfo->texture->warpimage)
+							surf->texinfo->texture->update_warp = true;
 					}
 				}
+			}
 
-			// add static models
-			if (leaf->efrags)
-				R_StoreEfrags (&leaf->efrags);
-		}
+		// add static models
+		if (leaf->efrags)
+			R_StoreEfrags (&leaf->efrags);
 	}
 }
 
@@ -41,6 +41,14 @@
 
 static snd_codec_t *codecs;
 
+/* messages from the read and rewind functions, see S_CodecPrintf.
+ * each one is a level byte (0: always, 1: developer) and a string. */
+#define CODEC_MSGSIZE	2048
+static SDL_mutex *codec_msglock;
+static char codec_msgs[CODEC_MSGSIZE];
+static int codec_msglen;
+static int codec_msgdropped;
+
 /*
 =================
 S_CodecRegister
@@ -92,6 +100,10 @@ void S_CodecInit (void)
 	S_CodecRegister(&opus_codec);
 #endif
 
+	codec_msglock = SDL_CreateMutex();
+	if (!codec_msglock)
+		Sys_Error("S_CodecInit: %s", SDL_GetError());
+
 	codec = codecs;
 	while (codec)
 	{
@@ -114,6 +126,90 @@ void S_CodecShutdown (void)
 		codec = codec->next;
 	}
 	codecs = NULL;
+
+	S_CodecFlushMessages();
+	SDL_DestroyMutex(codec_msglock);
+	codec_msglock = NULL;
+}
+
+/*
+=================
+S_CodecPrintf
+
+The read and rewind functions run on the music decoder thread, where
+the console can't be touched, so they report through these instead.
+The messages are kept until S_CodecFlushMessages prints them on the
+main thread; if too many pile up, the rest are counted and dropped.
+=================
+*/
+static void S_CodecVPrintf (int level, const char *fmt, va_list argptr)
+{
+	char text[256];
+	int len;
+
+	len = q_vsnprintf(text, sizeof(text), fmt, argptr);
+	len = CLAMP(0, len, (int)sizeof(text) - 1);
+
+	SDL_LockMutex(codec_msglock);
+	if (codec_msglen + len + 2 <= CODEC_MSGSIZE)
+	{
+		codec_msgs[codec_msglen] = (char)level;
+		memcpy(codec_msgs + codec_msglen + 1, text, len + 1);
+		codec_msglen += len + 2;
+	}
+	else	codec_msgdropped++;
+	SDL_UnlockMutex(codec_msglock);
+}
+
+void S_CodecPrintf (const char *fmt, ...)
+{
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	S_CodecVPrintf(0, fmt, argptr);
+	va_end(argptr);
+}
+
+void S_CodecDPrintf (const char *fmt, ...)
+{
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	S_CodecVPrintf(1, fmt, argptr);
+	va_end(argptr);
+}
+
+/*
+=================
+S_CodecFlushMessages
+
+Prints what S_CodecPrintf and S_CodecDPrintf kept, main thread only.
+=================
+*/
+void S_CodecFlushMessages (void)
+{
+	static char msgs[CODEC_MSGSIZE];
+	int len, dropped, i;
+
+	if (!codec_msglock)
+		return;
+
+	SDL_LockMutex(codec_msglock);
+	len = codec_msglen;
+	dropped = codec_msgdropped;
+	memcpy(msgs, codec_msgs, len);
+	codec_msglen = 0;
+	codec_msgdropped = 0;
+	SDL_UnlockMutex(codec_msglock);
+
+	for (i = 0; i < len; i += strlen(msgs + i + 1) + 2)
+	{
+		if (msgs[i])
+			Con_DPrintf("%s", msgs + i + 1);
+		else	Con_Printf("%s", msgs + i + 1);
+	}
+	if (dropped)
+		Con_DPrintf("%d more music decoder messages dropped\n", dropped);
 }
 
 /*
@@ -82,6 +82,14 @@ int S_CodecReadStream (snd_stream_t *stream, int bytes, void *buffer);
 int S_CodecRewindStream (snd_stream_t *stream);
 int S_CodecJumpToOrder (snd_stream_t *stream, int to);
 
+/* The read, rewind and jump functions may run on the music decoder
+ * thread, so codecs must report from them (and anything they call)
+ * through these, never Con_Printf.  S_CodecFlushMessages prints the
+ * messages on the main thread. */
+void S_CodecPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
+void S_CodecDPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
+void S_CodecFlushMessages (void);
+
 snd_stream_t *S_CodecUtilOpen(const char *filename, snd_codec_t *codec, qboolean loop);
 void S_CodecUtilClose(snd_stream_t **stream);
 
@@ -34,6 +34,10 @@ static void S_SoundList (void);
 static void S_Update_ (void);
 void S_StopAllSounds (qboolean clear);
 static void S_StopAllSoundsC (void);
+static void S_RunCommands (void);
+static void S_DrainReleases (void);
+static void S_ClearChannels (void);
+static void S_ClearDMABuffer (void);
 
 // =======================================================================
 // Internal sound data & structures
@@ -58,8 +62,23 @@ vec3_t		listener_up;
 int		soundtime;	// sample PAIRS
 int		paintedtime;	// sample PAIRS
 
-int		s_rawend;
+/*
+ The music goes through a ring of raw samples with a single producer, the
+ music decoder, and a single consumer, the mixer, which takes what is there
+ and never waits for more.  The positions only ever grow, wrapping around
+ as unsigned ints, and are published after the samples they cover.  The
+ producer drops what it wrote by moving the discard mark up to its head
+ and counting the clear.  The mixer skips its tail to the mark only when
+ the count has changed since it last looked, so a mark left behind long
+ ago can't come out ahead of the tail again once the positions wrap.
+*/
 portable_samplepair_t	s_rawsamples[MAX_RAW_SAMPLES];
+SDL_atomic_t	s_rawhead;	// written by the producer
+SDL_atomic_t	s_rawtail;	// written by the mixer
+SDL_atomic_t	s_rawdiscard;	// written by the producer
+SDL_atomic_t	s_rawclears;	// counted by the producer, after the mark
+SDL_atomic_t	s_rawstate;	// a rawstate_t
+SDL_atomic_t	s_rawunderruns;	// counted by the mixer
 
 
 #define	MAX_SFX		1024
@@ -67,9 +86,71 @@ static sfx_t	*known_sfx = NULL;	// hunk allocated [MAX_SFX]
 static int	num_sfx;
 
 static sfx_t	*ambient_sfx[NUM_AMBIENTS];
+static sfxcache_t	*ambient_sc[NUM_AMBIENTS];	// pinned until S_StopAllSounds
+static int	ambient_vol[NUM_AMBIENTS];		// faded towards the leaf's levels
+static qboolean	ambient_on;
+
+static int	num_statics;		// main thread's count of posted static sounds
 
 static qboolean	sound_started = false;
 
+/*
+ The mixer runs on its own thread, woken up by the device callback each
+ time it has consumed part of the dma buffer.  Only the mixer touches the
+ channels: the game posts what it wants done to a single producer, single
+ consumer command queue, which the mixer runs before it paints.  The data
+ of a sound is pinned in the cache by the main thread before it is posted,
+ and the mixer hands the sfx back through a second queue once no channel
+ plays it, for the main thread to unpin.  With -nosoundthread, commands
+ run as they are posted and the main loop mixes, as it used to.
+*/
+typedef enum
+{
+	SNDCMD_START,
+	SNDCMD_STATIC,
+	SNDCMD_STOP,
+	SNDCMD_STOPALL,		// releases the ambient sounds in ambientsc
+	SNDCMD_LISTENER
+} sndcmdtype_t;
+
+typedef struct
+{
+	sndcmdtype_t	type;
+	int		entnum;		// the view entity for SNDCMD_LISTENER
+	int		entchannel;
+	sfx_t		*sfx;		// pinned
+	sfxcache_t	*sc;
+	vec3_t		origin;
+	int		master_vol;
+	vec_t		dist_mult;
+	vec3_t		right;
+	int		ambientvol[NUM_AMBIENTS];
+	sfxcache_t	*ambientsc[NUM_AMBIENTS];	// NULL when the ambient is off
+} sndcmd_t;
+
+#define	MAX_SNDCMDS	1024	// power of two
+#define	MAX_SNDRELEASES	4096	// power of two, more than MAX_SNDCMDS + MAX_CHANNELS
+
+static sndcmd_t		snd_cmds[MAX_SNDCMDS];
+static SDL_atomic_t	snd_cmdhead;		// written by the main thread
+static SDL_atomic_t	snd_cmdtail;		// written by the mixer
+
+static sfx_t		*snd_releases[MAX_SNDRELEASES];
+static SDL_atomic_t	snd_releasehead;	// written by the mixer
+static SDL_atomic_t	snd_releasetail;	// written by the main thread
+
+static void S_RunCommand (const sndcmd_t *cmd);
+
+static SDL_Thread	*snd_thread;
+static SDL_sem		*snd_wake;
+static SDL_atomic_t	snd_quit;
+
+// the mixer's own view of the listener
+static int	mix_viewentity;
+static vec3_t	mix_origin;
+static vec3_t	mix_right;
+static SDL_atomic_t	mix_audible;	// channels heard in the last update, for snd_show
+
 cvar_t		bgmvolume = {"bgmvolume", "1", CVAR_ARCHIVE};
 cvar_t		sfxvolume = {"volume", "0.7", CVAR_ARCHIVE};
 
@@ -126,6 +207,78 @@ static void SND_Callback_snd_filterquality (cvar_t *var)
 		Con_Printf ("snd_filterquality must be between 1 and 5\n");
 		Cvar_SetQuick (&snd_filterquality, SND_FILTERQUALITY_DEFAULT);
 	}
+	SND_UpdateLowpass ();
+}
+
+static void SND_Callback_sndspeed (cvar_t *var)
+{
+	SND_UpdateLowpass ();
+}
+
+/*
+================
+S_MixerThread
+================
+*/
+static int SDLCALL S_MixerThread (void *unused)
+{
+	while (!SDL_AtomicGet (&snd_quit))
+	{
+		SDL_SemWaitTimeout (snd_wake, 10);
+		S_Update_ ();
+	}
+
+	return 0;
+}
+
+/*
+================
+S_WakeMixer
+
+Called from the device callback
+================
+*/
+void S_WakeMixer (void)
+{
+	if (snd_wake)
+		SDL_SemPost (snd_wake);
+}
+
+/*
+================
+S_StartMixer
+================
+*/
+static void S_StartMixer (void)
+{
+	if (COM_CheckParm ("-nosoundthread"))
+		return;
+
+	SDL_AtomicSet (&snd_quit, 0);
+	snd_wake = SDL_CreateSemaphore (0);
+	if (snd_wake)
+		snd_thread = SDL_CreateThread (S_MixerThread, "mixer", NULL);
+	if (!snd_thread)
+		Con_Printf ("S_StartMixer: %s\n", SDL_GetError ());
+}
+
+/*
+================
+S_StopMixer
+================
+*/
+static void S_StopMixer (void)
+{
+	if (!snd_thread)
+		return;
+
+	SDL_AtomicSet (&snd_quit, 1);
+	SDL_SemPost (snd_wake);
+	SDL_WaitThread (snd_thread, NULL);
+	snd_thread = NULL;
+
+// finish what was posted, so everything gets unpinned
+	S_RunCommands ();
 }
 
 /*
@@ -148,6 +301,8 @@ void S_Startup (void)
 	{
 		Con_Printf("Audio: %d bit, %s, %d Hz\n", shm->samplebits,
 				(shm->channels == 2) ? "stereo" : "mono", shm->speed);
+		SND_UpdateLowpass ();
+		S_StartMixer ();
 	}
 }
 
@@ -180,6 +335,8 @@ void S_Init (void)
 	Cvar_RegisterVariable(&sndspeed);
 	Cvar_RegisterVariable(&snd_mixspeed);
 	Cvar_RegisterVariable(&snd_filterquality);
+	SND_InitMixKernels ();
+	S_InitSoundCache ();
 	
 	if (safemode || COM_CheckParm("-nosound"))
 		return;
@@ -212,6 +369,7 @@ void S_Init (void)
 
 	Cvar_SetCallback(&sfxvolume, SND_Callback_sfxvolume);
 	Cvar_SetCallback(&snd_filterquality, &SND_Callback_snd_filterquality);
+	Cvar_SetCallback(&sndspeed, SND_Callback_sndspeed);
 
 	SND_InitScaletable ();
 
@@ -242,9 +400,21 @@ void S_Init (void)
 // =======================================================================
 void S_Shutdown (void)
 {
+	int		i;
+
 	if (!sound_started)
 		return;
 
+	S_StopMixer ();
+	S_ClearChannels ();
+	S_DrainReleases ();
+	for (i = 0; i < NUM_AMBIENTS; i++)
+	{
+		if (ambient_sc[i])
+			Cache_Unpin (&ambient_sfx[i]->cache);
+		ambient_sc[i] = NULL;
+	}
+
 	sound_started = 0;
 	snd_blocked = 0;
 
@@ -252,6 +422,13 @@ void S_Shutdown (void)
 
 	SNDDMA_Shutdown();
 	shm = NULL;
+	SND_UpdateLowpass ();	// frees the filters
+
+	if (snd_wake)
+	{
+		SDL_DestroySemaphore (snd_wake);
+		snd_wake = NULL;
+	}
 }
 
 
@@ -314,6 +491,29 @@ void S_TouchSound (const char *name)
 	Cache_Check (&sfx->cache);
 }
 
+/*
+==================
+S_PrefetchSound
+
+Starts reading a sound in the background if it isn't cached already.
+==================
+*/
+void S_PrefetchSound (const char *name)
+{
+	sfx_t	*sfx;
+	char	namebuffer[MAX_QPATH];
+
+	if (!sound_started || nosound.value || !precache.value || !name[0])
+		return;
+
+	sfx = S_FindName (name);
+	if (Cache_Peek (&sfx->cache))
+		return;
+
+	q_snprintf (namebuffer, sizeof(namebuffer), "sound/%s", name);
+	COM_PrefetchFile (namebuffer);
+}
+
 /*
 ==================
 S_PrecacheSound
@@ -331,7 +531,7 @@ sfx_t *S_PrecacheSound (const char *name)
 
 // cache it in
 	if (precache.value)
-		S_LoadSound (sfx);
+		S_PreloadSound (sfx);
 
 	return sfx;
 }
@@ -339,6 +539,112 @@ sfx_t *S_PrecacheSound (const char *name)
 
 //=============================================================================
 
+/*
+=================
+S_PostCommand
+
+Main thread only
+=================
+*/
+static void S_PostCommand (const sndcmd_t *cmd)
+{
+	int	head, next;
+
+	S_DrainReleases ();
+
+	if (!snd_thread)
+	{
+		S_RunCommand (cmd);
+		return;
+	}
+
+	head = SDL_AtomicGet (&snd_cmdhead);
+	next = (head + 1) & (MAX_SNDCMDS - 1);
+	while (next == SDL_AtomicGet (&snd_cmdtail))
+	{	// full, let the mixer catch up
+		SDL_SemPost (snd_wake);
+		SDL_Delay (1);
+	}
+
+	snd_cmds[head] = *cmd;
+	SDL_AtomicSet (&snd_cmdhead, next);
+}
+
+/*
+=================
+S_FinishCommands
+
+Main thread only, waits for the mixer to run everything posted so far
+=================
+*/
+static void S_FinishCommands (void)
+{
+	if (!snd_thread)
+		return;
+
+	while (SDL_AtomicGet (&snd_cmdtail) != SDL_AtomicGet (&snd_cmdhead))
+	{
+		SDL_SemPost (snd_wake);
+		SDL_Delay (1);
+	}
+}
+
+/*
+=================
+S_DrainReleases
+
+Main thread only, unpins the sounds the mixer is done with
+=================
+*/
+static void S_DrainReleases (void)
+{
+	int	head, tail;
+
+	head = SDL_AtomicGet (&snd_releasehead);
+	for (tail = SDL_AtomicGet (&snd_releasetail); tail != head; tail = (tail + 1) & (MAX_SNDRELEASES - 1))
+		Cache_Unpin (&snd_releases[tail]->cache);
+	SDL_AtomicSet (&snd_releasetail, tail);
+}
+
+/*
+=================
+S_ReleaseSfx
+
+Mixer side.  Every pinned sfx is either in the command queue, on a channel
+or in the release queue, and the main thread drains the releases before
+each post, so this can't fill up.  If it somehow did, the sound would just
+stay cached.
+=================
+*/
+static void S_ReleaseSfx (sfx_t *sfx)
+{
+	int	head, next;
+
+	head = SDL_AtomicGet (&snd_releasehead);
+	next = (head + 1) & (MAX_SNDRELEASES - 1);
+	if (next == SDL_AtomicGet (&snd_releasetail))
+		return;
+
+	snd_releases[head] = sfx;
+	SDL_AtomicSet (&snd_releasehead, next);
+}
+
+/*
+=================
+S_ReleaseChannel
+
+Mixer side.  The ambient channels are released by SNDCMD_STOPALL.
+=================
+*/
+void S_ReleaseChannel (channel_t *ch)
+{
+	if (ch->sfx && ch - snd_channels >= NUM_AMBIENTS)
+		S_ReleaseSfx (ch->sfx);
+
+	ch->sfx = NULL;
+	ch->sc = NULL;
+}
+
 /*
 =================
 SND_PickChannel
@@ -366,7 +672,7 @@ channel_t *SND_PickChannel (int entnum, int entchannel)
 		}
 
 		// don't let monster sounds override player sounds
-		if (snd_channels[ch_idx].entnum == cl.viewentity && entnum != cl.viewentity && snd_channels[ch_idx].sfx)
+		if (snd_channels[ch_idx].entnum == mix_viewentity && entnum != mix_viewentity && snd_channels[ch_idx].sfx)
 			continue;
 
 		if (snd_channels[ch_idx].end - paintedtime < life_left)
@@ -380,7 +686,7 @@ channel_t *SND_PickChannel (int entnum, int entchannel)
 		return NULL;
 
 	if (snd_channels[first_to_die].sfx)
-		snd_channels[first_to_die].sfx = NULL;
+		S_ReleaseChannel (&snd_channels[first_to_die]);
 
 	return &snd_channels[first_to_die];
 }
@@ -400,7 +706,7 @@ void SND_Spatialize (channel_t *ch)
 	vec3_t	source_vec;
 
 // anything coming from the view entity will always be full volume
-	if (ch->entnum == cl.viewentity)
+	if (ch->entnum == mix_viewentity)
 	{
 		ch->leftvol = ch->master_vol;
 		ch->rightvol = ch->master_vol;
@@ -408,9 +714,9 @@ void SND_Spatialize (channel_t *ch)
 	}
 
 // calculate stereo seperation and distance attenuation
-	VectorSubtract(ch->origin, listener_origin, source_vec);
+	VectorSubtract(ch->origin, mix_origin, source_vec);
 	dist = VectorNormalize(source_vec) * ch->dist_mult;
-	dot = DotProduct(listener_right, source_vec);
+	dot = DotProduct(mix_right, source_vec);
 
 	if (shm->channels == 1)
 	{
@@ -440,48 +746,46 @@ void SND_Spatialize (channel_t *ch)
 // Start a sound effect
 // =======================================================================
 
-void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
+/*
+=================
+S_StartChannel
+
+Mixer side of S_StartSound
+=================
+*/
+static void S_StartChannel (const sndcmd_t *cmd)
 {
 	channel_t	*target_chan, *check;
-	sfxcache_t	*sc;
+	sfxcache_t	*sc = cmd->sc;
 	int		ch_idx;
 	int		skip;
 
-	if (!sound_started)
-		return;
-
-	if (!sfx)
-		return;
-
-	if (nosound.value)
-		return;
-
 // pick a channel to play on
-	target_chan = SND_PickChannel(entnum, entchannel);
+	target_chan = SND_PickChannel(cmd->entnum, cmd->entchannel);
 	if (!target_chan)
+	{
+		S_ReleaseSfx (cmd->sfx);
 		return;
+	}
 
 // spatialize
 	memset (target_chan, 0, sizeof(*target_chan));
-	VectorCopy(origin, target_chan->origin);
-	target_chan->dist_mult = attenuation / sound_nominal_clip_dist;
-	target_chan->master_vol = (int) (fvol * 255);
-	target_chan->entnum = entnum;
-	target_chan->entchannel = entchannel;
+	VectorCopy(cmd->origin, target_chan->origin);
+	target_chan->dist_mult = cmd->dist_mult;
+	target_chan->master_vol = cmd->master_vol;
+	target_chan->entnum = cmd->entnum;
+	target_chan->entchannel = cmd->entchannel;
 	SND_Spatialize(target_chan);
 
 	if (!target_chan->leftvol && !target_chan->rightvol)
-		return;		// not audible at all
-
-// new channel
-	sc = S_LoadSound (sfx);
-	if (!sc)
 	{
-		target_chan->sfx = NULL;
-		return;		// couldn't load the sound's data
+		S_ReleaseSfx (cmd->sfx);
+		return;		// not audible at all
 	}
 
-	target_chan->sfx = sfx;
+// new channel
+	target_chan->sfx = cmd->sfx;
+	target_chan->sc = sc;
 	target_chan->pos = 0.0;
 	target_chan->end = paintedtime + sc->length;
 
@@ -492,7 +796,7 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	{
 		if (check == target_chan)
 			continue;
-		if (check->sfx == sfx && !check->pos)
+		if (check->sfx == cmd->sfx && !check->pos)
 		{
 			/*
 			skip = rand () % (int)(0.1 * shm->speed);
@@ -512,7 +816,51 @@ void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float
 	}
 }
 
+void S_StartSound (int entnum, int entchannel, sfx_t *sfx, vec3_t origin, float fvol, float attenuation)
+{
+	sndcmd_t	cmd;
+	sfxcache_t	*sc;
+
+	if (!sound_started)
+		return;
+
+	if (!sfx)
+		return;
+
+	if (nosound.value)
+		return;
+
+// the mixer can't touch the cache, so load it here
+	sc = S_LoadSound (sfx);
+	if (!sc)
+		return;		// couldn't load the sound's data
+	Cache_Pin (&sfx->cache);
+
+	cmd.type = SNDCMD_START;
+	cmd.entnum = entnum;
+	cmd.entchannel = entchannel;
+	cmd.sfx = sfx;
+	cmd.sc = sc;
+	VectorCopy (origin, cmd.origin);
+	cmd.master_vol = (int) (fvol * 255);
+	cmd.dist_mult = attenuation / sound_nominal_clip_dist;
+	S_PostCommand (&cmd);
+}
+
 void S_StopSound (int entnum, int entchannel)
+{
+	sndcmd_t	cmd;
+
+	if (!sound_started)
+		return;
+
+	cmd.type = SNDCMD_STOP;
+	cmd.entnum = entnum;
+	cmd.entchannel = entchannel;
+	S_PostCommand (&cmd);
+}
+
+static void S_StopChannel (int entnum, int entchannel)
 {
 	int	i;
 
@@ -522,7 +870,7 @@ void S_StopSound (int entnum, int entchannel)
 			&& snd_channels[i].entchannel == entchannel)
 		{
 			snd_channels[i].end = 0;
-			snd_channels[i].sfx = NULL;
+			S_ReleaseChannel (&snd_channels[i]);
 			return;
 		}
 	}
@@ -530,20 +878,27 @@ void S_StopSound (int entnum, int entchannel)
 
 void S_StopAllSounds (qboolean clear)
 {
+	sndcmd_t	cmd;
 	int		i;
 
 	if (!sound_started)
 		return;
 
-	total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
-
-	for (i = 0; i < MAX_CHANNELS; i++)
+// the mixer hands the ambient sounds back with everything else, so that
+// nothing stays pinned across a map or game change
+	cmd.type = SNDCMD_STOPALL;
+	for (i = 0; i < NUM_AMBIENTS; i++)
 	{
-		if (snd_channels[i].sfx)
-			snd_channels[i].sfx = NULL;
+		cmd.ambientsc[i] = ambient_sc[i];
+		ambient_sc[i] = NULL;
 	}
+	S_PostCommand (&cmd);
+	S_FinishCommands ();
+	S_DrainReleases ();
 
-	memset(snd_channels, 0, MAX_CHANNELS * sizeof(channel_t));
+	num_statics = 0;
+	memset (ambient_vol, 0, sizeof(ambient_vol));
+	ambient_on = false;
 
 	if (clear)
 		S_ClearBuffer ();
@@ -554,19 +909,51 @@ static void S_StopAllSoundsC (void)
 	S_StopAllSounds (true);
 }
 
-void S_ClearBuffer (void)
+/*
+=================
+S_ClearChannels
+
+Mixer side of S_StopAllSounds
+=================
+*/
+static void S_ClearChannels (void)
 {
-	int		clear;
+	int		i;
+
+	total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
+
+	for (i = 0; i < MAX_CHANNELS; i++)
+	{
+		if (snd_channels[i].sfx)
+			S_ReleaseChannel (&snd_channels[i]);
+	}
+
+	memset(snd_channels, 0, MAX_CHANNELS * sizeof(channel_t));
+}
 
+void S_ClearBuffer (void)
+{
 	if (!sound_started || !shm)
 		return;
 
+	S_ClearDMABuffer ();
+}
+
+/*
+=================
+S_ClearDMABuffer
+
+Leaves the music alone, which belongs to its decoder
+=================
+*/
+static void S_ClearDMABuffer (void)
+{
+	int		clear;
+
 	SNDDMA_LockBuffer ();
 	if (! shm->buffer)
 		return;
 
-	s_rawend = 0;
-
 	if (shm->samplebits == 8 && !shm->signed8)
 		clear = 0x80;
 	else
@@ -585,20 +972,19 @@ S_StaticSound
 */
 void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 {
-	channel_t	*ss;
+	sndcmd_t	cmd;
 	sfxcache_t		*sc;
 
 	if (!sfx)
 		return;
 
-	if (total_channels == MAX_CHANNELS)
+	if (num_statics == MAX_CHANNELS - MAX_DYNAMIC_CHANNELS - NUM_AMBIENTS)
 	{
 		Con_Printf ("total_channels == MAX_CHANNELS\n");
 		return;
 	}
 
-	ss = &snd_channels[total_channels];
-	total_channels++;
+	num_statics++;
 
 	sc = S_LoadSound (sfx);
 	if (!sc)
@@ -610,11 +996,43 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 		return;
 	}
 
-	ss->sfx = sfx;
-	VectorCopy (origin, ss->origin);
-	ss->master_vol = (int)vol;
-	ss->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
-	ss->end = paintedtime + sc->length;
+	Cache_Pin (&sfx->cache);
+
+	cmd.type = SNDCMD_STATIC;
+	cmd.sfx = sfx;
+	cmd.sc = sc;
+	VectorCopy (origin, cmd.origin);
+	cmd.master_vol = (int)vol;
+	cmd.dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
+	S_PostCommand (&cmd);
+}
+
+/*
+=================
+S_StartStatic
+
+Mixer side of S_StaticSound
+=================
+*/
+static void S_StartStatic (const sndcmd_t *cmd)
+{
+	channel_t	*ss;
+
+	if (total_channels == MAX_CHANNELS)
+	{
+		S_ReleaseSfx (cmd->sfx);
+		return;
+	}
+
+	ss = &snd_channels[total_channels];
+	total_channels++;
+
+	ss->sfx = cmd->sfx;
+	ss->sc = cmd->sc;
+	VectorCopy (cmd->origin, ss->origin);
+	ss->master_vol = cmd->master_vol;
+	ss->dist_mult = cmd->dist_mult;
+	ss->end = paintedtime + cmd->sc->length;
 
 	SND_Spatialize (ss);
 }
@@ -625,13 +1043,15 @@ void S_StaticSound (sfx_t *sfx, vec3_t origin, float vol, float attenuation)
 /*
 ===================
 S_UpdateAmbientSounds
+
+Fades the ambient volumes on the main thread, the mixer gets them with
+the listener
 ===================
 */
 static void S_UpdateAmbientSounds (void)
 {
 	mleaf_t		*l;
 	int		vol, ambient_channel;
-	channel_t	*chan;
 
 // no ambients when disconnected
 	if (cls.state != ca_connected)
@@ -643,39 +1063,78 @@ static void S_UpdateAmbientSounds (void)
 	l = Mod_PointInLeaf (listener_origin, cl.worldmodel);
 	if (!l || !ambient_level.value)
 	{
-		for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS; ambient_channel++)
-			snd_channels[ambient_channel].sfx = NULL;
+		ambient_on = false;
 		return;
 	}
 
+	ambient_on = true;
+
 	for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS; ambient_channel++)
 	{
-		chan = &snd_channels[ambient_channel];
-		chan->sfx = ambient_sfx[ambient_channel];
-
 		vol = (int) (ambient_level.value * l->ambient_sound_level[ambient_channel]);
 		if (vol < 8)
 			vol = 0;
 
 	// don't adjust volume too fast
-		if (chan->master_vol < vol)
+		if (ambient_vol[ambient_channel] < vol)
 		{
-			chan->master_vol += (int) (host_frametime * ambient_fade.value);
-			if (chan->master_vol > vol)
-				chan->master_vol = vol;
+			ambient_vol[ambient_channel] += (int) (host_frametime * ambient_fade.value);
+			if (ambient_vol[ambient_channel] > vol)
+				ambient_vol[ambient_channel] = vol;
 		}
-		else if (chan->master_vol > vol)
+		else if (ambient_vol[ambient_channel] > vol)
 		{
-			chan->master_vol -= (int) (host_frametime * ambient_fade.value);
-			if (chan->master_vol < vol)
-				chan->master_vol = vol;
+			ambient_vol[ambient_channel] -= (int) (host_frametime * ambient_fade.value);
+			if (ambient_vol[ambient_channel] < vol)
+				ambient_vol[ambient_channel] = vol;
 		}
+	}
+}
+
+/*
+===================
+S_AmbientCache
+
+The ambient sounds stay pinned once they are loaded, until
+S_StopAllSounds
+===================
+*/
+static sfxcache_t *S_AmbientCache (int ambient_channel)
+{
+	sfx_t	*sfx = ambient_sfx[ambient_channel];
 
-		chan->leftvol = chan->rightvol = chan->master_vol;
+	if (!ambient_sc[ambient_channel] && sfx)
+	{
+		ambient_sc[ambient_channel] = S_LoadSound (sfx);
+		if (ambient_sc[ambient_channel])
+			Cache_Pin (&sfx->cache);
 	}
+
+	return ambient_sc[ambient_channel];
 }
 
 
+/*
+===================
+S_RawSpace
+
+How many samples can go in the music ring
+===================
+*/
+int S_RawSpace (void)
+{
+	unsigned int head, tail;
+
+	if (!shm)
+		return 0;
+
+	head = (unsigned int) SDL_AtomicGet (&s_rawhead);
+	tail = (unsigned int) SDL_AtomicGet (&s_rawtail);
+	SDL_MemoryBarrierAcquire ();	// the mixer is done with what it passed
+
+	return MAX_RAW_SAMPLES - (int)(head - tail);
+}
+
 /*
 ===================
 S_RawSamples		(from QuakeII)
@@ -684,6 +1143,8 @@ Streaming music support. Byte swapping
 of data must be handled by the codec.
 Expects data in signed 16 bit, or unsigned
 8 bit format.
+Whatever does not fit in the ring is dropped,
+see S_RawSpace.
 ===================
 */
 void S_RawSamples (int samples, int rate, int width, int channels, byte *data, float volume)
@@ -692,35 +1153,37 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 	int src, dst;
 	float scale;
 	int intVolume;
+	unsigned int head;
+	int space;
 
-	if (s_rawend < paintedtime)
-		s_rawend = paintedtime;
+	space = S_RawSpace ();
+	head = (unsigned int) SDL_AtomicGet (&s_rawhead);
 
 	scale = (float) rate / shm->speed;
 	intVolume = (int) (256 * volume);
 
 	if (channels == 2 && width == 2)
 	{
-		for (i = 0; ; i++)
+		for (i = 0; i < space; i++)
 		{
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = head & (MAX_RAW_SAMPLES - 1);
+			head++;
 			s_rawsamples [dst].left = ((short *) data)[src * 2] * intVolume;
 			s_rawsamples [dst].right = ((short *) data)[src * 2 + 1] * intVolume;
 		}
 	}
 	else if (channels == 1 && width == 2)
 	{
-		for (i = 0; ; i++)
+		for (i = 0; i < space; i++)
 		{
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = head & (MAX_RAW_SAMPLES - 1);
+			head++;
 			s_rawsamples [dst].left = ((short *) data)[src] * intVolume;
 			s_rawsamples [dst].right = ((short *) data)[src] * intVolume;
 		}
@@ -729,13 +1192,13 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 	{
 		intVolume *= 256;
 
-		for (i = 0; ; i++)
+		for (i = 0; i < space; i++)
 		{
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = head & (MAX_RAW_SAMPLES - 1);
+			head++;
 		//	s_rawsamples [dst].left = ((signed char *) data)[src * 2] * intVolume;
 		//	s_rawsamples [dst].right = ((signed char *) data)[src * 2 + 1] * intVolume;
 			s_rawsamples [dst].left = (((byte *) data)[src * 2] - 128) * intVolume;
@@ -746,46 +1209,74 @@ void S_RawSamples (int samples, int rate, int width, int channels, byte *data, f
 	{
 		intVolume *= 256;
 
-		for (i = 0; ; i++)
+		for (i = 0; i < space; i++)
 		{
 			src = i * scale;
 			if (src >= samples)
 				break;
-			dst = s_rawend & (MAX_RAW_SAMPLES - 1);
-			s_rawend++;
+			dst = head & (MAX_RAW_SAMPLES - 1);
+			head++;
 		//	s_rawsamples [dst].left = ((signed char *) data)[src] * intVolume;
 		//	s_rawsamples [dst].right = ((signed char *) data)[src] * intVolume;
 			s_rawsamples [dst].left = (((byte *) data)[src] - 128) * intVolume;
 			s_rawsamples [dst].right = (((byte *) data)[src] - 128) * intVolume;
 		}
 	}
+
+	SDL_MemoryBarrierRelease ();
+	SDL_AtomicSet (&s_rawhead, (int) head);
+}
+
+/*
+===================
+S_RawClear
+
+Drops the music written so far, called by the producer
+===================
+*/
+void S_RawClear (void)
+{
+	SDL_AtomicSet (&s_rawdiscard, SDL_AtomicGet (&s_rawhead));
+	SDL_AtomicAdd (&s_rawclears, 1);
+}
+
+/*
+===================
+S_RawSetState
+
+RAW_PAUSE keeps the mixer from taking anything, RAW_PLAY
+has it count the times the ring runs dry as underruns.
+===================
+*/
+void S_RawSetState (rawstate_t state)
+{
+	SDL_AtomicSet (&s_rawstate, state);
+}
+
+/*
+===================
+S_RawUnderruns
+===================
+*/
+int S_RawUnderruns (void)
+{
+	return SDL_AtomicGet (&s_rawunderruns);
 }
 
 /*
 ============
-S_Update
+S_Respatialize
 
-Called once each time through the main loop
+Mixer side of the listener update
 ============
 */
-void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
+static void S_Respatialize (void)
 {
 	int			i, j;
 	int			total;
 	channel_t	*ch;
 	channel_t	*combine;
 
-	if (!sound_started || (snd_blocked > 0))
-		return;
-
-	VectorCopy(origin, listener_origin);
-	VectorCopy(forward, listener_forward);
-	VectorCopy(right, listener_right);
-	VectorCopy(up, listener_up);
-
-// update general area ambient sound sources
-	S_UpdateAmbientSounds ();
-
 	combine = NULL;
 
 // update spatialization for static and dynamic sounds
@@ -836,30 +1327,129 @@ void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 		}
 	}
 
-//
-// debugging output
-//
-	if (snd_show.value)
+// for snd_show
+	total = 0;
+	ch = snd_channels;
+	for (i = 0; i < total_channels; i++, ch++)
+	{
+		if (ch->sfx && (ch->leftvol || ch->rightvol) )
+			total++;
+	}
+	SDL_AtomicSet (&mix_audible, total);
+}
+
+/*
+============
+S_RunCommand
+
+Mixer side, or the main thread without a mixer thread
+============
+*/
+static void S_RunCommand (const sndcmd_t *cmd)
+{
+	int		i;
+	channel_t	*ch;
+
+	switch (cmd->type)
 	{
-		total = 0;
-		ch = snd_channels;
-		for (i = 0; i < total_channels; i++, ch++)
+	case SNDCMD_START:
+		S_StartChannel (cmd);
+		break;
+	case SNDCMD_STATIC:
+		S_StartStatic (cmd);
+		break;
+	case SNDCMD_STOP:
+		S_StopChannel (cmd->entnum, cmd->entchannel);
+		break;
+	case SNDCMD_STOPALL:
+		S_ClearChannels ();
+		for (i = 0; i < NUM_AMBIENTS; i++)
 		{
-			if (ch->sfx && (ch->leftvol || ch->rightvol) )
-			{
-			//	Con_Printf ("%3i %3i %s\n", ch->leftvol, ch->rightvol, ch->sfx->name);
-				total++;
-			}
+			if (cmd->ambientsc[i])
+				S_ReleaseSfx (ambient_sfx[i]);
 		}
+		break;
+	case SNDCMD_LISTENER:
+		mix_viewentity = cmd->entnum;
+		VectorCopy (cmd->origin, mix_origin);
+		VectorCopy (cmd->right, mix_right);
+		for (i = 0, ch = snd_channels; i < NUM_AMBIENTS; i++, ch++)
+		{
+			ch->sfx = cmd->ambientsc[i] ? ambient_sfx[i] : NULL;
+			ch->sc = cmd->ambientsc[i];
+			ch->master_vol = cmd->ambientvol[i];
+			ch->leftvol = ch->rightvol = ch->master_vol;
+		}
+		S_Respatialize ();
+		break;
+	}
+}
 
-		Con_Printf ("----(%i)----\n", total);
+/*
+============
+S_RunCommands
+
+Mixer side, runs whatever the main thread posted
+============
+*/
+static void S_RunCommands (void)
+{
+	int	head, tail;
+
+	head = SDL_AtomicGet (&snd_cmdhead);
+	for (tail = SDL_AtomicGet (&snd_cmdtail); tail != head; tail = (tail + 1) & (MAX_SNDCMDS - 1))
+		S_RunCommand (&snd_cmds[tail]);
+	SDL_AtomicSet (&snd_cmdtail, tail);
+}
+
+/*
+============
+S_Update
+
+Called once each time through the main loop
+============
+*/
+void S_Update (vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
+{
+	sndcmd_t	cmd;
+	int		i;
+
+	if (!sound_started || (snd_blocked > 0))
+		return;
+
+	S_DrainReleases ();
+
+	VectorCopy(origin, listener_origin);
+	VectorCopy(forward, listener_forward);
+	VectorCopy(right, listener_right);
+	VectorCopy(up, listener_up);
+
+// update general area ambient sound sources
+	S_UpdateAmbientSounds ();
+
+	cmd.type = SNDCMD_LISTENER;
+	cmd.entnum = cl.viewentity;
+	VectorCopy (origin, cmd.origin);
+	VectorCopy (right, cmd.right);
+	for (i = 0; i < NUM_AMBIENTS; i++)
+	{
+		cmd.ambientsc[i] = ambient_on ? S_AmbientCache (i) : NULL;
+		cmd.ambientvol[i] = ambient_vol[i];
 	}
+	S_PostCommand (&cmd);
+
+//
+// debugging output
+//
+	if (snd_show.value)
+		Con_Printf ("----(%i)----\n", SDL_AtomicGet (&mix_audible));
 
 // add raw data from streamed samples
 //	BGM_Update();	// moved to the main loop just before S_Update ()
 
-// mix some sound
-	S_Update_();
+// mix some sound, unless the mixer thread does
+	if (!snd_thread)
+		S_Update_();
 }
 
 static void GetSoundtime (void)
@@ -883,7 +1473,8 @@ static void GetSoundtime (void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds (true);
+			S_ClearChannels ();
+			S_ClearDMABuffer ();
 		}
 	}
 	oldsamplepos = samplepos;
@@ -895,6 +1486,8 @@ void S_ExtraUpdate (void)
 {
 	if (snd_noextraupdate.value)
 		return;		// don't pollute timings
+	if (snd_thread)
+		return;		// the mixer thread keeps up by itself
 	S_Update_();
 }
 
@@ -903,7 +1496,12 @@ static void S_Update_ (void)
 	unsigned int	endtime;
 	int		samps;
 
-	if (!sound_started || (snd_blocked > 0))
+	if (!sound_started)
+		return;
+
+	S_RunCommands ();
+
+	if (snd_blocked > 0)
 		return;
 
 	SNDDMA_LockBuffer ();
@@ -1018,7 +1616,7 @@ static void S_SoundList (void)
 	total = 0;
 	for (sfx = known_sfx, i = 0; i < num_sfx; i++, sfx++)
 	{
-		sc = (sfxcache_t *) Cache_Check (&sfx->cache);
+		sc = (sfxcache_t *) Cache_Peek (&sfx->cache);
 		if (!sc)
 			continue;
 		size = sc->length*sc->width*(sc->stereo + 1);
@@ -1056,10 +1654,3 @@ void S_ClearPrecache (void)
 {
 }
 
-void S_BeginPrecaching (void)
-{
-}
-
-void S_EndPrecaching (void)
-{
-}
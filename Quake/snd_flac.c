@@ -82,7 +82,7 @@ flac_error_func (const FLAC__StreamDecoder *decoder,
 {
 	flacfile_t *ff = (flacfile_t *) client_data;
 	ff->error = -1;
-	Con_Printf ("FLAC: decoder error %i\n", status);
+	S_CodecPrintf ("FLAC: decoder error %i\n", status);
 }
 
 static FLAC__StreamDecoderReadStatus
@@ -342,7 +342,7 @@ static int S_FLAC_CodecReadStream (snd_stream_t *stream, int len, void *buffer)
 		} else if (res < 0) { /* error */
 			return -1;
 		} else {
-			Con_DPrintf ("FLAC: EOF\n");
+			S_CodecDPrintf ("FLAC: EOF\n");
 			break;
 		}
 	}
@@ -23,41 +23,72 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 
+/*
+ Sounds are kept resampled to the output rate in a cache pool of their own,
+ with its own budget, so that loading models doesn't throw them out and
+ they aren't loaded and resampled over and over.  Between S_BeginPrecaching
+ and S_EndPrecaching, the resampling is done by the worker threads, while
+ the main thread goes on with the next sound.
+*/
+static cvar_t	snd_cachesize = {"snd_cachesize", "64", CVAR_ARCHIVE};	// megabytes
+static cvar_t	snd_resample = {"snd_resample", "1", CVAR_ARCHIVE};	// 0 nearest, 1 windowed sinc
+
+// a windowed sinc kernel from inrate to outrate, see ResampleSinc
+typedef struct sinctable_s
+{
+	struct sinctable_s	*next;
+	int		inrate, outrate;
+	int		taps, half;
+	float		*table;		// RESAMPLE_PHASES + 1 rows of taps
+} sinctable_t;
+
+#define	MAX_SINCTABLES	16	// dropped beyond this once no load uses them
+
+static sinctable_t	*sfx_sinctables;
+static int		sfx_numsinctables;
+
+typedef struct
+{
+	sfx_t		*sfx;		// pinned while a worker resamples it
+	sfxcache_t	*sc;		// all set up but the data
+	filemap_t	map;
+	const byte	*data;		// the samples in the file
+	int		inrate;
+	int		inwidth;
+	int		insamples;
+	int		inloopstart;
+	const sinctable_t	*sinc;	// NULL to take the nearest sample
+	qboolean	failed;		// set by the worker if it ran out of memory
+} sfxload_t;
+
+#define	MAX_SFXLOADS	256
+
+static sfxload_t	sfx_loads[MAX_SFXLOADS];
+static int		sfx_numloads;
+static taskgroup_t	sfx_loadgroup;
+static qboolean		sfx_precaching;
+
 /*
 ================
-ResampleSfx
+ResampleNearest
 ================
 */
-static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
+static void ResampleNearest (const sfxload_t *load)
 {
 	int		outcount;
 	int		srcsample;
 	float	stepscale;
 	int		i;
 	int		sample, fracstep;
-	sfxcache_t	*sc;
+	sfxcache_t	*sc = load->sc;
+	const byte	*data = load->data;
 
-	sc = (sfxcache_t *) Cache_Check (&sfx->cache);
-	if (!sc)
-		return;
-
-	stepscale = (float)inrate / shm->speed;	// this is usually 0.5, 1, or 2
-
-	outcount = sc->length / stepscale;
-	sc->length = outcount;
-	if (sc->loopstart != -1)
-		sc->loopstart = sc->loopstart / stepscale;
-
-	sc->speed = shm->speed;
-	if (loadas8bit.value)
-		sc->width = 1;
-	else
-		sc->width = inwidth;
-	sc->stereo = 0;
+	stepscale = (float)load->inrate / sc->speed;	// this is usually 0.5, 1, or 2
+	outcount = sc->length;
 
 // resample / decimate to the current source rate
 
-	if (stepscale == 1 && inwidth == 1 && sc->width == 1)
+	if (stepscale == 1 && load->inwidth == 1 && sc->width == 1)
 	{
 // fast special case
 		for (i = 0; i < outcount; i++)
@@ -73,7 +104,7 @@ static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 		{
 			srcsample = (int)(samplefrac >> 8);
 			samplefrac += fracstep; // need int64_t here to prevent overflow...
-			if (inwidth == 2)
+			if (load->inwidth == 2)
 				sample = LittleShort ( ((short *)data)[srcsample] );
 			else
 				sample = (int)( (unsigned char)(data[srcsample]) - 128) << 8;
@@ -85,14 +116,244 @@ static void ResampleSfx (sfx_t *sfx, int inrate, int inwidth, byte *data)
 	}
 }
 
+/*
+ Band limited resampling with a Blackman windowed sinc, cut off a little
+ below the lower of the two nyquist rates.  The kernel is tabulated at
+ RESAMPLE_PHASES fractional positions, and interpolated between them.
+ It only depends on the two rates, so the main thread makes each table
+ once and the workers share it.  Past the end, a looped sound goes on
+ from its loop start.
+*/
+#define	RESAMPLE_ZEROS	16	// zero crossings on each side of the kernel
+#define	RESAMPLE_PHASES	64
+#define	RESAMPLE_CUTOFF	0.92
+
+/*
+================
+S_GetSincTable
+
+Main thread, finds or makes the kernel for a pair of rates, which stays
+until S_FreeSincTables
+================
+*/
+static const sinctable_t *S_GetSincTable (int inrate, int outrate)
+{
+	sinctable_t	*st;
+	double	ratio, fc, halfwidth, t, x;
+	float	*row, sum;
+	int		j, p;
+
+	for (st = sfx_sinctables; st; st = st->next)
+	{
+		if (st->inrate == inrate && st->outrate == outrate)
+			return st;
+	}
+
+	ratio = (double)inrate / outrate;
+	fc = RESAMPLE_CUTOFF * (ratio > 1 ? 1 / ratio : 1);	// of the input nyquist rate
+	halfwidth = RESAMPLE_ZEROS / fc;
+
+	st = (sinctable_t *) malloc (sizeof(sinctable_t));
+	if (!st)
+		Sys_Error ("S_GetSincTable: out of memory");
+	st->inrate = inrate;
+	st->outrate = outrate;
+	st->half = (int)ceil(halfwidth);
+	st->taps = st->half * 2;
+	st->table = (float *) malloc ((RESAMPLE_PHASES + 1) * st->taps * sizeof(float));
+	if (!st->table)
+		Sys_Error ("S_GetSincTable: out of memory");
+
+// phase p of tap j is the kernel at j - half + 1 - p / RESAMPLE_PHASES
+	for (p = 0; p <= RESAMPLE_PHASES; p++)
+	{
+		row = st->table + p * st->taps;
+		sum = 0;
+		for (j = 0; j < st->taps; j++)
+		{
+			t = j - st->half + 1 - p / (double)RESAMPLE_PHASES;
+			if (fabs(t) >= halfwidth)
+				row[j] = 0;
+			else
+			{
+				x = M_PI * fc * t;
+				row[j] = (t == 0 ? 1 : sin(x) / x)
+					* (0.42 + 0.5 * cos(M_PI * t / halfwidth) + 0.08 * cos(2 * M_PI * t / halfwidth));
+			}
+			sum += row[j];
+		}
+	// every phase passes DC as it is
+		for (j = 0; j < st->taps; j++)
+			row[j] /= sum;
+	}
+
+	st->next = sfx_sinctables;
+	sfx_sinctables = st;
+	sfx_numsinctables++;
+
+	return st;
+}
+
+/*
+================
+S_FreeSincTables
+
+Only with no loads pending
+================
+*/
+static void S_FreeSincTables (void)
+{
+	sinctable_t	*st;
+
+	while (sfx_sinctables)
+	{
+		st = sfx_sinctables;
+		sfx_sinctables = st->next;
+		free (st->table);
+		free (st);
+	}
+	sfx_numsinctables = 0;
+}
+
+/*
+================
+ResampleSinc
+
+May run on a worker, so running out of memory only returns false
+================
+*/
+static qboolean ResampleSinc (const sfxload_t *load)
+{
+	sfxcache_t	*sc = load->sc;
+	const sinctable_t	*st = load->sinc;
+	const float	*row;
+	double	ratio, pos, f;
+	float	*in, a, b;
+	int		taps, half, padded, i, j, k, n, p, loop, sample;
+
+	ratio = (double)load->inrate / sc->speed;
+	half = st->half;
+	taps = st->taps;
+	n = load->insamples;
+
+	padded = n + taps + (int)ceil(ratio) + 1;
+	in = (float *) malloc (padded * sizeof(float));
+	if (!in)
+		return false;
+
+// in[k + half - 1] is sample k
+	loop = load->inloopstart >= 0 && load->inloopstart < n;
+	for (i = 0; i < padded; i++)
+	{
+		k = i - half + 1;
+		if (k >= n && loop)
+			k = load->inloopstart + (k - n) % (n - load->inloopstart);
+		if (k < 0 || k >= n)
+			in[i] = 0;
+		else if (load->inwidth == 2)
+			in[i] = LittleShort (((short *)load->data)[k]);
+		else
+			in[i] = (int)(load->data[k] - 128) << 8;
+	}
+
+	for (i = 0; i < sc->length; i++)
+	{
+		pos = i * ratio;
+		k = (int)pos;
+		f = (pos - k) * RESAMPLE_PHASES;
+		p = (int)f;
+		f -= p;
+
+		row = st->table + p * taps;
+		a = b = 0;
+		for (j = 0; j < taps; j++)
+		{
+			a += in[k + j] * row[j];
+			b += in[k + j] * row[j + taps];
+		}
+		sample = (int)floor(a + (b - a) * f + 0.5f);
+		sample = CLAMP(-32768, sample, 32767);
+
+		if (sc->width == 2)
+			((short *)sc->data)[i] = sample;
+		else
+			((signed char *)sc->data)[i] = sample >> 8;
+	}
+
+	free (in);
+	return true;
+}
+
+/*
+================
+ResampleSfx
+================
+*/
+static qboolean ResampleSfx (const sfxload_t *load)
+{
+	if (load->sinc)
+		return ResampleSinc (load);
+
+	ResampleNearest (load);
+	return true;
+}
+
+/*
+================
+ResampleSfx_Task
+
+Runs on a worker thread, touching nothing but its load
+================
+*/
+static void ResampleSfx_Task (void *data, int index)
+{
+	sfxload_t	*load = &((sfxload_t *)data)[index];
+
+	load->failed = !ResampleSfx (load);
+}
+
+/*
+================
+S_FinishLoads
+
+Waits for the workers to be done resampling, and throws out the sounds
+they couldn't
+================
+*/
+static void S_FinishLoads (void)
+{
+	sfxload_t	*load;
+	int		i;
+
+	Task_Wait (&sfx_loadgroup);
+
+	for (i = 0, load = sfx_loads; i < sfx_numloads; i++, load++)
+	{
+		COM_UnmapFile (&load->map);
+		Cache_Unpin (&load->sfx->cache);
+		if (load->failed)
+		{
+			Con_Warning ("not enough memory to resample %s\n", load->sfx->name);
+			Cache_Free (&load->sfx->cache, false);
+		}
+	}
+	sfx_numloads = 0;
+
+	if (sfx_numsinctables > MAX_SINCTABLES)
+		S_FreeSincTables ();
+}
+
 //=============================================================================
 
 /*
 ==============
-S_LoadSound
+S_LoadSfx
+
+With later set, the resampling may be left to the workers, the data isn't
+there until S_FinishLoads
 ==============
 */
-sfxcache_t *S_LoadSound (sfx_t *s)
+static sfxcache_t *S_LoadSfx (sfx_t *s, qboolean later)
 {
 	char	namebuffer[256];
 	byte	*data;
@@ -100,13 +361,17 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 	int		len;
 	float	stepscale;
 	sfxcache_t	*sc;
-	byte	stackbuf[1*1024];		// avoid dirtying the cache heap
+	sfxload_t	*load, temp;
 
 // see if still in memory
 	sc = (sfxcache_t *) Cache_Check (&s->cache);
 	if (sc)
 		return sc;
 
+	if (later && sfx_numloads == MAX_SFXLOADS)
+		S_FinishLoads ();
+	load = later ? &sfx_loads[sfx_numloads] : &temp;
+
 //	Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
 
 // load it in
@@ -115,7 +380,7 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 
 //	Con_Printf ("loading %s\n",namebuffer);
 
-	data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+	data = COM_MapFile(namebuffer, &load->map, NULL);
 
 	if (!data)
 	{
@@ -123,45 +388,168 @@ sfxcache_t *S_LoadSound (sfx_t *s)
 		return NULL;
 	}
 
-	info = GetWavinfo (s->name, data, com_filesize);
+	info = GetWavinfo (s->name, data, load->map.size);
 	if (info.channels != 1)
 	{
 		Con_Printf ("%s is a stereo sample\n",s->name);
+		COM_UnmapFile (&load->map);
 		return NULL;
 	}
 
 	if (info.width != 1 && info.width != 2)
 	{
 		Con_Printf("%s is not 8 or 16 bit\n", s->name);
+		COM_UnmapFile (&load->map);
 		return NULL;
 	}
 
-	stepscale = (float)info.rate / shm->speed;
+	stepscale = (float)info.rate / shm->speed;	// this is usually 0.5, 1, or 2
 	len = info.samples / stepscale;
 
-	len = len * info.width * info.channels;
-
 	if (info.samples == 0 || len == 0)
 	{
 		Con_Printf("%s has zero samples\n", s->name);
+		COM_UnmapFile (&load->map);
 		return NULL;
 	}
 
-	sc = (sfxcache_t *) Cache_Alloc ( &s->cache, len + sizeof(sfxcache_t), s->name);
+	sc = (sfxcache_t *) Cache_AllocPool (CACHE_SOUND, &s->cache, len * (loadas8bit.value ? 1 : info.width) + sizeof(sfxcache_t), s->name);
 	if (!sc)
+	{
+		COM_UnmapFile (&load->map);
 		return NULL;
+	}
 
-	sc->length = info.samples;
+	sc->length = len;
 	sc->loopstart = info.loopstart;
-	sc->speed = info.rate;
-	sc->width = info.width;
-	sc->stereo = info.channels;
+	if (sc->loopstart != -1)
+		sc->loopstart = sc->loopstart / stepscale;
+	sc->speed = shm->speed;
+	if (loadas8bit.value)
+		sc->width = 1;
+	else
+		sc->width = info.width;
+	sc->stereo = 0;
 
-	ResampleSfx (s, sc->speed, sc->width, data + info.dataofs);
+	load->sfx = s;
+	load->sc = sc;
+	load->data = data + info.dataofs;
+	load->inrate = info.rate;
+	load->inwidth = info.width;
+	load->insamples = info.samples;
+	load->inloopstart = info.loopstart;
+	load->sinc = (snd_resample.value > 0 && info.rate != sc->speed) ? S_GetSincTable (info.rate, sc->speed) : NULL;
+	load->failed = false;
+
+	if (later)
+	{
+		Cache_Pin (&s->cache);
+		Task_Submit (&sfx_loadgroup, ResampleSfx_Task, sfx_loads, sfx_numloads);
+		sfx_numloads++;
+	}
+	else
+	{
+		load->failed = !ResampleSfx (load);
+		COM_UnmapFile (&load->map);
+		if (load->failed)
+		{
+			Con_Warning ("not enough memory to resample %s\n", s->name);
+			Cache_Free (&s->cache, false);
+			return NULL;
+		}
+	}
 
 	return sc;
 }
 
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t *S_LoadSound (sfx_t *s)
+{
+	if (sfx_numloads)
+		S_FinishLoads ();
+
+	return S_LoadSfx (s, false);
+}
+
+/*
+==============
+S_PreloadSound
+
+Loads a sound for S_PrecacheSound, on the worker threads when precaching
+==============
+*/
+void S_PreloadSound (sfx_t *s)
+{
+	S_LoadSfx (s, sfx_precaching);
+}
+
+/*
+==============
+S_BeginPrecaching
+==============
+*/
+void S_BeginPrecaching (void)
+{
+	sfx_precaching = true;
+}
+
+/*
+==============
+S_EndPrecaching
+
+Also called by CL_Disconnect, in case an error got in the way of the
+usual call, so that no loads are left pinned and later sounds don't go
+to the workers
+==============
+*/
+void S_EndPrecaching (void)
+{
+	S_FinishLoads ();
+	sfx_precaching = false;
+}
+
+/*
+==============
+S_Callback_snd_cachesize
+==============
+*/
+static void S_Callback_snd_cachesize (cvar_t *var)
+{
+	Cache_SetBudget (CACHE_SOUND, var->value);
+}
+
+/*
+==============
+S_Callback_snd_resample
+
+Sounds get loaded again with the new resampler
+==============
+*/
+static void S_Callback_snd_resample (cvar_t *var)
+{
+	if (sfx_numloads)
+		S_FinishLoads ();
+	Cache_FlushPool (CACHE_SOUND);
+}
+
+/*
+==============
+S_InitSoundCache
+==============
+*/
+void S_InitSoundCache (void)
+{
+	Cvar_RegisterVariable (&snd_cachesize);
+	Cvar_SetCallback (&snd_cachesize, S_Callback_snd_cachesize);
+	S_Callback_snd_cachesize (&snd_cachesize);
+	Cvar_RegisterVariable (&snd_resample);
+	Cvar_SetCallback (&snd_resample, S_Callback_snd_resample);
+}
+
 
 
 /*
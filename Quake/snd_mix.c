@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // snd_mix.c -- portable code to mix sounds for snd_dma.c
 
 #include "quakedef.h"
+#include "q_simd.h"
 
 #define	PAINTBUFFER_SIZE	2048
 portable_samplepair_t paintbuffer[PAINTBUFFER_SIZE];
@@ -31,6 +32,19 @@ short		*snd_out;
 
 static int	snd_vol;
 
+// kernel sets for the inner loops, see MIX KERNELS
+typedef struct
+{
+	kernelinfo_t	info;
+	void	(*paint8) (portable_samplepair_t *out, const unsigned char *sfx, int count, int lscale, int rscale);
+	void	(*paint16) (portable_samplepair_t *out, const signed short *sfx, int count, int leftvol, int rightvol);
+	void	(*fir) (float *out, const float *in, const float *h, int taps, int count);
+} sndkernels_t;
+
+static const sndkernels_t	*snd_kernels;
+
+static cvar_t	snd_filterdecimate = {"snd_filterdecimate", "0", CVAR_ARCHIVE};
+
 static void Snd_WriteLinearBlastStereo16 (void)
 {
 	int		i;
@@ -196,30 +210,64 @@ static void S_MakeBlackmanWindowKernel(float *kernel, int M, float f_c)
 
 typedef struct {
 	float *memory;  // kernelsize floats
-	float *kernel;  // kernelsize floats
-	int kernelsize; // M+1, rounded up to be a multiple of 16
+	float *kernel;  // kernelsize floats, decimate phases of kernelsize/decimate taps
+	float *input;   // scratch, kernelsize + PAINTBUFFER_SIZE floats
+	float *output;  // scratch, PAINTBUFFER_SIZE floats
+	int kernelsize; // M+1, rounded up to be a multiple of 16 and of decimate
 	int M;			// M value used to make kernel, even
-	int parity;		// 0-3
+	int decimate;	// 1 runs at the full rate, else only every decimate'th sample is used
+	int parity;		// 0..decimate-1
 	float f_c;		// cutoff frequency, [0..1], fraction of sample rate
 } filter_t;
 
-static void S_UpdateFilter(filter_t *filter, int M, float f_c)
+static void S_FreeFilter(filter_t *filter)
+{
+	free(filter->memory);
+	free(filter->kernel);
+	free(filter->input);
+	free(filter->output);
+	memset(filter, 0, sizeof(*filter));
+}
+
+static void S_UpdateFilter(filter_t *filter, int M, float f_c, int decimate)
 {
-	if (filter->f_c != f_c || filter->M != M)
+	float	*kernel;
+	int		align, taps, i, j;
+
+	if (filter->f_c != f_c || filter->M != M || filter->decimate != decimate)
 	{
-		if (filter->memory != NULL) free(filter->memory);
-		if (filter->kernel != NULL) free(filter->kernel);
+		S_FreeFilter(filter);
 
 		filter->M = M;
 		filter->f_c = f_c;
+		filter->decimate = decimate;
 
 		filter->parity = 0;
-	// M + 1 rounded up to the next multiple of 16
-		filter->kernelsize = (M + 1) + 16 - ((M + 1) % 16);
+	// M + 1 rounded up to the next multiple of 16, which decimate must divide
+	// so that every phase has the same number of taps
+		align = 16;
+		while (align % decimate)
+			align += 16;
+		filter->kernelsize = (M + 1) + align - ((M + 1) % align);
 		filter->memory = (float *) calloc(filter->kernelsize, sizeof(float));
 		filter->kernel = (float *) calloc(filter->kernelsize, sizeof(float));
-		
-		S_MakeBlackmanWindowKernel(filter->kernel, M, f_c);
+		filter->input = (float *) malloc((filter->kernelsize + PAINTBUFFER_SIZE) * sizeof(float));
+		filter->output = (float *) malloc(PAINTBUFFER_SIZE * sizeof(float));
+		kernel = (float *) calloc(filter->kernelsize, sizeof(float));
+		if (!filter->memory || !filter->kernel || !filter->input || !filter->output || !kernel)
+			Sys_Error ("S_UpdateFilter: out of memory");
+
+		S_MakeBlackmanWindowKernel(kernel, M, f_c);
+
+	// tap j of phase i is kernel[i + j * decimate]
+		taps = filter->kernelsize / decimate;
+		for (i = 0; i < decimate; i++)
+		{
+			for (j = 0; j < taps; j++)
+				filter->kernel[i * taps + j] = kernel[i + j * decimate];
+		}
+
+		free(kernel);
 	}
 }
 
@@ -227,23 +275,27 @@ static void S_UpdateFilter(filter_t *filter, int M, float f_c)
 ==============
 S_ApplyFilter
 
-Lowpass-filter the given buffer containing 44100Hz audio.
+Lowpass-filter the given buffer, at most PAINTBUFFER_SIZE samples.
 
-As an optimization, it decimates the audio to 11025Hz (setting every sample
-position that's not a multiple of 4 to 0), then convoluting with the filter
-kernel is 4x faster, because we can skip 3/4 of the input samples that are
-known to be 0 and skip 3/4 of the filter kernel.
+With decimate > 1, every sample position that's not a multiple of decimate
+is taken as 0, which is what mixing at the lower rate sounds like.  Each
+output then only meets every decimate'th tap of the kernel, i.e. one of
+its phases, run over the kept samples, decimate times less work.  Outputs
+decimate apart use the same phase, with the kept samples moved on by one,
+so every phase is a plain FIR over its outputs.
+
+Otherwise it filters every sample, at the full output rate.
 ==============
 */
-static void S_ApplyFilter(filter_t *filter, int *data, int stride, int count)
+static void S_ApplyFilter(filter_t *filter, const sndkernels_t *k, int *data, int stride, int count)
 {
-	int i, j;
-	float *input;
+	int i, t;
+	float *input = filter->input;
+	float *output = filter->output;
 	const int kernelsize = filter->kernelsize;
-	const float *kernel = filter->kernel;
-	int parity;
-
-	input = (float *) malloc(sizeof(float) * (filter->kernelsize + count));
+	const int decimate = filter->decimate;
+	const int taps = kernelsize / decimate;
+	int first, kept, phase, outcount;
 
 // set up the input buffer
 // memory holds the previous filter->kernelsize samples of input.
@@ -258,50 +310,50 @@ static void S_ApplyFilter(filter_t *filter, int *data, int stride, int count)
 	memcpy(filter->memory, input + count, filter->kernelsize * sizeof(float));
 
 // apply the filter
-	parity = filter->parity;
-
-	for (i=0; i<count; i++)
+	if (decimate == 1)
 	{
-		const float *input_plus_i = input + i;
-		float val[4] = {0, 0, 0, 0};
-
-		for (j = (4 - parity) % 4; j < kernelsize; j+=16)
-		{
-			val[0] += kernel[j] * input_plus_i[j];
-			val[1] += kernel[j+4] * input_plus_i[j+4];
-			val[2] += kernel[j+8] * input_plus_i[j+8];
-			val[3] += kernel[j+12] * input_plus_i[j+12];
-		}
+		k->fir(output, input, filter->kernel, kernelsize, count);
+		for (i=0; i<count; i++)
+			data[i * stride] = output[i] * (32768.0 * 256.0);
+		return;
+	}
 
-	// 4.0 factor is to increase volume by 12 dB; this is to make up the
-	// volume drop caused by the zero-filling this filter does.
-		data[i * stride] = (val[0] + val[1] + val[2] + val[3])
-			* (32768.0 * 256.0 * 4.0);
+// pack the kept samples to the front
+	first = (decimate - filter->parity) % decimate;
+	kept = (kernelsize + count - first + decimate - 1) / decimate;
+	for (i=0; i<kept; i++)
+		input[i] = input[first + i * decimate];
 
-		parity = (parity + 1) % 4;
+	for (i=0; i<decimate && i<count; i++)
+	{
+	// taps from output i to the next kept sample, which is its phase
+		phase = (decimate - (filter->parity + i) % decimate) % decimate;
+		outcount = (count - i + decimate - 1) / decimate;
+		k->fir(output, input + (i + phase - first) / decimate, filter->kernel + phase * taps, taps, outcount);
+
+	// the decimate factor makes up the volume drop caused by the
+	// zero-filling, 12 dB for 11025Hz at 44100Hz
+		for (t=0; t<outcount; t++)
+			data[(i + t * decimate) * stride] = output[t] * (32768.0 * 256.0 * decimate);
 	}
 
-	filter->parity = parity;
-
-	free(input);
+	filter->parity = (filter->parity + count) % decimate;
 }
 
 /*
 ==============
-S_LowpassFilter
+S_SetupLowpass
 
-lowpass filters 24-bit integer samples in 'data' (stored in 32-bit ints).
-assumes 44100Hz sample rate, and lowpasses at around 5kHz
-memory should be a zero-filled filter_t struct
+Sets up a filter for speed Hz audio that cuts just below rate / 2.
+Decimating only works when rate divides speed.
 ==============
 */
-static void S_LowpassFilter(int *data, int stride, int count,
-							filter_t *memory)
+static void S_SetupLowpass(filter_t *filter, int quality, int rate, int speed, qboolean decimate)
 {
 	int M;
 	float bw, f_c;
 
-	switch ((int)snd_filterquality.value)
+	switch (quality)
 	{
 	case 1:
 		M = 126; bw = 0.900; break;
@@ -316,10 +368,80 @@ static void S_LowpassFilter(int *data, int stride, int count,
 		M = 222; bw = 0.960; break;
 	}
 
-	f_c = (bw * 11025 / 2.0) / 44100.0;
+// keep the transition band as many Hz wide as at 44100Hz
+	M = (int)(M * (speed / 44100.0) + 0.5) & ~1;
+
+	f_c = (bw * rate / 2.0) / speed;
+
+	S_UpdateFilter(filter, M, f_c, (decimate && speed % rate == 0) ? speed / rate : 1);
+}
+
+// the filters the mixer runs, down to what sndspeed can carry
+typedef struct
+{
+	filter_t	left, right;
+	int		quality, rate, speed;
+	qboolean	decimate;
+} lowpass_t;
+
+static lowpass_t	*snd_lowpass;	// NULL for none
+
+/*
+==============
+SND_UpdateLowpass
+
+Main thread, called when the device or the filter cvars change.  Makes
+new filters if the settings changed and swaps them in with the buffer
+locked, so that the mixer thread never allocates anything.
+==============
+*/
+void SND_UpdateLowpass (void)
+{
+	lowpass_t	*lp, *old;
+	int		quality, rate;
+	qboolean	decimate;
+
+	quality = (int)snd_filterquality.value;
+	rate = (int)sndspeed.value;
+	decimate = snd_filterdecimate.value != 0;
+
+	if (!shm || rate < 1 || rate >= shm->speed)
+		lp = NULL;
+	else if (snd_lowpass && snd_lowpass->quality == quality && snd_lowpass->rate == rate &&
+		 snd_lowpass->speed == shm->speed && snd_lowpass->decimate == decimate)
+		return;
+	else
+	{
+		lp = (lowpass_t *) calloc (1, sizeof(lowpass_t));
+		if (!lp)
+			Sys_Error ("SND_UpdateLowpass: out of memory");
+		lp->quality = quality;
+		lp->rate = rate;
+		lp->speed = shm->speed;
+		lp->decimate = decimate;
+		S_SetupLowpass (&lp->left, quality, rate, lp->speed, decimate);
+		S_SetupLowpass (&lp->right, quality, rate, lp->speed, decimate);
+	}
+
+	if (lp == snd_lowpass)
+		return;
+
+	SNDDMA_LockBuffer ();
+	old = snd_lowpass;
+	snd_lowpass = lp;
+	SNDDMA_Submit ();
+
+	if (old)
+	{
+		S_FreeFilter (&old->left);
+		S_FreeFilter (&old->right);
+		free (old);
+	}
+}
 
-	S_UpdateFilter(memory, M, f_c);
-	S_ApplyFilter(memory, data, stride, count);
+static void SND_Callback_lowpass (cvar_t *var)
+{
+	SND_UpdateLowpass ();
 }
 
 /*
@@ -333,6 +455,76 @@ CHANNEL MIXING
 static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
 static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int endtime, int paintbufferstart);
 
+/*
+================
+S_PaintRawSamples
+
+Adds in what the music decoder has queued, up to count samples, at the
+music volume.  Never waits for the decoder: coming up short while the
+music plays is an underrun.  After one, or when a stream starts, the
+music only goes on once the decoder is some way ahead again.
+================
+*/
+static void S_PaintRawSamples (int count)
+{
+	static qboolean	primed;		// far enough ahead to play
+	static int	lastclears;	// s_rawclears as of the last skip
+	unsigned int	head, tail, discard;
+	int		state, vol, i, s, n, clears;
+
+	state = SDL_AtomicGet (&s_rawstate);
+	if (state == RAW_PAUSE)
+		return;
+
+	vol = CLAMP(0, (int)(bgmvolume.value * 256), 256);	// BGM_Update clamps it late
+
+// the clears before the mark they count, which is never past the head read after it
+	clears = SDL_AtomicGet (&s_rawclears);
+	discard = (unsigned int) SDL_AtomicGet (&s_rawdiscard);
+	head = (unsigned int) SDL_AtomicGet (&s_rawhead);
+	SDL_MemoryBarrierAcquire ();
+	tail = (unsigned int) SDL_AtomicGet (&s_rawtail);
+	if (clears != lastclears)
+	{
+		lastclears = clears;
+		if ((int)(discard - tail) > 0)
+		{
+			tail = discard;
+			primed = false;		// the decoder starts over
+		}
+	}
+
+	n = (int)(head - tail);
+	if (state == RAW_PLAY && vol > 0 && !primed)
+	{
+		if (n < shm->speed / 8 || n < count)
+			n = 0;		// wait for an eighth of a second
+		else
+			primed = true;
+	}
+	if (n > count)
+		n = count;
+
+	for (i = 0; i < n; i++)
+	{
+		s = (tail + i) & (MAX_RAW_SAMPLES - 1);
+	// lower music by 6db to match sfx
+		paintbuffer[i].left += (s_rawsamples[s].left >> 8) * vol / 2;
+		paintbuffer[i].right += (s_rawsamples[s].right >> 8) * vol / 2;
+	}
+
+	if (state != RAW_PLAY || vol <= 0)
+		primed = false;
+	else if (primed && n < count)
+	{
+		SDL_AtomicAdd (&s_rawunderruns, 1);
+		primed = false;
+	}
+
+	SDL_MemoryBarrierRelease ();	// done reading before the decoder may write
+	SDL_AtomicSet (&s_rawtail, (int)(tail + n));
+}
+
 void S_PaintChannels (int endtime)
 {
 	int		i;
@@ -340,8 +532,6 @@ void S_PaintChannels (int endtime)
 	channel_t	*ch;
 	sfxcache_t	*sc;
 
-	snd_vol = sfxvolume.value * 256;
-
 	while (paintedtime < endtime)
 	{
 	// if paintbuffer is smaller than DMA buffer
@@ -360,9 +550,7 @@ void S_PaintChannels (int endtime)
 				continue;
 			if (!ch->leftvol && !ch->rightvol)
 				continue;
-			sc = S_LoadSound (ch->sfx);
-			if (!sc)
-				continue;
+			sc = ch->sc;
 
 			ltime = paintedtime;
 
@@ -395,7 +583,7 @@ void S_PaintChannels (int endtime)
 					}
 					else
 					{	// channel just stopped
-						ch->sfx = NULL;
+						S_ReleaseChannel (ch);
 						break;
 					}
 				}
@@ -411,34 +599,15 @@ void S_PaintChannels (int endtime)
 			paintbuffer[i].right = CLAMP(-32768 * 256, paintbuffer[i].right, 32767 * 256) / 2;
 		}
 
-	// apply a lowpass filter
-		if (sndspeed.value == 11025 && shm->speed == 44100)
+	// apply a lowpass filter, down to what sndspeed can carry
+		if (snd_lowpass)
 		{
-			static filter_t memory_l, memory_r;
-			S_LowpassFilter((int *)paintbuffer,       2, end - paintedtime, &memory_l);
-			S_LowpassFilter(((int *)paintbuffer) + 1, 2, end - paintedtime, &memory_r);
+			S_ApplyFilter(&snd_lowpass->left,  snd_kernels, (int *)paintbuffer,       2, end - paintedtime);
+			S_ApplyFilter(&snd_lowpass->right, snd_kernels, ((int *)paintbuffer) + 1, 2, end - paintedtime);
 		}
 
 	// paint in the music
-		if (s_rawend >= paintedtime)
-		{	// copy from the streaming sound source
-			int		s;
-			int		stop;
-
-			stop = (end < s_rawend) ? end : s_rawend;
-
-			for (i = paintedtime; i < stop; i++)
-			{
-				s = i & (MAX_RAW_SAMPLES - 1);
-			// lower music by 6db to match sfx
-				paintbuffer[i - paintedtime].left += s_rawsamples[s].left / 2;
-				paintbuffer[i - paintedtime].right += s_rawsamples[s].right / 2;
-			}
-			//	if (i != end)
-			//		Con_Printf ("partial stream\n");
-			//	else
-			//		Con_Printf ("full stream\n");
-		}
+		S_PaintRawSamples (end - paintedtime);
 
 	// transfer out according to DMA format
 		S_TransferPaintBuffer(end);
@@ -446,8 +615,17 @@ void S_PaintChannels (int endtime)
 	}
 }
 
+/*
+===============
+SND_InitScaletable -- called when volume changes
+
+Builds the table aside and copies it in, with the 16 bit volume, while the
+buffer is locked, since the mixer thread may be painting with them
+===============
+*/
 void SND_InitScaletable (void)
 {
+	static int	table[32][256];
 	int		i, j;
 	int		scale;
 
@@ -462,66 +640,866 @@ void SND_InitScaletable (void)
 		   value from the index as required. From Kevin Shanahan.
 		   See: http://gcc.gnu.org/bugzilla/show_bug.cgi?id=26719
 		*/
-		//	snd_scaletable[i][j] = ((signed char)j) * scale;
-			snd_scaletable[i][j] = ((j < 128) ?  j : j - 256) * scale;
+		//	table[i][j] = ((signed char)j) * scale;
+			table[i][j] = ((j < 128) ?  j : j - 256) * scale;
 		}
 	}
+
+	SNDDMA_LockBuffer ();
+	memcpy (snd_scaletable, table, sizeof(snd_scaletable));
+	snd_vol = sfxvolume.value * 256;
+	SNDDMA_Submit ();
 }
 
 
-static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
+/*
+===============================================================================
+
+MIX KERNELS
+
+Each kernel adds count mono samples, scaled by a left and a right volume,
+into count stereo pairs of the paint buffer.  The volumes are the plain
+multipliers: for 8 bit sources that is the snd_scaletable row for the
+channel volume, i.e. snd_scaletable[vol >> 3][1], for 16 bit sources the
+channel volume times snd_vol / 256.  All of it is integer math, so every
+kernel set gives exactly the C result.
+
+The FIR kernels run the lowpass filter: out[i] is the sum of h[j] * in[i + j]
+over the taps.  The SIMD ones work on several outputs at once, one per
+lane, adding up the taps in the same order as the C loop, so they give the
+very same floats.
+
+===============================================================================
+*/
+
+static cvar_t	snd_mixsimd = {"snd_mixsimd", "1", CVAR_NONE};
+
+static void SND_Paint8_C (portable_samplepair_t *out, const unsigned char *sfx, int count, int lscale, int rscale)
 {
-	int	data;
-	int		*lscale, *rscale;
-	unsigned char	*sfx;
-	int		i;
+	int	i, data;
 
-	if (ch->leftvol > 255)
-		ch->leftvol = 255;
-	if (ch->rightvol > 255)
-		ch->rightvol = 255;
+	for (i = 0; i < count; i++)
+	{
+		data = (sfx[i] ^ 0x80) - 0x80;	// signed, without relying on char conversion
+		out[i].left += data * lscale;
+		out[i].right += data * rscale;
+	}
+}
 
-	lscale = snd_scaletable[ch->leftvol >> 3];
-	rscale = snd_scaletable[ch->rightvol >> 3];
-	sfx = (unsigned char *)sc->data + ch->pos;
+static void SND_Paint16_C (portable_samplepair_t *out, const signed short *sfx, int count, int leftvol, int rightvol)
+{
+	int	i, data;
 
 	for (i = 0; i < count; i++)
 	{
 		data = sfx[i];
-		paintbuffer[paintbufferstart + i].left += lscale[data];
-		paintbuffer[paintbufferstart + i].right += rscale[data];
+	// this was causing integer overflow as observed in quakespasm
+	// with the warpspasm mod moved >>8 to left/right volume above.
+	//	left = (data * leftvol) >> 8;
+	//	right = (data * rightvol) >> 8;
+		out[i].left += data * leftvol;
+		out[i].right += data * rightvol;
+	}
+}
+
+// where the cpu has fused multiply-adds the compiler may turn the FIR sum
+// into them, depending on -ffp-contract, so the C and NEON kernels use
+// them explicitly there to stay bit exact with each other
+#if defined(__ARM_FEATURE_FMA)
+#define FIR_MAC(sum, a, b)	fmaf (a, b, sum)
+#else
+#define FIR_MAC(sum, a, b)	((sum) + (a) * (b))
+#endif
+
+static void SND_FIR_C (float *out, const float *in, const float *h, int taps, int count)
+{
+	int	i, j;
+	float	sum;
+
+	for (i = 0; i < count; i++)
+	{
+		sum = 0;
+		for (j = 0; j < taps; j++)
+			sum = FIR_MAC (sum, h[j], in[i + j]);
+		out[i] = sum;
+	}
+}
+
+static const sndkernels_t snd_kernels_c =
+{
+	{"C", 0},
+	SND_Paint8_C,
+	SND_Paint16_C,
+	SND_FIR_C
+};
+
+#if defined(USE_SSE2)
+
+/*
+SSE2 has no 32 bit multiply, so the products are built from 16 bit ones.
+8 bit: with scale = hi*256 + lo, s*scale = s*lo + (s*256)*hi, which is one
+_mm_madd_epi16 of (s, s*256) pairs against (lo, hi) pairs.  Putting the
+left and the right pair next to each other comes out as left, right, ...
+just like the paint buffer.  16 bit: the low and high halves of s*vol
+from _mm_mullo_epi16 and _mm_mulhi_epi16, for samples duplicated as
+s, s against vol pairs left, right.  Volumes that don't fit 16 bits are
+left to the C kernel.
+*/
+
+static SIMD_TARGET_SSE2 void SND_Paint8_SSE2 (portable_samplepair_t *out, const unsigned char *sfx, int count, int lscale, int rscale)
+{
+	__m128i	vol, s, pairs, dup, *dst;
+	int	i = 0;
+
+	if ((lscale >> 8) >= -32768 && (lscale >> 8) <= 32767 && (rscale >> 8) >= -32768 && (rscale >> 8) <= 32767)
+	{
+		vol = _mm_setr_epi16 (lscale & 255, lscale >> 8, rscale & 255, rscale >> 8,
+				      lscale & 255, lscale >> 8, rscale & 255, rscale >> 8);
+		for ( ; i + 8 <= count; i += 8)
+		{
+			s = _mm_loadl_epi64 ((const __m128i *)(sfx + i));
+			s = _mm_srai_epi16 (_mm_unpacklo_epi8 (s, s), 8);	// sign extend
+			dst = (__m128i *)(out + i);
+
+			pairs = _mm_unpacklo_epi16 (s, _mm_slli_epi16 (s, 8));
+			dup = _mm_unpacklo_epi32 (pairs, pairs);
+			_mm_storeu_si128 (dst, _mm_add_epi32 (_mm_loadu_si128 (dst), _mm_madd_epi16 (dup, vol)));
+			dup = _mm_unpackhi_epi32 (pairs, pairs);
+			_mm_storeu_si128 (dst + 1, _mm_add_epi32 (_mm_loadu_si128 (dst + 1), _mm_madd_epi16 (dup, vol)));
+
+			pairs = _mm_unpackhi_epi16 (s, _mm_slli_epi16 (s, 8));
+			dup = _mm_unpacklo_epi32 (pairs, pairs);
+			_mm_storeu_si128 (dst + 2, _mm_add_epi32 (_mm_loadu_si128 (dst + 2), _mm_madd_epi16 (dup, vol)));
+			dup = _mm_unpackhi_epi32 (pairs, pairs);
+			_mm_storeu_si128 (dst + 3, _mm_add_epi32 (_mm_loadu_si128 (dst + 3), _mm_madd_epi16 (dup, vol)));
+		}
+	}
+
+	SND_Paint8_C (out + i, sfx + i, count - i, lscale, rscale);
+}
+
+static SIMD_TARGET_SSE2 void SND_Paint16_SSE2 (portable_samplepair_t *out, const signed short *sfx, int count, int leftvol, int rightvol)
+{
+	__m128i	vol, s, dup, lo, hi, *dst;
+	int	i = 0;
+
+	if (leftvol >= -32768 && leftvol <= 32767 && rightvol >= -32768 && rightvol <= 32767)
+	{
+		vol = _mm_setr_epi16 (leftvol, rightvol, leftvol, rightvol, leftvol, rightvol, leftvol, rightvol);
+		for ( ; i + 8 <= count; i += 8)
+		{
+			s = _mm_loadu_si128 ((const __m128i *)(sfx + i));
+			dst = (__m128i *)(out + i);
+
+			dup = _mm_unpacklo_epi16 (s, s);
+			lo = _mm_mullo_epi16 (dup, vol);
+			hi = _mm_mulhi_epi16 (dup, vol);
+			_mm_storeu_si128 (dst, _mm_add_epi32 (_mm_loadu_si128 (dst), _mm_unpacklo_epi16 (lo, hi)));
+			_mm_storeu_si128 (dst + 1, _mm_add_epi32 (_mm_loadu_si128 (dst + 1), _mm_unpackhi_epi16 (lo, hi)));
+
+			dup = _mm_unpackhi_epi16 (s, s);
+			lo = _mm_mullo_epi16 (dup, vol);
+			hi = _mm_mulhi_epi16 (dup, vol);
+			_mm_storeu_si128 (dst + 2, _mm_add_epi32 (_mm_loadu_si128 (dst + 2), _mm_unpacklo_epi16 (lo, hi)));
+			_mm_storeu_si128 (dst + 3, _mm_add_epi32 (_mm_loadu_si128 (dst + 3), _mm_unpackhi_epi16 (lo, hi)));
+		}
+	}
+
+	SND_Paint16_C (out + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+static SIMD_TARGET_SSE2 void SND_FIR_SSE2 (float *out, const float *in, const float *h, int taps, int count)
+{
+	__m128		a0, a1, a2, a3, c;
+	const float	*p;
+	int		i, j;
+
+	for (i = 0; i + 16 <= count; i += 16)
+	{
+		a0 = a1 = a2 = a3 = _mm_setzero_ps ();
+		for (j = 0, p = in + i; j < taps; j++, p++)
+		{
+			c = _mm_set1_ps (h[j]);
+			a0 = _mm_add_ps (a0, _mm_mul_ps (c, _mm_loadu_ps (p)));
+			a1 = _mm_add_ps (a1, _mm_mul_ps (c, _mm_loadu_ps (p + 4)));
+			a2 = _mm_add_ps (a2, _mm_mul_ps (c, _mm_loadu_ps (p + 8)));
+			a3 = _mm_add_ps (a3, _mm_mul_ps (c, _mm_loadu_ps (p + 12)));
+		}
+		_mm_storeu_ps (out + i, a0);
+		_mm_storeu_ps (out + i + 4, a1);
+		_mm_storeu_ps (out + i + 8, a2);
+		_mm_storeu_ps (out + i + 12, a3);
+	}
+
+	for ( ; i + 4 <= count; i += 4)
+	{
+		a0 = _mm_setzero_ps ();
+		for (j = 0, p = in + i; j < taps; j++, p++)
+			a0 = _mm_add_ps (a0, _mm_mul_ps (_mm_set1_ps (h[j]), _mm_loadu_ps (p)));
+		_mm_storeu_ps (out + i, a0);
+	}
+
+	SND_FIR_C (out + i, in + i, h, taps, count - i);
+}
+
+static const sndkernels_t snd_kernels_sse2 =
+{
+	{"SSE2", CPU_SSE2},
+	SND_Paint8_SSE2,
+	SND_Paint16_SSE2,
+	SND_FIR_SSE2
+};
+
+#endif	/* USE_SSE2 */
+
+#if defined(USE_AVX2)
+
+/*
+AVX2 widens each sample twice (s, s) to 32 bits and multiplies by
+left, right volume pairs with _mm256_mullo_epi32, 4 stereo pairs a store.
+*/
+
+static SIMD_TARGET_AVX2 void SND_Paint8_AVX2 (portable_samplepair_t *out, const unsigned char *sfx, int count, int lscale, int rscale)
+{
+	const __m256i	vol = _mm256_setr_epi32 (lscale, rscale, lscale, rscale, lscale, rscale, lscale, rscale);
+	__m128i		s, dup;
+	__m256i		*dst;
+	int		i;
+
+	for (i = 0; i + 16 <= count; i += 16)
+	{
+		s = _mm_loadu_si128 ((const __m128i *)(sfx + i));
+		dst = (__m256i *)(out + i);
+
+		dup = _mm_unpacklo_epi8 (s, s);
+		_mm256_storeu_si256 (dst, _mm256_add_epi32 (_mm256_loadu_si256 (dst), _mm256_mullo_epi32 (_mm256_cvtepi8_epi32 (dup), vol)));
+		_mm256_storeu_si256 (dst + 1, _mm256_add_epi32 (_mm256_loadu_si256 (dst + 1), _mm256_mullo_epi32 (_mm256_cvtepi8_epi32 (_mm_srli_si128 (dup, 8)), vol)));
+		dup = _mm_unpackhi_epi8 (s, s);
+		_mm256_storeu_si256 (dst + 2, _mm256_add_epi32 (_mm256_loadu_si256 (dst + 2), _mm256_mullo_epi32 (_mm256_cvtepi8_epi32 (dup), vol)));
+		_mm256_storeu_si256 (dst + 3, _mm256_add_epi32 (_mm256_loadu_si256 (dst + 3), _mm256_mullo_epi32 (_mm256_cvtepi8_epi32 (_mm_srli_si128 (dup, 8)), vol)));
+	}
+
+	SND_Paint8_C (out + i, sfx + i, count - i, lscale, rscale);
+}
+
+static SIMD_TARGET_AVX2 void SND_Paint16_AVX2 (portable_samplepair_t *out, const signed short *sfx, int count, int leftvol, int rightvol)
+{
+	const __m256i	vol = _mm256_setr_epi32 (leftvol, rightvol, leftvol, rightvol, leftvol, rightvol, leftvol, rightvol);
+	__m128i		s;
+	__m256i		*dst;
+	int		i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		s = _mm_loadu_si128 ((const __m128i *)(sfx + i));
+		dst = (__m256i *)(out + i);
+
+		_mm256_storeu_si256 (dst, _mm256_add_epi32 (_mm256_loadu_si256 (dst), _mm256_mullo_epi32 (_mm256_cvtepi16_epi32 (_mm_unpacklo_epi16 (s, s)), vol)));
+		_mm256_storeu_si256 (dst + 1, _mm256_add_epi32 (_mm256_loadu_si256 (dst + 1), _mm256_mullo_epi32 (_mm256_cvtepi16_epi32 (_mm_unpackhi_epi16 (s, s)), vol)));
+	}
+
+	SND_Paint16_C (out + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+static SIMD_TARGET_AVX2 void SND_FIR_AVX2 (float *out, const float *in, const float *h, int taps, int count)
+{
+	__m256		a0, a1, a2, a3, c;
+	const float	*p;
+	int		i, j;
+
+	for (i = 0; i + 32 <= count; i += 32)
+	{
+		a0 = a1 = a2 = a3 = _mm256_setzero_ps ();
+		for (j = 0, p = in + i; j < taps; j++, p++)
+		{
+			c = _mm256_set1_ps (h[j]);
+			a0 = _mm256_add_ps (a0, _mm256_mul_ps (c, _mm256_loadu_ps (p)));
+			a1 = _mm256_add_ps (a1, _mm256_mul_ps (c, _mm256_loadu_ps (p + 8)));
+			a2 = _mm256_add_ps (a2, _mm256_mul_ps (c, _mm256_loadu_ps (p + 16)));
+			a3 = _mm256_add_ps (a3, _mm256_mul_ps (c, _mm256_loadu_ps (p + 24)));
+		}
+		_mm256_storeu_ps (out + i, a0);
+		_mm256_storeu_ps (out + i + 8, a1);
+		_mm256_storeu_ps (out + i + 16, a2);
+		_mm256_storeu_ps (out + i + 24, a3);
+	}
+
+	for ( ; i + 8 <= count; i += 8)
+	{
+		a0 = _mm256_setzero_ps ();
+		for (j = 0, p = in + i; j < taps; j++, p++)
+			a0 = _mm256_add_ps (a0, _mm256_mul_ps (_mm256_set1_ps (h[j]), _mm256_loadu_ps (p)));
+		_mm256_storeu_ps (out + i, a0);
+	}
+
+	SND_FIR_C (out + i, in + i, h, taps, count - i);
+}
+
+static const sndkernels_t snd_kernels_avx2 =
+{
+	{"AVX2", CPU_AVX2},
+	SND_Paint8_AVX2,
+	SND_Paint16_AVX2,
+	SND_FIR_AVX2
+};
+
+#endif	/* USE_AVX2 */
+
+#if defined(USE_NEON)
+
+// vld2q/vst2q split the paint buffer into left and right and put it back
+
+static void SND_Paint8_NEON (portable_samplepair_t *out, const unsigned char *sfx, int count, int lscale, int rscale)
+{
+	int16x8_t	s;
+	int32x4_t	s32;
+	int32x4x2_t	p;
+	int		i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		s = vmovl_s8 (vld1_s8 ((const int8_t *)(sfx + i)));
+
+		s32 = vmovl_s16 (vget_low_s16 (s));
+		p = vld2q_s32 ((int32_t *)(out + i));
+		p.val[0] = vmlaq_n_s32 (p.val[0], s32, lscale);
+		p.val[1] = vmlaq_n_s32 (p.val[1], s32, rscale);
+		vst2q_s32 ((int32_t *)(out + i), p);
+
+		s32 = vmovl_s16 (vget_high_s16 (s));
+		p = vld2q_s32 ((int32_t *)(out + i + 4));
+		p.val[0] = vmlaq_n_s32 (p.val[0], s32, lscale);
+		p.val[1] = vmlaq_n_s32 (p.val[1], s32, rscale);
+		vst2q_s32 ((int32_t *)(out + i + 4), p);
+	}
+
+	SND_Paint8_C (out + i, sfx + i, count - i, lscale, rscale);
+}
+
+static void SND_Paint16_NEON (portable_samplepair_t *out, const signed short *sfx, int count, int leftvol, int rightvol)
+{
+	int16x8_t	s;
+	int32x4_t	s32;
+	int32x4x2_t	p;
+	int		i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+	{
+		s = vld1q_s16 (sfx + i);
+
+		s32 = vmovl_s16 (vget_low_s16 (s));
+		p = vld2q_s32 ((int32_t *)(out + i));
+		p.val[0] = vmlaq_n_s32 (p.val[0], s32, leftvol);
+		p.val[1] = vmlaq_n_s32 (p.val[1], s32, rightvol);
+		vst2q_s32 ((int32_t *)(out + i), p);
+
+		s32 = vmovl_s16 (vget_high_s16 (s));
+		p = vld2q_s32 ((int32_t *)(out + i + 4));
+		p.val[0] = vmlaq_n_s32 (p.val[0], s32, leftvol);
+		p.val[1] = vmlaq_n_s32 (p.val[1], s32, rightvol);
+		vst2q_s32 ((int32_t *)(out + i + 4), p);
+	}
+
+	SND_Paint16_C (out + i, sfx + i, count - i, leftvol, rightvol);
+}
+
+// a + b * c, fused like FIR_MAC
+#if defined(__ARM_FEATURE_FMA)
+#define FIR_MAC_NEON(a, b, c)	vfmaq_f32 (a, b, c)
+#else
+#define FIR_MAC_NEON(a, b, c)	vaddq_f32 (a, vmulq_f32 (b, c))
+#endif
+
+static void SND_FIR_NEON (float *out, const float *in, const float *h, int taps, int count)
+{
+	float32x4_t	a0, a1, a2, a3, c;
+	const float	*p;
+	int		i, j;
+
+	for (i = 0; i + 16 <= count; i += 16)
+	{
+		a0 = a1 = a2 = a3 = vdupq_n_f32 (0);
+		for (j = 0, p = in + i; j < taps; j++, p++)
+		{
+			c = vdupq_n_f32 (h[j]);
+			a0 = FIR_MAC_NEON (a0, c, vld1q_f32 (p));
+			a1 = FIR_MAC_NEON (a1, c, vld1q_f32 (p + 4));
+			a2 = FIR_MAC_NEON (a2, c, vld1q_f32 (p + 8));
+			a3 = FIR_MAC_NEON (a3, c, vld1q_f32 (p + 12));
+		}
+		vst1q_f32 (out + i, a0);
+		vst1q_f32 (out + i + 4, a1);
+		vst1q_f32 (out + i + 8, a2);
+		vst1q_f32 (out + i + 12, a3);
 	}
 
+	for ( ; i + 4 <= count; i += 4)
+	{
+		a0 = vdupq_n_f32 (0);
+		for (j = 0, p = in + i; j < taps; j++, p++)
+			a0 = FIR_MAC_NEON (a0, vdupq_n_f32 (h[j]), vld1q_f32 (p));
+		vst1q_f32 (out + i, a0);
+	}
+
+	SND_FIR_C (out + i, in + i, h, taps, count - i);
+}
+
+static const sndkernels_t snd_kernels_neon =
+{
+	{"NEON", CPU_NEON},
+	SND_Paint8_NEON,
+	SND_Paint16_NEON,
+	SND_FIR_NEON
+};
+
+#endif	/* USE_NEON */
+
+// fastest first
+static const kernelinfo_t *snd_kernellist[] =
+{
+#if defined(USE_AVX2)
+	&snd_kernels_avx2.info,
+#endif
+#if defined(USE_SSE2)
+	&snd_kernels_sse2.info,
+#endif
+#if defined(USE_NEON)
+	&snd_kernels_neon.info,
+#endif
+	&snd_kernels_c.info
+};
+
+/*
+===============
+SND_SetMixKernels_f -- called when snd_mixsimd changes
+===============
+*/
+static void SND_SetMixKernels_f (cvar_t *var)
+{
+	const sndkernels_t	*k;
+
+	k = (const sndkernels_t *) COM_PickKernels (snd_kernellist, Q_COUNTOF(snd_kernellist), var->value != 0);
+
+	SNDDMA_LockBuffer ();	// not in the middle of a paint
+	snd_kernels = k;
+	SNDDMA_Submit ();
+}
+
+static void SND_PaintChannelFrom8 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
+{
+	if (ch->leftvol > 255)
+		ch->leftvol = 255;
+	if (ch->rightvol > 255)
+		ch->rightvol = 255;
+
+	snd_kernels->paint8 (paintbuffer + paintbufferstart, (unsigned char *)sc->data + ch->pos, count,
+			     snd_scaletable[ch->leftvol >> 3][1], snd_scaletable[ch->rightvol >> 3][1]);
+
 	ch->pos += count;
 }
 
 static void SND_PaintChannelFrom16 (channel_t *ch, sfxcache_t *sc, int count, int paintbufferstart)
 {
-	int	data;
-	int	left, right;
 	int	leftvol, rightvol;
-	signed short	*sfx;
-	int	i;
 
 	leftvol = ch->leftvol * snd_vol;
 	rightvol = ch->rightvol * snd_vol;
 	leftvol /= 256;
 	rightvol /= 256;
-	sfx = (signed short *)sc->data + ch->pos;
 
-	for (i = 0; i < count; i++)
+	snd_kernels->paint16 (paintbuffer + paintbufferstart, (signed short *)sc->data + ch->pos, count, leftvol, rightvol);
+
+	ch->pos += count;
+}
+
+/*
+===============================================================================
+
+BENCHMARK
+
+snd_mixbench [channels] [seconds] mixes that many looping channels, half
+8 bit and half 16 bit with made up volumes, for that much 44100Hz audio
+into a scratch paint buffer with every kernel set this cpu can run.  It
+checks the result against the C kernels and reports the time per mixed
+channel sample.
+
+===============================================================================
+*/
+
+#define	BENCH_SPEED		44100
+#define	BENCH_SFXLENGTH		11025	// odd loop points on purpose, to get the scalar tails
+
+typedef struct
+{
+	int		width;
+	int		pos;
+	int		lvol, rvol;
+} benchchannel_t;
+
+static uint64_t SND_BenchMix (const sndkernels_t *k, benchchannel_t *chans, int numchans, int samples,
+			      const unsigned char *sfx8, const signed short *sfx16, portable_samplepair_t *out)
+{
+	uint64_t	hash = 0;
+	int		painted, end, i, ltime, count;
+	benchchannel_t	*ch;
+
+	for (painted = 0; painted < samples; painted = end)
 	{
-		data = sfx[i];
-	// this was causing integer overflow as observed in quakespasm
-	// with the warpspasm mod moved >>8 to left/right volume above.
-	//	left = (data * leftvol) >> 8;
-	//	right = (data * rightvol) >> 8;
-		left = data * leftvol;
-		right = data * rightvol;
-		paintbuffer[paintbufferstart + i].left += left;
-		paintbuffer[paintbufferstart + i].right += right;
+		end = q_min (painted + PAINTBUFFER_SIZE, samples);
+		memset (out, 0, (end - painted) * sizeof(*out));
+
+		for (i = 0, ch = chans; i < numchans; i++, ch++)
+		{
+			for (ltime = painted; ltime < end; ltime += count)
+			{
+				count = q_min (end - ltime, BENCH_SFXLENGTH - ch->pos);
+				if (ch->width == 1)
+					k->paint8 (out + ltime - painted, sfx8 + ch->pos, count, ch->lvol, ch->rvol);
+				else
+					k->paint16 (out + ltime - painted, sfx16 + ch->pos, count, ch->lvol, ch->rvol);
+				ch->pos += count;
+				if (ch->pos == BENCH_SFXLENGTH)
+					ch->pos = (i * 7) % 13;
+			}
+		}
+
+		hash = Hash_Block64 (out, (end - painted) * sizeof(*out), hash);
 	}
 
-	ch->pos += count;
+	return hash;
+}
+
+typedef struct
+{
+	portable_samplepair_t	*out;
+	benchchannel_t	*chans;
+	unsigned char	*sfx8;
+	signed short	*sfx16;
+	int		numchans, samples;
+} mixbench_t;
+
+static void SND_BenchMixKernels (const kernelinfo_t *kernels, void *data, kernelbench_t *result)
+{
+	mixbench_t	*bench = (mixbench_t *) data;
+	benchchannel_t	*ch;
+	double		start;
+	int		j;
+
+	srand (4321);
+	for (j = 0, ch = bench->chans; j < bench->numchans; j++, ch++)
+	{
+		ch->width = (j & 1) + 1;
+		ch->pos = rand () % BENCH_SFXLENGTH;
+		if (ch->width == 1)
+		{
+			ch->lvol = (rand () % 32) * 8 * 256;	// what snd_scaletable gives at full volume
+			ch->rvol = (rand () % 32) * 8 * 256;
+		}
+		else
+		{
+			ch->lvol = rand () % 256;
+			ch->rvol = rand () % 256;
+		}
+	}
+
+	start = Sys_DoubleTime ();
+	result->hash = SND_BenchMix ((const sndkernels_t *) kernels, bench->chans, bench->numchans, bench->samples,
+				     bench->sfx8, bench->sfx16, bench->out);
+	result->time = Sys_DoubleTime () - start;
+
+	q_snprintf (result->columns, sizeof(result->columns), "%6.1fms  %9.3f", result->time * 1000.0,
+		    result->time * 1e9 / ((double)bench->samples * bench->numchans));
+}
+
+static void SND_MixBench_f (void)
+{
+	mixbench_t	bench;
+	float		seconds;
+	int		i;
+
+	bench.numchans = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : 128;
+	bench.numchans = CLAMP (1, bench.numchans, 1024);
+	seconds = (Cmd_Argc () > 2) ? atof (Cmd_Argv (2)) : 10;
+	seconds = CLAMP (0.1f, seconds, 600.f);
+	bench.samples = (int)(seconds * BENCH_SPEED);
+
+	bench.out = (portable_samplepair_t *) malloc (PAINTBUFFER_SIZE * sizeof(*bench.out));
+	bench.chans = (benchchannel_t *) malloc (bench.numchans * sizeof(*bench.chans));
+	bench.sfx8 = (unsigned char *) malloc (BENCH_SFXLENGTH);
+	bench.sfx16 = (signed short *) malloc (BENCH_SFXLENGTH * sizeof(*bench.sfx16));
+	if (!bench.out || !bench.chans || !bench.sfx8 || !bench.sfx16)
+	{
+		Con_Printf ("snd_mixbench: out of memory\n");
+		free (bench.out);
+		free (bench.chans);
+		free (bench.sfx8);
+		free (bench.sfx16);
+		return;
+	}
+
+	srand (1234);
+	for (i = 0; i < BENCH_SFXLENGTH; i++)
+	{
+		bench.sfx8[i] = rand () & 255;
+		bench.sfx16[i] = (rand () & 0xffff) - 0x8000;
+	}
+
+	Con_Printf ("mix kernels, %d channels x %.1f seconds, using %s\n", bench.numchans, seconds, snd_kernels->info.name);
+	Con_Printf ("        total  ns/sample  speedup\n");
+
+	COM_BenchKernels (snd_kernellist, Q_COUNTOF(snd_kernellist), SND_BenchMixKernels, &bench);
+
+	free (bench.out);
+	free (bench.chans);
+	free (bench.sfx8);
+	free (bench.sfx16);
+}
+
+/*
+===============================================================================
+
+FILTER BENCHMARK AND RESPONSE
+
+snd_filterbench [seconds] runs the lowpass at the current snd_filterquality
+over that much 44100Hz stereo noise, decimating to 11025Hz and at the full
+rate, with every kernel set this cpu can run.  It checks the result
+against the C kernels and reports how much of a cpu that takes in real
+time.
+
+snd_filterresponse [quality] measures the gain of the lowpass for sine
+waves at the mixing rate, both ways, and checks it against the design:
+flat to 0.1dB below the transition band and 60dB down above it.  When
+decimating, sines near a multiple of sndspeed / 2 are left out of the
+check, as their aliases land on them.
+
+===============================================================================
+*/
+
+#define	BENCH_NOISECHUNKS	16
+
+static uint64_t SND_BenchFilter (const sndkernels_t *k, qboolean decimate, const int *noise, int *buf, int samples)
+{
+	filter_t	left, right;
+	uint64_t	hash = 0;
+	int		painted, count;
+
+	memset (&left, 0, sizeof(left));
+	memset (&right, 0, sizeof(right));
+	S_SetupLowpass (&left, (int)snd_filterquality.value, 11025, BENCH_SPEED, decimate);
+	S_SetupLowpass (&right, (int)snd_filterquality.value, 11025, BENCH_SPEED, decimate);
+
+	for (painted = 0; painted < samples; painted += count)
+	{
+		count = q_min (samples - painted, PAINTBUFFER_SIZE);
+		memcpy (buf, noise + ((painted / PAINTBUFFER_SIZE) % BENCH_NOISECHUNKS) * PAINTBUFFER_SIZE * 2,
+			count * 2 * sizeof(*buf));
+		S_ApplyFilter (&left, k, buf, 2, count);
+		S_ApplyFilter (&right, k, buf + 1, 2, count);
+		hash = Hash_Block64 (buf, count * 2 * sizeof(*buf), hash);
+	}
+
+	S_FreeFilter (&left);
+	S_FreeFilter (&right);
+
+	return hash;
+}
+
+typedef struct
+{
+	int		*noise, *buf;
+	int		samples;
+	float		seconds;
+	qboolean	decimate;
+} filterbench_t;
+
+static void SND_BenchFilterKernels (const kernelinfo_t *kernels, void *data, kernelbench_t *result)
+{
+	filterbench_t	*bench = (filterbench_t *) data;
+	double		start;
+
+	start = Sys_DoubleTime ();
+	result->hash = SND_BenchFilter ((const sndkernels_t *) kernels, bench->decimate, bench->noise, bench->buf, bench->samples);
+	result->time = Sys_DoubleTime () - start;
+
+	q_snprintf (result->columns, sizeof(result->columns), "%-8s %6.1fms  %7.3f%%", bench->decimate ? "11025Hz" : "full",
+		    result->time * 1000.0, result->time * 100.0 / bench->seconds);
+}
+
+static void SND_FilterBench_f (void)
+{
+	filterbench_t	bench;
+	int		i, mode;
+
+	bench.seconds = (Cmd_Argc () > 1) ? atof (Cmd_Argv (1)) : 10;
+	bench.seconds = CLAMP (0.1f, bench.seconds, 600.f);
+	bench.samples = (int)(bench.seconds * BENCH_SPEED);
+
+	bench.noise = (int *) malloc (BENCH_NOISECHUNKS * PAINTBUFFER_SIZE * 2 * sizeof(*bench.noise));
+	bench.buf = (int *) malloc (PAINTBUFFER_SIZE * 2 * sizeof(*bench.buf));
+	if (!bench.noise || !bench.buf)
+	{
+		Con_Printf ("snd_filterbench: out of memory\n");
+		free (bench.noise);
+		free (bench.buf);
+		return;
+	}
+
+	srand (1234);
+	for (i = 0; i < BENCH_NOISECHUNKS * PAINTBUFFER_SIZE * 2; i++)
+		bench.noise[i] = (rand () % 65536 - 32768) * 128;	// what the mix looks like after the headroom cut
+
+	Con_Printf ("lowpass quality %d, %.1f seconds of %dHz stereo, using %s\n",
+		    CLAMP (1, (int)snd_filterquality.value, 5), bench.seconds, BENCH_SPEED, snd_kernels->info.name);
+	Con_Printf ("                 total  of a cpu  speedup\n");
+
+	for (mode = 0; mode < 2; mode++)
+	{
+		bench.decimate = (mode == 0);
+		COM_BenchKernels (snd_kernellist, Q_COUNTOF(snd_kernellist), SND_BenchFilterKernels, &bench);
+	}
+
+	free (bench.noise);
+	free (bench.buf);
 }
 
+#define	RESPONSE_WARMUP		2048
+#define	RESPONSE_SAMPLES	16384
+#define	RESPONSE_STEP		250	// Hz
+#define	RESPONSE_AMPLITUDE	(32768.0 * 256.0 / 2)
+
+/*
+===============
+SND_FilterGain
+
+Gain in dB of a fresh filter for a freq Hz sine, from the Hann windowed
+correlation of its output with that frequency
+===============
+*/
+static double SND_FilterGain (filter_t *filter, double freq, int speed)
+{
+	static int	buf[PAINTBUFFER_SIZE];
+	double		w, re, im, wsum, omega;
+	int		n, i, count;
+
+	omega = 2 * M_PI * freq / speed;
+	re = im = wsum = 0;
+	for (n = 0; n < RESPONSE_WARMUP + RESPONSE_SAMPLES; n += count)
+	{
+		count = q_min (RESPONSE_WARMUP + RESPONSE_SAMPLES - n, PAINTBUFFER_SIZE);
+		for (i = 0; i < count; i++)
+			buf[i] = (int)(RESPONSE_AMPLITUDE * sin (omega * (n + i)));
+
+		S_ApplyFilter (filter, snd_kernels, buf, 1, count);
+
+		for (i = 0; i < count; i++)
+		{
+			if (n + i < RESPONSE_WARMUP)
+				continue;
+			w = 0.5 - 0.5 * cos (2 * M_PI * (n + i - RESPONSE_WARMUP) / RESPONSE_SAMPLES);
+			re += w * buf[i] * cos (omega * (n + i));
+			im += w * buf[i] * sin (omega * (n + i));
+			wsum += w;
+		}
+	}
+
+	return 20 * log10 (q_max (2 * sqrt (re * re + im * im) / (RESPONSE_AMPLITUDE * wsum), 1e-9));
+}
+
+static void SND_FilterResponse_f (void)
+{
+	filter_t	filter;
+	double		gain, cutoff, width, ripple[2], stop[2];
+	int		quality, speed, rate, mode, numfreqs, f, i;
+	qboolean	skip;
+	float		*gains;
+
+	quality = (Cmd_Argc () > 1) ? atoi (Cmd_Argv (1)) : (int)snd_filterquality.value;
+	quality = CLAMP (1, quality, 5);
+	speed = shm ? shm->speed : BENCH_SPEED;
+	rate = (int)sndspeed.value;
+	if (rate < 1 || rate >= speed)
+	{
+		Con_Printf ("no lowpass for sndspeed %d at %dHz\n", rate, speed);
+		return;
+	}
+
+	numfreqs = speed / 2 / RESPONSE_STEP;
+	gains = (float *) malloc (numfreqs * 2 * sizeof(*gains));
+	if (!gains)
+	{
+		Con_Printf ("snd_filterresponse: out of memory\n");
+		return;
+	}
+
+	memset (&filter, 0, sizeof(filter));
+	for (mode = 0; mode < 2; mode++)
+	{
+		ripple[mode] = 0;
+		stop[mode] = -1000;
+		for (f = 0; f < numfreqs; f++)
+		{
+			S_FreeFilter (&filter);
+			S_SetupLowpass (&filter, quality, rate, speed, mode == 0);
+			if (mode == 0 && filter.decimate == 1)
+			{
+				gains[f * 2 + mode] = 0;
+				continue;
+			}
+
+			gain = SND_FilterGain (&filter, (f + 1) * RESPONSE_STEP, speed);
+			gains[f * 2 + mode] = gain;
+
+		// the design: cutoff f_c, with a transition band about 4 / M of the rate wide
+			cutoff = filter.f_c * speed;
+			width = 4.0 / filter.M * speed;
+			skip = false;
+			if (filter.decimate > 1)
+			{
+				i = ((f + 1) * RESPONSE_STEP + rate / 4) / (rate / 2);
+				skip = (i > 0 && fabs ((f + 1) * RESPONSE_STEP - i * rate / 2.0) < 2 * RESPONSE_STEP);
+			}
+			if ((f + 1) * RESPONSE_STEP <= cutoff - width)
+				ripple[mode] = q_max (ripple[mode], fabs (gain));
+			else if ((f + 1) * RESPONSE_STEP >= cutoff + width && !skip)
+				stop[mode] = q_max (stop[mode], gain);
+		}
+	}
+	S_FreeFilter (&filter);
+
+	Con_Printf ("lowpass quality %d for %dHz at %dHz, gain in dB\n", quality, rate, speed);
+	Con_Printf ("     Hz  decimated  full rate\n");
+	for (f = 0; f < numfreqs; f += q_max (1, numfreqs / 24))
+	{
+		if (speed % rate)
+			Con_Printf ("%7d          -  %9.2f\n", (f + 1) * RESPONSE_STEP, gains[f * 2 + 1]);
+		else
+			Con_Printf ("%7d  %9.2f  %9.2f\n", (f + 1) * RESPONSE_STEP, gains[f * 2], gains[f * 2 + 1]);
+	}
+	for (mode = 0; mode < 2; mode++)
+	{
+		if (mode == 0 && speed % rate)
+			continue;
+		Con_Printf ("%-9s: passband within %.3fdB, stopband %.1fdB down: %s\n", mode ? "full rate" : "decimated",
+			    ripple[mode], -stop[mode], (ripple[mode] <= 0.1 && stop[mode] <= -60) ? "ok" : "FAILED");
+	}
+
+	free (gains);
+}
+
+/*
+===============
+SND_InitMixKernels
+===============
+*/
+void SND_InitMixKernels (void)
+{
+	Cvar_RegisterVariable (&snd_mixsimd);
+	Cvar_SetCallback (&snd_mixsimd, SND_SetMixKernels_f);
+	Cvar_RegisterVariable (&snd_filterdecimate);
+	Cvar_SetCallback (&snd_filterdecimate, SND_Callback_lowpass);
+	Cmd_AddCommand ("snd_mixbench", SND_MixBench_f);
+	Cmd_AddCommand ("snd_filterbench", SND_FilterBench_f);
+	Cmd_AddCommand ("snd_filterresponse", SND_FilterResponse_f);
+
+	SND_SetMixKernels_f (&snd_mixsimd);
+}
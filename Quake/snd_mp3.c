@@ -225,7 +225,7 @@ static int mp3_decode(snd_stream_t *stream, byte *buf, int len)
 			if (mp3_inputdata(stream) == -1)
 			{
 				/* check feof() ?? */
-				Con_DPrintf("mp3 EOF\n");
+				S_CodecDPrintf("mp3 EOF\n");
 				break;
 			}
 		}
@@ -243,7 +243,7 @@ static int mp3_decode(snd_stream_t *stream, byte *buf, int len)
 					continue;
 				else
 				{
-					Con_Printf("MP3: unrecoverable frame level error (%s)\n",
+					S_CodecPrintf("MP3: unrecoverable frame level error (%s)\n",
 							mad_stream_errorstr(&p->Stream));
 					break;
 				}
@@ -305,7 +305,7 @@ static int mp3_madseek(snd_stream_t *stream, unsigned long offset)
 					MP3_BUFFER_SIZE - leftover, &stream->fh);
 		if (bytes_read <= 0)
 		{
-			Con_DPrintf("seek failure. unexpected EOF (frames=%lu leftover=%lu)\n",
+			S_CodecDPrintf("seek failure. unexpected EOF (frames=%lu leftover=%lu)\n",
 					(unsigned long)p->FrameCount, (unsigned long)leftover);
 			break;
 		}
@@ -326,16 +326,16 @@ static int mp3_madseek(snd_stream_t *stream, unsigned long offset)
 					break;	/* Normal behaviour; get some more data from the file */
 				if (!MAD_RECOVERABLE(p->Stream.error))
 				{
-					Con_DPrintf("unrecoverable MAD error\n");
+					S_CodecDPrintf("unrecoverable MAD error\n");
 					break;
 				}
 				if (p->Stream.error == MAD_ERROR_LOSTSYNC)
 				{
-					Con_DPrintf("MAD lost sync\n");
+					S_CodecDPrintf("MAD lost sync\n");
 				}
 				else
 				{
-					Con_DPrintf("recoverable MAD error\n");
+					S_CodecDPrintf("recoverable MAD error\n");
 				}
 				continue;
 			}
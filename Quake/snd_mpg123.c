@@ -180,7 +180,7 @@ static int S_MP3_CodecReadStream (snd_stream_t *stream, int bytes, void *buffer)
 	int res = mpg123_read (priv->handle, (unsigned char *)buffer, (size_t)bytes, &bytes_read);
 	switch (res) {
 	case MPG123_DONE:
-		Con_DPrintf("mp3 EOF\n");
+		S_CodecDPrintf("mp3 EOF\n");
 	case MPG123_OK:
 		return (int)bytes_read;
 	}
@@ -141,7 +141,7 @@ static int S_XMP_CodecReadStream (snd_stream_t *stream, int bytes, void *buffer)
 		return bytes;
 	}
 	if (r == -XMP_END) {
-		Con_DPrintf("XMP EOF\n");
+		S_CodecDPrintf("XMP EOF\n");
 		return 0;
 	}
 	return -1;
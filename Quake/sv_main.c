@@ -516,7 +516,7 @@ static int	fatpvs_capacity;
 void SV_AddToFatPVS (vec3_t org, mnode_t *node, qmodel_t *worldmodel) //johnfitz -- added worldmodel as a parameter
 {
 	int		i;
-	byte	*pvs;
+	const byte	*pvs;
 	mplane_t	*plane;
 	float	d;
 
@@ -1591,6 +1591,10 @@ void SV_SpawnServer (const char *server)
 
 	ED_LoadFromFile (sv.worldmodel->entities);
 
+// the sound list is complete, so the local client's reads can start now
+	for (i = 1; i < MAX_SOUNDS && sv.sound_precache[i]; i++)
+		S_PrefetchSound (sv.sound_precache[i]);
+
 	sv.active = true;
 
 // all setup is completed, any further precache statements are errors
@@ -45,6 +45,20 @@ int Sys_FileType (const char *path);
 /* returns an FS entity type, i.e. FS_ENT_FILE or FS_ENT_DIRECTORY.
  * returns FS_ENT_NONE (0) if no such file or directory is present. */
 
+void *Sys_FileMap (int handle, long offset, long length, void **view, size_t *viewsize);
+/* maps length bytes starting at offset of an open file into memory and
+ * returns a pointer to the first byte, or NULL if the file can't be mapped
+ * or is shorter than offset + length, so the caller can read it instead.
+ * the mapping is private copy-on-write: pages are shared with the OS file
+ * cache until somebody writes to them.  view and viewsize receive what has
+ * to be passed to Sys_FileUnmap.  the mapping stays valid after the file
+ * handle is closed. */
+void Sys_FileUnmap (void *view, size_t viewsize);
+
+qboolean Sys_FileReplace (const char *src, const char *dst);
+/* renames src to dst, replacing dst if it exists, in one step so
+ * that dst is always either the old or the new file. */
+
 //
 // system IO
 //
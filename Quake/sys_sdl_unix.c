@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #ifdef DO_USERDIRS
 #include <pwd.h>
@@ -158,6 +159,46 @@ int Sys_FileType (const char *path)
 	return FS_ENT_NONE;
 }
 
+void *Sys_FileMap (int handle, long offset, long length, void **view, size_t *viewsize)
+{
+	long	pagesize, start;
+	size_t	size;
+	void	*base;
+	struct stat	st;
+
+	if (length <= 0 || offset < 0)
+		return NULL;
+
+	/* touching a page past the end of the file is a SIGBUS */
+	if (fstat(fileno(sys_handles[handle]), &st) != 0 || offset > st.st_size - length)
+		return NULL;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize <= 0)
+		return NULL;
+	start = offset - (offset % pagesize);	/* offset must be page aligned */
+	size = (size_t)(length + (offset - start));
+
+	base = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			fileno(sys_handles[handle]), (off_t)start);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	*view = base;
+	*viewsize = size;
+	return (byte *)base + (offset - start);
+}
+
+void Sys_FileUnmap (void *view, size_t viewsize)
+{
+	munmap (view, viewsize);
+}
+
+qboolean Sys_FileReplace (const char *src, const char *dst)
+{
+	return rename (src, dst) == 0;
+}
+
 
 #if defined(__linux__) || defined(__sun) || defined(sun) || defined(_AIX)
 static int Sys_NumCPUs (void)
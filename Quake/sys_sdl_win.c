@@ -154,6 +154,54 @@ int Sys_FileType (const char *path)
 	return FS_ENT_FILE;
 }
 
+void *Sys_FileMap (int handle, long offset, long length, void **view, size_t *viewsize)
+{
+	SYSTEM_INFO	info;
+	HANDLE		file, mapping;
+	DWORD		start;
+	SIZE_T		size;
+	LARGE_INTEGER	filesize;
+	void		*base;
+
+	if (length <= 0 || offset < 0)
+		return NULL;
+
+	file = (HANDLE) _get_osfhandle (_fileno(sys_handles[handle]));
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	/* reading past the end of the file through the view faults */
+	if (!GetFileSizeEx (file, &filesize) || offset > filesize.QuadPart - length)
+		return NULL;
+
+	GetSystemInfo (&info);	/* views must start on the allocation granularity */
+	start = (DWORD)(offset - (offset % info.dwAllocationGranularity));
+	size = (SIZE_T)(length + (offset - start));
+
+	mapping = CreateFileMapping (file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping == NULL)
+		return NULL;
+	base = MapViewOfFile (mapping, FILE_MAP_COPY, 0, start, size);
+	CloseHandle (mapping);	/* the view keeps its own reference */
+	if (base == NULL)
+		return NULL;
+
+	*view = base;
+	*viewsize = size;
+	return (byte *)base + (offset - start);
+}
+
+void Sys_FileUnmap (void *view, size_t viewsize)
+{
+	UnmapViewOfFile (view);
+}
+
+qboolean Sys_FileReplace (const char *src, const char *dst)
+{
+	/* rename() won't replace an existing file here */
+	return MoveFileEx (src, dst, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
 static char	cwd[1024];
 
 static void Sys_GetBasedir (char *argv0, char *dst, size_t dstsize)
@@ -0,0 +1,298 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// tasks.c -- worker thread pool
+
+#include "quakedef.h"
+
+#define	MAX_WORKERS	16
+#define	MAX_TASKS	4096	// must be a power of two
+
+typedef struct
+{
+	task_func_t	func;
+	void		*data;
+	int		index;
+	taskgroup_t	*group;
+} task_t;
+
+static task_t	tasks[MAX_TASKS];
+static int	task_head, task_tail;	// tail == head: queue is empty
+
+static SDL_mutex	*task_mutex;
+static SDL_cond		*task_queued;	// signalled when a task is added
+static SDL_cond		*task_finished;	// broadcast when a task completes
+
+static SDL_Thread	*workers[MAX_WORKERS];
+static int	numworkers;
+static qboolean	tasks_quit;	// under task_mutex, the workers exit
+static SDL_threadID	tasks_mainthread;
+
+/*
+================
+Task_Pop
+
+Takes the oldest queued task of group, or of any group if group is NULL.
+The tasks queued ahead of it move up one slot so the queue stays in
+order.  task_mutex must be held.
+================
+*/
+static qboolean Task_Pop (taskgroup_t *group, task_t *task)
+{
+	int	i, prev;
+
+	for (i = task_tail; i != task_head; i = (i + 1) & (MAX_TASKS - 1))
+	{
+		if (!group || tasks[i].group == group)
+			break;
+	}
+	if (i == task_head)
+		return false;
+
+	*task = tasks[i];
+	for ( ; i != task_tail; i = prev)
+	{
+		prev = (i - 1) & (MAX_TASKS - 1);
+		tasks[i] = tasks[prev];
+	}
+	task_tail = (task_tail + 1) & (MAX_TASKS - 1);
+	return true;
+}
+
+/*
+================
+Task_Run
+
+Runs a popped task with task_mutex released, then retires it.
+================
+*/
+static void Task_Run (task_t *task)
+{
+	SDL_UnlockMutex (task_mutex);
+	task->func (task->data, task->index);
+	SDL_LockMutex (task_mutex);
+
+	task->group->pending--;
+	SDL_CondBroadcast (task_finished);
+}
+
+/*
+================
+Task_Worker
+================
+*/
+static int SDLCALL Task_Worker (void *unused)
+{
+	task_t	task;
+
+	SDL_LockMutex (task_mutex);
+	while (!tasks_quit)
+	{
+		if (Task_Pop (NULL, &task))
+			Task_Run (&task);
+		else	SDL_CondWait (task_queued, task_mutex);
+	}
+	SDL_UnlockMutex (task_mutex);
+
+	return 0;
+}
+
+/*
+================
+Task_Submit
+================
+*/
+void Task_Submit (taskgroup_t *group, task_func_t func, void *data, int index)
+{
+	int	next;
+
+	if (!numworkers)
+	{
+		func (data, index);
+		return;
+	}
+
+	SDL_LockMutex (task_mutex);
+
+	next = (task_head + 1) & (MAX_TASKS - 1);
+	if (next == task_tail)
+	{	// queue is full, just do it here
+		SDL_UnlockMutex (task_mutex);
+		func (data, index);
+		return;
+	}
+
+	tasks[task_head].func = func;
+	tasks[task_head].data = data;
+	tasks[task_head].index = index;
+	tasks[task_head].group = group;
+	task_head = next;
+	group->pending++;
+
+	SDL_CondSignal (task_queued);
+	SDL_UnlockMutex (task_mutex);
+}
+
+/*
+================
+Task_Done
+================
+*/
+qboolean Task_Done (taskgroup_t *group)
+{
+	qboolean	done;
+
+	if (!numworkers)
+		return true;
+
+	SDL_LockMutex (task_mutex);
+	done = (group->pending == 0);
+	SDL_UnlockMutex (task_mutex);
+
+	return done;
+}
+
+/*
+================
+Task_Wait
+
+Rather than sleeping, the caller runs the group's own tasks that are
+still queued.  It never picks up another group's work, so a short
+per-frame wait can't end up running a long background job.
+================
+*/
+void Task_Wait (taskgroup_t *group)
+{
+	task_t	task;
+
+	if (!numworkers)
+		return;
+
+	SDL_LockMutex (task_mutex);
+	while (group->pending)
+	{
+		if (Task_Pop (group, &task))
+			Task_Run (&task);
+		else	SDL_CondWait (task_finished, task_mutex);
+	}
+	SDL_UnlockMutex (task_mutex);
+}
+
+/*
+================
+Task_ParallelFor
+================
+*/
+void Task_ParallelFor (int count, task_func_t func, void *data)
+{
+	taskgroup_t	group;
+	int		i;
+
+	group.pending = 0;
+	for (i = 0; i < count; i++)
+		Task_Submit (&group, func, data, i);
+	Task_Wait (&group);
+}
+
+/*
+================
+Tasks_NumWorkers
+================
+*/
+int Tasks_NumWorkers (void)
+{
+	return numworkers;
+}
+
+/*
+================
+Tasks_Init
+
+-threads <n> sets the number of worker threads, 0 disables them.
+The default is one less than the number of cpus.
+================
+*/
+void Tasks_Init (void)
+{
+	int	i, count;
+
+	i = COM_CheckParm ("-threads");
+	if (i && i < com_argc - 1)
+		count = atoi (com_argv[i + 1]);
+	else	count = host_parms->numcpus - 1;
+	count = CLAMP (0, count, MAX_WORKERS);
+
+	if (count)
+	{
+		task_mutex = SDL_CreateMutex ();
+		task_queued = SDL_CreateCond ();
+		task_finished = SDL_CreateCond ();
+		if (!task_mutex || !task_queued || !task_finished)
+			Sys_Error ("Tasks_Init: %s", SDL_GetError ());
+	}
+
+	tasks_mainthread = SDL_ThreadID ();
+	tasks_quit = false;
+	for (i = 0; i < count; i++)
+	{
+		workers[i] = SDL_CreateThread (Task_Worker, "worker", NULL);
+		if (!workers[i])
+		{
+			Con_Printf ("Tasks_Init: %s\n", SDL_GetError ());
+			break;
+		}
+	}
+	numworkers = i;
+
+	Con_Printf ("%d worker thread%s\n", numworkers, (numworkers == 1) ? "" : "s");
+}
+
+/*
+================
+Tasks_Shutdown
+
+Lets the workers finish the tasks they are running and joins them.
+What is still queued is dropped, nobody waits for it any more.  Does
+nothing off the main thread, where Sys_Error can get here from a task.
+================
+*/
+void Tasks_Shutdown (void)
+{
+	int	i;
+
+	if (!numworkers || SDL_ThreadID () != tasks_mainthread)
+		return;
+
+	SDL_LockMutex (task_mutex);
+	tasks_quit = true;
+	SDL_CondBroadcast (task_queued);
+	SDL_UnlockMutex (task_mutex);
+
+	for (i = 0; i < numworkers; i++)
+		SDL_WaitThread (workers[i], NULL);
+	numworkers = 0;
+	task_head = task_tail = 0;
+
+	SDL_DestroyCond (task_finished);
+	SDL_DestroyCond (task_queued);
+	SDL_DestroyMutex (task_mutex);
+	task_finished = task_queued = NULL;
+	task_mutex = NULL;
+}
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef _QUAKE_TASKS_H
+#define _QUAKE_TASKS_H
+
+/*
+ worker thread pool
+
+Tasks are plain function calls run on a small pool of worker threads.
+A task must not touch the hunk, zone, cache, cvars, the console or GL:
+it may only read its own inputs and write its own outputs.  Anything
+else stays on the main thread.
+
+Tasks are counted in a taskgroup_t, which the main thread can wait on.
+A waiting main thread runs that group's queued tasks itself instead of
+sleeping, so everything still works (serially) when there are no worker
+threads.
+*/
+
+typedef void (*task_func_t) (void *data, int index);
+
+typedef struct
+{
+	int	pending;		// tasks submitted and not yet finished
+} taskgroup_t;
+
+void Tasks_Init (void);
+void Tasks_Shutdown (void);
+int Tasks_NumWorkers (void);
+
+void Task_Submit (taskgroup_t *group, task_func_t func, void *data, int index);
+qboolean Task_Done (taskgroup_t *group);
+void Task_Wait (taskgroup_t *group);
+
+// runs func (data, 0) .. func (data, count - 1) on the pool and waits for all of them
+void Task_ParallelFor (int count, task_func_t func, void *data);
+
+#endif	/* _QUAKE_TASKS_H */
+
@@ -0,0 +1,382 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+// texcache.c -- block compressed texture encoder and cache files
+
+#include "quakedef.h"
+#include "texcache.h"
+
+/*
+================================================================================
+
+	ENCODER
+
+A straightforward range fit: the endpoints of each color block are the
+extremes of its texels along their principal axis, and every texel takes
+the nearest of the four colors between them.  Alpha blocks use the
+smallest and largest alpha with the eight value ramp.  Blocks hanging
+over the edge of a small level repeat its last row and column.
+
+================================================================================
+*/
+
+/*
+================
+TexCache_LevelSize
+================
+*/
+int TexCache_LevelSize (int format, int width, int height)
+{
+	return ((width + 3) / 4) * ((height + 3) / 4) * (format == TEXCACHE_BC3 ? 16 : 8);
+}
+
+/*
+================
+TexCache_ChainSize -- all the levels, each half the size of the last
+================
+*/
+int TexCache_ChainSize (int format, int width, int height, int numlevels)
+{
+	int	i, size;
+
+	for (i = 0, size = 0; i < numlevels; i++)
+	{
+		size += TexCache_LevelSize (format, width, height);
+		width = q_max(width >> 1, 1);
+		height = q_max(height >> 1, 1);
+	}
+
+	return size;
+}
+
+static void TexCache_FetchBlock (const unsigned *pixels, int width, int height, int x, int y, byte block[16][4])
+{
+	int	i, j;
+
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 4; j++)
+			memcpy (block[i*4+j], &pixels[q_min(y+i, height-1) * width + q_min(x+j, width-1)], 4);
+	}
+}
+
+static int TexCache_Pack565 (const float color[3])
+{
+	int	r, g, b;
+
+	r = (int)(CLAMP(0.f, color[0], 255.f) * 31.f / 255.f + 0.5f);
+	g = (int)(CLAMP(0.f, color[1], 255.f) * 63.f / 255.f + 0.5f);
+	b = (int)(CLAMP(0.f, color[2], 255.f) * 31.f / 255.f + 0.5f);
+
+	return (r << 11) | (g << 5) | b;
+}
+
+static void TexCache_Unpack565 (int c, int rgb[3])
+{
+	rgb[0] = (c >> 11) & 31;
+	rgb[1] = (c >> 5) & 63;
+	rgb[2] = c & 31;
+	rgb[0] = (rgb[0] << 3) | (rgb[0] >> 2);
+	rgb[1] = (rgb[1] << 2) | (rgb[1] >> 4);
+	rgb[2] = (rgb[2] << 3) | (rgb[2] >> 2);
+}
+
+/*
+================
+TexCache_EncodeColor -- 8 bytes, always in four color mode
+================
+*/
+static void TexCache_EncodeColor (byte block[16][4], byte *out)
+{
+	float		mean[3], cov[3][3], axis[3], next[3], lo[3], hi[3];
+	float		t, tmin, tmax, len;
+	int		palette[4][3];
+	int		i, j, k, c0, c1, best, dist, bestdist;
+	unsigned int	indices;
+
+	// mean and covariance
+	mean[0] = mean[1] = mean[2] = 0;
+	for (i = 0; i < 16; i++)
+	{
+		for (j = 0; j < 3; j++)
+			mean[j] += block[i][j] * (1.f / 16.f);
+	}
+	memset (cov, 0, sizeof(cov));
+	for (i = 0; i < 16; i++)
+	{
+		for (j = 0; j < 3; j++)
+		{
+			for (k = 0; k < 3; k++)
+				cov[j][k] += (block[i][j] - mean[j]) * (block[i][k] - mean[k]);
+		}
+	}
+
+	// principal axis by power iteration, from the row with the most variance
+	k = (cov[1][1] > cov[0][0]) ? 1 : 0;
+	k = (cov[2][2] > cov[k][k]) ? 2 : k;
+	VectorCopy (cov[k], axis);
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 3; j++)
+			next[j] = DotProduct (cov[j], axis);
+		len = DotProduct (next, next);
+		if (len < 1e-12f)
+			break;
+		VectorScale (next, 1.f / sqrtf (len), axis);
+	}
+	if (i == 0)
+		axis[0] = axis[1] = axis[2] = 0;	// flat block
+
+	// extremes along the axis
+	tmin = tmax = 0;
+	for (i = 0; i < 16; i++)
+	{
+		t = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+		tmin = q_min(tmin, t);
+		tmax = q_max(tmax, t);
+	}
+	VectorMA (mean, tmin, axis, lo);
+	VectorMA (mean, tmax, axis, hi);
+
+	c0 = TexCache_Pack565 (hi);
+	c1 = TexCache_Pack565 (lo);
+	if (c0 < c1)
+	{
+		k = c0;
+		c0 = c1;
+		c1 = k;
+	}
+
+	indices = 0;
+	if (c0 != c1)
+	{
+		TexCache_Unpack565 (c0, palette[0]);
+		TexCache_Unpack565 (c1, palette[1]);
+		for (j = 0; j < 3; j++)
+		{
+			palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+			palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+		}
+
+		for (i = 0; i < 16; i++)
+		{
+			best = 0;
+			bestdist = INT_MAX;
+			for (k = 0; k < 4; k++)
+			{
+				dist = 0;
+				for (j = 0; j < 3; j++)
+					dist += (block[i][j] - palette[k][j]) * (block[i][j] - palette[k][j]);
+				if (dist < bestdist)
+				{
+					bestdist = dist;
+					best = k;
+				}
+			}
+			indices |= (unsigned int)best << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 255;
+	out[1] = c0 >> 8;
+	out[2] = c1 & 255;
+	out[3] = c1 >> 8;
+	out[4] = indices & 255;
+	out[5] = (indices >> 8) & 255;
+	out[6] = (indices >> 16) & 255;
+	out[7] = indices >> 24;
+}
+
+/*
+================
+TexCache_EncodeAlpha -- 8 bytes, always in eight value mode
+================
+*/
+static void TexCache_EncodeAlpha (byte block[16][4], byte *out)
+{
+	int		palette[8];
+	int		i, k, a0, a1, best, dist, bestdist;
+	uint64_t	indices;
+
+	a0 = a1 = block[0][3];
+	for (i = 1; i < 16; i++)
+	{
+		a0 = q_max(a0, (int)block[i][3]);
+		a1 = q_min(a1, (int)block[i][3]);
+	}
+
+	indices = 0;
+	if (a0 != a1)
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		for (k = 2; k < 8; k++)
+			palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+
+		for (i = 0; i < 16; i++)
+		{
+			best = 0;
+			bestdist = INT_MAX;
+			for (k = 0; k < 8; k++)
+			{
+				dist = abs (block[i][3] - palette[k]);
+				if (dist < bestdist)
+				{
+					bestdist = dist;
+					best = k;
+				}
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+	for (i = 0; i < 6; i++)
+		out[2+i] = (indices >> (i * 8)) & 255;
+}
+
+/*
+================
+TexCache_EncodeLevel -- writes TexCache_LevelSize bytes to out
+================
+*/
+void TexCache_EncodeLevel (int format, const unsigned *pixels, int width, int height, byte *out)
+{
+	byte	block[16][4];
+	int	x, y;
+
+	for (y = 0; y < height; y += 4)
+	{
+		for (x = 0; x < width; x += 4)
+		{
+			TexCache_FetchBlock (pixels, width, height, x, y, block);
+			if (format == TEXCACHE_BC3)
+			{
+				TexCache_EncodeAlpha (block, out);
+				out += 8;
+			}
+			TexCache_EncodeColor (block, out);
+			out += 8;
+		}
+	}
+}
+
+/*
+================================================================================
+
+	CACHE FILES
+
+Plain stdio, so these are safe on the worker threads.  A file only
+counts if its header matches the expected one exactly and it holds
+exactly the blocks the header promises, so a stale, damaged or half
+written file is simply rebuilt.
+
+================================================================================
+*/
+
+/*
+================
+TexCache_Key
+
+path and crc are the gltexture_t source_file and source_crc.  flags are
+the TEXPREF_ flags it was loaded with.  srcwidth * srcheight is the size
+of pixels, the RGBA source as loaded.  width * height is the size of the
+first level, after the engine's power of two rounding, gl_picmip and
+hardware size limit: an offline tool filling the cache has to pick these
+as the engine it fills it for would.
+================
+*/
+uint64_t TexCache_Key (const char *path, unsigned short crc, unsigned int flags, int srcwidth, int srcheight,
+		       int width, int height, const unsigned *pixels)
+{
+	int		params[6];
+	uint64_t	key;
+
+	params[0] = TEXCACHE_VERSION;
+	params[1] = flags;
+	params[2] = srcwidth;
+	params[3] = srcheight;
+	params[4] = width;
+	params[5] = height;
+	key = Hash_Block64 (params, sizeof(params), 0);
+	key = Hash_Block64 (path, strlen(path), key);
+	key = Hash_Block64 (&crc, sizeof(crc), key);
+	key = Hash_Block64 (pixels, srcwidth * srcheight * 4, key);
+
+	return key;
+}
+
+/*
+================
+TexCache_Path -- dir/<key>.qtc
+================
+*/
+void TexCache_Path (char *path, size_t size, const char *dir, uint64_t key)
+{
+	q_snprintf (path, size, "%s/%08x%08x.qtc", dir, (unsigned int)(key >> 32), (unsigned int)key);
+}
+
+/*
+================
+TexCache_Read -- fills in blocks if the file matches expect
+================
+*/
+qboolean TexCache_Read (const char *path, const texcache_header_t *expect, byte *blocks)
+{
+	texcache_header_t	header;
+	qboolean	ok;
+	FILE	*f;
+
+	f = fopen (path, "rb");
+	if (!f)
+		return false;
+
+	ok = fread (&header, sizeof(header), 1, f) == 1 &&
+	     header.magic == expect->magic && header.version == expect->version && header.key == expect->key &&
+	     header.format == expect->format && header.width == expect->width && header.height == expect->height &&
+	     header.numlevels == expect->numlevels && header.size == expect->size &&
+	     fread (blocks, 1, header.size, f) == (size_t)header.size && fgetc (f) == EOF;
+	fclose (f);
+
+	return ok;
+}
+
+/*
+================
+TexCache_Write -- writes a temp file and renames it over path, so that
+a reader never sees a partly written file
+================
+*/
+qboolean TexCache_Write (const char *path, const texcache_header_t *header, const byte *blocks)
+{
+	char	temppath[MAX_OSPATH];
+	FILE	*f;
+
+	f = COM_OpenTempFile (path, temppath, sizeof(temppath));
+	if (!f)
+		return false;
+
+	fwrite (header, sizeof(*header), 1, f);
+	fwrite (blocks, 1, header->size, f);
+
+	return COM_ReplaceFile (f, temppath, path);
+}
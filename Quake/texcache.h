@@ -0,0 +1,69 @@
+/*
+Copyright (C) 1996-2001 Id Software, Inc.
+Copyright (C) 2010-2014 QuakeSpasm developers
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef _QUAKE_TEXCACHE_H
+#define _QUAKE_TEXCACHE_H
+
+/*
+ block compressed texture cache
+
+Encodes RGBA mip levels into BC1 (DXT1, opaque) or BC3 (DXT5, with alpha)
+blocks, and reads and writes the cache files that hold a whole encoded
+mip chain.  Nothing here touches GL, the hunk, cvars or the console, so
+it runs on the worker threads and links into an offline tool that fills
+a cache without a GPU.
+
+A cache file is a texcache_header_t followed by every level's blocks,
+largest level first, named after TexCache_Key.
+*/
+
+#define	TEXCACHE_MAGIC		(('C'<<24)|('T'<<16)|('S'<<8)|'Q')	// "QSTC"
+#define	TEXCACHE_VERSION	1
+
+enum
+{
+	TEXCACHE_BC1,		// 8 bytes a 4x4 block, no alpha
+	TEXCACHE_BC3		// 16 bytes a 4x4 block
+};
+
+typedef struct
+{
+	int		magic;
+	int		version;
+	uint64_t	key;
+	int		format;
+	int		width, height;	// of the first level
+	int		numlevels;
+	int		size;		// of all the blocks that follow
+} texcache_header_t;
+
+int TexCache_LevelSize (int format, int width, int height);
+int TexCache_ChainSize (int format, int width, int height, int numlevels);
+void TexCache_EncodeLevel (int format, const unsigned *pixels, int width, int height, byte *out);
+
+uint64_t TexCache_Key (const char *path, unsigned short crc, unsigned int flags, int srcwidth, int srcheight,
+		       int width, int height, const unsigned *pixels);
+void TexCache_Path (char *path, size_t size, const char *dir, uint64_t key);
+qboolean TexCache_Read (const char *path, const texcache_header_t *expect, byte *blocks);
+qboolean TexCache_Write (const char *path, const texcache_header_t *header, const byte *blocks);
+
+#endif	/* _QUAKE_TEXCACHE_H */
+
@@ -26,44 +26,85 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	DYNAMIC_SIZE	(4 * 1024 * 1024) // ericw -- was 512KB (64-bit) / 384KB (32-bit)
 
 #define	ZONEID	0x1d4a11
-#define MINFRAGMENT	64
-
-typedef struct memblock_s
-{
-	int	size;		// including the header and possibly tiny fragments
-	int	tag;		// a tag of 0 is a free block
-	int	id;		// should be ZONEID
-	int	pad;		// pad to 64 bit boundary
-	struct	memblock_s	*next, *prev;
-} memblock_t;
-
-typedef struct
-{
-	int		size;		// total bytes malloced, including header
-	memblock_t	blocklist;	// start / end cap for linked list
-	memblock_t	*rover;
-} memzone_t;
-
-void Cache_FreeLow (int new_low_hunk);
-void Cache_FreeHigh (int new_high_hunk);
-
 
 /*
 ==============================================================================
 
 						ZONE MEMORY ALLOCATION
 
-There is never any space between memblocks, and there will never be two
-contiguous free memblocks.
+The zone is a set of size-class pools.  Every request is rounded up to the
+nearest class and served from that class's free list, so allocating and
+freeing are O(1) and never walk or merge neighbouring blocks.  A class gets
+more blocks by carving up a ZONE_PAGE_SIZE page, taken from the zone area
+at the bottom of the hunk (-zone) until that runs out and from the system
+after that.  Pages stay with their class for the rest of the session.
 
-The rover can be left pointing at a non-empty block
+Requests bigger than the largest class are passed through to malloc.
 
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
 ==============================================================================
 */
 
-static memzone_t	*mainzone;
+#define	ZONE_PAGE_SIZE		0x10000
+#define	ZONE_MAX_BLOCK		8192		// largest pooled block, including the header
+#define	ZONE_LARGE		-1		// sizeclass of a block passed through to malloc
+
+typedef struct
+{
+	int	id;		// should be ZONEID
+	int	tag;		// a tag of 0 is a free block
+	int	size;		// size requested by the caller
+	int	sizeclass;	// index into zone_classes, or ZONE_LARGE
+} memblock_t;			// 16 bytes, keeps the data 16 byte aligned
+
+typedef struct memfree_s
+{
+	memblock_t	header;
+	struct memfree_s	*next;
+} memfree_t;
+
+typedef struct
+{
+	int		blocksize;	// including the header
+	memfree_t	*freelist;
+	byte		*fresh, *freshend;	// not yet handed out part of the newest page
+	int		pages;
+	int		used, total;	// blocks in use / blocks carved so far
+	int		usedbytes;	// bytes requested by the blocks in use
+	int		peak;		// most blocks in use at once
+} memclass_t;
+
+static const int zone_classsizes[] =
+{
+	32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512,
+	640, 768, 1024, 1280, 1536, 2048, 2560, 3072, 4096, 5120, 6144, 7168,
+	ZONE_MAX_BLOCK
+};
+#define	NUM_ZONE_CLASSES	(int)(sizeof(zone_classsizes) / sizeof(zone_classsizes[0]))
+
+static memclass_t	zone_classes[NUM_ZONE_CLASSES];
+static byte		zone_classfor[ZONE_MAX_BLOCK / 16 + 1];	// (blocksize / 16) -> class
+
+static byte	*zone_area;		// the hunk part of the zone
+static int	zone_areasize, zone_areaused;
+static int	zone_syspages;		// pages malloced after the area ran out
+
+static int	zone_largecount, zone_largebytes, zone_largepeak;
+
+// marker for memory trash testing, right after the caller's bytes
+static void Z_SetTrashMark (byte *end)
+{
+	int	id = ZONEID;
+	memcpy (end, &id, sizeof(int));
+}
+
+static qboolean Z_TrashMarkOK (const byte *end)
+{
+	int	id;
+	memcpy (&id, end, sizeof(int));
+	return id == ZONEID;
+}
 
 
 /*
@@ -73,7 +114,9 @@ Z_Free
 */
 void Z_Free (void *ptr)
 {
-	memblock_t	*block, *other;
+	memblock_t	*block;
+	memclass_t	*mc;
+	memfree_t	*f;
 
 	if (!ptr)
 		Sys_Error ("Z_Free: NULL pointer");
@@ -83,110 +126,114 @@ void Z_Free (void *ptr)
 		Sys_Error ("Z_Free: freed a pointer without ZONEID");
 	if (block->tag == 0)
 		Sys_Error ("Z_Free: freed a freed pointer");
+	if (!Z_TrashMarkOK ((byte *)ptr + block->size))
+		Sys_Error ("Z_Free: memory trashed past the end of a %i byte block", block->size);
 
 	block->tag = 0;		// mark as free
 
-	other = block->prev;
-	if (!other->tag)
-	{	// merge with previous free block
-		other->size += block->size;
-		other->next = block->next;
-		other->next->prev = other;
-		if (block == mainzone->rover)
-			mainzone->rover = other;
-		block = other;
+	if (block->sizeclass == ZONE_LARGE)
+	{
+		zone_largecount--;
+		zone_largebytes -= block->size;
+		free (block);
+		return;
 	}
 
-	other = block->next;
-	if (!other->tag)
-	{	// merge the next free block onto the end
-		block->size += other->size;
-		block->next = other->next;
-		block->next->prev = block;
-		if (other == mainzone->rover)
-			mainzone->rover = block;
+	mc = &zone_classes[block->sizeclass];
+	mc->used--;
+	mc->usedbytes -= block->size;
+
+	f = (memfree_t *) block;
+	f->next = mc->freelist;
+	mc->freelist = f;
+}
+
+
+/*
+========================
+Z_NewPage
+
+Gives a size class a fresh page to carve blocks from.
+========================
+*/
+static void Z_NewPage (memclass_t *mc)
+{
+	byte	*page;
+
+	if (zone_areaused + ZONE_PAGE_SIZE <= zone_areasize)
+	{
+		page = zone_area + zone_areaused;
+		zone_areaused += ZONE_PAGE_SIZE;
+	}
+	else
+	{
+		page = (byte *) malloc (ZONE_PAGE_SIZE);
+		if (!page)
+			Sys_Error ("Z_Malloc: failed to allocate a %i byte page", ZONE_PAGE_SIZE);
+		zone_syspages++;
 	}
+
+	mc->fresh = page;
+	mc->freshend = page + ZONE_PAGE_SIZE - ZONE_PAGE_SIZE % mc->blocksize;
+	mc->pages++;
 }
 
 
 static void *Z_TagMalloc (int size, int tag)
 {
-	int		extra;
-	memblock_t	*start, *rover, *newblock, *base;
+	memblock_t	*block;
+	memclass_t	*mc;
+	int		blocksize, sizeclass;
 
 	if (!tag)
 		Sys_Error ("Z_TagMalloc: tried to use a 0 tag");
+	if (size < 0)
+		return NULL;
 
-//
-// scan through the block list looking for the first free block
-// of sufficient size
-//
-	size += sizeof(memblock_t);	// account for size of block header
-	size += 4;					// space for memory trash tester
-	size = (size + 7) & ~7;		// align to 8-byte boundary
-
-	base = rover = mainzone->rover;
-	start = base->prev;
+	blocksize = size + sizeof(memblock_t) + 4;	// header and memory trash tester
 
-	do
+	if (blocksize > ZONE_MAX_BLOCK)
 	{
-		if (rover == start)	// scaned all the way around the list
+		block = (memblock_t *) malloc (blocksize);
+		if (!block)
 			return NULL;
-		if (rover->tag)
-			base = rover = rover->next;
-		else
-			rover = rover->next;
-	} while (base->tag || base->size < size);
-
-//
-// found a block big enough
-//
-	extra = base->size - size;
-	if (extra >  MINFRAGMENT)
-	{	// there will be a free fragment after the allocated block
-		newblock = (memblock_t *) ((byte *)base + size );
-		newblock->size = extra;
-		newblock->tag = 0;			// free block
-		newblock->prev = base;
-		newblock->id = ZONEID;
-		newblock->next = base->next;
-		newblock->next->prev = newblock;
-		base->next = newblock;
-		base->size = size;
+		sizeclass = ZONE_LARGE;
+		zone_largecount++;
+		zone_largebytes += size;
+		zone_largepeak = q_max (zone_largepeak, zone_largecount);
 	}
+	else
+	{
+		sizeclass = zone_classfor[(blocksize + 15) >> 4];
+		mc = &zone_classes[sizeclass];
 
-	base->tag = tag;				// no longer a free block
-
-	mainzone->rover = base->next;	// next allocation will start looking here
-
-	base->id = ZONEID;
+		if (mc->freelist)
+		{
+			block = &mc->freelist->header;
+			mc->freelist = mc->freelist->next;
+		}
+		else
+		{
+			if (mc->fresh == mc->freshend)
+				Z_NewPage (mc);
+			block = (memblock_t *) mc->fresh;
+			mc->fresh += mc->blocksize;
+			mc->total++;
+		}
 
-// marker for memory trash testing
-	*(int *)((byte *)base + base->size - 4) = ZONEID;
+		mc->used++;
+		mc->usedbytes += size;
+		mc->peak = q_max (mc->peak, mc->used);
+	}
 
-	return (void *) ((byte *)base + sizeof(memblock_t));
-}
+	block->id = ZONEID;
+	block->tag = tag;
+	block->size = size;
+	block->sizeclass = sizeclass;
 
-/*
-========================
-Z_CheckHeap
-========================
-*/
-static void Z_CheckHeap (void)
-{
-	memblock_t	*block;
+	Z_SetTrashMark ((byte *)(block + 1) + size);
 
-	for (block = mainzone->blocklist.next ; ; block = block->next)
-	{
-		if (block->next == &mainzone->blocklist)
-			break;			// all blocks have been hit
-		if ( (byte *)block + block->size != (byte *)block->next)
-			Sys_Error ("Z_CheckHeap: block size does not touch the next block");
-		if ( block->next->prev != block)
-			Sys_Error ("Z_CheckHeap: next block doesn't have proper back link");
-		if (!block->tag && !block->next->tag)
-			Sys_Error ("Z_CheckHeap: two consecutive free blocks");
-	}
+	return (void *) (block + 1);
 }
 
 
@@ -199,7 +246,6 @@ void *Z_Malloc (int size)
 {
 	void	*buf;
 
-	Z_CheckHeap ();	// DEBUG
 	buf = Z_TagMalloc (size, 1);
 	if (!buf)
 		Sys_Error ("Z_Malloc: failed on allocation of %i bytes",size);
@@ -216,8 +262,9 @@ Z_Realloc
 void *Z_Realloc(void *ptr, int size)
 {
 	int old_size;
-	void *old_ptr;
+	void *new_ptr;
 	memblock_t *block;
+	memclass_t *mc;
 
 	if (!ptr)
 		return Z_Malloc (size);
@@ -229,20 +276,30 @@ void *Z_Realloc(void *ptr, int size)
 		Sys_Error ("Z_Realloc: realloced a freed pointer");
 
 	old_size = block->size;
-	old_size -= (4 + (int)sizeof(memblock_t));	/* see Z_TagMalloc() */
-	old_ptr = ptr;
 
-	Z_Free (ptr);
-	ptr = Z_TagMalloc (size, 1);
-	if (!ptr)
+// still fits in the same block, just move the trash tester
+	if (block->sizeclass != ZONE_LARGE && size >= 0 &&
+	    size + (int)sizeof(memblock_t) + 4 <= zone_classes[block->sizeclass].blocksize)
+	{
+		mc = &zone_classes[block->sizeclass];
+		mc->usedbytes += size - old_size;
+		block->size = size;
+		if (old_size < size)
+			memset ((byte *)ptr + old_size, 0, size - old_size);
+		Z_SetTrashMark ((byte *)ptr + size);
+		return ptr;
+	}
+
+	new_ptr = Z_TagMalloc (size, 1);
+	if (!new_ptr)
 		Sys_Error ("Z_Realloc: failed on allocation of %i bytes", size);
 
-	if (ptr != old_ptr)
-		memmove (ptr, old_ptr, q_min(old_size, size));
+	memcpy (new_ptr, ptr, q_min(old_size, size));
 	if (old_size < size)
-		memset ((byte *)ptr + old_size, 0, size - old_size);
+		memset ((byte *)new_ptr + old_size, 0, size - old_size);
+	Z_Free (ptr);
 
-	return ptr;
+	return new_ptr;
 }
 
 char *Z_Strdup (const char *s)
@@ -256,29 +313,44 @@ char *Z_Strdup (const char *s)
 
 /*
 ========================
-Z_Print
+Z_Stats_f
+
+Per-class occupancy.  "waste" is the space lost to rounding requests up to
+the class size (internal fragmentation), "free" is carved blocks sitting on
+the free lists (external fragmentation).
 ========================
 */
-void Z_Print (memzone_t *zone)
+static void Z_Stats_f (void)
 {
-	memblock_t	*block;
+	memclass_t	*mc;
+	int		i, carved, used, waste, freebytes;
 
-	Con_Printf ("zone size: %i  location: %p\n",mainzone->size,mainzone);
+	Con_Printf ("class  pages   used/total  peak  occupancy    waste     free\n");
 
-	for (block = zone->blocklist.next ; ; block = block->next)
+	carved = used = waste = freebytes = 0;
+	for (i = 0, mc = zone_classes; i < NUM_ZONE_CLASSES; i++, mc++)
 	{
-		Con_Printf ("block:%p    size:%7i    tag:%3i\n",
-			block, block->size, block->tag);
-
-		if (block->next == &zone->blocklist)
-			break;			// all blocks have been hit
-		if ( (byte *)block + block->size != (byte *)block->next)
-			Con_Printf ("ERROR: block size does not touch the next block\n");
-		if ( block->next->prev != block)
-			Con_Printf ("ERROR: next block doesn't have proper back link\n");
-		if (!block->tag && !block->next->tag)
-			Con_Printf ("ERROR: two consecutive free blocks\n");
+		if (!mc->pages)
+			continue;
+		Con_Printf ("%5i %6i %6i/%-6i %5i %8.1f%% %8i %8i\n",
+			mc->blocksize, mc->pages, mc->used, mc->total, mc->peak,
+			mc->total ? 100.0 * mc->used / mc->total : 0.0,
+			mc->used * mc->blocksize - mc->usedbytes,
+			(mc->total - mc->used) * mc->blocksize);
+		carved += mc->total * mc->blocksize;
+		used += mc->usedbytes;
+		waste += mc->used * mc->blocksize - mc->usedbytes;
+		freebytes += (mc->total - mc->used) * mc->blocksize;
 	}
+
+	Con_Printf ("-------------------------\n");
+	Con_Printf ("zone area   : %i of %i KB in pages, %i extra system pages\n",
+		zone_areaused / 1024, zone_areasize / 1024, zone_syspages);
+	Con_Printf ("pooled      : %i KB requested in %i KB of blocks\n", used / 1024, carved / 1024);
+	if (carved)
+		Con_Printf ("fragmented  : %.1f%% rounding, %.1f%% free blocks\n",
+			100.0 * waste / carved, 100.0 * freebytes / carved);
+	Con_Printf ("large blocks: %i (%i KB), peak %i\n", zone_largecount, zone_largebytes / 1024, zone_largepeak);
 }
 
 
@@ -444,8 +516,6 @@ void *Hunk_AllocName (int size, const char *name)
 	h = (hunk_t *)(hunk_base + hunk_low_used);
 	hunk_low_used += size;
 
-	Cache_FreeLow (hunk_low_used);
-
 	memset (h, 0, size);
 
 	h->size = size;
@@ -534,7 +604,6 @@ void *Hunk_HighAllocName (int size, const char *name)
 	}
 
 	hunk_high_used += size;
-	Cache_FreeHigh (hunk_high_used);
 
 	h = (hunk_t *)(hunk_base + hunk_size - hunk_high_used);
 
@@ -597,248 +666,242 @@ typedef struct cache_system_s
 	int			size;		// including this header
 	cache_user_t		*user;
 	char			name[CACHENAME_LEN];
-	struct cache_system_s	*prev, *next;
+	int			pins;		// Cache_Pin count, pinned data is never thrown out
+	struct cache_pool_s	*pool;
 	struct cache_system_s	*lru_prev, *lru_next;	// for LRU flushing
 } cache_system_t;
 
-cache_system_t *Cache_TryAlloc (int size, qboolean nobottom);
-
-cache_system_t	cache_head;
-
 /*
-===========
-Cache_Move
-===========
+ Each pool has a budget and an LRU list of its own, so that one kind of
+ data can't push out another: a level full of models doesn't throw out the
+ resampled sounds, which would have to be loaded and resampled all over.
 */
-void Cache_Move ( cache_system_t *c)
+typedef struct cache_pool_s
 {
-	cache_system_t		*new_cs;
-
-// we are clearing up space at the bottom, so only allocate it late
-	new_cs = Cache_TryAlloc (c->size, true);
-	if (new_cs)
+	const char	*name;
+	cache_system_t	head;
+	int		used;		// bytes, including headers
+	int		count;
+	int		budget;		// bytes
+	struct
 	{
-//		Con_Printf ("cache_move ok\n");
+		int	hits;		// Cache_Check found the data
+		int	misses;		// Cache_Alloc had to be called for it
+		int	evictions;	// freed to stay within the budget
+		double	evictedbytes;
+		int	peak;		// most bytes held at once
+	} stats;
+} cache_pool_t;
+
+static cache_pool_t	cache_pools[NUM_CACHE_POOLS] =
+{
+	{ "data" },
+	{ "sound" }
+};
 
-		Q_memcpy ( new_cs+1, c+1, c->size - sizeof(cache_system_t) );
-		new_cs->user = c->user;
-		Q_memcpy (new_cs->name, c->name, sizeof(new_cs->name));
-		Cache_Free (c->user, false); //johnfitz -- added second argument
-		new_cs->user->data = (void *)(new_cs+1);
-	}
-	else
-	{
-//		Con_Printf ("cache_move failed\n");
+static cvar_t	cache_size = {"cache_size", "256", CVAR_NONE};	// megabytes
 
-		Cache_Free (c->user, true); // tough luck... //johnfitz -- added second argument
-	}
+static void Cache_UnlinkLRU (cache_system_t *cs)
+{
+	if (!cs->lru_next || !cs->lru_prev)
+		Sys_Error ("Cache_UnlinkLRU: NULL link");
+
+	cs->lru_next->lru_prev = cs->lru_prev;
+	cs->lru_prev->lru_next = cs->lru_next;
+
+	cs->lru_prev = cs->lru_next = NULL;
+}
+
+static void Cache_MakeLRU (cache_system_t *cs)
+{
+	cache_system_t	*head = &cs->pool->head;
+
+	if (cs->lru_next || cs->lru_prev)
+		Sys_Error ("Cache_MakeLRU: active link");
+
+	head->lru_next->lru_prev = cs;
+	cs->lru_next = head->lru_next;
+	cs->lru_prev = head;
+	head->lru_next = cs;
 }
 
 /*
 ============
-Cache_FreeLow
+Cache_Evict
 
-Throw things out until the hunk can be expanded to the given point
+Throws out least recently used data until size more bytes fit in the budget
 ============
 */
-void Cache_FreeLow (int new_low_hunk)
+static void Cache_Evict (cache_pool_t *pool, int size)
 {
-	cache_system_t	*c;
+	cache_system_t	*cs, *prev;
 
-	while (1)
+	for (cs = pool->head.lru_prev; pool->used + size > pool->budget && cs != &pool->head; cs = prev)
 	{
-		c = cache_head.next;
-		if (c == &cache_head)
-			return;		// nothing in cache at all
-		if ((byte *)c >= hunk_base + new_low_hunk)
-			return;		// there is space to grow the hunk
-		Cache_Move ( c );	// reclaim the space
+		prev = cs->lru_prev;
+		if (cs->pins)
+			continue;
+		pool->stats.evictions++;
+		pool->stats.evictedbytes += cs->size;
+		Cache_Free (cs->user, true); //johnfitz -- added second argument
 	}
 }
 
 /*
 ============
-Cache_FreeHigh
+Cache_FlushPool
 
-Throw things out until the hunk can be expanded to the given point
+Throws out everything in one pool but what is pinned, which is still in
+use and only goes once its last pin does
 ============
 */
-void Cache_FreeHigh (int new_high_hunk)
+void Cache_FlushPool (cachepool_t pool)
 {
-	cache_system_t	*c, *prev;
+	cache_system_t	*head = &cache_pools[pool].head;
+	cache_system_t	*cs, *next;
 
-	prev = NULL;
-	while (1)
+	for (cs = head->lru_next; cs != head; cs = next)
 	{
-		c = cache_head.prev;
-		if (c == &cache_head)
-			return;		// nothing in cache at all
-		if ( (byte *)c + c->size <= hunk_base + hunk_size - new_high_hunk)
-			return;		// there is space to grow the hunk
-		if (c == prev)
-			Cache_Free (c->user, true);	// didn't move out of the way //johnfitz -- added second argument
+		next = cs->lru_next;
+		if (cs->pins)
+			Con_DPrintf ("Cache_FlushPool: %s is pinned %d times, kept\n", cs->name, cs->pins);
 		else
-		{
-			Cache_Move (c);	// try to move it
-			prev = c;
-		}
+			Cache_Free (cs->user, true); // reclaim the space //johnfitz -- added second argument
 	}
 }
 
-void Cache_UnlinkLRU (cache_system_t *cs)
-{
-	if (!cs->lru_next || !cs->lru_prev)
-		Sys_Error ("Cache_UnlinkLRU: NULL link");
-
-	cs->lru_next->lru_prev = cs->lru_prev;
-	cs->lru_prev->lru_next = cs->lru_next;
-
-	cs->lru_prev = cs->lru_next = NULL;
-}
+/*
+============
+Cache_Flush
 
-void Cache_MakeLRU (cache_system_t *cs)
+Throw everything out, so new data will be demand cached.  Pinned data
+stays, it is still in use.
+============
+*/
+void Cache_Flush (void)
 {
-	if (cs->lru_next || cs->lru_prev)
-		Sys_Error ("Cache_MakeLRU: active link");
+	int	i;
 
-	cache_head.lru_next->lru_prev = cs;
-	cs->lru_next = cache_head.lru_next;
-	cs->lru_prev = &cache_head;
-	cache_head.lru_next = cs;
+	for (i = 0; i < NUM_CACHE_POOLS; i++)
+		Cache_FlushPool ((cachepool_t) i);
 }
 
 /*
 ============
-Cache_TryAlloc
+Cache_Print
 
-Looks for a free block of memory between the high and low hunk marks
-Size should already include the header and padding
 ============
 */
-cache_system_t *Cache_TryAlloc (int size, qboolean nobottom)
+void Cache_Print (void)
 {
-	cache_system_t	*cs, *new_cs;
-
-// is the cache completely empty?
-
-	if (!nobottom && cache_head.prev == &cache_head)
-	{
-		if (hunk_size - hunk_high_used - hunk_low_used < size)
-			Sys_Error ("Cache_TryAlloc: %i is greater then free hunk", size);
-
-		new_cs = (cache_system_t *) (hunk_base + hunk_low_used);
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
-
-		cache_head.prev = cache_head.next = new_cs;
-		new_cs->prev = new_cs->next = &cache_head;
-
-		Cache_MakeLRU (new_cs);
-		return new_cs;
-	}
-
-// search from the bottom up for space
-
-	new_cs = (cache_system_t *) (hunk_base + hunk_low_used);
-	cs = cache_head.next;
+	cache_system_t	*cd;
+	int		i;
 
-	do
+	for (i = 0; i < NUM_CACHE_POOLS; i++)
 	{
-		if (!nobottom || cs != cache_head.next)
+		for (cd = cache_pools[i].head.lru_next ; cd != &cache_pools[i].head ; cd = cd->lru_next)
 		{
-			if ( (byte *)cs - (byte *)new_cs >= size)
-			{	// found space
-				memset (new_cs, 0, sizeof(*new_cs));
-				new_cs->size = size;
-
-				new_cs->next = cs;
-				new_cs->prev = cs->prev;
-				cs->prev->next = new_cs;
-				cs->prev = new_cs;
-
-				Cache_MakeLRU (new_cs);
-
-				return new_cs;
-			}
+			Con_Printf ("%8i : %-5s %s\n", cd->size, cache_pools[i].name, cd->name);
 		}
-
-	// continue looking
-		new_cs = (cache_system_t *)((byte *)cs + cs->size);
-		cs = cs->next;
-
-	} while (cs != &cache_head);
-
-// try to allocate one at the very end
-	if ( hunk_base + hunk_size - hunk_high_used - (byte *)new_cs >= size)
-	{
-		memset (new_cs, 0, sizeof(*new_cs));
-		new_cs->size = size;
-
-		new_cs->next = &cache_head;
-		new_cs->prev = cache_head.prev;
-		cache_head.prev->next = new_cs;
-		cache_head.prev = new_cs;
-
-		Cache_MakeLRU (new_cs);
-
-		return new_cs;
 	}
-
-	return NULL;		// couldn't allocate
 }
 
 /*
 ============
-Cache_Flush
+Cache_Report
 
-Throw everything out, so new data will be demand cached
 ============
 */
-void Cache_Flush (void)
+void Cache_Report (void)
 {
-	while (cache_head.next != &cache_head)
-		Cache_Free ( cache_head.next->user, true); // reclaim the space //johnfitz -- added second argument
+	cache_pool_t	*pool;
+	int		i;
+
+	for (i = 0, pool = cache_pools; i < NUM_CACHE_POOLS; i++, pool++)
+		Con_DPrintf ("%4.1f of %4.1f megabyte %s cache used\n", pool->used / (float)(1024*1024), pool->budget / (float)(1024*1024), pool->name);
 }
 
 /*
 ============
-Cache_Print
+Cache_Stats_f
 
+"cache_stats list" also lists the cached objects, most recently used first
 ============
 */
-void Cache_Print (void)
+static void Cache_Stats_f (void)
 {
-	cache_system_t	*cd;
+	cache_pool_t	*pool;
+	int		i, lookups;
 
-	for (cd = cache_head.next ; cd != &cache_head ; cd = cd->next)
+	if (Cmd_Argc () > 1 && !q_strcasecmp (Cmd_Argv (1), "list"))
+		Cache_Print ();
+
+	for (i = 0, pool = cache_pools; i < NUM_CACHE_POOLS; i++, pool++)
 	{
-		Con_Printf ("%8i : %s\n", cd->size, cd->name);
+		lookups = pool->stats.hits + pool->stats.misses;
+		Con_Printf ("%s cache:\n", pool->name);
+		Con_Printf ("budget   : %8.2f MB\n", pool->budget / (1024.0 * 1024.0));
+		Con_Printf ("used     : %8.2f MB in %i objects, peak %.2f MB\n", pool->used / (1024.0 * 1024.0),
+				pool->count, pool->stats.peak / (1024.0 * 1024.0));
+		Con_Printf ("hits     : %8i (%.1f%%)\n", pool->stats.hits, lookups ? 100.0 * pool->stats.hits / lookups : 0.0);
+		Con_Printf ("misses   : %8i\n", pool->stats.misses);
+		Con_Printf ("evictions: %8i (%.2f MB)\n", pool->stats.evictions, pool->stats.evictedbytes / (1024.0 * 1024.0));
 	}
 }
 
 /*
 ============
-Cache_Report
+Cache_SetBudget
 
+In megabytes.  Lowering it evicts right away.
 ============
 */
-void Cache_Report (void)
+void Cache_SetBudget (cachepool_t pool, float megabytes)
 {
-	Con_DPrintf ("%4.1f megabyte data cache\n", (hunk_size - hunk_high_used - hunk_low_used) / (float)(1024*1024) );
+	cache_pools[pool].budget = (int) (CLAMP (1.0f, megabytes, 2047.0f) * 1024 * 1024);
+	Cache_Evict (&cache_pools[pool], 0);
+}
+
+/*
+============
+Cache_SizeChanged
+============
+*/
+static void Cache_SizeChanged (cvar_t *var)
+{
+	Cache_SetBudget (CACHE_DATA, var->value);
 }
 
 /*
 ============
 Cache_Init
 
+Cached data lives in system memory, separate from the hunk.  The budget of
+the data pool is the cache_size cvar, in megabytes; -cachesize <megabytes>
+sets its default.  The sound pool's is set by the sound code.
 ============
 */
 void Cache_Init (void)
 {
-	cache_head.next = cache_head.prev = &cache_head;
-	cache_head.lru_next = cache_head.lru_prev = &cache_head;
+	int	i, p;
+
+	for (i = 0; i < NUM_CACHE_POOLS; i++)
+	{
+		cache_pools[i].head.lru_next = cache_pools[i].head.lru_prev = &cache_pools[i].head;
+		cache_pools[i].head.pool = &cache_pools[i];
+		cache_pools[i].budget = 1024 * 1024;
+	}
+
+	p = COM_CheckParm ("-cachesize");
+	if (p && p < com_argc-1)
+		cache_size.string = com_argv[p+1];
+
+	Cvar_RegisterVariable (&cache_size);
+	Cvar_SetCallback (&cache_size, Cache_SizeChanged);
+	Cache_SizeChanged (&cache_size);
 
 	Cmd_AddCommand ("flush", Cache_Flush);
+	Cmd_AddCommand ("cache_stats", Cache_Stats_f);
 }
 
 /*
@@ -856,14 +919,15 @@ void Cache_Free (cache_user_t *c, qboolean freetextures) //johnfitz -- added sec
 		Sys_Error ("Cache_Free: not allocated");
 
 	cs = ((cache_system_t *)c->data) - 1;
-
-	cs->prev->next = cs->next;
-	cs->next->prev = cs->prev;
-	cs->next = cs->prev = NULL;
+	if (cs->pins)
+		Sys_Error ("Cache_Free: %s is pinned", cs->name);
 
 	c->data = NULL;
 
 	Cache_UnlinkLRU (cs);
+	cs->pool->used -= cs->size;
+	cs->pool->count--;
+	free (cs);
 
 	//johnfitz -- if a model becomes uncached, free the gltextures.  This only works
 	//becuase the cache_user_t is the last component of the qmodel_t struct.  Should
@@ -892,19 +956,70 @@ void *Cache_Check (cache_user_t *c)
 	Cache_UnlinkLRU (cs);
 	Cache_MakeLRU (cs);
 
+	cs->pool->stats.hits++;
+
+	return c->data;
+}
+
+/*
+==============
+Cache_Peek
+
+Like Cache_Check, for callers that only want to know whether the data
+is there: it isn't counted as a hit and doesn't move in the LRU list.
+==============
+*/
+void *Cache_Peek (cache_user_t *c)
+{
 	return c->data;
 }
 
 
 /*
 ==============
-Cache_Alloc
+Cache_Pin
+
+Keeps the data from being thrown out until the matching Cache_Unpin, so
+it can be handed to code that doesn't run on the main thread.  Pins nest.
 ==============
 */
-void *Cache_Alloc (cache_user_t *c, int size, const char *name)
+void Cache_Pin (cache_user_t *c)
+{
+	if (!c->data)
+		Sys_Error ("Cache_Pin: not allocated");
+
+	(((cache_system_t *)c->data) - 1)->pins++;
+}
+
+/*
+==============
+Cache_Unpin
+==============
+*/
+void Cache_Unpin (cache_user_t *c)
 {
 	cache_system_t	*cs;
 
+	if (!c->data)
+		Sys_Error ("Cache_Unpin: not allocated");
+
+	cs = ((cache_system_t *)c->data) - 1;
+	if (cs->pins <= 0)
+		Sys_Error ("Cache_Unpin: %s is not pinned", cs->name);
+	cs->pins--;
+}
+
+
+/*
+==============
+Cache_AllocPool
+==============
+*/
+void *Cache_AllocPool (cachepool_t poolnum, cache_user_t *c, int size, const char *name)
+{
+	cache_pool_t	*pool = &cache_pools[poolnum];
+	cache_system_t	*cs;
+
 	if (c->data)
 		Sys_Error ("Cache_Alloc: already allocated");
 
@@ -913,48 +1028,66 @@ void *Cache_Alloc (cache_user_t *c, int size, const char *name)
 
 	size = (size + sizeof(cache_system_t) + 15) & ~15;
 
-// find memory for it
-	while (1)
-	{
-		cs = Cache_TryAlloc (size, false);
-		if (cs)
-		{
-			q_strlcpy (cs->name, name, CACHENAME_LEN);
-			c->data = (void *)(cs+1);
-			cs->user = c;
-			break;
-		}
+// free the least recently used data until it fits.  something bigger
+// than the whole budget still gets cached, on its own.
+	Cache_Evict (pool, size);
 
-	// free the least recently used cahedat
-		if (cache_head.lru_prev == &cache_head)
+	cs = (cache_system_t *) malloc (size);
+	if (!cs)
+	{
+		Cache_Flush ();
+		cs = (cache_system_t *) malloc (size);
+		if (!cs)
 			Sys_Error ("Cache_Alloc: out of memory"); // not enough memory at all
-
-		Cache_Free (cache_head.lru_prev->user, true); //johnfitz -- added second argument
 	}
 
-	return Cache_Check (c);
+	memset (cs, 0, sizeof(*cs));
+	cs->size = size;
+	q_strlcpy (cs->name, name, CACHENAME_LEN);
+	cs->user = c;
+	cs->pool = pool;
+	Cache_MakeLRU (cs);
+
+	pool->used += size;
+	pool->count++;
+	pool->stats.peak = q_max (pool->stats.peak, pool->used);
+	pool->stats.misses++;
+
+	c->data = (void *)(cs+1);
+
+	return c->data;
+}
+
+/*
+==============
+Cache_Alloc
+==============
+*/
+void *Cache_Alloc (cache_user_t *c, int size, const char *name)
+{
+	return Cache_AllocPool (CACHE_DATA, c, size, name);
 }
 
 //============================================================================
 
 
-static void Memory_InitZone (memzone_t *zone, int size)
+static void Memory_InitZone (int size)
 {
-	memblock_t	*block;
+	int	i, j;
 
-// set the entire zone to one free block
+	zone_area = (byte *) Hunk_AllocName (size, "zone");
+	zone_areasize = size;
+	zone_areaused = 0;
 
-	zone->blocklist.next = zone->blocklist.prev = block =
-		(memblock_t *)( (byte *)zone + sizeof(memzone_t) );
-	zone->blocklist.tag = 1;	// in use block
-	zone->blocklist.id = 0;
-	zone->blocklist.size = 0;
-	zone->rover = block;
+	for (i = 0, j = 0; i <= ZONE_MAX_BLOCK / 16; i++)
+	{
+		while (zone_classsizes[j] < i * 16)
+			j++;
+		zone_classfor[i] = j;
+	}
 
-	block->prev = block->next = &zone->blocklist;
-	block->tag = 0;			// free block
-	block->id = ZONEID;
-	block->size = size - sizeof(memzone_t);
+	for (i = 0; i < NUM_ZONE_CLASSES; i++)
+		zone_classes[i].blocksize = zone_classsizes[i];
 }
 
 /*
@@ -972,7 +1105,6 @@ void Memory_Init (void *buf, int size)
 	hunk_low_used = 0;
 	hunk_high_used = 0;
 
-	Cache_Init ();
 	p = COM_CheckParm ("-zone");
 	if (p)
 	{
@@ -981,9 +1113,10 @@ void Memory_Init (void *buf, int size)
 		else
 			Sys_Error ("Memory_Init: you must specify a size in KB after -zone");
 	}
-	mainzone = (memzone_t *) Hunk_AllocName (zonesize, "zone" );
-	Memory_InitZone (mainzone, zonesize);
+	Memory_InitZone (zonesize);
+	Cache_Init ();
 
 	Cmd_AddCommand ("hunk_print", Hunk_Print_f); //johnfitz
+	Cmd_AddCommand ("zone_stats", Z_Stats_f);
 }
 
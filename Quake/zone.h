@@ -42,12 +42,14 @@ server allocations when changing to a higher video mode.
 
 
 Z_??? Zone memory functions used for small, dynamic allocations like text
-strings from command input.  There is only about 48K for it, allocated at
-the very bottom of the hunk.
+strings from command input.  Small blocks come from size-class pools whose
+pages are taken from the zone block at the very bottom of the hunk first,
+large ones from the system.
 
 Cache_??? Cache memory is for objects that can be dynamically loaded and
-can usefully stay persistant between levels.  The size of the cache
-fluctuates from level to level.
+can usefully stay persistant between levels.  It is allocated from the
+system, outside the hunk, and the least recently used objects are thrown
+out whenever the cache would grow past its budget (cache_size, in MB).
 
 To allocate a cachable object
 
@@ -71,8 +73,6 @@ surface cache
 
 <--- high hunk used
 
-cachable memory
-
 <--- low hunk used
 
 client and server low hunk allocations
@@ -122,15 +122,31 @@ typedef struct cache_user_s
 	void	*data;
 } cache_user_t;
 
+typedef enum
+{
+	CACHE_DATA,		// models and anything else, the cache_size cvar
+	CACHE_SOUND,		// resampled sounds, the snd_cachesize cvar
+	NUM_CACHE_POOLS
+} cachepool_t;
+
 void Cache_Flush (void);
+void Cache_FlushPool (cachepool_t pool);
+void Cache_SetBudget (cachepool_t pool, float megabytes);
 
 void *Cache_Check (cache_user_t *c);
 // returns the cached data, and moves to the head of the LRU list
 // if present, otherwise returns NULL
+void *Cache_Peek (cache_user_t *c);
+// returns the cached data or NULL, without counting a hit or touching the LRU
 
 void Cache_Free (cache_user_t *c, qboolean freetextures); //johnfitz -- added second argument
 
+void Cache_Pin (cache_user_t *c);
+void Cache_Unpin (cache_user_t *c);
+// pinned data is never thrown out, even by Cache_Flush
+
 void *Cache_Alloc (cache_user_t *c, int size, const char *name);
+void *Cache_AllocPool (cachepool_t pool, cache_user_t *c, int size, const char *name);
 // Returns NULL if all purgable data was tossed and there still
 // wasn't enough room.
 